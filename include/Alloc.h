@@ -0,0 +1,62 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/definitions.h"
+
+/**** Subsystems charged for engine allocations ****/
+enum AllocTag {
+  ALLOC_MAP,              // Cell list storage
+  ALLOC_SIMULATION,       // Run handles and particle arrays
+  ALLOC_ANALYSIS,
+  ALLOC_PACKING,
+  ALLOC_IO,               // Checkpoints, trajectories, shared frames
+  ALLOC_RENDER,
+  ALLOC_OCTREE,           // Barnes-Hut build buffers and nodes
+  ALLOC_FORCES,           // Pair potentials, contact history and the summed force field
+  ALLOC_MESH,             // Obstacle triangles and their BVH, plus load buffers
+  ALLOC_TAG_CT
+};
+
+typedef struct {
+  uint64_t allocs, frees;
+  int64_t live_bytes, peak_bytes;
+} AllocCounter;
+
+/**** Snapshot of every tag plus process totals; peaks are high-water marks since reset_allocPeak ****/
+typedef struct {
+  AllocCounter tag[ALLOC_TAG_CT];
+  AllocCounter total;
+} AllocStats;
+
+/* Tracked blocks carry a small header, so they must be released with tracked_free and never plain free.
+ * Memory handed to Python or ctypes callers that free() it stays on safe_malloc */
+void *
+tracked_malloc(const size_t size, const int tag);
+
+void *
+tracked_calloc(const size_t count, const size_t size, const int tag);
+
+void *
+tracked_realloc(void *ptr, const size_t size, const int tag);
+
+void
+tracked_free(void *ptr);
+
+AllocStats
+get_allocStats(void);
+
+// Total allocations so far, cheap enough to diff around a step
+uint64_t
+alloc_count(void);
+
+// Restarts every peak from the current live bytes
+void
+reset_allocPeak(void);
+
+const char *
+alloc_tagName(const int tag);
+
+#endif // ALLOC_H
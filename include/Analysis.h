@@ -0,0 +1,43 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/definitions.h"
+#include "../include/Geometry.h"
+#include "../include/ImprovedCollision.h"
+
+/**** In-situ reductions filled every interval frames; all buffers are allocated once ****/
+typedef struct {
+  int interval;               // Frames between samples
+  uint64_t samples, last_step;
+  // Radial distribution function over the 3x3x3 cell scan, so rdf_rmax is capped at one cell edge
+  int rdf_bins;
+  double rdf_rmax;
+  double *rdf;                // g(r) of the latest sample, bin b covers [b, b + 1) * rdf_rmax / rdf_bins
+  // Number density along the gravity axis (x), from cube.min.x to cube.max.x
+  int density_bins;
+  double *density;
+  // Kinetic energy, total and per axis
+  double kinetic, kinetic_axis[3];
+} Analysis;
+
+// NULL when rdf_bins or density_bins is negative or rdf_rmax isn't positive
+Analysis *
+createAnalysis(const int interval, const int rdf_bins, const double rdf_rmax, const int density_bins);
+
+// Samples the current state; the map must be built from objects with the given dims
+void
+analyzeMap(Analysis *analysis, Map *map[], const Object objects[], const Cube cube,
+           const int particle_ct, const Int3 dims);
+
+// Rebuilds the cell list in store (the run's own, so a warm store allocates nothing) and samples it
+int
+analyzeObjects(Analysis *analysis, MapStore *store, const Object objects[], const Cube cube,
+               const int particle_ct, const Int3 dims);
+
+void
+destroy_analysis(Analysis *analysis);
+
+#endif // ANALYSIS_H
@@ -0,0 +1,77 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/definitions.h"
+#include "../include/Geometry.h"
+#include "../include/Simulation.h"
+#include "../include/Contact.h"
+#include "../include/PairForce.h"
+#include "../include/Octree.h"
+#include "../include/Mesh.h"
+
+#define CHECKPOINT_MAGIC "PSIMCKPT"
+#define CHECKPOINT_VERSION 9       // 2: Cube gained periodic. 3: grid dims per axis. 4: container shapes.
+                                  // 5: contact model and history. 6: force field, pair and gravity settings.
+                                  // 7: integrator. 8: Object lost its unused wall flags. 9: obstacle triangles
+#define CHECKPOINT_ALIGN 64       // Object array starts on a cache line inside the file
+
+/**** The external field by value, and the settings the attached pair potential and Barnes-Hut gravity are
+ * rebuilt from ****/
+typedef struct {
+  ForceField field;
+  int32_t pairs_present, pair_kind;
+  double epsilon, sigma, cutoff;
+  int32_t gravity_present, leaf_size;
+  double theta, strength, softening;
+} CheckpointForces;
+
+/**** The run's ContactModel, if attached: its parameters, the counters that size its next tables, and how many
+ * history entries follow the object array ****/
+typedef struct {
+  int32_t present;
+  double kn, kt, restitution, friction;
+  ContactStats stats;
+  uint64_t capacity, entry_ct;
+} CheckpointContacts;
+
+/**** The run's obstacle mesh, if attached: its triangles follow the contact history in tree order, so load
+ * rebuilds the same BVH ****/
+typedef struct {
+  int32_t present, triangle_ct;
+  double restitution;
+  MeshStats stats;
+} CheckpointObstacles;
+
+/**** Fixed header at offset 0; the raw Object array follows at data_offset, then the contact history and the
+ * obstacle triangles ****/
+typedef struct {
+  char magic[8];
+  uint32_t version, object_size;  // object_size rejects files written with another Object layout
+  uint64_t particle_ct, step;
+  Int3 grid_dims;
+  int32_t sub_steps;
+  int32_t integrator, primed;     // primed: the objects' accelerations are Verlet's cache for this state
+  double dt, time;
+  Cube cube;
+  Container container;
+  Rng rng;
+  CheckpointForces forces;
+  CheckpointContacts contacts;
+  CheckpointObstacles obstacles;
+  uint64_t data_offset, data_bytes;
+} CheckpointHeader;
+
+/* Writes header, objects, contact history and obstacle triangles with a single gathered write to a temporary file
+   which is renamed over path, so a preempted save never leaves a torn file */
+int
+save_checkpoint(const Simulation *sim, const char *path);
+
+/* Maps path privately and points the returned run's objects straight into the
+   mapping. status: 0 success, 1 io failure, 2 bad/incompatible file */
+Simulation *
+load_checkpoint(const char *path, int *status);
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,84 @@
+#ifndef CONTACT_H
+#define CONTACT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/definitions.h"
+#include "../include/Geometry.h"
+#include "../include/ImprovedCollision.h"
+#include "../include/Mesh.h"
+#include "../include/Container.h"
+
+#define CONTACT_EMPTY UINT64_MAX          // Key of an unused history slot
+
+/**** Tangential spring stretch of one contact, keyed by the pair (lower index << 32 | higher index).
+ * Container contacts use ~feature in the low half and mesh contacts ~(CONTAINER_FEATURE_CT + triangle), so they
+ * can't meet a particle index ****/
+typedef struct {
+  uint64_t key;
+  Vector3 stretch;
+} ContactEntry;                           // 32 Bytes
+
+/**** Counters from the last contactForces ****/
+typedef struct {
+  uint64_t pairs_tested;
+  uint64_t contacts, wall_contacts;   // Sphere-sphere and sphere-container contacts
+  uint64_t mesh_contacts;     // Sphere-triangle contacts with obstacles
+  uint64_t sliding;           // Contacts at the Coulomb limit
+  uint64_t continued;         // Contacts that found history from the previous step
+  uint64_t dropped;           // Contacts whose history didn't fit the table
+  double max_overlap;         // Largest overlap / smaller radius
+} ContactStats;
+
+/**** Linear spring-dashpot DEM contacts between spheres and against the container walls and obstacle triangles:
+ * normal force kn overlap - gn v_n (never attractive), tangential -kt stretch - gt v_t capped at friction |F_n|.
+ * Damping follows from restitution and each pair's reduced mass. Objects carry no spin, so friction acts on the
+ * sliding velocity only. History lives in two open addressing tables, read from one and written to the other,
+ * so contacts that separate are forgotten at the next swap ****/
+typedef struct {
+  double kn, kt;              // Normal and tangential stiffness
+  double restitution, friction;
+  double damping_ratio;       // -ln(e) / sqrt(pi^2 + ln(e)^2), from restitution
+  ContactStats stats;
+  // Reused across steps
+  MapStore store;
+  Int3 dims;                  // Cells per axis of the last pass
+  ContactEntry *history[2];
+  int current;                // history[current] holds the last step's contacts, the other is written next
+  uint64_t capacity;          // Slots per table, a power of two
+  uint64_t stored;            // Entries written this step
+} ContactModel;
+
+// kt <= 0 picks 2/7 kn; restitution in (0, 1]
+ContactModel *
+createContactModel(const double kn, const double kt, const double restitution, const double friction);
+
+// Adds contact forces divided by mass into accel; dt advances the tangential springs. container and mesh, when
+// not NULL, are fixed bodies, and mesh gets its stats. -1 on allocation failure
+int
+contactForces(ContactModel *cm, const Object objects[], const Cube cube, const Container *container,
+              TriangleMesh *mesh, const int particle_ct, const double dt, Vector3 accel[]);
+
+// Binary collision duration for a pair of reduced mass m; steps of a tenth of it or less resolve contacts
+double
+contact_time(const ContactModel *cm, const double m);
+
+// Forgets every open contact, e.g. after the particles were repacked; the tables keep their size
+void
+contact_clearHistory(ContactModel *cm);
+
+// Copies the contacts the next pass reads into entries, or only counts them when entries is NULL
+uint64_t
+contact_saveHistory(const ContactModel *cm, ContactEntry entries[]);
+
+// Sizes both tables for capacity slots and makes entries the last step's contacts, as a checkpoint left them.
+// -1 on allocation failure or a capacity that isn't a power of two with room for them
+int
+contact_loadHistory(ContactModel *cm, const ContactEntry entries[], const uint64_t entry_ct,
+                    const uint64_t capacity);
+
+void
+destroy_contactModel(ContactModel *cm);
+
+#endif // CONTACT_H
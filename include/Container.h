@@ -0,0 +1,82 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/definitions.h"
+#include "../include/Geometry.h"
+#include "../include/ImprovedCollision.h"
+
+#define CONTAINER_MAX_SHAPES 8
+#define CONTAINER_PASSES 3                // Boundary contacts per sphere, one per face at a box corner
+#define CONTAINER_FEATURE_CT (8 * CONTAINER_MAX_SHAPES)     // Feature ids are shape * 8 + face
+
+enum ShapeKind {
+  SHAPE_BOX,              // Axis aligned, a = min, b = max; faces 2 * axis + (max side)
+  SHAPE_SPHERE,           // Centre a
+  SHAPE_CYLINDER,         // Flat capped, axis from a to b; faces 0 side, 1 cap at a, 2 cap at b
+  SHAPE_CAPSULE,          // Segment a to b swept by radius
+  SHAPE_PLANE,            // Half space through a, b the outward normal
+  SHAPE_KIND_CT
+};
+
+/**** How a shape's interior combines with the region built from the shapes before it ****/
+enum ShapeOp {
+  SHAPE_UNION,
+  SHAPE_INTERSECT,
+  SHAPE_SUBTRACT,         // Cuts the shape out, e.g. a solid pillar standing in a box
+  SHAPE_OP_CT
+};
+
+typedef struct {
+  int kind, op;
+  Vector3 a, b;
+  double radius;          // Sphere, cylinder and capsule
+} Shape;
+
+/**** Region the particles are kept in, as a signed distance function: negative inside, built left to right with
+ * min (union), max (intersect) and max(d, -shape) (subtract). No shapes confine nothing, as in a periodic box.
+ * A fixed array so runs copy and checkpoint it as plain data ****/
+typedef struct {
+  Shape shapes[CONTAINER_MAX_SHAPES];
+  int shape_ct;
+  double restitution;     // Impulse pass, 0.75 like the old cube walls
+} Container;
+
+/**** One boundary contact of a sphere: normal points into the container ****/
+typedef struct {
+  Vector3 normal;
+  double overlap;
+  int feature;
+} ContainerContact;
+
+// The cube's six walls as one box, or an empty container when cube.periodic
+Container
+boxContainer(const Cube cube);
+
+// Appends a shape; -1 when full, the kind or op is unknown, or a size is not positive
+int
+addShape(Container *container, const Shape shape);
+
+// Signed distance from p to the container's boundary, with the outward unit gradient and the feature deciding it
+double
+containerDistance(const Container *container, const Vector3 p, Vector3 *gradient, int *feature);
+
+/* Contacts of a sphere overlapping the boundary, deepest first; each next one is found with the sphere pushed
+ * off those before, so a box corner gives one per face. Returns how many were written */
+int
+containerContacts(const Container *container, const Vector3 p, const double radius,
+                  ContainerContact contacts[CONTAINER_PASSES]);
+
+/* Linear pass after integration: pushes every sphere back inside and reflects its outward normal velocity with
+ * container->restitution. A lone union box takes a per axis clamp instead of the distance function. Returns the
+ * contacts resolved */
+int
+containObjects(const Container *container, Object objects[], const int particle_ct);
+
+// Lower case name of a kind ("box", "sphere", ...), NULL when out of range
+const char *
+shape_kindName(const int kind);
+
+#endif // CONTAINER_H
@@ -0,0 +1,98 @@
+#ifndef FORCEFIELD_H
+#define FORCEFIELD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../include/definitions.h"
+#include "../include/Geometry.h"
+
+/**** Every external field the integrator is compiled for: X(kind, function suffix, name).
+ * Adding one means a line here and a field_<suffix> below; updateObjects gets its own loop for it ****/
+#define FORCE_FIELDS(X)                                                                             \
+  X(FIELD_SPIN,     spin,     "spin")       /* Gravity.x, centripetal pull about the x axis */      \
+  X(FIELD_NONE,     none,     "none")       /* Free flight */                                       \
+  X(FIELD_UNIFORM,  uniform,  "uniform")    /* Constant gravity vector */                           \
+  X(FIELD_DRAG,     drag,     "drag")       /* gravity - drag v */                                  \
+  X(FIELD_HARMONIC, harmonic, "harmonic")   /* -stiffness (r - center) - drag v */
+
+enum FieldKind {
+#define FIELD_ENUM(kind, suffix, name) kind,
+  FORCE_FIELDS(FIELD_ENUM)
+#undef FIELD_ENUM
+  FIELD_KIND_CT
+};
+
+/**** Acceleration per unit mass felt by every particle, on top of any attached forces.
+ * Fields read only the parameters they need ****/
+typedef struct {
+  int kind;
+  Vector3 gravity;          // Uniform and drag; spin uses gravity.x only
+  double drag;              // Linear drag rate, drag and harmonic
+  double stiffness;         // Spring rate per unit mass, harmonic
+  Vector3 center;           // Harmonic trap centre
+  double path_radius;       // Spin
+} ForceField;
+
+// Field of the given kind with the engine's defaults: gravity 9.81 along -x, no drag, path radius 5 and a unit
+// stiffness trap at (5, 5, 5)
+ForceField
+createForceField(const int kind);
+
+// Lower case name of a kind ("spin", "none", ...), NULL when out of range
+const char *
+field_kindName(const int kind);
+
+// Kind of a lower case name, -1 when unknown
+int
+field_kindOf(const char *name);
+
+/* Field kernels. Written on components rather than through Geometry.c so each one inlines into its own
+ * integration loop; out is the acceleration at (p, v) */
+
+static inline void
+field_spin(const ForceField *ff, const double p[3], const double v[3], double out[3])
+{
+  const double norm = sqrt(p[0] * p[2] + p[1] * p[1]);       // As unit_direction()
+  out[0] = (fabs(v[0]) < tol && fabs(p[0]) < tol) ? 0 : ff->gravity.x;
+  out[1] = 0.5 * v[1] * v[1] / ff->path_radius * ((0.0 - p[1]) / norm);
+  out[2] = 0.5 * v[2] * v[2] / ff->path_radius * ((0.0 - p[2]) / norm);
+}
+
+static inline void
+field_none(const ForceField *ff, const double p[3], const double v[3], double out[3])
+{
+  (void)ff;
+  (void)p;
+  (void)v;
+  out[0] = out[1] = out[2] = 0.0;
+}
+
+static inline void
+field_uniform(const ForceField *ff, const double p[3], const double v[3], double out[3])
+{
+  (void)p;
+  (void)v;
+  out[0] = ff->gravity.x;
+  out[1] = ff->gravity.y;
+  out[2] = ff->gravity.z;
+}
+
+static inline void
+field_drag(const ForceField *ff, const double p[3], const double v[3], double out[3])
+{
+  (void)p;
+  out[0] = ff->gravity.x - ff->drag * v[0];
+  out[1] = ff->gravity.y - ff->drag * v[1];
+  out[2] = ff->gravity.z - ff->drag * v[2];
+}
+
+static inline void
+field_harmonic(const ForceField *ff, const double p[3], const double v[3], double out[3])
+{
+  out[0] = -ff->stiffness * (p[0] - ff->center.x) - ff->drag * v[0];
+  out[1] = -ff->stiffness * (p[1] - ff->center.y) - ff->drag * v[1];
+  out[2] = -ff->stiffness * (p[2] - ff->center.z) - ff->drag * v[2];
+}
+
+#endif // FORCEFIELD_H
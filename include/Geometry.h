@@ -24,12 +24,19 @@ typedef struct {
   double x, y, z, w;
 } Vector4;
 
+/**** Axis aligned simulation box. Extents along x, y and z are independent (max - min); size is the longest ****/
 typedef struct {
   Vector3 origin;
   Vector3 min, max;
   double size; 
+  int periodic;           // 1: each face wraps to the opposite one and there are no walls
 } Cube;
 
+// Counter-based rng: draw n depends only on (seed, n) so the state is two integers
+typedef struct {
+  uint64_t seed, counter;
+} Rng;
+
 // Custom malloc with error handling to reduce debug if statements
 void*
 safe_malloc(size_t size);
@@ -57,6 +64,14 @@ randomPosition();
 Vector3
 randomVector();
 
+// Stateless splitmix64 style mix of a seed and counter
+uint64_t
+rng_hash(const uint64_t seed, const uint64_t counter);
+
+// Returns the next double in [0, 1) and advances the counter
+double
+rng_uniform(Rng *rng);
+
 // Vector operations
 Vector3
 addVectors(Vector3 a, const Vector3 b);
@@ -82,8 +97,40 @@ dotProduct(const Vector3 aT, const Vector3 b);
 double
 magnitude(Vector3 vector);
 
-// Creates cube from initial conditions
+// Creates cube from initial conditions, walled
 Cube
 createCube(Vector3 __origin, Vector3 __min, Vector3 __max, double __size);
 
+// Walled box spanning min to max, e.g. a 10:1 column; origin at min and size the longest extent
+Cube
+createBox(Vector3 min, Vector3 max);
+
+// Edge lengths of the box along x, y and z
+static inline Vector3
+cubeExtent(const Cube *cube)
+{
+  return (Vector3){cube->max.x - cube->min.x, cube->max.y - cube->min.y, cube->max.z - cube->min.z};
+}
+
+/* Periodic box helpers, inline for the pair loops. Positions are kept wrapped, so a separation is never more
+ * than one box length off its nearest image */
+
+// Component d of a separation reduced to its nearest image along an axis of length period
+static inline double
+min_image(double d, const double period)
+{
+  if (d > 0.5 * period) d -= period;
+  else if (d < -0.5 * period) d += period;
+  return d;
+}
+
+// Separation d reduced to its nearest image when the cube is periodic, unchanged otherwise
+static inline Vector3
+minimumImage(const Cube *cube, const Vector3 d)
+{
+  if (!cube->periodic) return d;
+  return (Vector3){min_image(d.x, cube->max.x - cube->min.x), min_image(d.y, cube->max.y - cube->min.y),
+                   min_image(d.z, cube->max.z - cube->min.z)};
+}
+
 #endif // GEOMETRY_H
\ No newline at end of file
@@ -8,13 +8,13 @@
 #include <time.h>
 #include "../include/definitions.h"
 #include "../include/Geometry.h"
+#include "../include/ForceField.h"
 
 /**** Object that stores x, dx, and d^2x to be used in approximating the solution of x(t) ****/
 typedef struct {
   Vector3 position, velocity, acceleration;
   double mass, radius;
-  Int3 wall;
-} Object;               // 80 Bytes
+} Object;               // 88 Bytes
 
 /**** Stores the boundaries for each cube partition ****/
 typedef struct {
@@ -28,6 +28,28 @@ typedef struct Map{
   struct Map *next;
 } Map;                  // 72 Bytes
 
+/**** Cell list storage kept across steps: bucket heads, one sentinel per bucket and one node per particle
+ * in a single block that only grows ****/
+typedef struct {
+  Map **map;
+  size_t capacity;        // Bytes
+  int partition_ct;
+} MapStore;
+
+#define OCCUPANCY_BINS 16
+
+/**** Counters gathered by collisionCall; occupancy[b] counts buckets holding b particles, the last bin b or more.
+ * wall_hits is not: collisionCall leaves it 0 and the step loops add what containObjects returns ****/
+typedef struct {
+  uint64_t pairs_tested, contacts;
+  uint64_t wall_hits;         // Spheres pushed back inside by the container pass
+  uint64_t empty_visits;      // In range neighbour buckets scanned that held nothing
+  uint64_t cells, occupied_cells, binned;
+  int max_occupancy;
+  double mean_occupancy;      // binned / occupied_cells
+  uint64_t occupancy[OCCUPANCY_BINS];
+} CollisionStats;
+
 /* *** Full refactor of Collision.c, Physics.c, Map.c all into one succicient file ***
  * Main changes: 
  * Physics doesn't have a rouge wall check in it.
@@ -37,36 +59,142 @@ typedef struct Map{
  * Collision detection is now a 3x3x3 moving grid. Plans to implement multithreading. 
 */
 
-int
-mapSize(Object objects[], double cube_size);
+/**** Cells along x, y and z of a bucket grid over cube: as many cells of at least min_edge as fit each extent,
+ * at least one. max_cells > 0 widens the cells so a dilute box gets about max_cells or fewer ****/
+Int3
+gridDims(const Cube cube, const double min_edge, const int max_cells);
+
+// Collision grid: cell edges of at least the largest diameter in objects, about 2 particle_ct cells or fewer
+Int3
+mapSize(const Object objects[], const int particle_ct, const Cube cube);
 
 // Object *
 // initializeObjects(const int count);
 
+Vector3
+unit_direction(Vector3 position);
+
+/**** Time integrators. Each call below takes forces (NULL for the default spin field) and field,
+ * where field[i] (e.g. Octree.accel) is added for particle i, NULL for none ****/
+enum IntegratorKind {
+  INTEGRATOR_MIDSTEP,     // updateObjects: second order, two field evaluations, attached forces held over the step
+  INTEGRATOR_VERLET,      // driftObjects, forces at the new positions, kickObjects: kick-drift-kick velocity Verlet
+                          // (leapfrog), symplectic, one evaluation of everything per step
+  INTEGRATOR_EULER,       // eulerObjects: semi-implicit Euler, first order, one evaluation; for cheap previews
+  INTEGRATOR_KIND_CT
+};
+
+// One midstep update
 void
-handleUpdate(Object *object, const double dt);
+updateObjects(Object objects[], const ForceField *forces, const Vector3 field[], const int particle_ct,
+              const double dt);
 
-Vector3
-physics(Vector3 position, Vector3 velocity);
+// One semi-implicit Euler step with forces and field evaluated at the current state
+void
+eulerObjects(Object objects[], const ForceField *forces, const Vector3 field[], const int particle_ct,
+             const double dt);
 
-Vector3
-unit_direction(Vector3 position);
+// First half of a Verlet step: v += a dt / 2 with the cached acceleration, then p += v dt
+void
+driftObjects(Object objects[], const int particle_ct, const double dt);
 
+// Second half of a Verlet step, field computed at the drifted positions: caches the new acceleration and
+// kicks v by half of it. dt = 0 only fills the cache, to start a run
 void
-updateObjects(Object objects[], const int particle_ct, const double dt);
+kickObjects(Object objects[], const ForceField *forces, const Vector3 field[], const int particle_ct,
+            const double dt);
 
+// Wraps positions back into a periodic cube; call after every position update
+void
+wrapObjects(Object objects[], const Cube cube, const int particle_ct);
+
+// Lower case name of an integrator ("midstep", "verlet", "euler"), NULL when out of range
+const char *
+integrator_kindName(const int kind);
+
+// Integrator of a lower case name, -1 when unknown
 int
-grid_indexCalc(const Int3 index_vec, const int axis_ct);
+integrator_kindOf(const char *name);
+
+// Grids are dims.x * dims.y * dims.z buckets in (x, y, z) order, z fastest
+int
+grid_indexCalc(const Int3 index_vec, const Int3 dims);
 
 Int3
-decompose_1Dindex(const int index, const int axis_ct);
+decompose_1Dindex(const int index, const Int3 dims);
+
+static inline int
+grid_partitionCount(const Int3 dims)
+{
+  return dims.x * dims.y * dims.z;
+}
+
+static inline int
+grid_contains(const Int3 cell, const Int3 dims)
+{
+  return cell.x >= 0 && cell.y >= 0 && cell.z >= 0 && cell.x < dims.x && cell.y < dims.y && cell.z < dims.z;
+}
+
+/**** Buckets of one colour of a bucket sweep: first + 3 * (0 .. count - 1) along each axis. Buckets of one colour
+ * have disjoint 3x3x3 neighbourhoods, wrapped ones included in a periodic box, so they can run in parallel ****/
+typedef struct {
+  Int3 first, count;
+} SweepClass;
+
+// Colours of a sweep over a dims grid; a sweep visits colours 0 .. sweep_colours - 1 in order
+int
+sweep_colours(const Int3 dims, const int periodic);
+
+SweepClass
+sweepClass(const Int3 dims, const int periodic, const int colour);
+
+// k'th bucket of a class, k < count.x * count.y * count.z
+static inline Int3
+sweep_cell(const SweepClass *sweep, const int k)
+{
+  const int z = k % sweep->count.z, y = (k / sweep->count.z) % sweep->count.y;
+  const int x = k / (sweep->count.z * sweep->count.y);
+  return (Int3){sweep->first.x + 3 * x, sweep->first.y + 3 * y, sweep->first.z + 3 * z};
+}
+
+// Cell index wrapped onto a periodic grid, for offsets of at most one grid length
+static inline Int3
+wrap_cell(const Int3 cell, const Int3 dims)
+{
+  return (Int3){(cell.x < 0) ? cell.x + dims.x : (cell.x >= dims.x) ? cell.x - dims.x : cell.x,
+                (cell.y < 0) ? cell.y + dims.y : (cell.y >= dims.y) ? cell.y - dims.y : cell.y,
+                (cell.z < 0) ? cell.z + dims.z : (cell.z >= dims.z) ? cell.z - dims.z : cell.z};
+}
+
+// A periodic axis under 3 cells would wrap a neighbourhood onto itself, so sweeps merge it into one cell
+static inline Int3
+sweep_dims(const Int3 dims, const int periodic)
+{
+  if (!periodic) return dims;
+  return (Int3){(dims.x < 3) ? 1 : dims.x, (dims.y < 3) ? 1 : dims.y, (dims.z < 3) ? 1 : dims.z};
+}
+
+// 1 when a neighbour offset steps along a merged periodic axis and so lands on cells already visited
+static inline int
+sweep_repeats(const Int3 offset, const Int3 dims, const int periodic)
+{
+  return periodic && ((dims.x == 1 && offset.x != 0) || (dims.y == 1 && offset.y != 0)
+                      || (dims.z == 1 && offset.z != 0));
+}
+
+int
+insert_obj(Map *map[], Map *node, const Grid grid, const int grid_index, const int obj_index);
 
+// Rebuilds the cell list of objects in store; -1 if growing the store failed
 int
-insert_obj(Map *map[], const Grid grid[], const int grid_index, const int obj_index);
+buildMap(MapStore *store, const Object objects[], const Cube cube, const Int3 dims, const int particle_ct);
+
+void
+destroy_mapStore(MapStore *store);
 
 Map **
 createMap(const Object objects[], const Cube cube, 
-          const int axis_ct, const int particle_ct, int *status);
+          const Int3 dims, const int particle_ct, int *status);
 
 // double
 // hit_wall(const Vector3 _max_, const Vector3 _min_, const Vector3 _position_,
@@ -82,16 +210,29 @@ createMap(const Object objects[], const Cube cube,
 void
 handleCollision(Object *src, Object *deflecting);
 
-static void
-processWall(Cube cube, Object *object, Int3 center, 
-            Int3 bad_index, int obj_index, const int axis_ct);
+// handleCollision with the separation src - deflecting supplied, e.g. the nearest periodic image
+void
+resolveCollision(Object *src, Object *deflecting, const Vector3 separation);
+
+// Collision pass reusing store for the cell list; particles only, walls are left to containObjects
+void
+collisionStep(MapStore *store, Cube cube, Object objects[], const int particle_ct, const Int3 grid_dims);
 
+// Same pass with a cell list built and freed inside the call
 void
-collisionCall(Cube cube, Object objects[], const int partition_ct, const int particle_ct, const int axis_ct);
+collisionCall(Cube cube, Object objects[], const int partition_ct, const int particle_ct, const Int3 dims);
 
 void
 destroy_map(Map *map[], const int size);
 
+// Counters from the most recent collisionCall
+CollisionStats
+get_collisionStats(void);
+
+// Adds one collisionCall's counters into a running total (e.g. all substeps of a frame)
+void
+mergeCollisionStats(CollisionStats *total, const CollisionStats *add);
+
 void
 print_map(Map *map[], const int size);
 
@@ -0,0 +1,85 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/definitions.h"
+#include "../include/Geometry.h"
+#include "../include/ImprovedCollision.h"
+
+#define MESH_LEAF_SIZE 4          // Triangles per BVH leaf at most
+#define MESH_MAX_DEPTH 64         // Traversal stack; a median split stays far below it
+#define MESH_MAX_HITS 32          // Triangles one sphere is resolved against per pass
+
+/**** One triangle with its unit face normal (a, b, c counter-clockwise about it) ****/
+typedef struct {
+  Vector3 a, b, c;
+  Vector3 normal;
+} MeshTriangle;                   // 96 Bytes
+
+/**** Bounding box of a subtree. Inner nodes (count 0) have their left child next in the array and the right one
+ * at first; leaves cover triangles [first, first + count) ****/
+typedef struct {
+  double min[3], max[3];
+  int first, count;
+} MeshNode;                       // 56 Bytes
+
+/**** Counters from the last meshCollisions or contactForces pass ****/
+typedef struct {
+  uint64_t queries;           // Spheres tested against the mesh
+  uint64_t nodes_visited, triangles_tested;
+  uint64_t contacts;          // Sphere-triangle contacts resolved
+  uint64_t dropped;           // Hits past MESH_MAX_HITS for one sphere
+} MeshStats;
+
+/**** Static obstacles such as hoppers, baffles and funnels: triangles bound in a precomputed BVH so a sphere
+ * reaches the few triangles near it in O(log T). Triangles are two sided and don't wrap in a periodic box ****/
+typedef struct {
+  MeshTriangle *triangles;    // Reordered so every leaf covers a contiguous run
+  MeshNode *nodes;            // Depth first, nodes[0] is the root
+  int triangle_ct, node_ct, depth;
+  double restitution;         // Impulse collisions, 0.75 like the cube walls
+  MeshStats stats;
+} TriangleMesh;
+
+/* vertices holds vertex_ct (x, y, z) triples and indices triangle_ct index triples into them. Degenerate
+ * triangles are dropped. NULL on an index out of range, no usable triangle or allocation failure */
+TriangleMesh *
+createTriangleMesh(const double vertices[], const int vertex_ct, const int indices[], const int triangle_ct);
+
+/* Rebuilds the BVH over triangles already in a mesh's tree order, e.g. a checkpoint's, keeping that order and
+ * the stored normals. Splits depend only on counts, so the tree and every triangle index match the original's.
+ * NULL on no triangles or allocation failure */
+TriangleMesh *
+restore_triangleMesh(const MeshTriangle triangles[], const int triangle_ct);
+
+/* Reads a Wavefront OBJ (v and f lines, polygons fanned into triangles) or, by a .stl extension, a binary
+ * or ASCII STL. status: 0 success, 1 io failure, 2 bad file */
+TriangleMesh *
+load_triangleMesh(const char *path, int *status);
+
+// Scales about the origin, then translates; scale > 0 keeps the tree valid without a rebuild
+void
+transformMesh(TriangleMesh *mesh, const double scale, const Vector3 offset);
+
+// Point of triangle t closest to p
+Vector3
+mesh_closestPoint(const MeshTriangle *t, const Vector3 p);
+
+/* Writes to hits the triangles closer than radius to center, in tree order, and returns how many; past
+ * max_hits the rest are counted in stats->dropped. stats may be NULL */
+int
+mesh_query(const TriangleMesh *mesh, const Vector3 center, const double radius, int hits[], const int max_hits,
+           MeshStats *stats);
+
+/* Impulse collisions against the mesh, run after collisionStep: an overlapping sphere is pushed out along the
+ * normal from its closest point and an approaching normal velocity is reflected with mesh->restitution.
+ * Particles are independent, so the result doesn't depend on thread count. Allocates nothing */
+void
+meshCollisions(TriangleMesh *mesh, Object objects[], const int particle_ct);
+
+void
+destroy_triangleMesh(TriangleMesh *mesh);
+
+#endif // MESH_H
@@ -0,0 +1,79 @@
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/definitions.h"
+#include "../include/Geometry.h"
+#include "../include/ImprovedCollision.h"
+
+#define OCTREE_DEPTH 21                       // Morton key bits per axis, 63 bit keys
+#define OCTREE_STACK (8 * (OCTREE_DEPTH + 1)) // Traversal stack bound: at most 7 siblings left per level
+#define OCTREE_GROUP 32                       // Largest subtree whose particles share one walk
+
+/**** One cell of the tree. Children of a node are contiguous; leaves have child_ct 0.
+ * Particles of a node are sorted[first .. first + count) in Morton order ****/
+typedef struct {
+  Vector3 com;              // Centre of mass
+  double mass;
+  Vector3 center;           // Geometric centre, the cell spans center +- half
+  double half;
+  int first, count;
+  int child, child_ct;
+} OctreeNode;               // 80 Bytes
+
+/**** Counters from the last octreeForces ****/
+typedef struct {
+  int nodes, leaves, depth, groups;
+  uint64_t cell_interactions;   // Particle-node monopole terms
+  uint64_t pair_interactions;   // Particle-particle terms inside opened leaves, self included
+} OctreeStats;
+
+/**** One thread's interaction list: accepted node monopoles and opened leaf particles as point masses.
+ * Written only by its own OpenMP thread; padded against false sharing ****/
+typedef struct {
+  double *x, *y, *z, *m;
+  int count, capacity;
+  char pad[64 - 4 * sizeof(double*) - 2 * sizeof(int)];
+} OctreeList;
+
+/**** Barnes-Hut long-range force. Softened inverse square law between every pair of particles:
+ * a_i = strength * sum_j m_j (r_j - r_i) / (|r_j - r_i|^2 + softening^2)^(3/2)
+ * strength > 0 is self-gravity (G), strength < 0 a softened repulsion with charge proportional to mass.
+ * The sum is over open space; a periodic cube's images are not included.
+ * Buffers only grow, so rebuilding every step allocates nothing once the particle count is stable ****/
+typedef struct {
+  double theta;             // Opening angle: a node of edge s is used whole when s < theta * d, d measured from
+                            // its centre of mass to the nearest point of the group being walked
+  double strength, softening;
+  int leaf_size;            // Particles at or below this count are not split further
+  Vector3 *accel;           // Result per particle, in object order
+  OctreeStats stats;
+  // Build state, reused across steps
+  int particle_capacity, node_capacity, node_ct, overflow;
+  uint64_t *keys, *keys_tmp;
+  int *sorted, *sorted_tmp;     // Object index of each Morton ordered slot
+  double *x, *y, *z, *m;        // Positions and masses gathered in Morton order for the leaf loops
+  OctreeNode *nodes;
+  int *groups, group_capacity;  // Nodes walked once for all their particles
+  OctreeList *lists;
+  int list_ct;                  // One per OpenMP thread
+} Octree;
+
+Octree *
+createOctree(const double theta, const double strength, const double softening, const int leaf_size);
+
+// Rebuilds the tree over objects and fills tree->accel; -1 if growing the buffers failed
+int
+octreeForces(Octree *tree, const Object objects[], const int particle_ct);
+
+// O(N^2) sum of the same law for the particles in which[0 .. count), for checking theta; out is per entry
+void
+directForces(const Octree *tree, const Object objects[], const int particle_ct,
+             const int which[], const int count, Vector3 out[]);
+
+void
+destroy_octree(Octree *tree);
+
+#endif // OCTREE_H
@@ -0,0 +1,37 @@
+#ifndef PACKING_H
+#define PACKING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/definitions.h"
+#include "../include/Geometry.h"
+#include "../include/ImprovedCollision.h"
+#include "../include/Simulation.h"
+
+/**** Initial condition generators ****/
+typedef enum {
+  PACK_UNIFORM = 0,       // Old behaviour: uniform in the box, overlaps allowed
+  PACK_SC,                // Simple cubic lattice stretched to fill the box
+  PACK_FCC,               // Face centered cubic lattice stretched to fill the box
+  PACK_RSA                // Random sequential addition, rejection tested against the cell grid
+} PackingMode;
+
+/* Places particle_ct particles of the given radius inside cube. Every draw is
+   rng_hash(seed, per particle counter), so the result is identical for any
+   thread count. jitter in [0, 1] displaces lattice sites by up to that fraction
+   of the largest overlap free offset. Returns the number placed (RSA can run
+   out of attempts at high density) or -1 if the lattice can't fit the count */
+int
+packObjects(Object objects[], const int particle_ct, const Cube cube, const double radius,
+            const PackingMode mode, const double jitter, const uint64_t seed);
+
+/* Repacks a run's particles from its own rng and advances the rng past the draws used. When RSA saturates the run
+   keeps the particles placed: particle_ct drops and the cell grid is resized to match. Cached accelerations are
+   marked stale and contact history is cleared either way. Returns how many didn't fit (0 when all did), -1 if the
+   lattice can't fit the count (or the copy below can't be allocated), and -2 for a short pack while sim->trajectory
+   or sim->frames is attached: those expect a fixed count, so the run is left as it was */
+int
+packSimulation(Simulation *sim, const PackingMode mode, const double jitter);
+
+#endif // PACKING_H
@@ -0,0 +1,57 @@
+#ifndef PAIRFORCE_H
+#define PAIRFORCE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/definitions.h"
+#include "../include/Geometry.h"
+#include "../include/ImprovedCollision.h"
+
+/**** Short-range pair potentials, all truncated at the cutoff and shifted so U(cutoff) = 0 ****/
+enum PairKind {
+  PAIR_LJ,                // 4 epsilon ((sigma/r)^12 - (sigma/r)^6), default cutoff 2.5 sigma
+  PAIR_WCA,               // Repulsive LJ, cutoff fixed at 2^(1/6) sigma
+  PAIR_SOFT,              // Harmonic soft sphere epsilon / 2 (1 - r/sigma)^2, cutoff fixed at sigma
+  PAIR_KIND_CT
+};
+
+/**** Potential on its own cell list, with cells at least one cutoff wide. Each pair is visited once from
+ * a half shell of 13 neighbour cells, and the force goes to both particles ****/
+typedef struct {
+  int kind;
+  double epsilon, sigma, cutoff;
+  double shift;               // U(cutoff) before shifting
+  // Totals from the last pairForces
+  double potential;           // Sum of U over pairs in range
+  double virial;              // Sum of r_ij . f_ij over pairs in range; pressure = (2 K + virial) / (3 V)
+  uint64_t pairs_tested, pairs_in_range;
+  // Reused across steps
+  MapStore store;
+  Int3 dims;                  // Cells per axis of the last pass
+  double *cell_potential, *cell_virial;   // Per cell partial sums, added in cell order so totals are reproducible
+  int cell_capacity;
+} PairForce;
+
+// cutoff <= 0 picks the kind's default; WCA and soft sphere ignore it
+PairForce *
+createPairForce(const int kind, const double epsilon, const double sigma, const double cutoff);
+
+// 1 when cube can take the potential: open, or periodic and at least two cutoffs wide along every axis so each
+// pair has a single nearest image
+int
+pair_fitsCube(const PairForce *pf, const Cube cube);
+
+// Adds each particle's pair force divided by its mass into accel; -1 if growing the cell list failed or a periodic
+// cube is too small for the cutoff (pair_fitsCube)
+int
+pairForces(PairForce *pf, const Object objects[], const Cube cube, const int particle_ct, Vector3 accel[]);
+
+void
+destroy_pairForce(PairForce *pf);
+
+// Lower case name of a kind ("lj", "wca", "soft"), NULL when out of range
+const char *
+pair_kindName(const int kind);
+
+#endif // PAIRFORCE_H
@@ -0,0 +1,75 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "../include/definitions.h"
+
+#define PERF_MAX_THREADS 256
+
+/**** Counted events; any of them may be missing on a given machine, see PerfCounters.event_ok ****/
+enum PerfEvent {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES,        // L1 data cache read misses
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_TASK_CLOCK,        // Software, nanoseconds on cpu; usually present even when the PMU isn't
+  PERF_EVENT_CT
+};
+
+/**** Engine phases sampled by collisionCall, updateObjects, octreeForces and pairForces ****/
+enum PerfPhase {
+  PERF_MAP,               // createMap and destroy_map
+  PERF_SCAN,              // Coloured 3x3x3 collision scan
+  PERF_INTEGRATE,         // updateObjects
+  PERF_TREE,              // Octree build and force traversal
+  PERF_PAIRS,             // Short-range pair forces
+  PERF_CONTACTS,          // DEM contact forces
+  PERF_MESH,              // Obstacle mesh collisions
+  PERF_WALLS,             // Container pass
+  PERF_PHASE_CT
+};
+
+/**** One fd per event per OpenMP thread, opened by the threads themselves so every worker is counted.
+ * Counts are summed over threads and scaled for multiplexing ****/
+typedef struct {
+  int available;                          // At least one event opened
+  int thread_ct;
+  int event_ok[PERF_EVENT_CT];
+  int fds[PERF_MAX_THREADS][PERF_EVENT_CT];
+  uint64_t calls[PERF_PHASE_CT];
+  double value[PERF_PHASE_CT][PERF_EVENT_CT];
+  double snapshot[PERF_EVENT_CT];         // Totals at the last perf_enter
+  int error;                              // errno of the first failed open, 0 if none
+} PerfCounters;
+
+// While non-NULL, the engine phases above sample it around each phase. Only the stepping thread
+// may call perf_enter/perf_leave, and the OpenMP thread count must not change while it is set
+extern PerfCounters *perf_session;
+
+// Opens the counters on every OpenMP thread; returns NULL only on allocation failure.
+// Check ->available: without perf_event_open support (containers, paranoid settings) nothing is counted
+PerfCounters *
+openPerfCounters(void);
+
+// Zeroes totals and makes pc the active session (NULL detaches)
+void
+startPerfCounters(PerfCounters *pc);
+
+void
+perf_enter(void);
+
+void
+perf_leave(const int phase);
+
+const char *
+perf_eventName(const int event);
+
+const char *
+perf_phaseName(const int phase);
+
+void
+closePerfCounters(PerfCounters *pc);
+
+#endif // PERFCOUNTERS_H
@@ -0,0 +1,80 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "../include/definitions.h"
+
+/**** Hot path phases; nested phases are counted inside their parent too ****/
+enum ProfilePhase {
+  PHASE_MAP_ALLOC,        // Bucket sentinels, grid bounds and destroy_map
+  PHASE_BINNING,          // Placing each particle in its bucket
+  PHASE_NEIGHBOR_SCAN,    // Building the 27 neighbour indices of a bucket
+  PHASE_NARROW,           // One bucket's 3x3x3 distance tests, includes PHASE_COLLISION
+  PHASE_COLLISION,        // handleCollision
+  PHASE_WALL,             // containObjects, after integration
+  PHASE_INTEGRATE,        // updateObjects
+  PHASE_TREE_BUILD,       // Morton sort and octree build
+  PHASE_TREE_FORCE,       // Barnes-Hut traversal
+  PHASE_PAIRS,            // Short-range pair forces, cell list included
+  PHASE_CONTACTS,         // DEM contact forces, cell list included
+  PHASE_MESH,             // Sphere-triangle collisions against obstacles
+  PHASE_CT
+};
+
+typedef struct {
+  uint64_t ticks, calls;
+} PhaseCounter;
+
+/**** Totals since the last reset_profile(); enabled is 0 when built without PSIM_PROFILE ****/
+typedef struct {
+  int enabled;
+  double ticks_per_second;
+  PhaseCounter phase[PHASE_CT];
+} Profile;
+
+/**** Timer source: TSC on x86, monotonic nanoseconds elsewhere ****/
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t
+profile_ticks(void)
+{
+  return __rdtsc();
+}
+#else
+static inline uint64_t
+profile_ticks(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+/* Process wide; worker threads add with relaxed atomics, so phase ticks are summed across threads.
+ * Without PSIM_PROFILE the macros expand to nothing and the hot path carries no timer code */
+#ifdef PSIM_PROFILE
+extern PhaseCounter profile_counters[PHASE_CT];
+#define PROFILE_BEGIN(stamp) const uint64_t stamp = profile_ticks()
+#define PROFILE_END(phase, stamp)                                                                   \
+  do {                                                                                              \
+    __atomic_fetch_add(&profile_counters[(phase)].ticks, profile_ticks() - (stamp), __ATOMIC_RELAXED); \
+    __atomic_fetch_add(&profile_counters[(phase)].calls, 1, __ATOMIC_RELAXED);                      \
+  } while (0)
+#else
+#define PROFILE_BEGIN(stamp) ((void)0)
+#define PROFILE_END(phase, stamp) ((void)0)
+#endif
+
+Profile
+get_profile(void);
+
+void
+reset_profile(void);
+
+// Lower case name of a phase for reports, NULL when out of range
+const char *
+profile_phaseName(const int phase);
+
+#endif // PROFILE_H
@@ -0,0 +1,52 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/definitions.h"
+#include "../include/Geometry.h"
+#include "../include/ImprovedCollision.h"
+
+#define INSTANCE_FLOATS 5     // x, y, z, radius, speed
+#define LOD_TIERS 3           // 0 = full detail ... LOD_TIERS - 1 = coarsest
+
+/**** Unit sphere shared by every instance. Positions double as normals ****/
+typedef struct {
+  float *vertices;            // vertex_ct * 3 floats
+  uint32_t *indices;          // index_ct entries, GL_TRIANGLES
+  int vertex_ct, index_ct;
+} SphereMesh;
+
+// Tessellates a unit UV sphere once; slices >= 3, stacks >= 2
+SphereMesh *
+createSphereMesh(const int slices, const int stacks);
+
+void
+destroy_sphereMesh(SphereMesh *mesh);
+
+/* Packs every particle into out as INSTANCE_FLOATS float32s (position, radius,
+   speed). out must hold particle_ct * INSTANCE_FLOATS floats. Returns particle_ct */
+int
+fillInstances(const Object objects[], const int particle_ct, float out[]);
+
+/**** Output of a cull: instances are grouped by tier, tier k occupies [tier_start[k], tier_start[k] + tier_ct[k]) ****/
+typedef struct {
+  int visible;
+  int tier_start[LOD_TIERS], tier_ct[LOD_TIERS];
+  int cells_rejected, cells_accepted;     // Grid cells settled without per-particle tests
+} CullResult;
+
+/* Frustum culls and LOD-bins every particle. view_proj is the column-major
+   projection * modelview (as glGetFloatv returns), focal_px is
+   viewport_height / (2 tan(fovy / 2)), and lod_px[k] is the projected diameter
+   in pixels below which a particle drops to tier k + 1. Grid cells of the
+   createMap grid are tested first so whole buckets are rejected or accepted
+   at once. tier is scratch of particle_ct ints; out receives the compacted
+   INSTANCE_FLOATS instances. Returns -1 if the map can't be built */
+int
+cullInstances(const Object objects[], const int particle_ct, const Cube cube, const Int3 dims,
+              const float view_proj[16], const double focal_px, const double lod_px[LOD_TIERS - 1],
+              int tier[], float out[], CullResult *result);
+
+#endif // RENDER_H
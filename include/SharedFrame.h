@@ -0,0 +1,63 @@
+#ifndef SHAREDFRAME_H
+#define SHAREDFRAME_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/definitions.h"
+#include "../include/Geometry.h"
+#include "../include/ImprovedCollision.h"
+
+#define SHARED_FRAME_MAGIC "PSIMSHM"
+#define SHARED_FRAME_VERSION 1
+#define SHARED_FRAME_ALIGN 64
+
+/* Shared memory layout (all offsets from the start of the segment):
+   [SharedRingHeader][slot 0]...[slot slot_ct - 1], each slot slot_bytes long:
+   [SharedSlotHeader][float positions[3 * particle_ct]][float radii[particle_ct]] */
+
+typedef struct {
+  char magic[8];
+  uint32_t version, slot_ct;
+  uint64_t particle_ct, slot_bytes, slot_offset;
+  uint64_t latest;        // Index of the most recently completed slot, UINT64_MAX before the first
+  unsigned char pad[SHARED_FRAME_ALIGN - 48];
+} SharedRingHeader;
+
+/**** seq is odd while the writer is filling the slot; readers retry if it changed under them ****/
+typedef struct {
+  uint64_t seq, frame;
+  double time;
+  unsigned char pad[SHARED_FRAME_ALIGN - 24];
+} SharedSlotHeader;
+
+typedef struct {
+  SharedRingHeader *ring;
+  size_t length;
+  int writable;
+  char *name;
+} SharedFrames;
+
+// Creates (or replaces) the segment /name sized for particle_ct and slot_ct frames; NULL unless both are positive
+SharedFrames *
+openSharedFrames(const char *name, const int particle_ct, const int slot_ct);
+
+// Maps an existing segment read-only for a viewer or monitor process
+SharedFrames *
+attachSharedFrames(const char *name);
+
+// Writes positions/radii as float32 into slot step % slot_ct; -1 on a read-only mapping or another particle count
+int
+publishFrame(SharedFrames *shm, const Object objects[], const int particle_ct, const uint64_t step,
+             const double time);
+
+/* Copies the newest consistent frame. Returns 0, or -1 if nothing is published yet
+   or the writer kept overwriting the slot (reader fell a whole ring behind) */
+int
+readLatestFrame(const SharedFrames *shm, float positions[], float radii[], uint64_t *frame);
+
+// Unmaps; the creating process also removes the name
+void
+closeSharedFrames(SharedFrames *shm);
+
+#endif // SHAREDFRAME_H
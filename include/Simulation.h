@@ -0,0 +1,67 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/definitions.h"
+#include "../include/Geometry.h"
+#include "../include/ImprovedCollision.h"
+#include "../include/Analysis.h"
+#include "../include/Octree.h"
+#include "../include/PairForce.h"
+#include "../include/Contact.h"
+#include "../include/Mesh.h"
+#include "../include/Container.h"
+#include "../include/Trajectory.h"
+#include "../include/SharedFrame.h"
+
+/**** Handle for a single run: particle state plus everything needed to resume it ****/
+typedef struct {
+  Cube cube;              // Bounds of the cell grid
+  Container container;    // Walls the particles stay inside, the cube's by default and none when periodic
+  Object *objects;
+  int particle_ct, sub_steps;
+  Int3 grid_dims;         // Collision cells along x, y and z, from mapSize
+  double dt, time;        // Frame timestep and simulation clock
+  uint64_t step;          // Frames completed
+  Rng rng;
+  ForceField forces;      // External field every particle feels, FIELD_SPIN by default
+  int integrator;         // IntegratorKind, INTEGRATOR_MIDSTEP by default
+  int primed;             // Cached accelerations match the current state; cleared to make Verlet recompute them
+  Analysis *analysis;     // Optional in-situ sampling, owned by the run
+  Octree *gravity;        // Optional Barnes-Hut long-range force, owned by the run
+  PairForce *pairs;       // Optional short-range pair potential, owned by the run
+  ContactModel *contacts; // Optional DEM contacts, replace the impulse collisions; owned by the run
+  TriangleMesh *obstacles;    // Optional static mesh, collided after the cell list or added to the contacts; owned
+  TrajectoryWriter *trajectory;   // Optional recording of every trajectory->interval'th frame, closed with the run
+  SharedFrames *frames;           // Optional shared memory ring every frame is published to, closed with the run
+  Vector3 *field;         // Accelerations from gravity, pairs and contacts, allocated on first use
+  CollisionStats collision;   // collisionCall counters and container wall hits summed over the last frame's substeps
+  MapStore store;             // Cell list reused by every substep
+  uint64_t frame_allocs;      // Tracked allocations during the last frame, 0 in steady state
+  void *mapping;          // Set when objects live in a mapped checkpoint instead of the heap
+  size_t mapping_len;
+} Simulation;
+
+// Creates a run with particles placed from the seeded rng
+Simulation *
+createSimulation(const Cube cube, const int particle_ct, const double radius,
+                 const double dt, const int sub_steps, const uint64_t seed);
+
+// Advances the run by frames full timesteps (sub_steps collision/update passes each, with sim->gravity,
+// sim->pairs and sim->contacts evaluated once per substep when attached; contacts skip collisions and take
+// sim->obstacles and sim->container as contacts, which otherwise collide right after the particles and push
+// them back inside after the update).
+// Midstep and Euler evaluate them at the start of the substep, Verlet after the drift.
+// Samples sim->analysis, if attached, at the end of every analysis->interval'th frame, then hands the positions
+// to sim->trajectory every trajectory->interval'th and publishes every frame to sim->frames. 0 when a force, the
+// analysis, the trajectory or the ring failed
+int
+stepSimulation(Simulation *sim, const int frames);
+
+// Frees objects (or unmaps the checkpoint they were loaded from) and the handle
+void
+destroy_simulation(Simulation *sim);
+
+#endif // SIMULATION_H
@@ -0,0 +1,78 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "../include/definitions.h"
+
+/**** Event names; the string table lives in Trace.c ****/
+enum TraceName {
+  TRACE_FRAME,            // One stepSimulation frame
+  TRACE_MAP,              // createMap
+  TRACE_SCAN,             // Whole coloured collision scan
+  TRACE_BUCKET,           // One bucket's narrow phase on a worker, args: cell, particles
+  TRACE_DESTROY_MAP,
+  TRACE_INTEGRATE,        // One worker's share of updateObjects, args: particles
+  TRACE_TREE_BUILD,       // Morton sort and octree build, args: particles, nodes
+  TRACE_TREE_FORCE,       // One worker's share of the Barnes-Hut traversal, args: particles
+  TRACE_PAIRS,            // Pair force pass, args: particles, pairs in range
+  TRACE_CONTACTS,         // Contact pass, args: particles, contacts
+  TRACE_MESH,             // Obstacle mesh pass, args: particles, contacts
+  TRACE_WALLS,            // Container pass, args: particles, contacts
+  TRACE_NAME_CT
+};
+
+/**** Complete event: start and duration in ns from the trace epoch ****/
+typedef struct {
+  uint64_t start, duration;
+  int32_t name, arg0, arg1;
+} TraceEvent;
+
+/**** Written only by its own OpenMP thread, so recording takes no locks; padded against false sharing ****/
+typedef struct {
+  TraceEvent *events;
+  size_t count, capacity, dropped;
+  char pad[64 - sizeof(TraceEvent*) - 3 * sizeof(size_t)];
+} TraceBuffer;
+
+typedef struct {
+  int thread_ct;
+  uint64_t epoch;
+  TraceBuffer *buffers;
+} TraceState;
+
+// Non-NULL while tracing; the engine checks it before taking a timestamp
+extern TraceState *trace_active;
+
+static inline uint64_t
+trace_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#define TRACE_BEGIN(stamp) const uint64_t stamp = (trace_active != NULL) ? trace_now() : 0
+#define TRACE_END(name, stamp, arg0, arg1)                                 \
+  do {                                                                     \
+    if (trace_active != NULL) trace_record((name), (stamp), (arg0), (arg1)); \
+  } while (0)
+
+// Starts recording with room for events_per_thread per OpenMP thread; events past that are counted and dropped.
+// A non-NULL exit_path writes the trace there when the process exits. Returns -1 on allocation failure
+int
+startTrace(const size_t events_per_thread, const char *exit_path);
+
+void
+trace_record(const int name, const uint64_t start, const int arg0, const int arg1);
+
+// Writes Chrome trace JSON (chrome://tracing, ui.perfetto.dev); recording continues
+int
+dumpTrace(const char *path);
+
+// Stops recording and frees the buffers
+void
+stopTrace(void);
+
+#endif // TRACE_H
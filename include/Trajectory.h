@@ -0,0 +1,100 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "../include/definitions.h"
+#include "../include/Geometry.h"
+#include "../include/ImprovedCollision.h"
+
+#define TRAJECTORY_MAGIC "PSIMTRAJ"
+#define TRAJECTORY_INDEX_MAGIC "PSIMTIDX"
+#define TRAJECTORY_VERSION 1
+#define TRAJECTORY_QUANT_LIMIT ((1 << 30) - 1)    // |quantized| bound, so a delta of two always fits an int32
+
+/**** File header. Positions are stored as int32 multiples of resolution measured from origin, clamped to
+ * TRAJECTORY_QUANT_LIMIT steps either side of it ****/
+typedef struct {
+  char magic[8];
+  uint32_t version, keyframe_interval;
+  uint64_t particle_ct;
+  double resolution;
+  Vector3 origin;
+} TrajectoryHeader;
+
+/**** Per frame header; payload_bytes of encoded positions follow ****/
+typedef struct {
+  uint64_t step;
+  double time;
+  uint32_t payload_bytes, keyframe;   // keyframe: 1 raw int32 triples, 0 varint deltas vs last keyframe
+} TrajectoryFrame;
+
+/**** Seek table appended on close, followed by {index_offset, frame_ct, TRAJECTORY_INDEX_MAGIC} ****/
+typedef struct {
+  uint64_t step, offset;              // offset of the frame's TrajectoryFrame header
+} TrajectoryIndex;
+
+/**** Queue slot: positions copied off the step thread ****/
+typedef struct {
+  uint64_t step;
+  double time;
+  Vector3 *positions;
+} TrajectorySlot;
+
+typedef struct {
+  FILE *file;
+  TrajectoryHeader header;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty, not_full;
+  TrajectorySlot *slots;              // Bounded ring of queue_depth slots
+  int queue_depth, head, tail, queued, closing, failed;
+  int interval;                       // Frames between submits when stepSimulation feeds the writer
+  uint64_t stalls;                    // Submits that had to wait for the io thread
+  // Owned by the io thread
+  int32_t *keyframe, *quantized;
+  unsigned char *payload;
+  TrajectoryIndex *index;
+  uint64_t frame_ct, index_cap;
+  uint64_t clipped;                   // Coordinates clamped to the quantization range, NaN included
+} TrajectoryWriter;
+
+/**** Reader side: keeps the index and the last decoded keyframe for sequential reads ****/
+typedef struct {
+  FILE *file;
+  TrajectoryHeader header;
+  TrajectoryIndex *index;
+  uint64_t frame_ct, keyframe_no;
+  int32_t *keyframe;
+  unsigned char *payload;
+} TrajectoryReader;
+
+// Opens path and starts the background io thread. Attached as sim->trajectory, every interval'th frame is recorded
+TrajectoryWriter *
+openTrajectory(const char *path, const Cube cube, const int particle_ct, const int interval,
+               const int keyframe_interval, const int queue_depth, const double resolution);
+
+// Copies the positions into a free slot; only blocks if the queue is full. -1 after a failed write or when
+// particle_ct isn't the count the file was opened for
+int
+submitFrame(TrajectoryWriter *writer, const Object objects[], const int particle_ct, const uint64_t step,
+            const double time);
+
+// Drains the queue, writes the seek table and frees the writer. Returns -1 if any write failed
+int
+closeTrajectory(TrajectoryWriter *writer);
+
+TrajectoryReader *
+openTrajectoryReader(const char *path);
+
+// Decodes frame frame_no into positions (particle_ct entries) by seeking to it. -1 past the end, on a read error
+// or when the frame header is corrupt
+int
+readFrame(TrajectoryReader *reader, const uint64_t frame_no, Vector3 positions[], uint64_t *step);
+
+void
+closeTrajectoryReader(TrajectoryReader *reader);
+
+#endif // TRAJECTORY_H
@@ -2,25 +2,51 @@
 #include <stdlib.h>
 #include <math.h>
 #include <float.h>
-#include <windows.h>
+#include <stdint.h>
+#include <stddef.h>
 #include "../include/Geometry.h"
 #include "../include/ImprovedCollision.h"
+#include "../include/Container.h"
+
+/**** Pointer, shape and byte strides of one Vector3 field across the object array ****/
+typedef struct {
+  double *data;
+  int64_t shape[2];       // {particle_ct, 3}
+  int64_t strides[2];     // {sizeof(Object), sizeof(double)}
+} ArrayView;
+
+static CollisionStats frame_stats;
+static MapStore call_store;         // Cell list kept between updateCall calls
 
 /**** Main call in front-end to update physics of system. Substepping enabled ****/
 int
 updateCall(const Cube cube, Object objects[], 
-           const int particle_ct, const int axis_ct, const double dt, const int sub_steps)
+           const int particle_ct, const Int3 dims, const double dt, const int sub_steps)
 {
   double sub_dt = (double)(dt / sub_steps);
+  const Container walls = boxContainer(cube);
+  CollisionStats sub_stats;
 
+  memset(&frame_stats, 0, sizeof(CollisionStats));
   for (int i = 0; i < sub_steps; i++) {  
-    collisionCall(cube, objects, axis_ct * axis_ct * axis_ct, particle_ct, axis_ct);
-    updateObjects(objects, particle_ct, sub_dt);
+    collisionStep(&call_store, cube, objects, particle_ct, dims);
+    sub_stats = get_collisionStats();
+    mergeCollisionStats(&frame_stats, &sub_stats);
+    updateObjects(objects, NULL, NULL, particle_ct, sub_dt);
+    frame_stats.wall_hits += containObjects(&walls, objects, particle_ct);
+    if (cube.periodic) wrapObjects(objects, cube, particle_ct);
   }
 
   return 1;                               // Successful time-step update
 } 
 
+/**** collisionCall counters summed over the substeps of the last updateCall ****/
+CollisionStats
+read_collisionStats(void)
+{
+  return frame_stats;
+}
+
 Vector3 *
 read_positions(Object objects[], int size)
 {
@@ -31,6 +57,54 @@ read_positions(Object objects[], int size)
   return positions;
 }
 
+/**** Views alias the objects array directly: stable until the array is freed, no copy, writable ****/
+static ArrayView
+field_view(Object objects[], const int particle_ct, const size_t offset)
+{
+  ArrayView view;
+  view.data = (double*)((char*)objects + offset);
+  view.shape[0] = particle_ct;
+  view.shape[1] = 3;
+  view.strides[0] = sizeof(Object);
+  view.strides[1] = sizeof(double);
+  return view;
+}
+
+ArrayView
+position_view(Object objects[], const int particle_ct)
+{
+  return field_view(objects, particle_ct, offsetof(Object, position));
+}
+
+ArrayView
+velocity_view(Object objects[], const int particle_ct)
+{
+  return field_view(objects, particle_ct, offsetof(Object, velocity));
+}
+
+ArrayView
+acceleration_view(Object objects[], const int particle_ct)
+{
+  return field_view(objects, particle_ct, offsetof(Object, acceleration));
+}
+
+/**** Bulk setters from a packed (particle_ct, 3) float64 array ****/
+void
+set_positions(Object objects[], const int particle_ct, const double xyz[])
+{
+  for (int i = 0; i < particle_ct; i++) {
+    objects[i].position = (Vector3){xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]};
+  }
+}
+
+void
+set_velocities(Object objects[], const int particle_ct, const double xyz[])
+{
+  for (int i = 0; i < particle_ct; i++) {
+    objects[i].velocity = (Vector3){xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]};
+  }
+}
+
 // Python function to free memory created in C
 void free_memory(void *ptr) {
   free(ptr);
@@ -1,12 +1,14 @@
 # Imports
 import ctypes as ct
 import argparse
+import numpy as np
 # Render Imports
 import pygame
 from pygame.locals import *
 import OpenGL.GL as GL
 import OpenGL.GLUT as GLUT
 import OpenGL.GLU as GLU
+import OpenGL.GL.shaders as shaders
 
 # Structure Definition to communicate positions between update loop and renderer
 # Simple vector3 c type structure
@@ -18,30 +20,27 @@ class Vec3(ct.Structure):
   def __str__(self):
     return f'  X: {self.x:.4f}\n  Y: {self.y:.4f}\n  Z: {self.z:.4f}'
   
-# ^ For 3D boolean
-class Short3(ct.Structure):
-  _fields_ = [('x', ct.c_short),
-              ('y', ct.c_short),
-              ('z', ct.c_short)]
+# Integer triple matching Int3 (grid dims)
+class Int3(ct.Structure):
+  _fields_ = [('x', ct.c_int),
+              ('y', ct.c_int),
+              ('z', ct.c_int)]
 
 # Cube defn to pass as arg 
 class Cube(ct.Structure):
   _fields_ = [('origin', Vec3),
               ('min', Vec3),
               ('max', Vec3),
-              ('size', ct.c_double)]
+              ('size', ct.c_double),
+              ('periodic', ct.c_int)]
   
-# C Linked list structure defn for object to pass in update loop
+# Object array element; must match the field order of Object in ImprovedCollision.h
 class Object(ct.Structure):
-  pass
-Object._fields_ = [('next', ct.POINTER(Object)),
-                  ('id', ct.c_char_p),
-                  ('position', Vec3),
-                  ('velocity', Vec3),
-                  ('acceleration', Vec3),
-                  ('wall', Short3),
-                  ('mass', ct.c_double),
-                  ('radius', ct.c_double)]
+  _fields_ = [('position', Vec3),
+              ('velocity', Vec3),
+              ('acceleration', Vec3),
+              ('mass', ct.c_double),
+              ('radius', ct.c_double)]
 
 # Grid array of bounds
 class Grid(ct.Structure):
@@ -54,42 +53,232 @@ Map._fields_ = [('object', ct.POINTER(Object)),
                 ('count', ct.c_int),
                 ('next', ct.POINTER(Map))]
 
-# Definse the vertices and edges for given Cube structure for mesh
-def drawSphere(Vec3, radius):
-  y = Vec3.x
-  x = Vec3.y
-  z = Vec3.z
-  slices = 40
-  stacks = 40
-
-  GL.glPushMatrix()
-  GL.glTranslatef(x, y, z)
-
-  GL.glColor3f(0.0, 0.66, 0.33)
-
-  sphere = GLU.gluNewQuadric()
-  GLU.gluQuadricNormals(sphere, GLU.GLU_SMOOTH)
-  GLU.gluSphere(sphere, radius, slices, stacks)
-
-  GL.glPopMatrix()
-
-  # Check for error
-  error = GL.glGetError()
-  if error != GL.GL_NO_ERROR:
-    print(f'drawSphere error: {error}')
+# Strided view of a Vector3 field inside the C object array
+class ArrayView(ct.Structure):
+  _fields_ = [('data', ct.POINTER(ct.c_double)),
+              ('shape', ct.c_int64 * 2),
+              ('strides', ct.c_int64 * 2)]
+
+# Wraps a view as a writable numpy array without copying; only valid while the objects array is alive
+def as_numpy(view):
+  shape = tuple(view.shape)
+  strides = tuple(view.strides)
+  span = (shape[0] - 1) * strides[0] + shape[1] * strides[1] if shape[0] > 0 else 0
+  buffer = (ct.c_char * span).from_address(ct.addressof(view.data.contents)) if span else b''
+  return np.ndarray(shape=shape, dtype=np.float64, buffer=buffer, strides=strides)
+
+# Per-phase timers from Profile.h, zero unless the library was built with make render PROFILE=1
+PROFILE_PHASES = ('map_alloc', 'binning', 'neighbor_scan', 'narrow', 'collision', 'wall', 'integrate', 'tree_build', 'tree_force', 'pairs', 'contacts', 'mesh')
+
+class PhaseCounter(ct.Structure):
+  _fields_ = [('ticks', ct.c_uint64),
+              ('calls', ct.c_uint64)]
+
+class Profile(ct.Structure):
+  _fields_ = [('enabled', ct.c_int),
+              ('ticks_per_second', ct.c_double),
+              ('phase', PhaseCounter * len(PROFILE_PHASES))]
+
+# {phase: (seconds, calls)} since the last c.reset_profile()
+def get_profile():
+  profile = c.get_profile()
+  if not profile.enabled:
+    return {}
+  return {name: (counter.ticks / profile.ticks_per_second, counter.calls)
+          for name, counter in zip(PROFILE_PHASES, profile.phase)}
+
+# Counters summed over the substeps of the last updateCall, see CollisionStats in ImprovedCollision.h
+OCCUPANCY_BINS = 16
+
+class CollisionStats(ct.Structure):
+  _fields_ = [('pairs_tested', ct.c_uint64),
+              ('contacts', ct.c_uint64),
+              ('wall_hits', ct.c_uint64),
+              ('empty_visits', ct.c_uint64),
+              ('cells', ct.c_uint64),
+              ('occupied_cells', ct.c_uint64),
+              ('binned', ct.c_uint64),
+              ('max_occupancy', ct.c_int),
+              ('mean_occupancy', ct.c_double),
+              ('occupancy', ct.c_uint64 * OCCUPANCY_BINS)]
+
+# Shared sphere mesh layout returned by createSphereMesh
+class SphereMesh(ct.Structure):
+  _fields_ = [('vertices', ct.POINTER(ct.c_float)),
+              ('indices', ct.POINTER(ct.c_uint32)),
+              ('vertex_ct', ct.c_int),
+              ('index_ct', ct.c_int)]
+
+INSTANCE_FLOATS = 5   # x, y, z, radius, speed (matches Render.h)
+
+# Unit sphere scaled/offset per instance; x and y are swapped as in the old drawSphere
+SPHERE_VERTEX_SHADER = """
+#version 120
+attribute vec3 vertex;
+attribute vec4 instance;
+attribute float speed;
+varying vec3 normal;
+varying float heat;
+uniform float max_speed;
+void main() {
+  normal = normalize(gl_NormalMatrix * vertex);
+  heat = clamp(speed / max_speed, 0.0, 1.0);
+  gl_Position = gl_ModelViewProjectionMatrix * vec4(instance.yxz + vertex * instance.w, 1.0);
+}
+"""
+
+SPHERE_FRAGMENT_SHADER = """
+#version 120
+varying vec3 normal;
+varying float heat;
+void main() {
+  float diffuse = max(dot(normalize(normal), normalize(vec3(0.5, 0.5, 1.0))), 0.0);
+  vec3 base = mix(vec3(0.0, 0.66, 0.33), vec3(0.9, 0.2, 0.1), heat);
+  gl_FragColor = vec4(base * (0.25 + 0.75 * diffuse), 1.0);
+}
+"""
+
+LOD_TIERS = 3         # matches Render.h
+LOD_MESHES = ((24, 16), (12, 8), (6, 4))   # (slices, stacks) per tier, finest first
+SWAP_XY = np.array([[0, 1, 0, 0], [1, 0, 0, 0], [0, 0, 1, 0], [0, 0, 0, 1]], dtype=np.float32)
+
+# Compacted, tier grouped output of cullInstances
+class CullResult(ct.Structure):
+  _fields_ = [('visible', ct.c_int),
+              ('tier_start', ct.c_int * LOD_TIERS),
+              ('tier_ct', ct.c_int * LOD_TIERS),
+              ('cells_rejected', ct.c_int),
+              ('cells_accepted', ct.c_int)]
+
+# Draws particles with one glDrawElementsInstanced per LOD tier; C fills the instance buffer each frame
+class SphereRenderer:
+  def __init__(self, particle_ct, max_speed=5.0, lod_px=(24.0, 8.0)):
+    self.particle_ct = particle_ct
+    self.max_speed = max_speed
+    self.instances = np.zeros((particle_ct, INSTANCE_FLOATS), dtype=np.float32)
+    self.tier = np.zeros(particle_ct, dtype=np.int32)
+    self.lod_px = (ct.c_double * (LOD_TIERS - 1))(*lod_px)
+    self.cull = CullResult()
+
+    self.program = GL.glCreateProgram()
+    GL.glAttachShader(self.program, shaders.compileShader(SPHERE_VERTEX_SHADER, GL.GL_VERTEX_SHADER))
+    GL.glAttachShader(self.program, shaders.compileShader(SPHERE_FRAGMENT_SHADER, GL.GL_FRAGMENT_SHADER))
+    GL.glBindAttribLocation(self.program, 0, 'vertex')   # Compat profiles want attribute 0 per-vertex
+    GL.glLinkProgram(self.program)
+    if GL.glGetProgramiv(self.program, GL.GL_LINK_STATUS) != GL.GL_TRUE:
+      raise RuntimeError(GL.glGetProgramInfoLog(self.program))
+    self.instance_loc = GL.glGetAttribLocation(self.program, 'instance')
+    self.speed_loc = GL.glGetAttribLocation(self.program, 'speed')
+    self.max_speed_loc = GL.glGetUniformLocation(self.program, 'max_speed')
+
+    # One (vertex vbo, index vbo, index count) per tier
+    self.meshes = []
+    for slices, stacks in LOD_MESHES:
+      mesh_ptr = c.createSphereMesh(slices, stacks)
+      mesh = mesh_ptr.contents
+      vertices = np.ctypeslib.as_array(mesh.vertices, shape=(mesh.vertex_ct * 3,))
+      indices = np.ctypeslib.as_array(mesh.indices, shape=(mesh.index_ct,))
+      vertex_vbo, index_vbo = GL.glGenBuffers(2)
+      GL.glBindBuffer(GL.GL_ARRAY_BUFFER, vertex_vbo)
+      GL.glBufferData(GL.GL_ARRAY_BUFFER, vertices.nbytes, vertices, GL.GL_STATIC_DRAW)
+      GL.glBindBuffer(GL.GL_ELEMENT_ARRAY_BUFFER, index_vbo)
+      GL.glBufferData(GL.GL_ELEMENT_ARRAY_BUFFER, indices.nbytes, indices, GL.GL_STATIC_DRAW)
+      self.meshes.append((vertex_vbo, index_vbo, mesh.index_ct))
+      # Mesh is copied to the GPU, the C copy is no longer needed
+      c.destroy_sphereMesh(mesh_ptr)
+
+    self.instance_vbo = GL.glGenBuffers(1)
+    GL.glBindBuffer(GL.GL_ARRAY_BUFFER, self.instance_vbo)
+    GL.glBufferData(GL.GL_ARRAY_BUFFER, self.instances.nbytes, None, GL.GL_STREAM_DRAW)
+    GL.glBindBuffer(GL.GL_ARRAY_BUFFER, 0)
+    GL.glBindBuffer(GL.GL_ELEMENT_ARRAY_BUFFER, 0)
+
+  # Instanced draw of instances [first, first + count) of the uploaded buffer with a tier's mesh
+  def _draw_range(self, tier, first, count):
+    vertex_vbo, index_vbo, index_ct = self.meshes[tier]
+    stride = INSTANCE_FLOATS * 4
+    offset = first * stride
+
+    GL.glBindBuffer(GL.GL_ARRAY_BUFFER, self.instance_vbo)
+    GL.glEnableVertexAttribArray(self.instance_loc)
+    GL.glVertexAttribPointer(self.instance_loc, 4, GL.GL_FLOAT, GL.GL_FALSE, stride, ct.c_void_p(offset))
+    GL.glVertexAttribDivisor(self.instance_loc, 1)
+    if self.speed_loc >= 0:
+      GL.glEnableVertexAttribArray(self.speed_loc)
+      GL.glVertexAttribPointer(self.speed_loc, 1, GL.GL_FLOAT, GL.GL_FALSE, stride, ct.c_void_p(offset + 16))
+      GL.glVertexAttribDivisor(self.speed_loc, 1)
+
+    GL.glBindBuffer(GL.GL_ARRAY_BUFFER, vertex_vbo)
+    GL.glEnableVertexAttribArray(0)
+    GL.glVertexAttribPointer(0, 3, GL.GL_FLOAT, GL.GL_FALSE, 12, ct.c_void_p(0))
+
+    GL.glBindBuffer(GL.GL_ELEMENT_ARRAY_BUFFER, index_vbo)
+    GL.glDrawElementsInstanced(GL.GL_TRIANGLES, index_ct, GL.GL_UNSIGNED_INT, None, count)
+
+  def _begin(self, count):
+    GL.glUseProgram(self.program)
+    GL.glUniform1f(self.max_speed_loc, self.max_speed)
+    GL.glBindBuffer(GL.GL_ARRAY_BUFFER, self.instance_vbo)
+    GL.glBufferSubData(GL.GL_ARRAY_BUFFER, 0, count * INSTANCE_FLOATS * 4, self.instances)
+
+  def _end(self):
+    # Leave divisors and arrays clean for the fixed function cube
+    GL.glVertexAttribDivisor(self.instance_loc, 0)
+    GL.glDisableVertexAttribArray(self.instance_loc)
+    if self.speed_loc >= 0:
+      GL.glVertexAttribDivisor(self.speed_loc, 0)
+      GL.glDisableVertexAttribArray(self.speed_loc)
+    GL.glDisableVertexAttribArray(0)
+    GL.glBindBuffer(GL.GL_ARRAY_BUFFER, 0)
+    GL.glBindBuffer(GL.GL_ELEMENT_ARRAY_BUFFER, 0)
+    GL.glUseProgram(0)
+
+    # Check for error
+    error = GL.glGetError()
+    if error != GL.GL_NO_ERROR:
+      print(f'SphereRenderer error: {error}')
+
+  # Everything at full detail
+  def draw(self, objects, count=None):
+    count = self.particle_ct if count is None else count
+    if count == 0:
+      return
+    c.fillInstances(objects, count, self.instances)
+    self._begin(count)
+    self._draw_range(0, 0, count)
+    self._end()
+
+  # Only what the current camera sees, one draw per LOD tier; fovy in degrees as given to gluPerspective
+  def draw_culled(self, objects, cube, dims, fovy, viewport_height, count=None):
+    count = self.particle_ct if count is None else count
+    projection = np.array(GL.glGetFloatv(GL.GL_PROJECTION_MATRIX), dtype=np.float32).reshape(4, 4)
+    modelview = np.array(GL.glGetFloatv(GL.GL_MODELVIEW_MATRIX), dtype=np.float32).reshape(4, 4)
+    # glGet returns column-major, so the row-major product is reversed; SWAP_XY matches the shader's .yxz
+    view_proj = np.ascontiguousarray((SWAP_XY @ modelview @ projection).reshape(16))
+    focal_px = viewport_height / (2.0 * np.tan(np.radians(fovy) / 2.0))
+
+    visible = c.cullInstances(objects, count, cube, dims, view_proj, focal_px, self.lod_px,
+                              self.tier, self.instances, ct.byref(self.cull))
+    if visible <= 0:
+      return visible
+    self._begin(visible)
+    for tier in range(LOD_TIERS):
+      if self.cull.tier_ct[tier] > 0:
+        self._draw_range(tier, self.cull.tier_start[tier], self.cull.tier_ct[tier])
+    self._end()
+    return visible
 
 def cube_mesh(Cube):
-  min = int(Cube.min.x)
-  max = int(Cube.size)
+  lo, hi = Cube.min, Cube.max
   vertices = (
-    (min, min, min),
-    (max, min, min),
-    (max, max, min),
-    (min, max, min),
-    (min, min, max),
-    (max, min, max),
-    (max, max, max),
-    (min, max, max),
+    (lo.x, lo.y, lo.z),
+    (hi.x, lo.y, lo.z),
+    (hi.x, hi.y, lo.z),
+    (lo.x, hi.y, lo.z),
+    (lo.x, lo.y, hi.z),
+    (hi.x, lo.y, hi.z),
+    (hi.x, hi.y, hi.z),
+    (lo.x, hi.y, hi.z),
   )
   edges = (
     (0, 1),
@@ -168,9 +357,8 @@ def main():
   radius = 0.5
   objects = c.initializeObjects(particle_ct, radius)
 
-  axis_ct = c.mapSize(objects, cube.size)
-  axis_ct = 8
-  partition_ct = axis_ct * axis_ct * axis_ct
+  dims = c.mapSize(objects, particle_ct, cube)
+  partition_ct = dims.x * dims.y * dims.z
   # print(f'Size: {partition_ct}')
 
   # Renderer initialization
@@ -180,14 +368,13 @@ def main():
   GLU.gluPerspective(60, display[0]/display[1], 0.1, 50.0)
   GL.glTranslatef(-10, -5, -25)
   setLighting()
+  spheres = SphereRenderer(particle_ct)
 
   end = False
 
 # Update Loop
   while True:
 
-    positions = c.read_positions(objects, particle_ct)
-
     # Clear color and depth buffer 
     GL.glClear(GL.GL_COLOR_BUFFER_BIT|GL.GL_DEPTH_BUFFER_BIT)
     # Rotate Matrix
@@ -198,11 +385,8 @@ def main():
     # draw Cube without lighting
     drawCube(cube)
 
-    # draw Sphere with lighting enabled
-    GL.glEnable(GL.GL_LIGHTING)
-    for i in range(particle_ct):
-      drawSphere(positions[i], radius)
-    GL.glDisable(GL.GL_LIGHTING)
+    # draw visible spheres, one instanced call per LOD tier (shaded in the shader)
+    spheres.draw_culled(objects, cube, dims, 60, display[1])
 
     GL.glPopMatrix()
 
@@ -225,7 +409,7 @@ def main():
       break
     
     # Update positions, check collision map, rectify collisions and oob
-    updateStatus = c.updateCall(cube, objects, particle_ct, axis_ct, dt, sub_steps)
+    updateStatus = c.updateCall(cube, objects, particle_ct, dims, dt, sub_steps)
     if updateStatus == False:
       print('Error! Aborting')
       break
@@ -241,8 +425,8 @@ def main():
 c = ct.CDLL('./python_integration/fast_collisionMath.so')
 
 # Returns the number of partitions on each axis
-c.mapSize.restype = ct.c_int
-c.mapSize.argtypes = [ct.POINTER(Object), ct.c_double]
+c.mapSize.restype = Int3
+c.mapSize.argtypes = [ct.POINTER(Object), ct.c_int, Cube]
 
 # Return and arg types of initializeObjects (c func will be a python representation of the c type)
 c.initializeObjects.restype = ct.POINTER(Object)
@@ -251,9 +435,38 @@ c.initializeObjects.argtypes = [ct.c_int, ct.c_double]
 c.read_positions.restype = ct.POINTER(Vec3)
 c.read_positions.argtypes = [ct.POINTER(Object), ct.c_int]
 
+# Zero-copy views of object fields and bulk setters taking contiguous (n, 3) float64 arrays
+for view in (c.position_view, c.velocity_view, c.acceleration_view):
+  view.restype = ArrayView
+  view.argtypes = [ct.POINTER(Object), ct.c_int]
+
+c.set_positions.argtypes = [ct.POINTER(Object), ct.c_int, np.ctypeslib.ndpointer(np.float64, flags='C_CONTIGUOUS')]
+c.set_velocities.argtypes = [ct.POINTER(Object), ct.c_int, np.ctypeslib.ndpointer(np.float64, flags='C_CONTIGUOUS')]
+
 # int updateCall(Map **map[], const Cube cube, Object objects[], const int particle_ct, const double dt, const int sub_steps)
 c.updateCall.restype = ct.c_int
-c.updateCall.argtypes = [Cube, ct.POINTER(Object), ct.c_int, ct.c_int, ct.c_double, ct.c_int]
+c.updateCall.argtypes = [Cube, ct.POINTER(Object), ct.c_int, Int3, ct.c_double, ct.c_int]
+
+# Instanced rendering: one shared sphere mesh, instance buffer filled from particle state
+c.createSphereMesh.restype = ct.POINTER(SphereMesh)
+c.createSphereMesh.argtypes = [ct.c_int, ct.c_int]
+c.destroy_sphereMesh.argtypes = [ct.POINTER(SphereMesh)]
+c.fillInstances.restype = ct.c_int
+c.fillInstances.argtypes = [ct.POINTER(Object), ct.c_int, np.ctypeslib.ndpointer(np.float32, flags='C_CONTIGUOUS')]
+c.cullInstances.restype = ct.c_int
+c.cullInstances.argtypes = [ct.POINTER(Object), ct.c_int, Cube, Int3,
+                            np.ctypeslib.ndpointer(np.float32, flags='C_CONTIGUOUS'), ct.c_double,
+                            ct.POINTER(ct.c_double), np.ctypeslib.ndpointer(np.int32, flags='C_CONTIGUOUS'),
+                            np.ctypeslib.ndpointer(np.float32, flags='C_CONTIGUOUS'), ct.POINTER(CullResult)]
+
+# Per-frame collision counters
+c.read_collisionStats.restype = CollisionStats
+c.read_collisionStats.argtypes = []
+
+# Phase timers
+c.get_profile.restype = Profile
+c.get_profile.argtypes = []
+c.reset_profile.argtypes = []
 
 # Print object positions since python + ctypes is finicky with trying to print them in loop
 c.print_positions.argtypes = [ct.POINTER(Object), ct.c_int]
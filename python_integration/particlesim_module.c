@@ -0,0 +1,1075 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stddef.h>
+#include "../include/Geometry.h"
+#include "../include/ImprovedCollision.h"
+#include "../include/Simulation.h"
+#include "../include/Checkpoint.h"
+#include "../include/Packing.h"
+#include "../include/Profile.h"
+#include "../include/Trace.h"
+#include "../include/Alloc.h"
+#include "../include/Octree.h"
+#include "../include/PairForce.h"
+
+/**** Native replacement for the ctypes bridge: one handle, n frames per call, GIL released while stepping ****/
+
+typedef struct {
+  PyObject_HEAD
+  Simulation *sim;
+  int busy;               // Set while a call runs on the handle without the GIL
+  Py_ssize_t exports;     // Live buffers from Field views; they point into objects, which must outlive them
+} SimObject;
+
+/**** (n, 3) float64 buffer aliasing one Vector3 field of the object array ****/
+typedef struct {
+  PyObject_HEAD
+  SimObject *owner;       // Strong ref keeps the objects alive for as long as the view is
+  size_t offset;
+  Py_ssize_t shape[2], strides[2];
+} FieldObject;
+
+static PyTypeObject SimType;
+static PyTypeObject FieldType;
+
+/**** Guards calls that touch the handle: must be initialized and not mid-step on another thread ****/
+static int
+sim_ready(SimObject *self)
+{
+  if (self->sim == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "Simulation is not initialized");
+    return 0;
+  }
+  if (self->busy) {
+    PyErr_SetString(PyExc_RuntimeError, "another call is already running on this simulation");
+    return 0;
+  }
+  return 1;
+}
+
+/**** Buffer protocol: hands numpy the objects array with the Object stride ****/
+static int
+field_getbuffer(PyObject *self, Py_buffer *view, int flags)
+{
+  FieldObject *field = (FieldObject*)self;
+  Simulation *sim = field->owner->sim;
+
+  if (sim == NULL) {
+    PyErr_SetString(PyExc_BufferError, "Simulation is not initialized");
+    return -1;
+  }
+  if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES) {
+    PyErr_SetString(PyExc_BufferError, "particle state is strided; request PyBUF_STRIDES");
+    return -1;
+  }
+
+  field->shape[0] = sim->particle_ct;
+  field->shape[1] = 3;
+  field->strides[0] = sizeof(Object);
+  field->strides[1] = sizeof(double);
+
+  view->buf = (char*)sim->objects + field->offset;
+  view->obj = self;
+  Py_INCREF(self);
+  view->len = (Py_ssize_t)sim->particle_ct * 3 * sizeof(double);
+  view->readonly = 0;
+  view->itemsize = sizeof(double);
+  view->format = (flags & PyBUF_FORMAT) ? "d" : NULL;
+  view->ndim = 2;
+  view->shape = field->shape;
+  view->strides = field->strides;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+  field->owner->exports++;
+  return 0;
+}
+
+static void
+field_releasebuffer(PyObject *self, Py_buffer *view)
+{
+  (void)view;
+  ((FieldObject*)self)->owner->exports--;
+}
+
+static void
+field_dealloc(FieldObject *self)
+{
+  Py_XDECREF(self->owner);
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyBufferProcs field_as_buffer = {field_getbuffer, field_releasebuffer};
+
+static PyTypeObject FieldType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "_particlesim.Field",
+  .tp_basicsize = sizeof(FieldObject),
+  .tp_dealloc = (destructor)field_dealloc,
+  .tp_as_buffer = &field_as_buffer,
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_doc = "Zero-copy (n, 3) float64 view of a particle field; wrap with numpy.asarray",
+};
+
+static PyObject *
+make_field(SimObject *owner, const size_t offset)
+{
+  FieldObject *field;
+
+  if (owner->sim == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "Simulation is not initialized");
+    return NULL;
+  }
+  field = PyObject_New(FieldObject, &FieldType);
+  if (field == NULL) return NULL;
+  Py_INCREF(owner);
+  field->owner = owner;
+  field->offset = offset;
+  return (PyObject*)field;
+}
+
+/**** Simulation(particle_ct, cube_size, radius=0.5, dt=1e-3, sub_steps=8, seed=0, periodic=False,
+ *            box=(cube_size, cube_size, cube_size))
+ * box gives the extents of a non-cubic box, replacing cube_size. Re-initializing frees the old particle state, so
+ * it is refused while a call is running or numpy arrays still view it ****/
+static int
+sim_init(SimObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"particle_ct", "cube_size", "radius", "dt", "sub_steps", "seed", "periodic", "box", NULL};
+  int particle_ct, sub_steps = 8, periodic = 0;
+  double cube_size, radius = 0.5, dt = 1e-3;
+  unsigned long long seed = 0;
+  Vector3 box = {0, 0, 0};
+  Cube cube;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "id|ddiKp(ddd)", kwlist, &particle_ct, &cube_size,
+                                   &radius, &dt, &sub_steps, &seed, &periodic, &box.x, &box.y, &box.z)) {
+    return -1;
+  }
+  if (particle_ct <= 0 || sub_steps <= 0) {
+    PyErr_SetString(PyExc_ValueError, "particle_ct and sub_steps must be positive");
+    return -1;
+  }
+  if (box.x == 0 && box.y == 0 && box.z == 0) box = (Vector3){cube_size, cube_size, cube_size};
+  if (box.x <= 0 || box.y <= 0 || box.z <= 0) {
+    PyErr_SetString(PyExc_ValueError, "box extents must be positive");
+    return -1;
+  }
+
+  if (self->busy) {
+    PyErr_SetString(PyExc_RuntimeError, "another call is already running on this simulation");
+    return -1;
+  }
+  if (self->exports > 0) {
+    PyErr_SetString(PyExc_BufferError, "arrays still view the particle state; release them before re-initializing");
+    return -1;
+  }
+
+  cube = createBox((Vector3){0, 0, 0}, box);
+  cube.periodic = periodic;
+  destroy_simulation(self->sim);
+  self->sim = createSimulation(cube, particle_ct, radius, dt, sub_steps, seed);
+  if (self->sim == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  return 0;
+}
+
+static void
+sim_dealloc(SimObject *self)
+{
+  destroy_simulation(self->sim);
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+/**** step(n=1): runs n frames in C; other Python threads run meanwhile ****/
+static PyObject *
+sim_step(SimObject *self, PyObject *args)
+{
+  int frames = 1, status;
+
+  if (!PyArg_ParseTuple(args, "|i", &frames)) return NULL;
+  if (!sim_ready(self)) return NULL;
+
+  self->busy = 1;
+  Py_BEGIN_ALLOW_THREADS
+  status = stepSimulation(self->sim, frames);
+  Py_END_ALLOW_THREADS
+  self->busy = 0;
+
+  if (!status) {
+    return PyErr_Format(PyExc_RuntimeError, "step failed at frame %llu: out of memory or a failed trajectory write",
+                        (unsigned long long)self->sim->step);
+  }
+  Py_RETURN_NONE;
+}
+
+/**** Copies a (n, 3) float64 buffer into one field; accepts any C-contiguous exporter ****/
+static PyObject *
+set_field(SimObject *self, PyObject *args, const size_t offset)
+{
+  Py_buffer src;
+  const double *xyz;
+  Vector3 *dst;
+
+  if (!sim_ready(self)) return NULL;
+  if (!PyArg_ParseTuple(args, "y*", &src)) return NULL;
+  if (src.len != (Py_ssize_t)self->sim->particle_ct * 3 * (Py_ssize_t)sizeof(double)) {
+    PyBuffer_Release(&src);
+    PyErr_SetString(PyExc_ValueError, "expected particle_ct x 3 float64 values");
+    return NULL;
+  }
+
+  xyz = (const double*)src.buf;
+  for (int i = 0; i < self->sim->particle_ct; i++) {
+    dst = (Vector3*)((char*)&self->sim->objects[i] + offset);
+    (*dst) = (Vector3){xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]};
+  }
+
+  PyBuffer_Release(&src);
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+sim_set_positions(SimObject *self, PyObject *args)
+{
+  return set_field(self, args, offsetof(Object, position));
+}
+
+static PyObject *
+sim_set_velocities(SimObject *self, PyObject *args)
+{
+  return set_field(self, args, offsetof(Object, velocity));
+}
+
+/**** pack(mode=PACK_FCC, jitter=0.0): overlap free initial placement from the run's seed. Returns the count
+ * placed; a saturated RSA keeps fewer particles and warns, unless a trajectory or frame ring holds the count ****/
+static PyObject *
+sim_pack(SimObject *self, PyObject *args)
+{
+  int mode = PACK_FCC, shortfall;
+  double jitter = 0.0;
+
+  if (!sim_ready(self)) return NULL;
+  if (!PyArg_ParseTuple(args, "|id", &mode, &jitter)) return NULL;
+  if (self->exports > 0) {
+    PyErr_SetString(PyExc_BufferError, "arrays still view the particle state; release them before packing");
+    return NULL;
+  }
+
+  self->busy = 1;
+  Py_BEGIN_ALLOW_THREADS
+  shortfall = packSimulation(self->sim, (PackingMode)mode, jitter);
+  Py_END_ALLOW_THREADS
+  self->busy = 0;
+  if (shortfall == -2) {
+    PyErr_SetString(PyExc_RuntimeError, "not every particle fit and a trajectory or frame ring is attached; "
+                                        "the run is unchanged");
+    return NULL;
+  }
+  if (shortfall < 0) {
+    PyErr_SetString(PyExc_ValueError, "particles do not fit the requested lattice");
+    return NULL;
+  }
+  if (shortfall > 0 && PyErr_WarnFormat(PyExc_RuntimeWarning, 1, "only %d of %d particles fit; the run keeps %d",
+                                        self->sim->particle_ct, self->sim->particle_ct + shortfall,
+                                        self->sim->particle_ct) < 0) {
+    return NULL;
+  }
+  return PyLong_FromLong(self->sim->particle_ct);
+}
+
+/**** enable_analysis(interval, rdf_bins=50, rdf_rmax=1.0, density_bins=20) ****/
+static PyObject *
+sim_enable_analysis(SimObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"interval", "rdf_bins", "rdf_rmax", "density_bins", NULL};
+  int interval, rdf_bins = 50, density_bins = 20;
+  double rdf_rmax = 1.0;
+  Analysis *analysis;
+
+  if (!sim_ready(self)) return NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|idi", kwlist, &interval, &rdf_bins, &rdf_rmax, &density_bins)) {
+    return NULL;
+  }
+  if (rdf_bins < 0 || density_bins < 0) {
+    PyErr_SetString(PyExc_ValueError, "rdf_bins and density_bins must not be negative");
+    return NULL;
+  }
+  if (!(rdf_rmax > 0)) {
+    PyErr_SetString(PyExc_ValueError, "rdf_rmax must be positive");
+    return NULL;
+  }
+  analysis = createAnalysis(interval, rdf_bins, rdf_rmax, density_bins);
+  if (analysis == NULL) return PyErr_NoMemory();
+
+  destroy_analysis(self->sim->analysis);
+  self->sim->analysis = analysis;
+  Py_RETURN_NONE;
+}
+
+/**** record_trajectory(path, interval=1, keyframe_interval=32, resolution=1e-4, queue_depth=8): step() hands
+ * every interval'th frame to the background writer. None closes the current file ****/
+static PyObject *
+sim_record_trajectory(SimObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"path", "interval", "keyframe_interval", "resolution", "queue_depth", NULL};
+  const char *path;
+  int interval = 1, keyframe_interval = 32, queue_depth = 8, status = 0;
+  double resolution = 1e-4;
+  TrajectoryWriter *writer = NULL;
+
+  if (!sim_ready(self)) return NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "z|iidi", kwlist, &path, &interval, &keyframe_interval,
+                                   &resolution, &queue_depth)) {
+    return NULL;
+  }
+  if (interval <= 0 || keyframe_interval <= 0 || queue_depth <= 0 || !(resolution > 0)) {
+    PyErr_SetString(PyExc_ValueError, "interval, keyframe_interval, queue_depth and resolution must be positive");
+    return NULL;
+  }
+  if (path != NULL) {
+    writer = openTrajectory(path, self->sim->cube, self->sim->particle_ct, interval, keyframe_interval,
+                            queue_depth, resolution);
+    if (writer == NULL) return PyErr_Format(PyExc_OSError, "could not open trajectory %s", path);
+  }
+
+  if (self->sim->trajectory != NULL) {
+    self->busy = 1;
+    Py_BEGIN_ALLOW_THREADS
+    status = closeTrajectory(self->sim->trajectory);
+    Py_END_ALLOW_THREADS
+    self->busy = 0;
+  }
+  self->sim->trajectory = writer;
+  if (status != 0) {
+    PyErr_SetString(PyExc_OSError, "writing the previous trajectory failed");
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+/**** publish_frames(name, slot_ct=4): step() writes every frame into the shared memory ring /name for viewers in
+ * other processes (layout in SharedFrame.h). None removes the ring ****/
+static PyObject *
+sim_publish_frames(SimObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"name", "slot_ct", NULL};
+  const char *name;
+  int slot_ct = 4;
+  SharedFrames *frames = NULL;
+
+  if (!sim_ready(self)) return NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "z|i", kwlist, &name, &slot_ct)) return NULL;
+  if (slot_ct < 2) {
+    PyErr_SetString(PyExc_ValueError, "slot_ct must be at least 2 so readers can copy one slot while the next fills");
+    return NULL;
+  }
+  if (name != NULL) {
+    frames = openSharedFrames(name, self->sim->particle_ct, slot_ct);
+    if (frames == NULL) return PyErr_Format(PyExc_OSError, "could not create shared memory %s", name);
+  }
+
+  closeSharedFrames(self->sim->frames);
+  self->sim->frames = frames;
+  Py_RETURN_NONE;
+}
+
+/**** enable_gravity(theta=0.5, strength=1.0, softening=0.0, leaf_size=8); theta < 0 detaches it ****/
+static PyObject *
+sim_enable_gravity(SimObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"theta", "strength", "softening", "leaf_size", NULL};
+  double theta = 0.5, strength = 1.0, softening = 0.0;
+  int leaf_size = 8;
+  Octree *gravity = NULL;
+
+  if (!sim_ready(self)) return NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|dddi", kwlist, &theta, &strength, &softening, &leaf_size)) {
+    return NULL;
+  }
+  if (theta >= 0) {
+    gravity = createOctree(theta, strength, softening, leaf_size);
+    if (gravity == NULL) return PyErr_NoMemory();
+  }
+
+  destroy_octree(self->sim->gravity);
+  self->sim->gravity = gravity;
+  Py_RETURN_NONE;
+}
+
+/**** Tree shape and interaction counts from the last substep, or None without gravity ****/
+static PyObject *
+sim_gravity_stats(SimObject *self, PyObject *Py_UNUSED(ignored))
+{
+  const OctreeStats *ts;
+
+  if (!sim_ready(self)) return NULL;
+  if (self->sim->gravity == NULL) Py_RETURN_NONE;
+  ts = &self->sim->gravity->stats;
+  return Py_BuildValue("{s:i,s:i,s:i,s:i,s:K,s:K}",
+                       "nodes", ts->nodes,
+                       "leaves", ts->leaves,
+                       "depth", ts->depth,
+                       "groups", ts->groups,
+                       "cell_interactions", (unsigned long long)ts->cell_interactions,
+                       "pair_interactions", (unsigned long long)ts->pair_interactions);
+}
+
+/**** set_field(kind=FIELD_SPIN, gravity=(-9.81, 0, 0), drag=0.0, stiffness=1.0, center=(5, 5, 5), path_radius=5.0) ****/
+static PyObject *
+sim_set_field(SimObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"kind", "gravity", "drag", "stiffness", "center", "path_radius", NULL};
+  int kind = FIELD_SPIN;
+  ForceField ff = createForceField(FIELD_SPIN);
+
+  if (!sim_ready(self)) return NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i(ddd)dd(ddd)d", kwlist, &kind,
+                                   &ff.gravity.x, &ff.gravity.y, &ff.gravity.z, &ff.drag, &ff.stiffness,
+                                   &ff.center.x, &ff.center.y, &ff.center.z, &ff.path_radius)) return NULL;
+  if (field_kindName(kind) == NULL) {
+    PyErr_SetString(PyExc_ValueError, "kind must be one of the FIELD_* constants");
+    return NULL;
+  }
+  ff.kind = kind;
+  self->sim->forces = ff;
+  Py_RETURN_NONE;
+}
+
+/**** Current external field as a dict ****/
+static PyObject *
+sim_field(SimObject *self, PyObject *Py_UNUSED(ignored))
+{
+  const ForceField *ff;
+
+  if (!sim_ready(self)) return NULL;
+  ff = &self->sim->forces;
+  return Py_BuildValue("{s:s,s:(ddd),s:d,s:d,s:(ddd),s:d}",
+                       "kind", field_kindName(ff->kind),
+                       "gravity", ff->gravity.x, ff->gravity.y, ff->gravity.z,
+                       "drag", ff->drag,
+                       "stiffness", ff->stiffness,
+                       "center", ff->center.x, ff->center.y, ff->center.z,
+                       "path_radius", ff->path_radius);
+}
+
+/**** set_integrator(kind); Verlet recomputes its cached accelerations on the next step ****/
+static PyObject *
+sim_set_integrator(SimObject *self, PyObject *args)
+{
+  int kind;
+
+  if (!sim_ready(self)) return NULL;
+  if (!PyArg_ParseTuple(args, "i", &kind)) return NULL;
+  if (integrator_kindName(kind) == NULL) {
+    PyErr_SetString(PyExc_ValueError, "kind must be INTEGRATOR_MIDSTEP, INTEGRATOR_VERLET or INTEGRATOR_EULER");
+    return NULL;
+  }
+  self->sim->integrator = kind;
+  self->sim->primed = 0;
+  Py_RETURN_NONE;
+}
+
+/**** enable_pairs(kind=PAIR_LJ, epsilon=1.0, sigma=2 * radius, cutoff=0.0); kind < 0 detaches it. A periodic box
+ * under two cutoffs wide is refused, as pairForces would fail every step ****/
+static PyObject *
+sim_enable_pairs(SimObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"kind", "epsilon", "sigma", "cutoff", NULL};
+  int kind = PAIR_LJ;
+  double epsilon = 1.0, sigma = 0.0, cutoff = 0.0;
+  PairForce *pairs = NULL;
+
+  if (!sim_ready(self)) return NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|iddd", kwlist, &kind, &epsilon, &sigma, &cutoff)) return NULL;
+  if (kind >= PAIR_KIND_CT) {
+    PyErr_SetString(PyExc_ValueError, "kind must be PAIR_LJ, PAIR_WCA, PAIR_SOFT or negative");
+    return NULL;
+  }
+  if (sigma <= 0) sigma = 2.0 * self->sim->objects[0].radius;
+  if (kind >= 0) {
+    pairs = createPairForce(kind, epsilon, sigma, cutoff);
+    if (pairs == NULL) return PyErr_NoMemory();
+    if (!pair_fitsCube(pairs, self->sim->cube)) {
+      PyErr_SetString(PyExc_ValueError, "a periodic box must be at least two cutoffs wide along every axis");
+      destroy_pairForce(pairs);
+      return NULL;
+    }
+  }
+
+  destroy_pairForce(self->sim->pairs);
+  self->sim->pairs = pairs;
+  Py_RETURN_NONE;
+}
+
+/**** Energy, virial and pair counts from the last substep, or None without a pair potential ****/
+static PyObject *
+sim_pair_stats(SimObject *self, PyObject *Py_UNUSED(ignored))
+{
+  const PairForce *pf;
+
+  if (!sim_ready(self)) return NULL;
+  pf = self->sim->pairs;
+  if (pf == NULL) Py_RETURN_NONE;
+  return Py_BuildValue("{s:s,s:d,s:d,s:d,s:K,s:K}",
+                       "kind", pair_kindName(pf->kind),
+                       "cutoff", pf->cutoff,
+                       "potential", pf->potential,
+                       "virial", pf->virial,
+                       "pairs_tested", (unsigned long long)pf->pairs_tested,
+                       "pairs_in_range", (unsigned long long)pf->pairs_in_range);
+}
+
+/**** enable_contacts(kn, restitution=0.5, friction=0.5, kt=0.0); kn <= 0 detaches them ****/
+static PyObject *
+sim_enable_contacts(SimObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"kn", "restitution", "friction", "kt", NULL};
+  double kn, restitution = 0.5, friction = 0.5, kt = 0.0;
+  ContactModel *contacts = NULL;
+
+  if (!sim_ready(self)) return NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "d|ddd", kwlist, &kn, &restitution, &friction, &kt)) return NULL;
+  if (kn > 0 && (restitution > 1 || friction < 0)) {
+    PyErr_SetString(PyExc_ValueError, "restitution must be at most 1 and friction non-negative");
+    return NULL;
+  }
+  if (kn > 0) {
+    contacts = createContactModel(kn, kt, restitution, friction);
+    if (contacts == NULL) return PyErr_NoMemory();
+  }
+
+  destroy_contactModel(self->sim->contacts);
+  self->sim->contacts = contacts;
+  Py_RETURN_NONE;
+}
+
+/**** Contact counters from the last substep, or None without contacts ****/
+static PyObject *
+sim_contact_stats(SimObject *self, PyObject *Py_UNUSED(ignored))
+{
+  const ContactModel *cm;
+
+  if (!sim_ready(self)) return NULL;
+  cm = self->sim->contacts;
+  if (cm == NULL) Py_RETURN_NONE;
+  return Py_BuildValue("{s:d,s:d,s:d,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:d}",
+                       "kn", cm->kn,
+                       "kt", cm->kt,
+                       "collision_time", contact_time(cm, self->sim->objects[0].mass / 2),
+                       "pairs_tested", (unsigned long long)cm->stats.pairs_tested,
+                       "contacts", (unsigned long long)cm->stats.contacts,
+                       "wall_contacts", (unsigned long long)cm->stats.wall_contacts,
+                       "mesh_contacts", (unsigned long long)cm->stats.mesh_contacts,
+                       "sliding", (unsigned long long)cm->stats.sliding,
+                       "continued", (unsigned long long)cm->stats.continued,
+                       "dropped", (unsigned long long)cm->stats.dropped,
+                       "max_overlap", cm->stats.max_overlap);
+}
+
+/**** load_obstacles(path, scale=1.0, offset=(0, 0, 0)); None detaches the mesh ****/
+static PyObject *
+sim_load_obstacles(SimObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"path", "scale", "offset", NULL};
+  const char *path;
+  double scale = 1.0;
+  Vector3 offset = {0, 0, 0};
+  int status = 0;
+  TriangleMesh *mesh = NULL;
+
+  if (!sim_ready(self)) return NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "z|d(ddd)", kwlist, &path, &scale,
+                                   &offset.x, &offset.y, &offset.z)) return NULL;
+  if (scale <= 0) {
+    PyErr_SetString(PyExc_ValueError, "scale must be positive");
+    return NULL;
+  }
+  if (path != NULL) {
+    Py_BEGIN_ALLOW_THREADS
+    mesh = load_triangleMesh(path, &status);
+    Py_END_ALLOW_THREADS
+    if (mesh == NULL) {
+      return PyErr_Format(status == 2 ? PyExc_ValueError : PyExc_OSError, "could not load mesh %s", path);
+    }
+    transformMesh(mesh, scale, offset);
+  }
+
+  destroy_triangleMesh(self->sim->obstacles);
+  self->sim->obstacles = mesh;
+  Py_RETURN_NONE;
+}
+
+/**** Obstacle mesh size and counters from the last substep, or None without one ****/
+static PyObject *
+sim_obstacle_stats(SimObject *self, PyObject *Py_UNUSED(ignored))
+{
+  const TriangleMesh *mesh;
+
+  if (!sim_ready(self)) return NULL;
+  mesh = self->sim->obstacles;
+  if (mesh == NULL) Py_RETURN_NONE;
+  return Py_BuildValue("{s:i,s:i,s:i,s:K,s:K,s:K,s:K,s:K}",
+                       "triangles", mesh->triangle_ct,
+                       "nodes", mesh->node_ct,
+                       "depth", mesh->depth,
+                       "queries", (unsigned long long)mesh->stats.queries,
+                       "nodes_visited", (unsigned long long)mesh->stats.nodes_visited,
+                       "triangles_tested", (unsigned long long)mesh->stats.triangles_tested,
+                       "contacts", (unsigned long long)mesh->stats.contacts,
+                       "dropped", (unsigned long long)mesh->stats.dropped);
+}
+
+/**** add_shape(kind, a, b=(0, 0, 0), radius=0.0, op=SHAPE_UNION): appends to the container the walls keep
+ * particles in; clear_container() first to replace the cube ****/
+static PyObject *
+sim_add_shape(SimObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {"kind", "a", "b", "radius", "op", NULL};
+  Shape shape = {0};
+
+  if (!sim_ready(self)) return NULL;
+  shape.op = SHAPE_UNION;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "i(ddd)|(ddd)di", kwlist, &shape.kind, &shape.a.x, &shape.a.y,
+                                   &shape.a.z, &shape.b.x, &shape.b.y, &shape.b.z, &shape.radius, &shape.op)) {
+    return NULL;
+  }
+  if (addShape(&self->sim->container, shape) != 0) {
+    PyErr_SetString(PyExc_ValueError, "container is full, or the shape's kind, op or size is invalid");
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+/**** Removes every shape, cube walls included; nothing confines the particles until shapes are added ****/
+static PyObject *
+sim_clear_container(SimObject *self, PyObject *Py_UNUSED(ignored))
+{
+  if (!sim_ready(self)) return NULL;
+  self->sim->container.shape_ct = 0;
+  Py_RETURN_NONE;
+}
+
+/**** Container shapes in order as a list of dicts ****/
+static PyObject *
+sim_container(SimObject *self, PyObject *Py_UNUSED(ignored))
+{
+  const Container *container;
+  PyObject *list;
+
+  if (!sim_ready(self)) return NULL;
+  container = &self->sim->container;
+  list = PyList_New(container->shape_ct);
+  if (list == NULL) return NULL;
+  for (int i = 0; i < container->shape_ct; i++) {
+    const Shape *s = &container->shapes[i];
+    PyObject *item = Py_BuildValue("{s:s,s:i,s:(ddd),s:(ddd),s:d}",
+                                   "kind", shape_kindName(s->kind),
+                                   "op", s->op,
+                                   "a", s->a.x, s->a.y, s->a.z,
+                                   "b", s->b.x, s->b.y, s->b.z,
+                                   "radius", s->radius);
+    if (item == NULL) {
+      Py_DECREF(list);
+      return NULL;
+    }
+    PyList_SET_ITEM(list, i, item);
+  }
+  return list;
+}
+
+/**** Copies the latest sample out into a dict; the buffers are tiny ****/
+static PyObject *
+doubles_to_list(const double values[], const int count)
+{
+  PyObject *list = PyList_New(count);
+  if (list == NULL) return NULL;
+  for (int i = 0; i < count; i++) {
+    PyList_SET_ITEM(list, i, PyFloat_FromDouble(values[i]));
+  }
+  return list;
+}
+
+static PyObject *
+sim_analysis(SimObject *self, PyObject *Py_UNUSED(ignored))
+{
+  const Analysis *a;
+
+  if (!sim_ready(self)) return NULL;
+  a = self->sim->analysis;
+  if (a == NULL || a->samples == 0) Py_RETURN_NONE;
+
+  return Py_BuildValue("{s:K,s:d,s:(ddd),s:N,s:N}",
+                       "frame", (unsigned long long)a->last_step,
+                       "kinetic", a->kinetic,
+                       "kinetic_axis", a->kinetic_axis[0], a->kinetic_axis[1], a->kinetic_axis[2],
+                       "rdf", doubles_to_list(a->rdf, a->rdf_bins),
+                       "density", doubles_to_list(a->density, a->density_bins));
+}
+
+/**** collisionCall counters and container wall hits summed over the substeps of the last frame ****/
+static PyObject *
+sim_collision_stats(SimObject *self, PyObject *Py_UNUSED(ignored))
+{
+  const CollisionStats *cs;
+  PyObject *histogram;
+
+  if (!sim_ready(self)) return NULL;
+  cs = &self->sim->collision;
+  histogram = PyList_New(OCCUPANCY_BINS);
+  if (histogram == NULL) return NULL;
+  for (int b = 0; b < OCCUPANCY_BINS; b++) {
+    PyList_SET_ITEM(histogram, b, PyLong_FromUnsignedLongLong(cs->occupancy[b]));
+  }
+
+  return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:i,s:d,s:N}",
+                       "pairs_tested", (unsigned long long)cs->pairs_tested,
+                       "contacts", (unsigned long long)cs->contacts,
+                       "wall_hits", (unsigned long long)cs->wall_hits,
+                       "empty_visits", (unsigned long long)cs->empty_visits,
+                       "cells", (unsigned long long)cs->cells,
+                       "occupied_cells", (unsigned long long)cs->occupied_cells,
+                       "max_occupancy", cs->max_occupancy,
+                       "mean_occupancy", cs->mean_occupancy,
+                       "occupancy", histogram);
+}
+
+static PyObject *
+sim_save(SimObject *self, PyObject *args)
+{
+  const char *path;
+  int status;
+
+  if (!sim_ready(self)) return NULL;
+  if (!PyArg_ParseTuple(args, "s", &path)) return NULL;
+  self->busy = 1;
+  Py_BEGIN_ALLOW_THREADS
+  status = save_checkpoint(self->sim, path);
+  Py_END_ALLOW_THREADS
+  self->busy = 0;
+  if (status != 0) return PyErr_Format(PyExc_OSError, "could not write checkpoint %s", path);
+  Py_RETURN_NONE;
+}
+
+/**** Simulation.load(path): resumes from a checkpoint written by save() ****/
+static PyObject *
+sim_load(PyObject *cls, PyObject *args)
+{
+  const char *path;
+  int status = 0;
+  SimObject *self;
+  Simulation *sim;
+
+  if (!PyArg_ParseTuple(args, "s", &path)) return NULL;
+  sim = load_checkpoint(path, &status);
+  if (sim == NULL) {
+    return PyErr_Format(status == 2 ? PyExc_ValueError : PyExc_OSError,
+                        "could not load checkpoint %s", path);
+  }
+
+  self = (SimObject*)((PyTypeObject*)cls)->tp_alloc((PyTypeObject*)cls, 0);
+  if (self == NULL) {
+    destroy_simulation(sim);
+    return NULL;
+  }
+  self->sim = sim;
+  return (PyObject*)self;
+}
+
+static PyObject *
+sim_get_positions(SimObject *self, void *closure)
+{
+  (void)closure;
+  return make_field(self, offsetof(Object, position));
+}
+
+static PyObject *
+sim_get_velocities(SimObject *self, void *closure)
+{
+  (void)closure;
+  return make_field(self, offsetof(Object, velocity));
+}
+
+static PyObject *
+sim_get_accelerations(SimObject *self, void *closure)
+{
+  (void)closure;
+  return make_field(self, offsetof(Object, acceleration));
+}
+
+static PyObject *
+sim_get_time(SimObject *self, void *closure)
+{
+  (void)closure;
+  if (self->sim == NULL) Py_RETURN_NONE;
+  return PyFloat_FromDouble(self->sim->time);
+}
+
+static PyObject *
+sim_get_frame(SimObject *self, void *closure)
+{
+  (void)closure;
+  if (self->sim == NULL) Py_RETURN_NONE;
+  return PyLong_FromUnsignedLongLong(self->sim->step);
+}
+
+static PyObject *
+sim_get_particle_ct(SimObject *self, void *closure)
+{
+  (void)closure;
+  if (self->sim == NULL) Py_RETURN_NONE;
+  return PyLong_FromLong(self->sim->particle_ct);
+}
+
+static PyObject *
+sim_get_frame_allocs(SimObject *self, void *closure)
+{
+  (void)closure;
+  if (self->sim == NULL) Py_RETURN_NONE;
+  return PyLong_FromUnsignedLongLong(self->sim->frame_allocs);
+}
+
+static PyMethodDef sim_methods[] = {
+  {"step", (PyCFunction)sim_step, METH_VARARGS, "step(n=1): advance n frames with the GIL released"},
+  {"set_positions", (PyCFunction)sim_set_positions, METH_VARARGS, "Copy an (n, 3) float64 array into positions"},
+  {"set_velocities", (PyCFunction)sim_set_velocities, METH_VARARGS, "Copy an (n, 3) float64 array into velocities"},
+  {"pack", (PyCFunction)sim_pack, METH_VARARGS, "pack(mode=PACK_FCC, jitter=0.0): place particles without overlaps"},
+  {"enable_analysis", (PyCFunction)(void(*)(void))sim_enable_analysis, METH_VARARGS | METH_KEYWORDS,
+   "enable_analysis(interval, rdf_bins=50, rdf_rmax=1.0, density_bins=20): sample every interval frames"},
+  {"analysis", (PyCFunction)sim_analysis, METH_NOARGS, "Latest in-situ sample as a dict, or None"},
+  {"enable_gravity", (PyCFunction)(void(*)(void))sim_enable_gravity, METH_VARARGS | METH_KEYWORDS,
+   "enable_gravity(theta=0.5, strength=1.0, softening=0.0, leaf_size=8): Barnes-Hut pair force, theta < 0 removes it"},
+  {"gravity_stats", (PyCFunction)sim_gravity_stats, METH_NOARGS, "Octree counters from the last substep, or None"},
+  {"set_field", (PyCFunction)(void(*)(void))sim_set_field, METH_VARARGS | METH_KEYWORDS,
+   "set_field(kind=FIELD_SPIN, gravity=(-9.81, 0, 0), drag=0.0, stiffness=1.0, center=(5, 5, 5), path_radius=5.0)"},
+  {"field", (PyCFunction)sim_field, METH_NOARGS, "External force field parameters as a dict"},
+  {"set_integrator", (PyCFunction)sim_set_integrator, METH_VARARGS,
+   "set_integrator(kind): INTEGRATOR_MIDSTEP (default), INTEGRATOR_VERLET or INTEGRATOR_EULER"},
+  {"enable_pairs", (PyCFunction)(void(*)(void))sim_enable_pairs, METH_VARARGS | METH_KEYWORDS,
+   "enable_pairs(kind=PAIR_LJ, epsilon=1.0, sigma=2*radius, cutoff=0.0): short-range potential, kind < 0 removes it; "
+   "ValueError if a periodic box is under two cutoffs wide"},
+  {"pair_stats", (PyCFunction)sim_pair_stats, METH_NOARGS, "Pair potential energy, virial and counts, or None"},
+  {"enable_contacts", (PyCFunction)(void(*)(void))sim_enable_contacts, METH_VARARGS | METH_KEYWORDS,
+   "enable_contacts(kn, restitution=0.5, friction=0.5, kt=2/7 kn): DEM contacts instead of collisions, kn <= 0 removes them"},
+  {"contact_stats", (PyCFunction)sim_contact_stats, METH_NOARGS, "Contact counters from the last substep, or None"},
+  {"load_obstacles", (PyCFunction)(void(*)(void))sim_load_obstacles, METH_VARARGS | METH_KEYWORDS,
+   "load_obstacles(path, scale=1.0, offset=(0, 0, 0)): static OBJ or STL mesh, scaled then moved; None removes it"},
+  {"obstacle_stats", (PyCFunction)sim_obstacle_stats, METH_NOARGS, "Obstacle mesh size and counters, or None"},
+  {"record_trajectory", (PyCFunction)(void(*)(void))sim_record_trajectory, METH_VARARGS | METH_KEYWORDS,
+   "record_trajectory(path, interval=1, keyframe_interval=32, resolution=1e-4, queue_depth=8): None closes it"},
+  {"publish_frames", (PyCFunction)(void(*)(void))sim_publish_frames, METH_VARARGS | METH_KEYWORDS,
+   "publish_frames(name, slot_ct=4): every frame into a POSIX shared memory ring; None removes it"},
+  {"add_shape", (PyCFunction)(void(*)(void))sim_add_shape, METH_VARARGS | METH_KEYWORDS,
+   "add_shape(kind, a, b=(0, 0, 0), radius=0.0, op=SHAPE_UNION): SHAPE_BOX, SHAPE_SPHERE, SHAPE_CYLINDER, ..."},
+  {"clear_container", (PyCFunction)sim_clear_container, METH_NOARGS, "Remove every container shape, walls included"},
+  {"container", (PyCFunction)sim_container, METH_NOARGS, "Container shapes as a list of dicts"},
+  {"collision_stats", (PyCFunction)sim_collision_stats, METH_NOARGS,
+   "Pair, contact, wall and bucket occupancy counters of the last frame"},
+  {"save", (PyCFunction)sim_save, METH_VARARGS, "save(path): write a binary checkpoint"},
+  {"load", (PyCFunction)sim_load, METH_VARARGS | METH_CLASS, "load(path): resume from a checkpoint"},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef sim_getset[] = {
+  {"positions", (getter)sim_get_positions, NULL, "Zero-copy (n, 3) positions", NULL},
+  {"velocities", (getter)sim_get_velocities, NULL, "Zero-copy (n, 3) velocities", NULL},
+  {"accelerations", (getter)sim_get_accelerations, NULL, "Zero-copy (n, 3) accelerations", NULL},
+  {"time", (getter)sim_get_time, NULL, "Simulation clock", NULL},
+  {"frame", (getter)sim_get_frame, NULL, "Frames completed", NULL},
+  {"particle_ct", (getter)sim_get_particle_ct, NULL, "Number of particles", NULL},
+  {"frame_allocs", (getter)sim_get_frame_allocs, NULL, "Tracked allocations during the last frame", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject SimType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "_particlesim.Simulation",
+  .tp_basicsize = sizeof(SimObject),
+  .tp_dealloc = (destructor)sim_dealloc,
+  .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+  .tp_doc = "Simulation(particle_ct, cube_size, radius=0.5, dt=1e-3, sub_steps=8, seed=0, periodic=False, "
+            "box=(cube_size, cube_size, cube_size))",
+  .tp_methods = sim_methods,
+  .tp_getset = sim_getset,
+  .tp_init = (initproc)sim_init,
+  .tp_new = PyType_GenericNew,
+};
+
+/**** {phase: {"seconds", "calls", "ticks"}}; empty when built without PROFILE=1 ****/
+static PyObject *
+module_get_profile(PyObject *module, PyObject *unused)
+{
+  Profile profile = get_profile();
+  PyObject *result = PyDict_New(), *entry;
+  (void)module;
+  (void)unused;
+
+  if (result == NULL || !profile.enabled) return result;
+  for (int p = 0; p < PHASE_CT; p++) {
+    entry = Py_BuildValue("{s:d,s:K,s:K}",
+                          "seconds", profile.phase[p].ticks / profile.ticks_per_second,
+                          "calls", (unsigned long long)profile.phase[p].calls,
+                          "ticks", (unsigned long long)profile.phase[p].ticks);
+    if (entry == NULL || PyDict_SetItemString(result, profile_phaseName(p), entry) < 0) {
+      Py_XDECREF(entry);
+      Py_DECREF(result);
+      return NULL;
+    }
+    Py_DECREF(entry);
+  }
+  return result;
+}
+
+/**** {tag: {"allocs", "frees", "live_bytes", "peak_bytes"}} plus "total" ****/
+static PyObject *
+alloc_entry(const AllocCounter *c)
+{
+  return Py_BuildValue("{s:K,s:K,s:L,s:L}", "allocs", (unsigned long long)c->allocs,
+                       "frees", (unsigned long long)c->frees, "live_bytes", (long long)c->live_bytes,
+                       "peak_bytes", (long long)c->peak_bytes);
+}
+
+static PyObject *
+module_get_alloc_stats(PyObject *module, PyObject *unused)
+{
+  const AllocStats stats = get_allocStats();
+  PyObject *result = PyDict_New(), *entry;
+  (void)module;
+  (void)unused;
+
+  if (result == NULL) return NULL;
+  for (int t = 0; t <= ALLOC_TAG_CT; t++) {
+    entry = alloc_entry((t < ALLOC_TAG_CT) ? &stats.tag[t] : &stats.total);
+    if (entry == NULL || PyDict_SetItemString(result, (t < ALLOC_TAG_CT) ? alloc_tagName(t) : "total", entry) < 0) {
+      Py_XDECREF(entry);
+      Py_DECREF(result);
+      return NULL;
+    }
+    Py_DECREF(entry);
+  }
+  return result;
+}
+
+static PyObject *
+module_reset_profile(PyObject *module, PyObject *unused)
+{
+  (void)module;
+  (void)unused;
+  reset_profile();
+  Py_RETURN_NONE;
+}
+
+/**** start_trace(path=None, events_per_thread=1 << 20): path, if given, is written at interpreter exit ****/
+static PyObject *
+module_start_trace(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+  static char *kwlist[] = {"path", "events_per_thread", NULL};
+  const char *path = NULL;
+  Py_ssize_t events = 1 << 20;
+  (void)module;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|zn", kwlist, &path, &events)) return NULL;
+  if (events <= 0) {
+    PyErr_SetString(PyExc_ValueError, "events_per_thread must be positive");
+    return NULL;
+  }
+  if (startTrace((size_t)events, path) != 0) return PyErr_NoMemory();
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+module_dump_trace(PyObject *module, PyObject *args)
+{
+  const char *path;
+  (void)module;
+
+  if (!PyArg_ParseTuple(args, "s", &path)) return NULL;
+  if (trace_active == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "tracing is not running");
+    return NULL;
+  }
+  if (dumpTrace(path) != 0) return PyErr_Format(PyExc_OSError, "could not write trace %s", path);
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+module_stop_trace(PyObject *module, PyObject *unused)
+{
+  (void)module;
+  (void)unused;
+  stopTrace();
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef module_methods[] = {
+  {"get_profile", module_get_profile, METH_NOARGS, "Per-phase engine timings since the last reset_profile()"},
+  {"reset_profile", module_reset_profile, METH_NOARGS, "Zero the per-phase timers"},
+  {"get_alloc_stats", module_get_alloc_stats, METH_NOARGS, "Tracked engine allocations per subsystem"},
+  {"start_trace", (PyCFunction)(void(*)(void))module_start_trace, METH_VARARGS | METH_KEYWORDS,
+   "start_trace(path=None, events_per_thread=1 << 20): record a per-thread timeline"},
+  {"dump_trace", module_dump_trace, METH_VARARGS, "dump_trace(path): write Chrome trace JSON"},
+  {"stop_trace", module_stop_trace, METH_NOARGS, "Stop recording and free the buffers"},
+  {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef particlesim_module = {
+  PyModuleDef_HEAD_INIT,
+  "_particlesim",
+  "Native particle simulation handle",
+  -1,
+  module_methods, NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC
+PyInit__particlesim(void)
+{
+  PyObject *module;
+
+  if (PyType_Ready(&SimType) < 0 || PyType_Ready(&FieldType) < 0) return NULL;
+
+  module = PyModule_Create(&particlesim_module);
+  if (module == NULL) return NULL;
+
+  Py_INCREF(&SimType);
+  if (PyModule_AddObject(module, "Simulation", (PyObject*)&SimType) < 0) {
+    Py_DECREF(&SimType);
+    Py_DECREF(module);
+    return NULL;
+  }
+  if (PyModule_AddIntConstant(module, "PACK_UNIFORM", PACK_UNIFORM) < 0
+      || PyModule_AddIntConstant(module, "PACK_SC", PACK_SC) < 0
+      || PyModule_AddIntConstant(module, "PACK_FCC", PACK_FCC) < 0
+      || PyModule_AddIntConstant(module, "PACK_RSA", PACK_RSA) < 0
+      || PyModule_AddIntConstant(module, "PAIR_LJ", PAIR_LJ) < 0
+      || PyModule_AddIntConstant(module, "PAIR_WCA", PAIR_WCA) < 0
+      || PyModule_AddIntConstant(module, "PAIR_SOFT", PAIR_SOFT) < 0) {
+    Py_DECREF(module);
+    return NULL;
+  }
+#define FIELD_CONSTANT(kind, suffix, name)                                \
+  if (PyModule_AddIntConstant(module, #kind, kind) < 0) {                 \
+    Py_DECREF(module);                                                    \
+    return NULL;                                                          \
+  }
+  FORCE_FIELDS(FIELD_CONSTANT)
+#undef FIELD_CONSTANT
+  if (PyModule_AddIntConstant(module, "INTEGRATOR_MIDSTEP", INTEGRATOR_MIDSTEP) < 0
+      || PyModule_AddIntConstant(module, "INTEGRATOR_VERLET", INTEGRATOR_VERLET) < 0
+      || PyModule_AddIntConstant(module, "INTEGRATOR_EULER", INTEGRATOR_EULER) < 0) {
+    Py_DECREF(module);
+    return NULL;
+  }
+  if (PyModule_AddIntConstant(module, "SHAPE_BOX", SHAPE_BOX) < 0
+      || PyModule_AddIntConstant(module, "SHAPE_SPHERE", SHAPE_SPHERE) < 0
+      || PyModule_AddIntConstant(module, "SHAPE_CYLINDER", SHAPE_CYLINDER) < 0
+      || PyModule_AddIntConstant(module, "SHAPE_CAPSULE", SHAPE_CAPSULE) < 0
+      || PyModule_AddIntConstant(module, "SHAPE_PLANE", SHAPE_PLANE) < 0
+      || PyModule_AddIntConstant(module, "SHAPE_UNION", SHAPE_UNION) < 0
+      || PyModule_AddIntConstant(module, "SHAPE_INTERSECT", SHAPE_INTERSECT) < 0
+      || PyModule_AddIntConstant(module, "SHAPE_SUBTRACT", SHAPE_SUBTRACT) < 0) {
+    Py_DECREF(module);
+    return NULL;
+  }
+  return module;
+}
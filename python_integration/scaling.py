@@ -0,0 +1,59 @@
+# Imports
+import sys
+import numpy as np
+import matplotlib.pyplot as plt
+
+# Plots the CSV written by ./particlesim_bench -m strong|weak -c scaling.csv
+# Usage: python python_integration/scaling.py scaling.csv [more.csv ...]
+paths = sys.argv[1:] if len(sys.argv) > 1 else ['scaling.csv']
+
+plt.figure(figsize=(12, 8))
+for path in paths:
+  data = np.genfromtxt(path, delimiter=',', names=True, dtype=None, encoding='utf-8')
+  data = np.atleast_1d(data)
+  mode = data['mode'][0]
+
+  # One curve per problem size; weak runs are keyed by particles per thread
+  keys = data['particle_ct'] // data['threads'] if mode == 'weak' else data['particle_ct']
+  for key in np.unique(keys):
+    run = data[keys == key]
+    label = f'{mode} {key} / thread' if mode == 'weak' else f'{mode} n={key}'
+
+    plt.subplot(2, 2, 1)
+    plt.plot(run['threads'], run['steps_per_sec'], marker='o', label=label)
+
+    plt.subplot(2, 2, 2)
+    plt.plot(run['threads'], run['particle_updates_per_sec'], marker='o', label=label)
+
+    plt.subplot(2, 2, 3)
+    plt.plot(run['threads'], run['efficiency'], marker='o', label=label)
+
+    plt.subplot(2, 2, 4)
+    plt.plot(run['particle_ct'], run['bytes_per_particle'], marker='o', label=label)
+
+plt.subplot(2, 2, 1)
+plt.title('Steps per Second')
+plt.xlabel('Threads')
+plt.ylabel('Steps/s')
+plt.legend()
+
+plt.subplot(2, 2, 2)
+plt.title('Particle Updates per Second')
+plt.xlabel('Threads')
+plt.ylabel('Updates/s')
+plt.yscale('log')
+
+plt.subplot(2, 2, 3)
+plt.title('Parallel Efficiency')
+plt.xlabel('Threads')
+plt.ylabel('Efficiency')
+plt.ylim(0, 1.1)
+
+plt.subplot(2, 2, 4)
+plt.title('Memory per Particle')
+plt.xlabel('Particles')
+plt.ylabel('Bytes')
+plt.xscale('log')
+
+plt.tight_layout()
+plt.show()
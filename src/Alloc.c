@@ -0,0 +1,146 @@
+#include <string.h>
+#include "../include/Alloc.h"
+
+/**** Size and tag in front of every block; the union keeps the payload aligned like malloc's ****/
+typedef union {
+  struct {
+    size_t size;
+    int tag;
+  } info;
+  long double align;
+} AllocHeader;
+
+static AllocCounter counters[ALLOC_TAG_CT];
+static AllocCounter total;
+
+static const char *tag_names[ALLOC_TAG_CT] = {
+  "map", "simulation", "analysis", "packing", "io", "render", "octree", "forces", "mesh"
+};
+
+static void
+raise_peak(int64_t *peak, const int64_t live)
+{
+  int64_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+  while (live > seen && !__atomic_compare_exchange_n(peak, &seen, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+static void
+charge(const int tag, const int64_t bytes)
+{
+  int64_t live;
+
+  __atomic_fetch_add(&counters[tag].allocs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&total.allocs, 1, __ATOMIC_RELAXED);
+  live = __atomic_add_fetch(&counters[tag].live_bytes, bytes, __ATOMIC_RELAXED);
+  raise_peak(&counters[tag].peak_bytes, live);
+  live = __atomic_add_fetch(&total.live_bytes, bytes, __ATOMIC_RELAXED);
+  raise_peak(&total.peak_bytes, live);
+}
+
+static void
+refund(const int tag, const int64_t bytes)
+{
+  __atomic_fetch_add(&counters[tag].frees, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&total.frees, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_sub(&counters[tag].live_bytes, bytes, __ATOMIC_RELAXED);
+  __atomic_fetch_sub(&total.live_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void *
+tracked_malloc(const size_t size, const int tag)
+{
+  AllocHeader *header = (AllocHeader*)malloc(sizeof(AllocHeader) + size);
+
+  if (header == NULL) {
+    fprintf(stderr, "Memory allocation failed (%zu bytes, %s)\n", size, alloc_tagName(tag));
+    return NULL;
+  }
+  header->info.size = size;
+  header->info.tag = tag;
+  charge(tag, (int64_t)size);
+  return header + 1;
+}
+
+void *
+tracked_calloc(const size_t count, const size_t size, const int tag)
+{
+  void *mem;
+
+  if (size != 0 && count > SIZE_MAX / size) return NULL;
+  mem = tracked_malloc(count * size, tag);
+  if (mem != NULL) memset(mem, 0, count * size);
+  return mem;
+}
+
+/**** Counted as a free of the old block and an allocation of the new one ****/
+void *
+tracked_realloc(void *ptr, const size_t size, const int tag)
+{
+  AllocHeader *header, *grown;
+  size_t old_size;
+
+  if (ptr == NULL) return tracked_malloc(size, tag);
+  header = (AllocHeader*)ptr - 1;
+  old_size = header->info.size;
+  grown = (AllocHeader*)realloc(header, sizeof(AllocHeader) + size);
+  if (grown == NULL) return NULL;
+
+  refund(grown->info.tag, (int64_t)old_size);
+  grown->info.size = size;
+  grown->info.tag = tag;
+  charge(tag, (int64_t)size);
+  return grown + 1;
+}
+
+void
+tracked_free(void *ptr)
+{
+  AllocHeader *header;
+
+  if (ptr == NULL) return;
+  header = (AllocHeader*)ptr - 1;
+  refund(header->info.tag, (int64_t)header->info.size);
+  free(header);
+}
+
+AllocStats
+get_allocStats(void)
+{
+  AllocStats stats;
+
+  for (int t = 0; t < ALLOC_TAG_CT; t++) {
+    stats.tag[t].allocs = __atomic_load_n(&counters[t].allocs, __ATOMIC_RELAXED);
+    stats.tag[t].frees = __atomic_load_n(&counters[t].frees, __ATOMIC_RELAXED);
+    stats.tag[t].live_bytes = __atomic_load_n(&counters[t].live_bytes, __ATOMIC_RELAXED);
+    stats.tag[t].peak_bytes = __atomic_load_n(&counters[t].peak_bytes, __ATOMIC_RELAXED);
+  }
+  stats.total.allocs = __atomic_load_n(&total.allocs, __ATOMIC_RELAXED);
+  stats.total.frees = __atomic_load_n(&total.frees, __ATOMIC_RELAXED);
+  stats.total.live_bytes = __atomic_load_n(&total.live_bytes, __ATOMIC_RELAXED);
+  stats.total.peak_bytes = __atomic_load_n(&total.peak_bytes, __ATOMIC_RELAXED);
+  return stats;
+}
+
+uint64_t
+alloc_count(void)
+{
+  return __atomic_load_n(&total.allocs, __ATOMIC_RELAXED);
+}
+
+void
+reset_allocPeak(void)
+{
+  for (int t = 0; t < ALLOC_TAG_CT; t++) {
+    __atomic_store_n(&counters[t].peak_bytes, __atomic_load_n(&counters[t].live_bytes, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&total.peak_bytes, __atomic_load_n(&total.live_bytes, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+const char *
+alloc_tagName(const int tag)
+{
+  if (tag < 0 || tag >= ALLOC_TAG_CT) return NULL;
+  return tag_names[tag];
+}
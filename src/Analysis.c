@@ -0,0 +1,145 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include "../include/Analysis.h"
+#include "../include/Alloc.h"
+
+/**** Allocates the result buffers up front so sampling never allocates them ****/
+Analysis *
+createAnalysis(const int interval, const int rdf_bins, const double rdf_rmax, const int density_bins)
+{
+  Analysis *analysis;
+
+  if (rdf_bins < 0 || density_bins < 0 || !(rdf_rmax > 0)) return NULL;
+  analysis = (Analysis*)tracked_malloc(sizeof(Analysis), ALLOC_ANALYSIS);
+  if (analysis == NULL) return NULL;
+  memset(analysis, 0, sizeof(Analysis));
+
+  analysis->interval = (interval > 0) ? interval : 1;
+  analysis->rdf_bins = rdf_bins;
+  analysis->rdf_rmax = rdf_rmax;
+  analysis->density_bins = density_bins;
+  analysis->rdf = (double*)tracked_calloc(rdf_bins > 0 ? rdf_bins : 1, sizeof(double), ALLOC_ANALYSIS);
+  analysis->density = (double*)tracked_calloc(density_bins > 0 ? density_bins : 1, sizeof(double), ALLOC_ANALYSIS);
+  if (analysis->rdf == NULL || analysis->density == NULL) {
+    destroy_analysis(analysis);
+    return NULL;
+  }
+  return analysis;
+}
+
+/**** Kinetic energy and the density profile are single linear passes ****/
+static void
+linear_pass(Analysis *analysis, const Object objects[], const Cube cube, const int particle_ct)
+{
+  const double bin_len = (cube.max.x - cube.min.x) / analysis->density_bins;
+  const double bin_volume = bin_len * (cube.max.y - cube.min.y) * (cube.max.z - cube.min.z);
+  double kx = 0, ky = 0, kz = 0;
+  int bin;
+
+  memset(analysis->density, 0, analysis->density_bins * sizeof(double));
+  for (int i = 0; i < particle_ct; i++) {
+    const Vector3 v = objects[i].velocity;
+    kx += 0.5 * objects[i].mass * v.x * v.x;
+    ky += 0.5 * objects[i].mass * v.y * v.y;
+    kz += 0.5 * objects[i].mass * v.z * v.z;
+
+    if (analysis->density_bins > 0) {
+      bin = (int)((objects[i].position.x - cube.min.x) / bin_len);
+      bin = (bin < 0) ? 0 : (bin >= analysis->density_bins) ? analysis->density_bins - 1 : bin;
+      analysis->density[bin] += 1.0;
+    }
+  }
+  for (int b = 0; b < analysis->density_bins; b++) {
+    analysis->density[b] /= bin_volume;
+  }
+
+  analysis->kinetic_axis[0] = kx;
+  analysis->kinetic_axis[1] = ky;
+  analysis->kinetic_axis[2] = kz;
+  analysis->kinetic = kx + ky + kz;
+}
+
+/* Pair histogram over each bucket's 3x3x3 neighbourhood, same scan as collisionCall.
+   Each pair is counted once (lower index first) and credited to both particles. No
+   wall correction is applied, so g(r) sags near r_max for particles close to walls;
+   a periodic box wraps the scan and uses nearest images instead */
+static void
+rdf_pass(Analysis *analysis, Map *map[], const Object objects[], const Cube cube,
+         const int particle_ct, const Int3 dims)
+{
+  const Vector3 extent = cubeExtent(&cube);
+  const double cell_len = fmin(extent.x / dims.x, fmin(extent.y / dims.y, extent.z / dims.z));
+  const double rmax = (analysis->rdf_rmax < cell_len) ? analysis->rdf_rmax : cell_len;
+  const double inv_dr = analysis->rdf_bins / rmax;
+  const double rmax2 = rmax * rmax;
+  const double density = particle_ct / (extent.x * extent.y * extent.z);
+  const int partition_ct = grid_partitionCount(dims);
+  double r, r_in, r_out, shell;
+  int bin;
+  Vector3 d;
+  Int3 center, n;
+  Map *curr, *other;
+
+  memset(analysis->rdf, 0, analysis->rdf_bins * sizeof(double));
+  for (int i = 0; i < partition_ct; i++) {
+    if (map[i]->obj_index == -1) continue;
+    center = decompose_1Dindex(i, dims);
+
+    for (int j = 0; j < 27; j++) {
+      n = decompose_1Dindex(j, (Int3){3, 3, 3});
+      n = (Int3){n.x - 1, n.y - 1, n.z - 1};
+      if (sweep_repeats(n, dims, cube.periodic)) continue;      // A merged axis is its own neighbourhood
+      n = (Int3){center.x + n.x, center.y + n.y, center.z + n.z};
+      if (cube.periodic) n = wrap_cell(n, dims);
+      if (!grid_contains(n, dims)) continue;
+
+      for (curr = map[i]; curr != NULL && curr->obj_index != -1; curr = curr->next) {
+        for (other = map[grid_indexCalc(n, dims)]; other != NULL && other->obj_index != -1; other = other->next) {
+          if (other->obj_index <= curr->obj_index) continue;
+          d = minimumImage(&cube, subtractVectors(objects[curr->obj_index].position, objects[other->obj_index].position));
+          r = dotProduct(d, d);
+          if (!(r < rmax2)) continue;      // Also drops a NaN distance, which would index below the histogram
+          bin = (int)(sqrt(r) * inv_dr);
+          analysis->rdf[(bin < analysis->rdf_bins) ? bin : analysis->rdf_bins - 1] += 2.0;
+        }
+      }
+    }
+  }
+
+  // Normalize by the ideal gas count in each shell
+  for (int b = 0; b < analysis->rdf_bins; b++) {
+    r_in = b / inv_dr;
+    r_out = (b + 1) / inv_dr;
+    shell = (4.0 / 3.0) * M_PI * (r_out * r_out * r_out - r_in * r_in * r_in);
+    analysis->rdf[b] /= particle_ct * density * shell;
+  }
+}
+
+void
+analyzeMap(Analysis *analysis, Map *map[], const Object objects[], const Cube cube,
+           const int particle_ct, const Int3 dims)
+{
+  linear_pass(analysis, objects, cube, particle_ct);
+  if (analysis->rdf_bins > 0) rdf_pass(analysis, map, objects, cube, particle_ct, dims);
+  analysis->samples++;
+}
+
+int
+analyzeObjects(Analysis *analysis, MapStore *store, const Object objects[], const Cube cube,
+               const int particle_ct, const Int3 grid_dims)
+{
+  const Int3 dims = sweep_dims(grid_dims, cube.periodic);    // As collisionStep
+
+  if (analysis->rdf_bins > 0 && buildMap(store, objects, cube, dims, particle_ct) != 0) return -1;
+  analyzeMap(analysis, store->map, objects, cube, particle_ct, dims);
+  return 0;
+}
+
+void
+destroy_analysis(Analysis *analysis)
+{
+  if (analysis == NULL) return;
+  tracked_free(analysis->rdf);
+  tracked_free(analysis->density);
+  tracked_free(analysis);
+}
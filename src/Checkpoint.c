@@ -0,0 +1,325 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "../include/Checkpoint.h"
+#include "../include/Alloc.h"
+
+/**** Header size rounded up so the object array is aligned in the file and the mapping ****/
+static uint64_t
+data_offset(void)
+{
+  return (sizeof(CheckpointHeader) + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+}
+
+/**** writev until every iovec is drained; only loops if the kernel splits the write ****/
+static int
+write_all(int fd, struct iovec iov[], int iov_ct)
+{
+  while (iov_ct > 0) {
+    ssize_t written = writev(fd, iov, iov_ct);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    while (iov_ct > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      iov_ct--;
+    }
+    if (iov_ct > 0) {
+      iov->iov_base = (char*)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return 0;
+}
+
+/**** Fills the header's force section from the run's field and attachments ****/
+static void
+save_forces(const Simulation *sim, CheckpointForces *out)
+{
+  out->field = sim->forces;
+  if (sim->pairs != NULL) {
+    out->pairs_present = 1;
+    out->pair_kind = sim->pairs->kind;
+    out->epsilon = sim->pairs->epsilon;
+    out->sigma = sim->pairs->sigma;
+    out->cutoff = sim->pairs->cutoff;
+  }
+  if (sim->gravity != NULL) {
+    out->gravity_present = 1;
+    out->leaf_size = sim->gravity->leaf_size;
+    out->theta = sim->gravity->theta;
+    out->strength = sim->gravity->strength;
+    out->softening = sim->gravity->softening;
+  }
+}
+
+/**** Fills the header's contact section and gathers the live history; entries stays NULL when there is none ****/
+static int
+save_contacts(const ContactModel *cm, CheckpointContacts *out, ContactEntry **entries)
+{
+  (*entries) = NULL;
+  if (cm == NULL) return 0;
+  out->present = 1;
+  out->kn = cm->kn;
+  out->kt = cm->kt;
+  out->restitution = cm->restitution;
+  out->friction = cm->friction;
+  out->stats = cm->stats;
+  out->capacity = cm->capacity;
+  out->entry_ct = contact_saveHistory(cm, NULL);
+  if (out->entry_ct == 0) return 0;
+  (*entries) = (ContactEntry*)tracked_malloc(out->entry_ct * sizeof(ContactEntry), ALLOC_IO);
+  if ((*entries) == NULL) return -1;
+  contact_saveHistory(cm, *entries);
+  return 0;
+}
+
+/**** Fills the header's obstacle section; the triangles are written straight from the mesh ****/
+static void
+save_obstacles(const TriangleMesh *mesh, CheckpointObstacles *out)
+{
+  if (mesh == NULL) return;
+  out->present = 1;
+  out->triangle_ct = mesh->triangle_ct;
+  out->restitution = mesh->restitution;
+  out->stats = mesh->stats;
+}
+
+/**** Serializes the run: header page, the Object array exactly as it sits in memory, then the contact history
+ * and the obstacle triangles ****/
+int
+save_checkpoint(const Simulation *sim, const char *path)
+{
+  unsigned char header[sizeof(CheckpointHeader) + CHECKPOINT_ALIGN];
+  CheckpointHeader *h = (CheckpointHeader*)header;
+  struct iovec iov[4];
+  size_t path_len = strlen(path);
+  char *tmp_path = (char*)tracked_malloc(path_len + 5, ALLOC_IO);
+  ContactEntry *entries;
+  int fd;
+
+  if (tmp_path == NULL) return -1;
+  memcpy(tmp_path, path, path_len);
+  memcpy(tmp_path + path_len, ".tmp", 5);
+
+  memset(header, 0, sizeof(header));
+  memcpy(h->magic, CHECKPOINT_MAGIC, 8);
+  h->version = CHECKPOINT_VERSION;
+  h->object_size = sizeof(Object);
+  h->particle_ct = sim->particle_ct;
+  h->step = sim->step;
+  h->grid_dims = sim->grid_dims;
+  h->sub_steps = sim->sub_steps;
+  h->integrator = sim->integrator;
+  h->primed = sim->primed;
+  h->dt = sim->dt;
+  h->time = sim->time;
+  h->cube = sim->cube;
+  h->container = sim->container;
+  h->rng = sim->rng;
+  h->data_offset = data_offset();
+  h->data_bytes = (uint64_t)sim->particle_ct * sizeof(Object);
+  save_forces(sim, &h->forces);
+  save_obstacles(sim->obstacles, &h->obstacles);
+  if (save_contacts(sim->contacts, &h->contacts, &entries) != 0) {
+    tracked_free(tmp_path);
+    return -1;
+  }
+
+  iov[0] = (struct iovec){header, h->data_offset};
+  iov[1] = (struct iovec){sim->objects, h->data_bytes};
+  iov[2] = (struct iovec){entries, h->contacts.entry_ct * sizeof(ContactEntry)};
+  iov[3] = (struct iovec){(sim->obstacles != NULL) ? sim->obstacles->triangles : NULL,
+                          (size_t)h->obstacles.triangle_ct * sizeof(MeshTriangle)};
+
+  fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Checkpoint: cannot open %s\n", tmp_path);
+    tracked_free(entries);
+    tracked_free(tmp_path);
+    return -1;
+  }
+
+  if (write_all(fd, iov, 4) != 0 || fsync(fd) != 0) {
+    fprintf(stderr, "Checkpoint: write to %s failed\n", tmp_path);
+    close(fd);
+    unlink(tmp_path);
+    tracked_free(entries);
+    tracked_free(tmp_path);
+    return -1;
+  }
+  close(fd);
+  tracked_free(entries);
+
+  if (rename(tmp_path, path) != 0) {
+    fprintf(stderr, "Checkpoint: cannot rename %s to %s\n", tmp_path, path);
+    unlink(tmp_path);
+    tracked_free(tmp_path);
+    return -1;
+  }
+
+  tracked_free(tmp_path);
+  return 0;
+}
+
+/**** Checks that the header describes a file this build can map directly ****/
+static int
+valid_header(const CheckpointHeader *h, const size_t file_len)
+{
+  if (memcmp(h->magic, CHECKPOINT_MAGIC, 8) != 0) return 0;
+  if (h->version != CHECKPOINT_VERSION) return 0;
+  if (h->object_size != sizeof(Object)) return 0;
+  if (h->data_offset != data_offset()) return 0;
+  if (h->data_bytes != h->particle_ct * sizeof(Object)) return 0;
+  if (h->integrator < 0 || h->integrator >= INTEGRATOR_KIND_CT) return 0;
+  if (h->forces.field.kind < 0 || h->forces.field.kind >= FIELD_KIND_CT) return 0;
+  if (h->forces.pairs_present && (h->forces.pair_kind < 0 || h->forces.pair_kind >= PAIR_KIND_CT)) return 0;
+  if (h->contacts.present) {
+    const uint64_t capacity = h->contacts.capacity;
+    if ((capacity & (capacity - 1)) != 0 || h->contacts.entry_ct > capacity / 4 * 3) return 0;
+  }
+  else if (h->contacts.entry_ct != 0) return 0;
+  if (h->obstacles.present ? (h->obstacles.triangle_ct <= 0 || h->obstacles.triangle_ct > (1 << 28))
+                           : h->obstacles.triangle_ct != 0) {
+    return 0;
+  }
+  return h->data_offset + h->data_bytes + h->contacts.entry_ct * sizeof(ContactEntry)
+         + (uint64_t)h->obstacles.triangle_ct * sizeof(MeshTriangle) <= file_len;
+}
+
+/**** Restores the field and rebuilds the saved pair potential and gravity. -1 on allocation failure ****/
+static int
+load_forces(const CheckpointForces *f, Simulation *sim)
+{
+  sim->forces = f->field;
+  if (f->pairs_present) {
+    sim->pairs = createPairForce(f->pair_kind, f->epsilon, f->sigma, f->cutoff);
+    if (sim->pairs == NULL) return -1;
+  }
+  if (f->gravity_present) {
+    sim->gravity = createOctree(f->theta, f->strength, f->softening, f->leaf_size);
+    if (sim->gravity == NULL) return -1;
+  }
+  return 0;
+}
+
+/**** Rebuilds the saved ContactModel with its history copied out of the mapping. -1 on allocation failure ****/
+static int
+load_contacts(const CheckpointContacts *c, const ContactEntry entries[], Simulation *sim)
+{
+  ContactModel *cm;
+
+  if (!c->present) return 0;
+  cm = createContactModel(c->kn, c->kt, c->restitution, c->friction);
+  if (cm == NULL) return -1;
+  cm->stats = c->stats;
+  sim->contacts = cm;
+  return contact_loadHistory(cm, entries, c->entry_ct, c->capacity);
+}
+
+/**** Rebuilds the saved obstacle mesh from its triangles, copied out of the mapping. -1 on allocation failure ****/
+static int
+load_obstacles(const CheckpointObstacles *o, const MeshTriangle triangles[], Simulation *sim)
+{
+  if (!o->present) return 0;
+  sim->obstacles = restore_triangleMesh(triangles, o->triangle_ct);
+  if (sim->obstacles == NULL) return -1;
+  sim->obstacles->restitution = o->restitution;
+  sim->obstacles->stats = o->stats;
+  return 0;
+}
+
+/**** Maps a checkpoint copy-on-write; nothing is parsed or copied beyond the header ****/
+Simulation *
+load_checkpoint(const char *path, int *status)
+{
+  struct stat st;
+  const CheckpointHeader *h;
+  const ContactEntry *entries;
+  Simulation *sim;
+  void *mapping;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) {
+    (*status) = 1;
+    return NULL;
+  }
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    (*status) = 1;
+    return NULL;
+  }
+  if ((size_t)st.st_size < sizeof(CheckpointHeader)) {
+    close(fd);
+    (*status) = 2;
+    return NULL;
+  }
+
+  // Private so the run can step in place without touching the file
+  mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    (*status) = 1;
+    return NULL;
+  }
+
+  h = (const CheckpointHeader*)mapping;
+  if (!valid_header(h, st.st_size)) {
+    fprintf(stderr, "Checkpoint: %s is not a compatible v%d checkpoint\n", path, CHECKPOINT_VERSION);
+    munmap(mapping, st.st_size);
+    (*status) = 2;
+    return NULL;
+  }
+
+  sim = (Simulation*)tracked_malloc(sizeof(Simulation), ALLOC_SIMULATION);
+  if (sim == NULL) {
+    munmap(mapping, st.st_size);
+    (*status) = 1;
+    return NULL;
+  }
+
+  sim->cube = h->cube;
+  sim->container = h->container;
+  sim->objects = (Object*)((char*)mapping + h->data_offset);
+  sim->particle_ct = (int)h->particle_ct;
+  sim->grid_dims = h->grid_dims;
+  sim->sub_steps = h->sub_steps;
+  sim->dt = h->dt;
+  sim->time = h->time;
+  sim->step = h->step;
+  sim->rng = h->rng;
+  sim->integrator = h->integrator;
+  sim->primed = h->primed;      // The cached accelerations came back with the objects
+  sim->analysis = NULL;
+  sim->gravity = NULL;
+  sim->pairs = NULL;
+  sim->contacts = NULL;
+  sim->obstacles = NULL;
+  sim->trajectory = NULL;
+  sim->frames = NULL;
+  sim->field = NULL;
+  memset(&sim->collision, 0, sizeof(CollisionStats));
+  sim->store = (MapStore){NULL, 0, 0};
+  sim->frame_allocs = 0;
+  sim->mapping = mapping;
+  sim->mapping_len = st.st_size;
+
+  // The handle is complete, so a failed attachment is undone by destroying it
+  entries = (const ContactEntry*)((char*)mapping + h->data_offset + h->data_bytes);
+  if (load_forces(&h->forces, sim) != 0 || load_contacts(&h->contacts, entries, sim) != 0
+      || load_obstacles(&h->obstacles, (const MeshTriangle*)(entries + h->contacts.entry_ct), sim) != 0) {
+    destroy_simulation(sim);
+    (*status) = 1;
+    return NULL;
+  }
+
+  (*status) = 0;
+  return sim;
+}
@@ -0,0 +1,416 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include "../include/Contact.h"
+#include "../include/Profile.h"
+#include "../include/PerfCounters.h"
+#include "../include/Trace.h"
+#include "../include/Alloc.h"
+
+#define MIN_CAPACITY 1024
+
+/**** Neighbours after a cell in (x, y, z) order, as in PairForce.c ****/
+static const Int3 half_shell[13] = {
+  {1, -1, -1}, {1, -1, 0}, {1, -1, 1}, {1, 0, -1}, {1, 0, 0}, {1, 0, 1}, {1, 1, -1}, {1, 1, 0}, {1, 1, 1},
+  {0, 1, -1}, {0, 1, 0}, {0, 1, 1},
+  {0, 0, 1}
+};
+
+/**** Per thread counters, reduced after the pass ****/
+typedef struct {
+  uint64_t tested, contacts, walls, meshes, sliding, continued, dropped;
+  double max_overlap;
+} ContactTally;
+
+ContactModel *
+createContactModel(const double kn, const double kt, const double restitution, const double friction)
+{
+  ContactModel *cm;
+  const double log_e = log((restitution > 0) ? restitution : 1e-6);
+
+  if (kn <= 0 || restitution > 1 || friction < 0) return NULL;
+  cm = (ContactModel*)tracked_calloc(1, sizeof(ContactModel), ALLOC_FORCES);
+  if (cm == NULL) return NULL;
+
+  cm->kn = kn;
+  cm->kt = (kt > 0) ? kt : 2.0 / 7.0 * kn;
+  cm->restitution = restitution;
+  cm->friction = friction;
+  cm->damping_ratio = -log_e / sqrt(M_PI * M_PI + log_e * log_e);
+  cm->store = (MapStore){NULL, 0, 0};
+  return cm;
+}
+
+void
+destroy_contactModel(ContactModel *cm)
+{
+  if (cm == NULL) return;
+  destroy_mapStore(&cm->store);
+  tracked_free(cm->history[0]);
+  tracked_free(cm->history[1]);
+  tracked_free(cm);
+}
+
+double
+contact_time(const ContactModel *cm, const double m)
+{
+  return M_PI / (sqrt(cm->kn / m) * sqrt(1.0 - cm->damping_ratio * cm->damping_ratio));
+}
+
+static uint64_t
+slot_of(const uint64_t key, const uint64_t mask)
+{
+  return ((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+}
+
+/**** Stretch stored for key in a read-only table; 0 when the contact is new ****/
+static int
+history_find(const ContactEntry table[], const uint64_t capacity, const uint64_t key, Vector3 *stretch)
+{
+  const uint64_t mask = capacity - 1;
+  for (uint64_t s = slot_of(key, mask), probes = 0; probes < capacity; s = (s + 1) & mask, probes++) {
+    if (table[s].key == key) {
+      *stretch = table[s].stretch;
+      return 1;
+    }
+    if (table[s].key == CONTACT_EMPTY) return 0;
+  }
+  return 0;
+}
+
+/**** Claims a slot with a CAS so threads can write one table together. Past 3/4 load the entry is dropped,
+ * and the table is grown before the next pass ****/
+static int
+history_store(ContactModel *cm, ContactEntry table[], const uint64_t key, const Vector3 stretch)
+{
+  const uint64_t mask = cm->capacity - 1;
+  if (__atomic_fetch_add(&cm->stored, 1, __ATOMIC_RELAXED) >= cm->capacity / 4 * 3) return -1;
+
+  for (uint64_t s = slot_of(key, mask);; s = (s + 1) & mask) {
+    uint64_t expected = CONTACT_EMPTY;
+    if (__atomic_compare_exchange_n(&table[s].key, &expected, key, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      table[s].stretch = stretch;
+      return 0;
+    }
+  }
+}
+
+/**** Swaps in two fresh tables of capacity slots, the first holding the non-empty entries of src rehashed ****/
+static int
+replace_tables(ContactModel *cm, const uint64_t capacity, const ContactEntry src[], const uint64_t src_ct)
+{
+  ContactEntry *tables[2];
+
+  tables[0] = (ContactEntry*)tracked_malloc(capacity * sizeof(ContactEntry), ALLOC_FORCES);
+  tables[1] = (ContactEntry*)tracked_malloc(capacity * sizeof(ContactEntry), ALLOC_FORCES);
+  if (tables[0] == NULL || tables[1] == NULL) {
+    tracked_free(tables[0]);
+    tracked_free(tables[1]);
+    return -1;
+  }
+  for (uint64_t s = 0; s < capacity; s++) tables[0][s].key = CONTACT_EMPTY;
+
+  for (uint64_t s = 0; s < src_ct; s++) {
+    if (src[s].key == CONTACT_EMPTY) continue;
+    uint64_t t = slot_of(src[s].key, capacity - 1);
+    while (tables[0][t].key != CONTACT_EMPTY) t = (t + 1) & (capacity - 1);
+    tables[0][t] = src[s];
+  }
+  tracked_free(cm->history[0]);
+  tracked_free(cm->history[1]);
+  cm->history[0] = tables[0];
+  cm->history[1] = tables[1];
+  cm->current = 0;
+  cm->capacity = capacity;
+  return 0;
+}
+
+/**** Sizes both tables for about twice the last step's contacts plus one per particle, keeping the history ****/
+static int
+grow_history(ContactModel *cm, const int particle_ct)
+{
+  const uint64_t last = cm->stats.contacts + cm->stats.wall_contacts + cm->stats.mesh_contacts;
+  const ContactEntry *live;
+  uint64_t capacity = MIN_CAPACITY;
+
+  while (capacity < 2 * (last + (uint64_t)particle_ct)) capacity *= 2;
+  if (capacity <= cm->capacity) return 0;
+  // Rehash what the next pass reads
+  live = cm->history[cm->current];
+  return replace_tables(cm, capacity, live, (live != NULL) ? cm->capacity : 0);
+}
+
+void
+contact_clearHistory(ContactModel *cm)
+{
+  for (int t = 0; t < 2; t++) {
+    if (cm->history[t] == NULL) continue;
+    for (uint64_t s = 0; s < cm->capacity; s++) cm->history[t][s].key = CONTACT_EMPTY;
+  }
+}
+
+uint64_t
+contact_saveHistory(const ContactModel *cm, ContactEntry entries[])
+{
+  const ContactEntry *live = cm->history[cm->current];
+  uint64_t entry_ct = 0;
+
+  if (live == NULL) return 0;
+  for (uint64_t s = 0; s < cm->capacity; s++) {
+    if (live[s].key == CONTACT_EMPTY) continue;
+    if (entries != NULL) entries[entry_ct] = live[s];
+    entry_ct++;
+  }
+  return entry_ct;
+}
+
+/**** Lookups only depend on the keys, so rehashing the saved entries gives the same forces ****/
+int
+contact_loadHistory(ContactModel *cm, const ContactEntry entries[], const uint64_t entry_ct,
+                    const uint64_t capacity)
+{
+  if (capacity == 0) return (entry_ct == 0) ? 0 : -1;
+  if ((capacity & (capacity - 1)) != 0 || entry_ct > capacity / 4 * 3) return -1;
+  return replace_tables(cm, capacity, entries, entry_ct);
+}
+
+/**** Force on body a of one contact. n is the unit normal pointing at a, overlap > 0, v = v_a - v_b and m the
+ * reduced mass. The stored stretch is turned onto the current tangent plane, advanced by v_t dt and, when
+ * the spring would exceed the Coulomb limit, shortened to sit on it ****/
+static Vector3
+contact_force(ContactModel *cm, const ContactEntry read[], ContactEntry write[], const uint64_t key,
+              const Vector3 n, const double overlap, const Vector3 v, const double m, const double dt,
+              ContactTally *tally)
+{
+  const double vn = dotProduct(v, n);
+  const Vector3 vt = subtractVectors(v, scaleVector(n, vn));
+  const double gn = 2.0 * cm->damping_ratio * sqrt(m * cm->kn);
+  const double gt = 2.0 * cm->damping_ratio * sqrt(m * cm->kt);
+  const double fn = fmax(0.0, cm->kn * overlap - gn * vn);
+  Vector3 stretch = {0, 0, 0}, ft;
+  double length, ft_mag;
+
+  if (history_find(read, cm->capacity, key, &stretch)) {
+    tally->continued++;
+    length = magnitude(stretch);
+    stretch = subtractVectors(stretch, scaleVector(n, dotProduct(stretch, n)));
+    if (length > 0 && magnitude(stretch) > 0) stretch = scaleVector(stretch, length / magnitude(stretch));
+  }
+  stretch = addVectors(stretch, scaleVector(vt, dt));
+
+  ft = scaleVector(addVectors(scaleVector(stretch, cm->kt), scaleVector(vt, gt)), -1.0);
+  ft_mag = magnitude(ft);
+  if (ft_mag > cm->friction * fn) {
+    ft = (ft_mag > 0) ? scaleVector(ft, cm->friction * fn / ft_mag) : ft;
+    stretch = scaleVector(addVectors(ft, scaleVector(vt, gt)), -1.0 / cm->kt);
+    tally->sliding++;
+  }
+  if (history_store(cm, write, key, stretch) != 0) tally->dropped++;
+  return addVectors(scaleVector(n, fn), ft);
+}
+
+/**** Spheres i < j; the lower index is body a so the stretch keeps one orientation across steps ****/
+static void
+pair_contact(ContactModel *cm, const Cube *cube, const ContactEntry read[], ContactEntry write[],
+             const Object objects[], int i, int j, const double dt, Vector3 accel[], ContactTally *tally)
+{
+  Vector3 d, n, force;
+  double dist, reach, overlap;
+  const Object *a, *b;
+
+  if (i > j) {
+    const int swap = i;
+    i = j;
+    j = swap;
+  }
+  a = &objects[i];
+  b = &objects[j];
+  tally->tested++;
+  d = minimumImage(cube, subtractVectors(a->position, b->position));
+  reach = a->radius + b->radius;
+  if (dotProduct(d, d) >= reach * reach) return;
+  dist = magnitude(d);
+  if (dist == 0) return;                  // Coincident centres have no normal
+
+  overlap = reach - dist;
+  n = scaleVector(d, 1.0 / dist);
+  tally->contacts++;
+  force = contact_force(cm, read, write, (uint64_t)i << 32 | (uint64_t)j, n, overlap,
+                        subtractVectors(a->velocity, b->velocity), a->mass * b->mass / (a->mass + b->mass), dt, tally);
+  accel[i] = addVectors(accel[i], scaleVector(force, 1.0 / a->mass));
+  accel[j] = subtractVectors(accel[j], scaleVector(force, 1.0 / b->mass));
+  if (overlap / fmin(a->radius, b->radius) > tally->max_overlap) tally->max_overlap = overlap / fmin(a->radius, b->radius);
+}
+
+/**** Contacts within cell c and with its half shell, as pair_cell in PairForce.c ****/
+static void
+contact_cell(ContactModel *cm, const Cube *cube, const ContactEntry read[], ContactEntry write[],
+             const Object objects[], Map *map[], const int c, const double dt, Vector3 accel[], ContactTally *tally)
+{
+  const Int3 center = decompose_1Dindex(c, cm->dims);
+  const Int3 dims = cm->dims;
+  Map *curr, *adjust;
+
+  if (map[c]->obj_index == -1) return;
+  for (curr = map[c]; curr != NULL; curr = curr->next) {
+    for (adjust = curr->next; adjust != NULL; adjust = adjust->next) {
+      pair_contact(cm, cube, read, write, objects, curr->obj_index, adjust->obj_index, dt, accel, tally);
+    }
+  }
+  for (int s = 0; s < 13; s++) {
+    Int3 n = {center.x + half_shell[s].x, center.y + half_shell[s].y, center.z + half_shell[s].z};
+    if (sweep_repeats(half_shell[s], dims, cube->periodic)) continue;
+    if (cube->periodic) n = wrap_cell(n, dims);
+    if (!grid_contains(n, dims)) continue;
+    Map *neighbour = map[grid_indexCalc(n, dims)];
+    if (neighbour->obj_index == -1) continue;
+    for (curr = map[c]; curr != NULL; curr = curr->next) {
+      for (adjust = neighbour; adjust != NULL; adjust = adjust->next) {
+        pair_contact(cm, cube, read, write, objects, curr->obj_index, adjust->obj_index, dt, accel, tally);
+      }
+    }
+  }
+}
+
+/**** Container walls, as contacts with a fixed body of infinite mass. A box corner gives one contact per face ****/
+static void
+wall_contacts(ContactModel *cm, const ContactEntry read[], ContactEntry write[], const Container *container,
+              const Object *obj, const int i, const double dt, Vector3 *accel, ContactTally *tally)
+{
+  ContainerContact walls[CONTAINER_PASSES];
+  const int wall_ct = containerContacts(container, obj->position, obj->radius, walls);
+
+  for (int k = 0; k < wall_ct; k++) {
+    const Vector3 force = contact_force(cm, read, write, (uint64_t)i << 32 | (uint32_t)~walls[k].feature,
+                                        walls[k].normal, walls[k].overlap, obj->velocity, obj->mass, dt, tally);
+    tally->walls++;
+    *accel = addVectors(*accel, scaleVector(force, 1.0 / obj->mass));
+    if (walls[k].overlap / obj->radius > tally->max_overlap) tally->max_overlap = walls[k].overlap / obj->radius;
+  }
+}
+
+/**** Obstacle triangles, fixed bodies like the walls. A sphere on an edge or vertex finds the same closest point on
+ * every triangle sharing it; only the first of them is a contact, so the feature pushes once ****/
+static void
+mesh_contacts(ContactModel *cm, const ContactEntry read[], ContactEntry write[], const TriangleMesh *mesh,
+              const Object *obj, const int i, const double dt, Vector3 *accel, ContactTally *tally, MeshStats *mesh_tally)
+{
+  int hits[MESH_MAX_HITS], kept = 0;
+  Vector3 points[MESH_MAX_HITS];
+  const int hit_ct = mesh_query(mesh, obj->position, obj->radius, hits, MESH_MAX_HITS, mesh_tally);
+
+  for (int k = 0; k < hit_ct; k++) {
+    const Vector3 q = mesh_closestPoint(&mesh->triangles[hits[k]], obj->position);
+    const Vector3 d = subtractVectors(obj->position, q);
+    const double dist = magnitude(d), overlap = obj->radius - dist;
+    int shared = 0;
+    Vector3 force;
+
+    for (int p = 0; p < kept && !shared; p++) {
+      const Vector3 gap = subtractVectors(points[p], q);
+      shared = dotProduct(gap, gap) <= 1e-12 * obj->radius * obj->radius;
+    }
+    points[kept++] = q;
+    if (shared || dist == 0) continue;            // A centre on the face has no normal, as coincident spheres
+    tally->meshes++;
+    force = contact_force(cm, read, write, (uint64_t)i << 32 | (uint32_t)~(CONTAINER_FEATURE_CT + hits[k]),
+                          scaleVector(d, 1.0 / dist), overlap, obj->velocity, obj->mass, dt, tally);
+    *accel = addVectors(*accel, scaleVector(force, 1.0 / obj->mass));
+    if (overlap / obj->radius > tally->max_overlap) tally->max_overlap = overlap / obj->radius;
+  }
+}
+
+/**** Same coloured half shell sweep as pairForces, then the container walls and the obstacle mesh per particle.
+ * Forces don't depend on the thread count; only which slot an entry lands in does ****/
+int
+contactForces(ContactModel *cm, const Object objects[], const Cube cube, const Container *container,
+              TriangleMesh *mesh, const int particle_ct, const double dt, Vector3 accel[])
+{
+  double max_radius = 0, max_overlap = 0;
+  const int walled_ct = (container != NULL && container->shape_ct > 0) ? particle_ct : 0;
+  const int meshed_ct = (mesh != NULL) ? particle_ct : 0;
+  int colour_ct;
+  Int3 dims;
+  uint64_t tested = 0, contacts = 0, walls = 0, meshes = 0, sliding = 0, continued = 0, dropped = 0;
+  uint64_t queries = 0, visited = 0, triangles = 0, mesh_dropped = 0;
+  ContactEntry *read, *write;
+  Map **map;
+
+  if (grow_history(cm, particle_ct) != 0) return -1;
+  read = cm->history[cm->current];
+  write = cm->history[cm->current ^ 1];
+  memset(&cm->stats, 0, sizeof(ContactStats));
+  if (particle_ct == 0) return 0;
+
+  for (int i = 0; i < particle_ct; i++) max_radius = fmax(max_radius, objects[i].radius);
+  dims = sweep_dims(gridDims(cube, 2.0 * max_radius, 2 * particle_ct), cube.periodic);
+  colour_ct = sweep_colours(dims, cube.periodic);
+  cm->dims = dims;
+
+  PROFILE_BEGIN(contact_start);
+  perf_enter();
+  TRACE_BEGIN(contact_trace);
+  if (buildMap(&cm->store, objects, cube, dims, particle_ct) != 0) {
+    perf_leave(PERF_CONTACTS);
+    return -1;
+  }
+  map = cm->store.map;
+  cm->stored = 0;
+
+  #pragma omp parallel reduction(+:tested,contacts,walls,meshes,sliding,continued,dropped) \
+                       reduction(+:queries,visited,triangles,mesh_dropped) reduction(max:max_overlap)
+  {
+    ContactTally tally = {0, 0, 0, 0, 0, 0, 0, 0.0};
+    MeshStats mesh_tally = {0, 0, 0, 0, 0};
+
+    #pragma omp for schedule(static)
+    for (uint64_t s = 0; s < cm->capacity; s++) write[s].key = CONTACT_EMPTY;
+
+    for (int colour = 0; colour < colour_ct; colour++) {
+      const SweepClass sweep = sweepClass(dims, cube.periodic, colour);
+
+      #pragma omp for schedule(dynamic, 4)
+      for (int k = 0; k < sweep.count.x * sweep.count.y * sweep.count.z; k++) {
+        contact_cell(cm, &cube, read, write, objects, map, grid_indexCalc(sweep_cell(&sweep, k), dims), dt, accel,
+                     &tally);
+      }
+    }
+
+    #pragma omp for schedule(static)
+    for (int i = 0; i < walled_ct; i++) {
+      wall_contacts(cm, read, write, container, &objects[i], i, dt, &accel[i], &tally);
+    }
+
+    #pragma omp for schedule(static)
+    for (int i = 0; i < meshed_ct; i++) {
+      mesh_contacts(cm, read, write, mesh, &objects[i], i, dt, &accel[i], &tally, &mesh_tally);
+    }
+
+    tested += tally.tested;
+    contacts += tally.contacts;
+    walls += tally.walls;
+    meshes += tally.meshes;
+    queries += mesh_tally.queries;
+    visited += mesh_tally.nodes_visited;
+    triangles += mesh_tally.triangles_tested;
+    mesh_dropped += mesh_tally.dropped;
+    sliding += tally.sliding;
+    continued += tally.continued;
+    dropped += tally.dropped;
+    max_overlap = tally.max_overlap;
+  }
+
+  cm->current ^= 1;
+  cm->stats.pairs_tested = tested;
+  cm->stats.contacts = contacts;
+  cm->stats.wall_contacts = walls;
+  cm->stats.mesh_contacts = meshes;
+  cm->stats.sliding = sliding;
+  cm->stats.continued = continued;
+  cm->stats.dropped = dropped;
+  cm->stats.max_overlap = max_overlap;
+  if (mesh != NULL) mesh->stats = (MeshStats){queries, visited, triangles, meshes, mesh_dropped};
+  TRACE_END(TRACE_CONTACTS, contact_trace, particle_ct, (int)(contacts + walls + meshes));
+  perf_leave(PERF_CONTACTS);
+  PROFILE_END(PHASE_CONTACTS, contact_start);
+  return 0;
+}
@@ -0,0 +1,280 @@
+#include <string.h>
+#include "../include/Container.h"
+#include "../include/Profile.h"
+#include "../include/PerfCounters.h"
+#include "../include/Trace.h"
+
+static const char *kind_names[SHAPE_KIND_CT] = {"box", "sphere", "cylinder", "capsule", "plane"};
+
+Container
+boxContainer(const Cube cube)
+{
+  Container container;
+
+  memset(&container, 0, sizeof(Container));
+  container.restitution = 0.75;
+  if (!cube.periodic) {
+    container.shapes[0] = (Shape){SHAPE_BOX, SHAPE_UNION, cube.min, cube.max, 0.0};
+    container.shape_ct = 1;
+  }
+  return container;
+}
+
+int
+addShape(Container *container, const Shape shape)
+{
+  Shape s = shape;
+  const Vector3 axis = subtractVectors(s.b, s.a);
+
+  if (container->shape_ct >= CONTAINER_MAX_SHAPES || s.op < 0 || s.op >= SHAPE_OP_CT) return -1;
+  switch (s.kind) {
+    case SHAPE_BOX:
+      if (!(s.a.x < s.b.x && s.a.y < s.b.y && s.a.z < s.b.z)) return -1;
+      break;
+    case SHAPE_SPHERE:
+      if (!(s.radius > 0)) return -1;
+      break;
+    case SHAPE_CYLINDER:
+    case SHAPE_CAPSULE:
+      if (!(s.radius > 0) || !(magnitude(axis) > 0)) return -1;
+      break;
+    case SHAPE_PLANE:
+      if (!(magnitude(s.b) > 0)) return -1;
+      s.b = scaleVector(s.b, 1.0 / magnitude(s.b));
+      break;
+    default:
+      return -1;
+  }
+  container->shapes[container->shape_ct++] = s;
+  return 0;
+}
+
+const char *
+shape_kindName(const int kind)
+{
+  if (kind < 0 || kind >= SHAPE_KIND_CT) return NULL;
+  return kind_names[kind];
+}
+
+/* Written on components like the field kernels, since every sphere near the boundary evaluates them */
+
+static inline double
+v_dot(const Vector3 a, const Vector3 b)
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline Vector3
+v_along(const Vector3 a, const Vector3 d, const double s)
+{
+  return (Vector3){a.x + s * d.x, a.y + s * d.y, a.z + s * d.z};
+}
+
+/**** Unit direction of v, or any unit vector when v is zero ****/
+static inline Vector3
+v_unit(const Vector3 v)
+{
+  const double length = sqrt(v_dot(v, v));
+  return (length > 0) ? (Vector3){v.x / length, v.y / length, v.z / length} : (Vector3){1, 0, 0};
+}
+
+/**** Box: exact outside, and inside the deepest face decides ****/
+static double
+box_distance(const Shape *s, const Vector3 p, Vector3 *g, int *face)
+{
+  const double pos[3] = {p.x, p.y, p.z}, lo[3] = {s->a.x, s->a.y, s->a.z}, hi[3] = {s->b.x, s->b.y, s->b.z};
+  double q[3], side[3], out[3], outside = 0;
+  int deepest = 0;
+
+  for (int k = 0; k < 3; k++) {
+    const double center = 0.5 * (lo[k] + hi[k]);
+    side[k] = (pos[k] >= center) ? 1.0 : -1.0;
+    q[k] = fabs(pos[k] - center) - 0.5 * (hi[k] - lo[k]);
+    out[k] = fmax(q[k], 0.0);
+    outside += out[k] * out[k];
+    if (q[k] > q[deepest]) deepest = k;
+  }
+  *face = 2 * deepest + (side[deepest] > 0);
+  if (outside > 0) {
+    *g = v_unit((Vector3){side[0] * out[0], side[1] * out[1], side[2] * out[2]});
+    return sqrt(outside);
+  }
+  *g = (Vector3){(deepest == 0) ? side[0] : 0, (deepest == 1) ? side[1] : 0, (deepest == 2) ? side[2] : 0};
+  return q[deepest];
+}
+
+/**** Flat capped cylinder as a 2D box in (radial, axial) ****/
+static double
+cylinder_distance(const Shape *s, const Vector3 p, Vector3 *g, int *face)
+{
+  const Vector3 axis = subtractVectors(s->b, s->a), ap = subtractVectors(p, s->a);
+  const double length = sqrt(v_dot(axis, axis));
+  const Vector3 u = scaleVector(axis, 1.0 / length);
+  const double t = v_dot(ap, u);
+  const Vector3 radial = v_unit(v_along(ap, u, -t));
+  const double dr = v_dot(ap, radial) - s->radius;
+  const double da = (t < 0.5 * length) ? -t : t - length;
+  const Vector3 cap = (t < 0.5 * length) ? scaleVector(u, -1.0) : u;
+
+  if (dr > 0 && da > 0) {
+    const double d = sqrt(dr * dr + da * da);
+    *g = v_unit(v_along(scaleVector(radial, dr), cap, da));
+    *face = 0;
+    return d;
+  }
+  if (dr > da) {
+    *g = radial;
+    *face = 0;
+    return dr;
+  }
+  *g = cap;
+  *face = (t < 0.5 * length) ? 1 : 2;
+  return da;
+}
+
+/**** Distance of one shape, negative inside, with its outward unit gradient ****/
+static double
+shape_distance(const Shape *s, const Vector3 p, Vector3 *g, int *face)
+{
+  Vector3 d;
+  double t;
+
+  *face = 0;
+  switch (s->kind) {
+    case SHAPE_BOX:
+      return box_distance(s, p, g, face);
+    case SHAPE_SPHERE:
+      d = subtractVectors(p, s->a);
+      *g = v_unit(d);
+      return sqrt(v_dot(d, d)) - s->radius;
+    case SHAPE_CYLINDER:
+      return cylinder_distance(s, p, g, face);
+    case SHAPE_CAPSULE:
+      d = subtractVectors(s->b, s->a);
+      t = fmin(1.0, fmax(0.0, v_dot(subtractVectors(p, s->a), d) / v_dot(d, d)));
+      d = subtractVectors(p, v_along(s->a, d, t));
+      *g = v_unit(d);
+      return sqrt(v_dot(d, d)) - s->radius;
+    default:
+      *g = s->b;
+      return v_dot(subtractVectors(p, s->a), s->b);
+  }
+}
+
+double
+containerDistance(const Container *container, const Vector3 p, Vector3 *gradient, int *feature)
+{
+  double d = -INFINITY;
+
+  *gradient = (Vector3){0, 0, 0};
+  *feature = -1;
+  for (int k = 0; k < container->shape_ct; k++) {
+    const Shape *s = &container->shapes[k];
+    Vector3 g;
+    int face;
+    double ds = shape_distance(s, p, &g, &face);
+
+    if (s->op == SHAPE_SUBTRACT) {
+      ds = -ds;
+      g = scaleVector(g, -1.0);
+    }
+    if (k == 0 || (s->op == SHAPE_UNION && ds < d) || (s->op != SHAPE_UNION && ds > d)) {
+      d = ds;
+      *gradient = g;
+      *feature = 8 * k + face;
+    }
+  }
+  return d;
+}
+
+/**** Projects the centre onto the surface inset by radius, one constraint at a time. Overlaps within rounding
+ * of the last projection are not contacts ****/
+int
+containerContacts(const Container *container, const Vector3 p, const double radius,
+                  ContainerContact contacts[CONTAINER_PASSES])
+{
+  Vector3 q = p, g;
+  int ct = 0, feature;
+
+  for (int pass = 0; pass < CONTAINER_PASSES && container->shape_ct > 0; pass++) {
+    const double overlap = containerDistance(container, q, &g, &feature) + radius;
+    if (overlap <= ((pass == 0) ? 0.0 : 1e-12 * radius)) break;
+    contacts[ct++] = (ContainerContact){scaleVector(g, -1.0), overlap, feature};
+    q = v_along(q, g, -overlap);
+  }
+  return ct;
+}
+
+/**** One axis of the box sweep: clamp into [lo, hi] and bounce a velocity heading out ****/
+static inline int
+clamp_axis(double *p, double *v, const double lo, const double hi, const double restitution)
+{
+  const double position = *p;
+  const int below = position < lo, above = position > hi;
+
+  *p = below ? lo : (above ? hi : position);
+  if ((below && *v < 0) || (above && *v > 0)) *v *= -restitution;
+  return below + above;
+}
+
+/**** The whole cube as one box: three independent clamps per sphere, no distance function to evaluate ****/
+static int
+contain_box(const Container *container, Object objects[], const int particle_ct)
+{
+  const Vector3 lo = container->shapes[0].a, hi = container->shapes[0].b;
+  const double e = container->restitution;
+  int hits = 0;
+
+  #pragma omp parallel for schedule(static) reduction(+:hits)
+  for (int i = 0; i < particle_ct; i++) {
+    const double r = objects[i].radius;
+    hits += clamp_axis(&objects[i].position.x, &objects[i].velocity.x, lo.x + r, hi.x - r, e);
+    hits += clamp_axis(&objects[i].position.y, &objects[i].velocity.y, lo.y + r, hi.y - r, e);
+    hits += clamp_axis(&objects[i].position.z, &objects[i].velocity.z, lo.z + r, hi.z - r, e);
+  }
+  return hits;
+}
+
+/**** Composed shapes: every sphere's contacts, resolved in order. Spheres are independent, so any thread count
+ * gives the same result ****/
+static int
+contain_shapes(const Container *container, Object objects[], const int particle_ct)
+{
+  const double e = container->restitution;
+  int hits = 0;
+
+  #pragma omp parallel for schedule(static) reduction(+:hits)
+  for (int i = 0; i < particle_ct; i++) {
+    ContainerContact contacts[CONTAINER_PASSES];
+    const int ct = containerContacts(container, objects[i].position, objects[i].radius, contacts);
+
+    for (int k = 0; k < ct; k++) {
+      const double vn = v_dot(objects[i].velocity, contacts[k].normal);
+      objects[i].position = v_along(objects[i].position, contacts[k].normal, contacts[k].overlap);
+      if (vn < 0) objects[i].velocity = v_along(objects[i].velocity, contacts[k].normal, -(1.0 + e) * vn);
+    }
+    hits += ct;
+  }
+  return hits;
+}
+
+int
+containObjects(const Container *container, Object objects[], const int particle_ct)
+{
+  int hits;
+
+  if (container->shape_ct == 0) return 0;
+  PROFILE_BEGIN(wall_start);
+  perf_enter();
+  TRACE_BEGIN(wall_trace);
+  // Only a box that is the container itself; a lone subtracted box is an obstacle to be kept out of
+  if (container->shape_ct == 1 && container->shapes[0].kind == SHAPE_BOX && container->shapes[0].op == SHAPE_UNION) {
+    hits = contain_box(container, objects, particle_ct);
+  } else {
+    hits = contain_shapes(container, objects, particle_ct);
+  }
+  TRACE_END(TRACE_WALLS, wall_trace, particle_ct, hits);
+  perf_leave(PERF_WALLS);
+  PROFILE_END(PHASE_WALL, wall_start);
+  return hits;
+}
@@ -0,0 +1,37 @@
+#include <string.h>
+#include "../include/ForceField.h"
+
+static const char *kind_names[FIELD_KIND_CT] = {
+#define FIELD_NAME(kind, suffix, name) name,
+  FORCE_FIELDS(FIELD_NAME)
+#undef FIELD_NAME
+};
+
+ForceField
+createForceField(const int kind)
+{
+  return (ForceField){
+    .kind = kind,
+    .gravity = (Vector3){-9.81, 0, 0},
+    .drag = 0.0,
+    .stiffness = 1.0,
+    .center = (Vector3){5, 5, 5},
+    .path_radius = 5.0
+  };
+}
+
+const char *
+field_kindName(const int kind)
+{
+  if (kind < 0 || kind >= FIELD_KIND_CT) return NULL;
+  return kind_names[kind];
+}
+
+int
+field_kindOf(const char *name)
+{
+  for (int k = 0; k < FIELD_KIND_CT; k++) {
+    if (strcmp(name, kind_names[k]) == 0) return k;
+  }
+  return -1;
+}
@@ -54,7 +54,7 @@ Q_normalize(Vector3 a)
 Vector3
 normalize(Vector3 a)
 {
-  return scaleVector(a, 1.0 / sqrt(magnitude(a)));
+  return scaleVector(a, 1.0 / magnitude(a));
 }
 
 // Returns a double between 0 and 10
@@ -69,6 +69,24 @@ randomVector()
   return (Vector3){randomPosition(), randomPosition(), randomPosition()};
 }
 
+// splitmix64 finalizer applied to the counter offset by the seed
+uint64_t
+rng_hash(const uint64_t seed, const uint64_t counter)
+{
+  uint64_t z = seed + (counter + 1) * 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// Top 53 bits of the hash give an evenly spaced double in [0, 1)
+double
+rng_uniform(Rng *rng)
+{
+  uint64_t bits = rng_hash(rng->seed, rng->counter++);
+  return (double)(bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
 // Adds two vectors
 Vector3
 addVectors(Vector3 a, const Vector3 b)
@@ -133,5 +151,13 @@ createCube(Vector3 __origin, Vector3 __min, Vector3 __max, double __size)
   cube.min = __min;
   cube.max = __max;
   cube.size = __size;
+  cube.periodic = 0;
   return cube;
+}
+
+Cube
+createBox(Vector3 min, Vector3 max)
+{
+  const Vector3 extent = subtractVectors(max, min);
+  return createCube(min, min, max, fmax(extent.x, fmax(extent.y, extent.z)));
 }
\ No newline at end of file
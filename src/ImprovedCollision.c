@@ -1,22 +1,33 @@
 #include "../include/ImprovedCollision.h"
+#include "../include/Profile.h"
+#include "../include/PerfCounters.h"
+#include "../include/Trace.h"
+#include "../include/Alloc.h"
 
-/**** Calcs number of partitions on each side; is_Cubic is a check for perfect Cube ****/
-static int
-is_Cubic(int num)
+/**** Each axis is sized on its own, so a tall column gets a tall grid rather than a cube of mostly empty cells ****/
+Int3
+gridDims(const Cube cube, const double min_edge, const int max_cells)
 {
-  int root = round(cbrt(num));
-  return num == root * root * root;
+  const Vector3 extent = cubeExtent(&cube);
+  double edge = min_edge;
+  Int3 dims;
+
+  if (max_cells > 0) edge = fmax(edge, cbrt(extent.x * extent.y * extent.z / max_cells));
+  dims = (Int3){(int)(extent.x / edge), (int)(extent.y / edge), (int)(extent.z / edge)};
+  if (dims.x < 1) dims.x = 1;
+  if (dims.y < 1) dims.y = 1;
+  if (dims.z < 1) dims.z = 1;
+  return dims;
 }
 
-int
-mapSize(Object objects[], double cube_size)
+/**** Calcs number of partitions along each axis from the largest particle, about 2N or fewer so a dilute box
+ * doesn't scan mostly empty buckets ****/
+Int3
+mapSize(const Object objects[], const int particle_ct, const Cube cube)
 {
-  const double max_radius = objects[0].radius;
-  int axis_ct = (int)(cube_size / (2.0 * max_radius));
-  while (!is_Cubic(axis_ct)) {
-    axis_ct--;                                       // Decrement till perfect cube
-  }
-  return axis_ct;      // Return number of partitions
+  double max_radius = 0;
+  for (int i = 0; i < particle_ct; i++) max_radius = fmax(max_radius, objects[i].radius);
+  return gridDims(cube, 2.0 * max_radius, 2 * particle_ct);
 }
 
 /**** Initializes values of objects to random vectors and set radius ****/
@@ -49,146 +60,393 @@ unit_direction(Vector3 position)
   return (Vector3){xdir, ydir, zdir};
 }
 
-/**** Gravity in z direction, velocity dependent centripetal acceleration in xy-plane ****/ 
-Vector3
-physics(Vector3 position, Vector3 velocity)
-{
-  double path_radius = 5.0, gravity = 9.81;    // System defn
-  double ax, ay, az;
-  Vector3 unit = unit_direction(position);   // Unit vector
-  ax = (fabs(velocity.x) < tol && fabs(position.x) < tol) ? 0 : -gravity;
-  // Calculates x and y accelerations
-  az = 0.5 * velocity.z * velocity.z / path_radius;
-  ay = 0.5 * velocity.y * velocity.y / path_radius;
-  // Scales to unit vector
-  az *= unit.z;
-  ay *= unit.y;
-  // Returns acceleration vector
-  return (Vector3){ax, ay, az};
-}
-
-/**** Midstep/Velocity Verlet implementation ****/
+static const char *integrator_names[INTEGRATOR_KIND_CT] = {"midstep", "verlet", "euler"};
+
+/* Kernel preamble: particle i's attached force f (held over the step), cached acceleration a, velocity v and
+ * position p as components, so a whole step stays in registers */
+#define KERNEL_LOAD                                                                                 \
+  Object *obj = &objects[i];                                                                        \
+  const double f[3] = {(extra != NULL) ? extra[i].x : 0.0, (extra != NULL) ? extra[i].y : 0.0,      \
+                       (extra != NULL) ? extra[i].z : 0.0};                                         \
+  const double a[3] = {obj->acceleration.x, obj->acceleration.y, obj->acceleration.z};              \
+  double v[3] = {obj->velocity.x, obj->velocity.y, obj->velocity.z};                                \
+  double p[3] = {obj->position.x, obj->position.y, obj->position.z}, acc[3]
+
+/**** Three loops per force field, each with its field inlined:
+ * midstep_  half kick and drift, the field at the half step, then kick and drift again and the field at the end
+ * euler_    semi-implicit Euler, v += a(p, v) dt then p += v dt
+ * kick_     closing half kick of velocity Verlet, at the drifted position with the velocity predicted from the
+ *           cached acceleration; the result is cached for the next step's opening half kick ****/
+#define FIELD_KERNELS(kind, suffix, name)                                                           \
+static int                                                                                         \
+midstep_##suffix(Object objects[], const ForceField *ff, const Vector3 extra[], const int particle_ct, \
+                 const double dt)                                                                  \
+{                                                                                                  \
+  int updated = 0;                                                                                 \
+  _Pragma("omp for schedule(static) nowait")                                                       \
+  for (int i = 0; i < particle_ct; i++) {                                                          \
+    KERNEL_LOAD;                                                                                   \
+    for (int k = 0; k < 3; k++) {                                                                  \
+      v[k] = v[k] + a[k] * (dt * 0.5);                                                             \
+      p[k] = p[k] + v[k] * (dt * 0.5);                                                             \
+    }                                                                                              \
+    field_##suffix(ff, p, v, acc);                                                                 \
+    for (int k = 0; k < 3; k++) {                                                                  \
+      v[k] = v[k] + (acc[k] + f[k]) * (0.5 * dt);                                                  \
+      p[k] = p[k] + v[k] * (0.5 * dt);                                                             \
+    }                                                                                              \
+    field_##suffix(ff, p, v, acc);                                                                 \
+    obj->position = (Vector3){p[0], p[1], p[2]};                                                   \
+    obj->velocity = (Vector3){v[0], v[1], v[2]};                                                   \
+    obj->acceleration = (Vector3){acc[0] + f[0], acc[1] + f[1], acc[2] + f[2]};                    \
+    updated++;                                                                                     \
+  }                                                                                                \
+  return updated;                                                                                  \
+}                                                                                                  \
+                                                                                                   \
+static int                                                                                         \
+euler_##suffix(Object objects[], const ForceField *ff, const Vector3 extra[], const int particle_ct, \
+               const double dt)                                                                    \
+{                                                                                                  \
+  int updated = 0;                                                                                 \
+  _Pragma("omp for schedule(static) nowait")                                                       \
+  for (int i = 0; i < particle_ct; i++) {                                                          \
+    KERNEL_LOAD;                                                                                   \
+    (void)a;                                                                                       \
+    field_##suffix(ff, p, v, acc);                                                                 \
+    for (int k = 0; k < 3; k++) {                                                                  \
+      acc[k] += f[k];                                                                              \
+      v[k] = v[k] + acc[k] * dt;                                                                   \
+      p[k] = p[k] + v[k] * dt;                                                                     \
+    }                                                                                              \
+    obj->position = (Vector3){p[0], p[1], p[2]};                                                   \
+    obj->velocity = (Vector3){v[0], v[1], v[2]};                                                   \
+    obj->acceleration = (Vector3){acc[0], acc[1], acc[2]};                                         \
+    updated++;                                                                                     \
+  }                                                                                                \
+  return updated;                                                                                  \
+}                                                                                                  \
+                                                                                                   \
+static int                                                                                         \
+kick_##suffix(Object objects[], const ForceField *ff, const Vector3 extra[], const int particle_ct, \
+              const double dt)                                                                     \
+{                                                                                                  \
+  int updated = 0;                                                                                 \
+  _Pragma("omp for schedule(static) nowait")                                                       \
+  for (int i = 0; i < particle_ct; i++) {                                                          \
+    KERNEL_LOAD;                                                                                   \
+    double predicted[3];                                                                           \
+    for (int k = 0; k < 3; k++) predicted[k] = v[k] + a[k] * (0.5 * dt);                           \
+    field_##suffix(ff, p, predicted, acc);                                                         \
+    for (int k = 0; k < 3; k++) {                                                                  \
+      acc[k] += f[k];                                                                              \
+      v[k] = v[k] + acc[k] * (0.5 * dt);                                                           \
+    }                                                                                              \
+    obj->velocity = (Vector3){v[0], v[1], v[2]};                                                   \
+    obj->acceleration = (Vector3){acc[0], acc[1], acc[2]};                                         \
+    updated++;                                                                                     \
+  }                                                                                                \
+  return updated;                                                                                  \
+}
+FORCE_FIELDS(FIELD_KERNELS)
+#undef FIELD_KERNELS
+#undef KERNEL_LOAD
+
+enum KernelPass {PASS_MIDSTEP, PASS_EULER, PASS_KICK};
+
+/**** Runs one kernel over every particle. The field's loop is picked once per call; forces NULL is the default
+ * spin field and field may be NULL ****/
+static void
+integrate_pass(Object objects[], const ForceField *forces, const Vector3 field[], const int particle_ct,
+               const double dt, const enum KernelPass pass)
+{
+  const ForceField spin = createForceField(FIELD_SPIN);
+  const ForceField *ff = (forces != NULL) ? forces : &spin;
+
+  PROFILE_BEGIN(integrate_start);
+  perf_enter();
+  #pragma omp parallel
+  {
+    int updated = 0;
+    TRACE_BEGIN(integrate_trace);
+
+    switch (ff->kind) {
+#define FIELD_CASE(kind, suffix, name)                                                              \
+      case kind:                                                                                    \
+        if (pass == PASS_MIDSTEP) updated = midstep_##suffix(objects, ff, field, particle_ct, dt);  \
+        else if (pass == PASS_EULER) updated = euler_##suffix(objects, ff, field, particle_ct, dt); \
+        else updated = kick_##suffix(objects, ff, field, particle_ct, dt);                          \
+        break;
+      FORCE_FIELDS(FIELD_CASE)
+#undef FIELD_CASE
+      default: break;
+    }
+    TRACE_END(TRACE_INTEGRATE, integrate_trace, updated, 0);
+  }
+  perf_leave(PERF_INTEGRATE);
+  PROFILE_END(PHASE_INTEGRATE, integrate_start);
+}
+
+/**** Loops through object array and updates for inputted timestep ****/
 void
-handleUpdate(Object *object, const double dt)
+updateObjects(Object objects[], const ForceField *forces, const Vector3 field[], const int particle_ct,
+              const double dt)
 {
-  Vector3 new_position, new_velocity;
-  Vector3 half_velocity, half_position, half_acceleration;
+  integrate_pass(objects, forces, field, particle_ct, dt, PASS_MIDSTEP);
+}
 
-  half_velocity = addVectors(object->velocity, scaleVector(object->acceleration, dt * 0.5));
-  half_position = addVectors(object->position, scaleVector(half_velocity, dt * 0.5));
-  half_acceleration = physics(half_position, half_velocity);
+void
+eulerObjects(Object objects[], const ForceField *forces, const Vector3 field[], const int particle_ct,
+             const double dt)
+{
+  integrate_pass(objects, forces, field, particle_ct, dt, PASS_EULER);
+}
 
-  new_velocity = addVectors(half_velocity, scaleVector(half_acceleration, 0.5 * dt));
-  new_position = addVectors(half_position, scaleVector(new_velocity, 0.5 * dt));
+/**** Opening half kick with the cached acceleration and a full drift; needs no force evaluation ****/
+void
+driftObjects(Object objects[], const int particle_ct, const double dt)
+{
+  PROFILE_BEGIN(integrate_start);
+  perf_enter();
+  #pragma omp parallel
+  {
+    int updated = 0;
+    TRACE_BEGIN(integrate_trace);
+
+    #pragma omp for schedule(static) nowait
+    for (int i = 0; i < particle_ct; i++) {
+      Object *obj = &objects[i];
+      obj->velocity.x += obj->acceleration.x * (0.5 * dt);
+      obj->velocity.y += obj->acceleration.y * (0.5 * dt);
+      obj->velocity.z += obj->acceleration.z * (0.5 * dt);
+      obj->position.x += obj->velocity.x * dt;
+      obj->position.y += obj->velocity.y * dt;
+      obj->position.z += obj->velocity.z * dt;
+      updated++;
+    }
+    TRACE_END(TRACE_INTEGRATE, integrate_trace, updated, 0);
+  }
+  perf_leave(PERF_INTEGRATE);
+  PROFILE_END(PHASE_INTEGRATE, integrate_start);
+}
 
-  object->position = new_position;
-  object->velocity = new_velocity;
-  object->acceleration = physics(object->position, object->velocity);
+void
+kickObjects(Object objects[], const ForceField *forces, const Vector3 field[], const int particle_ct,
+            const double dt)
+{
+  integrate_pass(objects, forces, field, particle_ct, dt, PASS_KICK);
 }
 
-/**** Loops through object array and updates for inputted timestep ****/
 void
-updateObjects(Object objects[], const int particle_ct, const double dt)
+wrapObjects(Object objects[], const Cube cube, const int particle_ct)
 {
+  const double lo[3] = {cube.min.x, cube.min.y, cube.min.z};
+  const double period[3] = {cube.max.x - cube.min.x, cube.max.y - cube.min.y, cube.max.z - cube.min.z};
+
+  #pragma omp parallel for schedule(static)
   for (int i = 0; i < particle_ct; i++) {
-    (void)handleUpdate(&objects[i], dt);
+    double p[3] = {objects[i].position.x, objects[i].position.y, objects[i].position.z};
+    for (int k = 0; k < 3; k++) {
+      if (p[k] >= lo[k] && p[k] < lo[k] + period[k]) continue;
+      p[k] -= period[k] * floor((p[k] - lo[k]) / period[k]);
+      if (p[k] >= lo[k] + period[k]) p[k] = lo[k];      // Rounding of a tiny negative offset
+    }
+    objects[i].position = (Vector3){p[0], p[1], p[2]};
+  }
+}
+
+const char *
+integrator_kindName(const int kind)
+{
+  if (kind < 0 || kind >= INTEGRATOR_KIND_CT) return NULL;
+  return integrator_names[kind];
+}
+
+int
+integrator_kindOf(const char *name)
+{
+  for (int k = 0; k < INTEGRATOR_KIND_CT; k++) {
+    if (strcmp(name, integrator_names[k]) == 0) return k;
   }
+  return -1;
 }
 
 /**** Calculates the 1D index of a 3D array casted as a 1D array ****/
 int
-grid_indexCalc(const Int3 index_vec, const int axis_ct) {
-  return (int)(index_vec.x) * axis_ct * axis_ct + (int)(index_vec.y) * axis_ct + (int)(index_vec.z);
+grid_indexCalc(const Int3 index_vec, const Int3 dims) {
+  return (int)(index_vec.x) * dims.y * dims.z + (int)(index_vec.y) * dims.z + (int)(index_vec.z);
 }
 
 /**** Decomposes a 1D index into 3D indices ****/
 Int3
-decompose_1Dindex(const int index, const int axis_ct)
+decompose_1Dindex(const int index, const Int3 dims)
 {
   // Decomposes the 1D index into a vector of indices to modify
-  int x = (int)(index / (axis_ct * axis_ct)); 
-  int y = (int)(index / axis_ct) % axis_ct;
-  int z = index % axis_ct;
+  int x = (int)(index / (dims.y * dims.z)); 
+  int y = (int)(index / dims.z) % dims.y;
+  int z = index % dims.z;
   return (Int3){x, y, z};
 }
 
-/**** Add particle's absolute position to hashtable ****/
+/**** Per axis of n cells. Walled: cells c, c + 3, ... for colours 0..2. Periodic: the same classes over the first
+ * 3 (n / 3) cells, which stay at least 3 apart across the wrap, and each leftover cell alone ****/
+static int
+axis_colours(const int axis_ct, const int periodic)
+{
+  if (!periodic) return 3;
+  return ((axis_ct >= 3) ? 3 : 0) + axis_ct % 3;
+}
+
 int
-insert_obj(Map *map[], const Grid grid[], const int grid_index, const int obj_index)
+sweep_colours(const Int3 dims, const int periodic)
+{
+  return axis_colours(dims.x, periodic) * axis_colours(dims.y, periodic) * axis_colours(dims.z, periodic);
+}
+
+static void
+sweep_axis(const int axis_ct, const int periodic, const int colour, int *first, int *count)
 {
-  // Create memory
-  Map *new = (Map*)safe_malloc(sizeof(Map));
-  if (new == NULL) return -1;
+  const int full = (periodic && axis_ct >= 3) ? 3 : 0;
+
+  if (!periodic) {
+    (*first) = colour;
+    (*count) = (colour < axis_ct) ? (axis_ct - colour + 2) / 3 : 0;
+  } else if (colour < full) {
+    (*first) = colour;
+    (*count) = axis_ct / 3;
+  } else {
+    (*first) = axis_ct / 3 * 3 + colour - full;
+    (*count) = 1;
+  }
+}
+
+SweepClass
+sweepClass(const Int3 dims, const int periodic, const int colour)
+{
+  const Int3 colours = {axis_colours(dims.x, periodic), axis_colours(dims.y, periodic), axis_colours(dims.z, periodic)};
+  const Int3 c = decompose_1Dindex(colour, colours);
+  SweepClass sweep;
+
+  sweep_axis(dims.x, periodic, c.x, &sweep.first.x, &sweep.count.x);
+  sweep_axis(dims.y, periodic, c.y, &sweep.first.y, &sweep.count.y);
+  sweep_axis(dims.z, periodic, c.z, &sweep.first.z, &sweep.count.z);
+  return sweep;
+}
+
+/**** Pushes a pooled node for obj_index onto its bucket; the head node carries the bucket size ****/
+int
+insert_obj(Map *map[], Map *node, const Grid grid, const int grid_index, const int obj_index)
+{
+  if (node == NULL) return -1;
 
   // Instantiate new map node
-  new->obj_index = obj_index;
-  new->grid = grid[grid_index];
-  new->next = NULL;
+  node->obj_index = obj_index;
+  node->grid = grid;
+  node->next = NULL;
 
   // Insert into map
-  if (map[grid_index]->obj_index == -1) {             // Empty Bucket
-    new->count = 1;
-    map[grid_index] = new;
+  if (map[grid_index]->obj_index == -1) {             // Empty Bucket, the sentinel drops out
+    node->count = 1;
+    map[grid_index] = node;
   } else {
-    new->next = map[grid_index];
-    map[grid_index] = new;
-    (map[grid_index]->count)++;
+    node->count = map[grid_index]->count + 1;
+    node->next = map[grid_index];
+    map[grid_index] = node;
   }
 
   return 0;
 }
 
-/**** Map instantiation ****/
-Map **
-createMap(const Object objects[], const Cube cube, 
-          const int axis_ct, const int particle_ct, int *status)
+/**** Cell coordinate clamped to the grid so a particle pushed past a wall lands in a boundary bucket. NaN goes
+ * to cell 0 rather than indexing out of the grid ****/
+static int
+clamp_index(const double scaled, const int axis_ct)
 {
-  double partition_length = (double)(cube.size / axis_ct);
+  if (!(scaled >= 0)) return 0;
+  if (scaled >= axis_ct) return axis_ct - 1;
+  return (int)scaled;
+}
+
+/**** Bytes for partition_ct bucket heads, as many sentinels and one node per particle ****/
+static size_t
+store_bytes(const int partition_ct, const int particle_ct)
+{
+  return partition_ct * sizeof(Map*) + ((size_t)partition_ct + particle_ct) * sizeof(Map);
+}
+
+/**** Rebuilds the cell list in store, growing it only when the grid or particle count grew ****/
+int
+buildMap(MapStore *store, const Object objects[], const Cube cube, const Int3 dims, const int particle_ct)
+{
+  PROFILE_BEGIN(alloc_start);
+  const Vector3 extent = cubeExtent(&cube);
+  const Vector3 partition_length = {extent.x / dims.x, extent.y / dims.y, extent.z / dims.z};
+  const Vector3 inv_length = {1.0 / partition_length.x, 1.0 / partition_length.y, 1.0 / partition_length.z};
+  const int partition_ct = grid_partitionCount(dims);
+  const size_t bytes = store_bytes(partition_ct, particle_ct);
   Vector3 index_vec;
-  int i = 0, partition_ct = axis_ct * axis_ct * axis_ct, grid_index = 0;
-  Grid *grid = (Grid*)safe_malloc(partition_ct * sizeof(Grid));
-  Map **map = (Map**)safe_malloc(partition_ct * sizeof(Map*));
-  Map *init;
+  Int3 cell;
+  Map *sentinels, *nodes;
+  int grid_index;
+
+  if (bytes > store->capacity) {
+    tracked_free(store->map);
+    store->map = (Map**)tracked_malloc(bytes, ALLOC_MAP);
+    store->capacity = (store->map != NULL) ? bytes : 0;
+    if (store->map == NULL) return -1;
+  }
+  store->partition_ct = partition_ct;
+  sentinels = (Map*)(store->map + partition_ct);
+  nodes = sentinels + partition_ct;
 
   // Reset every bucket
-  for (i = 0; i < partition_ct; i++) {
-    init = (Map*)safe_malloc(sizeof(Map));
-    init->next = NULL;
-    init->count = 0;
-    init->obj_index = -1;
-    map[i] = init;
+  for (int i = 0; i < partition_ct; i++) {
+    sentinels[i].next = NULL;
+    sentinels[i].count = 0;
+    sentinels[i].obj_index = -1;
+    store->map[i] = &sentinels[i];
   }
+  PROFILE_END(PHASE_MAP_ALLOC, alloc_start);
 
-  i = 0;
-  for (double dz = 0; dz < cube.size; dz += partition_length) {
-    for (double dy = 0; dy < cube.size; dy += partition_length) {
-      for (double dx = 0; dx < cube.size; dx += partition_length) {
-        index_vec = (Vector3){dx, dy, dz};
-        grid[i].bounds[0] = index_vec;
-        grid[i].bounds[1] = addScalar(index_vec, partition_length);
-        i++;
-      }
-    }
+  PROFILE_BEGIN(binning_start);
+  for (int i = 0; i < particle_ct; i++) {
+    // Find index of the position relative to the box corner
+    index_vec = subtractVectors(objects[i].position, cube.min);
+    cell = (Int3){clamp_index(index_vec.x * inv_length.x, dims.x), clamp_index(index_vec.y * inv_length.y, dims.y),
+                  clamp_index(index_vec.z * inv_length.z, dims.z)};
+    grid_index = grid_indexCalc(cell, dims);
+
+    // Bounds of the bucket, (x, y, z) cell coordinates scaled to the partition
+    index_vec = addVectors(cube.min, (Vector3){cell.x * partition_length.x, cell.y * partition_length.y,
+                                               cell.z * partition_length.z});
+    (void)insert_obj(store->map, &nodes[i], (Grid){{index_vec, addVectors(index_vec, partition_length)}}, grid_index, i);
   }
+  PROFILE_END(PHASE_BINNING, binning_start);
 
-  // Iterate and add each objects absolute position to the map TODO: MAKE FUNC
-  for (i = 0; i < particle_ct; i++) {
-    // Find index of absolute position
-
-    index_vec = scaleVector(objects[i].position, 1.0 / partition_length);
-    grid_index = grid_indexCalc((Int3){(int)index_vec.x, (int)index_vec.y, (int)index_vec.z}, axis_ct);
-    
-    // Place new particle in table
-    if (insert_obj(map, grid, grid_index, i) != 0) {
-      destroy_map(map, partition_ct);
-      free(grid);
-      (*status) = -1; 
-      return NULL;
-    }
-  }
+  return 0;
+}
+
+void
+destroy_mapStore(MapStore *store)
+{
+  tracked_free(store->map);
+  store->map = NULL;
+  store->capacity = 0;
+  store->partition_ct = 0;
+}
+
+/**** Map instantiation: a one-off cell list in a single block, released with destroy_map ****/
+Map **
+createMap(const Object objects[], const Cube cube, 
+          const Int3 dims, const int particle_ct, int *status)
+{
+  MapStore store = {NULL, 0, 0};
 
-  free(grid);
-  return map;
+  if (buildMap(&store, objects, cube, dims, particle_ct) != 0) {
+    (*status) = -1;
+    return NULL;
+  }
+  return store.map;
 }
 
 /**** Standard Print of position, velocity, acceleration vectors for each object ****/
@@ -203,54 +461,58 @@ print_positions(const Object objects[], const int particle_ct)
   }
 }
 
-/**** Calculates the scan array of indices for iterating through positions ****/
-static int *
-calculate_scan(Int3 (*scan)[3][3], Int3 center, const int axis_ct)
+/**** Calculates the scan array of indices for iterating through positions; periodic grids wrap ****/
+static void
+calculate_scan(Int3 (*scan)[3][3], int indices[27], Int3 center, const Int3 dims, const int periodic)
 {
-  int *indices = (int*)safe_malloc(27 * sizeof(int));
-
   for (int i = 0; i < 3; i++) {
     for (int j = 0; j < 3; j++) {
       for (int k = 0; k < 3; k++) {
         scan[i][j][k] = (Int3){center.x + (1 - i), center.y + (1 - j), center.z + (1 - k)};
-        indices[i * 3 * 3 + j * 3 + k] = grid_indexCalc(scan[i][j][k], axis_ct);
+        if (periodic) scan[i][j][k] = wrap_cell(scan[i][j][k], dims);
+        indices[i * 3 * 3 + j * 3 + k] = grid_indexCalc(scan[i][j][k], dims);
       }
     }
   }
-
-  return indices;
 }
 
 /**** handles a collision between two particles moving them along the axis of intersection*/
 void
 handleCollision(Object *src, Object *deflecting)
+{
+  resolveCollision(src, deflecting, subtractVectors(src->position, deflecting->position));
+}
+
+/**** Same, with the separation src - deflecting given so a periodic box can pass its nearest image.
+ * Coincident centres, e.g. two spheres clamped into the same box corner, are parted along x ****/
+void
+resolveCollision(Object *src, Object *deflecting, const Vector3 separation)
 {
   const double restitution = 0.75;    // Inelastic
+  const double distance = magnitude(separation);
   double overlap;
   double normal_speed, impulse_scalar; 
   Vector3 normal, relative_velocity, impulse, normal_inv, displacement;
 
   // creates normal vector and adjusts magnitude to 1
-  normal = subtractVectors(src->position, deflecting->position);
-  normal_inv = subtractVectors(deflecting->position, src->position);
-  overlap = src->radius + deflecting->radius - magnitude(normal);
-  normal = normalize(normal);
+  overlap = src->radius + deflecting->radius - distance;
+  normal = (distance > 0) ? scaleVector(separation, 1.0 / distance) : (Vector3){1, 0, 0};
   // Finds relative velocity
   relative_velocity = subtractVectors(src->velocity, deflecting->velocity);
 
   // Fixes position
-  normal_inv = normalize(normal_inv);
+  normal_inv = scaleVector(normal, -1.0);
   displacement = scaleVector(normal_inv, overlap * 0.5);
 
   // normal speed is a scalar quantity
   normal_speed = dotProduct(normal, relative_velocity);
   // Apply overlap shift even if diverging
-  src->position = addVectors(src->position, displacement);
+  src->position = subtractVectors(src->position, displacement);
   deflecting->position = addVectors(deflecting->position, displacement);
   if (normal_speed > 0) return; // Diverging -> Don't rectify
 
-  // Calculates scalar impulse from the magnitude of the normal
-  impulse_scalar = (1.0 + restitution) * -normal_speed;
+  // Calculates scalar impulse from the magnitude of the normal, shared by the reduced mass
+  impulse_scalar = (1.0 + restitution) * -normal_speed / (1.0 / src->mass + 1.0 / deflecting->mass);
 
   // Vector impulse
   impulse = scaleVector(normal, impulse_scalar);
@@ -260,151 +522,165 @@ handleCollision(Object *src, Object *deflecting)
   deflecting->velocity = subtractVectors(deflecting->velocity, scaleVector(impulse, (1.0 / deflecting->mass)));
 }
 
-/**** Calculates how much the object's position needs to be shifted in a direction ****/
+static CollisionStats last_stats;
+
+/**** Counts a bucket of size ct into the occupancy histogram ****/
 static void
-overlap(double min, double max, double *position, double radius)
+record_occupancy(CollisionStats *stats, const int ct)
 {
-  // printf("Min: %lf, Max: %lf, Position: %lf\n", min, max, (*position));
-  double shift = 0;
-  double upper = max - (*position) - radius;
-  double lower = (*position) - min - radius;
-
-  // printf("  Upper: %lf\n  Lower: %lf\n", upper, lower);
-  if (upper < 0 || lower < 0) {
-    // printf("Wall collision\n");
-  }
-
-  if (upper < 0) {
-    (*position) += upper;
-  } else if (lower < 0) {
-    (*position) -= lower;
-  }
+  stats->cells++;
+  stats->occupancy[(ct < OCCUPANCY_BINS) ? ct : OCCUPANCY_BINS - 1]++;
+  if (ct == 0) return;
+  stats->occupied_cells++;
+  stats->binned += ct;
+  if (ct > stats->max_occupancy) stats->max_occupancy = ct;
 }
 
-/**** Checks indices for out of bounds. Rectifies ****/
+/**** Resolves every particle of bucket i against its 3x3x3 neighbourhood ****/
 static void
-processWall(Cube cube, Object *object, Int3 center, 
-            Int3 bad_index, int obj_index, const int axis_ct)
+collide_bucket(Cube cube, Object objects[], Map *map[], const int i, const Int3 dims, CollisionStats *stats)
 {
-  double restitution = 0.75;
-
-  Vector3 min = cube.min, max = cube.max;
-
-  if ((bad_index.x < 0 || bad_index.x >= axis_ct) && object->wall.x == 0) {
-    
-    if (max.x - center.x > (object->radius) && center.x - min.x > (object->radius)) {
-      return;
-    }
+  Map *curr = NULL, *adjust = NULL;
+  Int3 scan[3][3][3], bad_index, center;
+  int indices[27];
+  double distance = 0;
+  Vector3 separation;
 
-    object->velocity.x *= -restitution;
-    overlap(min.x, max.x, &object->position.x, object->radius);
-    object->wall.x = 1;
-  }
-  
-  if ((bad_index.y < 0 || bad_index.y >= axis_ct) && object->wall.y == 0) {
-    if (max.y - center.y > (object->radius) && center.y - min.y > (object->radius)) {
-      return;
-    }
+  center = decompose_1Dindex(i, dims);
+  PROFILE_BEGIN(scan_start);
+  calculate_scan(scan, indices, center, dims, cube.periodic);
+  PROFILE_END(PHASE_NEIGHBOR_SCAN, scan_start);
 
-    object[obj_index].velocity.y *= -restitution;
-    overlap(min.y, max.y, &object->position.y, object->radius);
-    object->wall.y = 1;
+  if (map[i]->obj_index == -1) {
+    record_occupancy(stats, 0);
+    return;
   }
-
-  if ((bad_index.z < 0 || bad_index.z >= axis_ct) && object->wall.z == 0) {
-    if (max.z - center.z > (object->radius) && center.z - min.z > (object->radius)) {
-      return;
+  record_occupancy(stats, map[i]->count);
+  // iterate through each particle in curr
+  PROFILE_BEGIN(narrow_start);
+  for (curr = map[i]; curr != NULL; curr = curr->next) {
+
+    // Loop through 3x3x3 cube
+    for (int j = 0; j < 27; j++) {
+      bad_index = decompose_1Dindex(j, (Int3){3, 3, 3});
+      if (sweep_repeats((Int3){1 - bad_index.x, 1 - bad_index.y, 1 - bad_index.z}, dims, cube.periodic)) continue;
+      bad_index = scan[bad_index.x][bad_index.y][bad_index.z];
+      if (!grid_contains(bad_index, dims)) continue;  // Past the walls; containObjects keeps particles inside
+
+      // Checking other objects; buckets are NULL terminated lists
+      if (map[indices[j]]->obj_index == -1) stats->empty_visits++;
+      for (adjust = map[indices[j]]; adjust != NULL && adjust->obj_index != -1; adjust = adjust->next) {
+        if (adjust->obj_index == curr->obj_index) continue;     // Skip self
+        stats->pairs_tested++;
+
+        separation = minimumImage(&cube, subtractVectors(objects[curr->obj_index].position,
+                                                         objects[adjust->obj_index].position));
+        distance = magnitude(separation);
+        if (distance < objects[curr->obj_index].radius + objects[adjust->obj_index].radius) {
+          // If all other checks are false then there is a possible collision that needs to be processed
+          PROFILE_BEGIN(collision_start);
+          resolveCollision(&objects[curr->obj_index], &objects[adjust->obj_index], separation);
+          PROFILE_END(PHASE_COLLISION, collision_start);
+          stats->contacts++;
+        }
+      }
     }
-
-    object[obj_index].velocity.z *= -restitution;
-    overlap(min.z, max.z, &object->position.z, object->radius);
-    object->wall.z = 1;
   }
+  PROFILE_END(PHASE_NARROW, narrow_start);
 }
 
-/**** Main collision update loop. Iterates over 3x3x3 grid checking each particle in radius and rectify collisions ****/
+/**** Main collision update loop. Iterates over 3x3x3 grid checking each particle in radius and rectify collisions
+ * Buckets are split into colours by sweepClass, 27 of them by (x % 3, y % 3, z % 3) in a walled box. Two buckets
+ * of one colour are at least three cells apart on some axis, so their neighbourhoods share no particles and a
+ * colour's buckets run in parallel. The sweep order doesn't depend on the thread count, so results are identical
+ * for any OMP_NUM_THREADS. The cell list is rebuilt in store, so once store has grown a pass allocates nothing.
+ * Neighbourhoods wrap in a periodic box, and an axis under 3 cells is merged into one cell. Walls are not part of
+ * the pass: containObjects keeps particles inside after integration ****/
 void
-collisionCall(Cube cube, Object objects[], const int partition_ct, const int particle_ct, const int axis_ct)
+collisionStep(MapStore *store, Cube cube, Object objects[], const int particle_ct, const Int3 grid_dims)
 {
-  int status = 0;
-  Map **map = createMap(objects, cube, axis_ct, particle_ct, &status);
-  Map *curr = NULL, *adjust = NULL;
-  Int3 scan[3][3][3], bad_index, center;
-  int *indices = NULL, step = 0;
-  double distance = 0;
-
-  for (int i = 0; i < particle_ct; i++) {
-    objects[i].wall = (Int3){0, 0, 0};
+  Map **map;
+  int status;
+  const Int3 dims = sweep_dims(grid_dims, cube.periodic);
+  const int colour_ct = sweep_colours(dims, cube.periodic);
+  CollisionStats stats;
+
+  memset(&stats, 0, sizeof(CollisionStats));
+  perf_enter();
+  TRACE_BEGIN(map_trace);
+  status = buildMap(store, objects, cube, dims, particle_ct);
+  map = store->map;
+  TRACE_END(TRACE_MAP, map_trace, 0, 0);
+  perf_leave(PERF_MAP);
+  if (status != 0) {
+    last_stats = stats;
+    return;
   }
 
-  for (int i = 0; i < partition_ct; i++) {          // For bucket in hashtable
-
-    center = decompose_1Dindex(i, axis_ct);
-    indices = calculate_scan(scan, center, axis_ct);
-
-    if (map[i]->obj_index == -1) continue;
-    curr = map[i];
-    // iterate through each particle in curr
-    while (curr->obj_index != -1) {
-
-      // Loop through 3x3x3 cube
-      for (int j = 0; j < 27; j++) {
-        if (indices[j] < 0 || indices[j] >= axis_ct) {
-          // Handle a 'bad' index by checking if colliding with wall and handling
-          bad_index = decompose_1Dindex(j, 3);
-          // printf("Indices: <%d,%d,%d>\n", bad_index.x, bad_index.y, bad_index.z);
-          bad_index = scan[bad_index.x][bad_index.y][bad_index.z];
-          if (curr->obj_index >= particle_ct || curr->obj_index < 0) printf("Out of bounds\n");
-          // printf("Center <%d,%d,%d>\n", center.x, center.y, center.z);
-          (void)processWall(cube, &objects[curr->obj_index], center, bad_index, curr->obj_index, axis_ct);
-          continue;                                 // Can't be colliding with anything out of bounds
-        }
-
-        // Checking other objects
-        if (map[indices[j]]->obj_index == -1) continue;      // Empty bucket
-
-        // printf("Adjust bucket %d relative to src bucket %d\n", indices[j], i);
+  perf_enter();
+  TRACE_BEGIN(scan_trace);
+  #pragma omp parallel
+  {
+    CollisionStats local;
+    memset(&local, 0, sizeof(CollisionStats));
+
+    for (int colour = 0; colour < colour_ct; colour++) {
+      const SweepClass sweep = sweepClass(dims, cube.periodic, colour);
+
+      // Dynamic: dense buckets (the floor under gravity) cost far more than sparse ones
+      #pragma omp for schedule(dynamic, 4)
+      for (int k = 0; k < sweep.count.x * sweep.count.y * sweep.count.z; k++) {
+        const int bucket = grid_indexCalc(sweep_cell(&sweep, k), dims);
+        TRACE_BEGIN(bucket_trace);
+        collide_bucket(cube, objects, map, bucket, dims, &local);
+        TRACE_END(TRACE_BUCKET, bucket_trace, bucket, map[bucket]->count);
+      }
+    }
 
-        adjust = map[indices[j]];                   // Set relative object
+    #pragma omp critical
+    mergeCollisionStats(&stats, &local);
+  }
+  TRACE_END(TRACE_SCAN, scan_trace, 0, 0);
+  perf_leave(PERF_SCAN);
 
-        while (adjust->obj_index != -1) {
-          // printf("Adjusting\n");
+  last_stats = stats;
+}
 
-          // Moves adjust forward if indices[j] is in the absolute bucket
-          if (adjust->obj_index == curr->obj_index) {
+/**** One-off pass with a temporary cell list, for callers without a MapStore ****/
+void
+collisionCall(Cube cube, Object objects[], const int partition_ct, const int particle_ct, const Int3 dims)
+{
+  MapStore store = {NULL, 0, 0};
+  (void)partition_ct;
 
-            if (adjust->next->obj_index != -1) {
-              // printf("  Identical, more particles\n");
-              adjust = adjust->next;                // Shift off duplicate
-            // If they are identical and there are no other particles in bucket end 
-            } else if (adjust->next->obj_index == -1) {
-              // printf("  Identical, no other particles\n");
-              break;
-            }
-          }
+  collisionStep(&store, cube, objects, particle_ct, dims);
 
-          // printf("Absolute Particle %d: <%lf,%lf,%lf>\n", curr->obj_index, objects[curr->obj_index].position.x, objects[curr->obj_index].position.y, objects[curr->obj_index].position.z);
-          // printf("Ajusting Particle %d: <%lf,%lf,%lf>\n", adjust->obj_index, objects[adjust->obj_index].position.x, objects[adjust->obj_index].position.y, objects[adjust->obj_index].position.z);
+  perf_enter();
+  TRACE_BEGIN(destroy_trace);
+  destroy_mapStore(&store);
+  TRACE_END(TRACE_DESTROY_MAP, destroy_trace, 0, 0);
+  perf_leave(PERF_MAP);
+}
 
-          distance = magnitude(subtractVectors(objects[curr->obj_index].position, objects[adjust->obj_index].position));
-          // printf("Distance %lf\n", distance);
-          // scanf("%d", &step);
-          //printf("Distance: %lf\n", distance);
-          if (distance < objects[curr->obj_index].radius + objects[adjust->obj_index].radius) {
-            // If all other checks are false then there is a possible collision that needs to be processed
-            (void)handleCollision(&objects[curr->obj_index], &objects[adjust->obj_index]);
-          }
+CollisionStats
+get_collisionStats(void)
+{
+  return last_stats;
+}
 
-          if (adjust->next->obj_index == -1) break;        // No more particles in bucket
-          adjust = adjust->next;                  // Advance to next particle
-        }
-      }
-      if (curr->next == NULL) break;              // If no more in bucket end.
-      curr = curr->next;
-    }
-    free(indices);
-  }
-  (void)destroy_map(map, partition_ct);
+void
+mergeCollisionStats(CollisionStats *total, const CollisionStats *add)
+{
+  total->pairs_tested += add->pairs_tested;
+  total->contacts += add->contacts;
+  total->wall_hits += add->wall_hits;
+  total->empty_visits += add->empty_visits;
+  total->cells += add->cells;
+  total->occupied_cells += add->occupied_cells;
+  total->binned += add->binned;
+  if (add->max_occupancy > total->max_occupancy) total->max_occupancy = add->max_occupancy;
+  for (int b = 0; b < OCCUPANCY_BINS; b++) total->occupancy[b] += add->occupancy[b];
+  total->mean_occupancy = (total->occupied_cells > 0) ? (double)total->binned / total->occupied_cells : 0.0;
 }
 
 /**** Standard Print of components of Hashtable ****/
@@ -427,20 +703,12 @@ print_map(Map *map[], const int size)
   }
 }
 
-/**** Frees memory allocated to a map structure */
+/**** Frees a map from createMap; heads, sentinels and nodes share its one block */
 void
 destroy_map(Map *map[], const int size)
 {
-  Map *curr, *destroy;
-  // Iterates through array portion
-  for (int i = 0; i < size; i++) {
-    curr = map[i];
-    // Iterates through l_list portion and frees each node
-    while (curr != NULL) {
-      destroy = curr;
-      curr = curr->next;
-      free(destroy);
-    }
-  }
-  free(map);        // Frees memory allocated to pointer of type Map*
+  PROFILE_BEGIN(free_start);
+  (void)size;
+  tracked_free(map);
+  PROFILE_END(PHASE_MAP_ALLOC, free_start);
 }
\ No newline at end of file
@@ -0,0 +1,513 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include <strings.h>
+#include "../include/Mesh.h"
+#include "../include/Profile.h"
+#include "../include/PerfCounters.h"
+#include "../include/Trace.h"
+#include "../include/Alloc.h"
+
+/**** Grows a tracked array to hold at least needed elements, doubling; -1 on failure ****/
+static int
+grow_array(void **array, int *capacity, const int needed, const size_t size)
+{
+  int next = (*capacity > 0) ? *capacity : 64;
+  void *grown;
+
+  if (needed <= *capacity) return 0;
+  while (next < needed) next *= 2;
+  grown = tracked_realloc(*array, next * size, ALLOC_MESH);
+  if (grown == NULL) return -1;
+  *array = grown;
+  *capacity = next;
+  return 0;
+}
+
+static double
+component(const Vector3 v, const int axis)
+{
+  return (axis == 0) ? v.x : (axis == 1) ? v.y : v.z;
+}
+
+/**** Reorders triangles [lo, hi) so the k'th smallest centroid along axis sits at k with none larger before it ****/
+static void
+select_median(MeshTriangle triangles[], double centroids[], int lo, int hi, const int k, const int axis)
+{
+  while (hi - lo > 1) {
+    const double pivot = centroids[3 * ((lo + hi) / 2) + axis];
+    int i = lo, j = hi - 1;
+
+    while (i <= j) {
+      while (centroids[3 * i + axis] < pivot) i++;
+      while (centroids[3 * j + axis] > pivot) j--;
+      if (i > j) break;
+      MeshTriangle t = triangles[i];
+      triangles[i] = triangles[j];
+      triangles[j] = t;
+      for (int a = 0; a < 3; a++) {
+        const double c = centroids[3 * i + a];
+        centroids[3 * i + a] = centroids[3 * j + a];
+        centroids[3 * j + a] = c;
+      }
+      i++;
+      j--;
+    }
+    if (k <= j) {
+      hi = j + 1;
+    } else if (k >= i) {
+      lo = i;
+    } else {
+      return;
+    }
+  }
+}
+
+/**** Builds the subtree over triangles [first, first + count) and returns its node. Inner nodes split at the
+ * centroid median of their widest axis, so the tree is balanced and about log2(T / MESH_LEAF_SIZE) deep. The
+ * split point depends only on count; without centroids the triangles keep their order and only boxes are built ****/
+static int
+build_node(TriangleMesh *mesh, double centroids[], const int first, const int count, const int depth)
+{
+  const int index = mesh->node_ct++;
+  MeshNode *node = &mesh->nodes[index];
+  double lo[3] = {INFINITY, INFINITY, INFINITY}, hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+  int axis = 0;
+
+  if (depth + 1 > mesh->depth) mesh->depth = depth + 1;
+  for (int a = 0; a < 3; a++) {
+    node->min[a] = INFINITY;
+    node->max[a] = -INFINITY;
+  }
+  for (int t = first; t < first + count; t++) {
+    const MeshTriangle *tri = &mesh->triangles[t];
+    for (int a = 0; a < 3; a++) {
+      node->min[a] = fmin(node->min[a], fmin(component(tri->a, a), fmin(component(tri->b, a), component(tri->c, a))));
+      node->max[a] = fmax(node->max[a], fmax(component(tri->a, a), fmax(component(tri->b, a), component(tri->c, a))));
+      if (centroids == NULL) continue;
+      lo[a] = fmin(lo[a], centroids[3 * t + a]);
+      hi[a] = fmax(hi[a], centroids[3 * t + a]);
+    }
+  }
+
+  if (count <= MESH_LEAF_SIZE) {
+    node->first = first;
+    node->count = count;
+    return index;
+  }
+  for (int a = 1; a < 3; a++) {
+    if (hi[a] - lo[a] > hi[axis] - lo[axis]) axis = a;
+  }
+  if (centroids != NULL) select_median(mesh->triangles, centroids, first, first + count, first + count / 2, axis);
+  (void)build_node(mesh, centroids, first, count / 2, depth + 1);
+  node->count = 0;
+  node->first = build_node(mesh, centroids, first + count / 2, count - count / 2, depth + 1);
+  return index;
+}
+
+TriangleMesh *
+createTriangleMesh(const double vertices[], const int vertex_ct, const int indices[], const int triangle_ct)
+{
+  TriangleMesh *mesh;
+  double *centroids;
+  int kept = 0;
+
+  if (vertex_ct <= 0 || triangle_ct <= 0 || triangle_ct > (1 << 28)) return NULL;
+  for (int i = 0; i < 3 * triangle_ct; i++) {
+    if (indices[i] < 0 || indices[i] >= vertex_ct) return NULL;
+  }
+
+  mesh = (TriangleMesh*)tracked_calloc(1, sizeof(TriangleMesh), ALLOC_MESH);
+  if (mesh == NULL) return NULL;
+  mesh->restitution = 0.75;
+  mesh->triangles = (MeshTriangle*)tracked_malloc(triangle_ct * sizeof(MeshTriangle), ALLOC_MESH);
+  centroids = (double*)tracked_malloc(3 * triangle_ct * sizeof(double), ALLOC_MESH);
+  if (mesh->triangles == NULL || centroids == NULL) {
+    tracked_free(centroids);
+    destroy_triangleMesh(mesh);
+    return NULL;
+  }
+
+  for (int t = 0; t < triangle_ct; t++) {
+    const double *p[3] = {&vertices[3 * indices[3 * t]], &vertices[3 * indices[3 * t + 1]],
+                          &vertices[3 * indices[3 * t + 2]]};
+    MeshTriangle tri = {{p[0][0], p[0][1], p[0][2]}, {p[1][0], p[1][1], p[1][2]}, {p[2][0], p[2][1], p[2][2]},
+                        {0, 0, 0}};
+    const Vector3 n = crossProduct(subtractVectors(tri.b, tri.a), subtractVectors(tri.c, tri.a));
+    const double area = magnitude(n);
+
+    if (!(area > 0) || !isfinite(area)) continue;       // Zero area or non-finite vertices
+    tri.normal = scaleVector(n, 1.0 / area);
+    mesh->triangles[kept] = tri;
+    centroids[3 * kept] = (tri.a.x + tri.b.x + tri.c.x) / 3.0;
+    centroids[3 * kept + 1] = (tri.a.y + tri.b.y + tri.c.y) / 3.0;
+    centroids[3 * kept + 2] = (tri.a.z + tri.b.z + tri.c.z) / 3.0;
+    kept++;
+  }
+  mesh->triangle_ct = kept;
+
+  // A leaf holds at least one triangle and every inner node two leaves' worth, so 2T nodes always suffice
+  mesh->nodes = (kept > 0) ? (MeshNode*)tracked_malloc(2 * kept * sizeof(MeshNode), ALLOC_MESH) : NULL;
+  if (mesh->nodes == NULL) {
+    tracked_free(centroids);
+    destroy_triangleMesh(mesh);
+    return NULL;
+  }
+  (void)build_node(mesh, centroids, 0, kept, 0);
+  tracked_free(centroids);
+  return mesh;
+}
+
+TriangleMesh *
+restore_triangleMesh(const MeshTriangle triangles[], const int triangle_ct)
+{
+  TriangleMesh *mesh;
+
+  if (triangle_ct <= 0 || triangle_ct > (1 << 28)) return NULL;
+  mesh = (TriangleMesh*)tracked_calloc(1, sizeof(TriangleMesh), ALLOC_MESH);
+  if (mesh == NULL) return NULL;
+  mesh->restitution = 0.75;
+  mesh->triangles = (MeshTriangle*)tracked_malloc(triangle_ct * sizeof(MeshTriangle), ALLOC_MESH);
+  mesh->nodes = (MeshNode*)tracked_malloc(2 * triangle_ct * sizeof(MeshNode), ALLOC_MESH);
+  if (mesh->triangles == NULL || mesh->nodes == NULL) {
+    destroy_triangleMesh(mesh);
+    return NULL;
+  }
+  memcpy(mesh->triangles, triangles, triangle_ct * sizeof(MeshTriangle));
+  mesh->triangle_ct = triangle_ct;
+  (void)build_node(mesh, NULL, 0, triangle_ct, 0);
+  return mesh;
+}
+
+/**** Index of an OBJ face vertex: 1 based, negative counts back from the latest vertex. -1 when invalid ****/
+static int
+obj_index(const char *token, const int vertex_ct)
+{
+  char *end;
+  const long index = strtol(token, &end, 10);
+
+  if (end == token || (*end != '\0' && *end != '/')) return -1;
+  if (index > 0) return (int)(index - 1);
+  if (index < 0 && -index <= vertex_ct) return (int)(vertex_ct + index);
+  return -1;
+}
+
+/**** v x y z and f a b c ... lines; everything else (normals, texture coordinates, groups) is skipped ****/
+static int
+read_obj(FILE *f, double **vertices, int *vertex_ct, int **indices, int *triangle_ct)
+{
+  int vertex_cap = 0, index_cap = 0, status = 0;
+  char *line = NULL, *save, *token;
+  size_t line_cap = 0;
+
+  while (status == 0 && getline(&line, &line_cap, f) != -1) {
+    token = strtok_r(line, " \t\r\n", &save);
+    if (token == NULL) continue;
+
+    if (strcmp(token, "v") == 0) {
+      double p[3];
+      for (int a = 0; a < 3 && status == 0; a++) {
+        token = strtok_r(NULL, " \t\r\n", &save);
+        if (token == NULL || sscanf(token, "%lf", &p[a]) != 1) status = 2;
+      }
+      if (status != 0) break;
+      if (grow_array((void**)vertices, &vertex_cap, 3 * (*vertex_ct + 1), sizeof(double)) != 0) {
+        status = 1;
+        break;
+      }
+      memcpy(&(*vertices)[3 * (*vertex_ct)++], p, sizeof(p));
+    } else if (strcmp(token, "f") == 0) {
+      int corner_ct = 0, first = -1, prev = -1;
+      while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+        const int v = obj_index(token, *vertex_ct);
+        if (v < 0) {
+          status = 2;
+          break;
+        }
+        if (corner_ct == 0) {
+          first = v;
+        } else if (corner_ct >= 2) {
+          if (grow_array((void**)indices, &index_cap, 3 * (*triangle_ct + 1), sizeof(int)) != 0) {
+            status = 1;
+            break;
+          }
+          (*indices)[3 * (*triangle_ct)] = first;
+          (*indices)[3 * (*triangle_ct) + 1] = prev;
+          (*indices)[3 * (*triangle_ct) + 2] = v;
+          (*triangle_ct)++;
+        }
+        prev = v;
+        corner_ct++;
+      }
+      if (status == 0 && corner_ct < 3) status = 2;
+    }
+  }
+  free(line);                                     // getline's buffer is plain malloc
+  return status;
+}
+
+/**** Appends one triangle of unshared corners, as STL stores them ****/
+static int
+stl_triangle(const double corners[9], double **vertices, int *vertex_cap, int *vertex_ct,
+             int **indices, int *index_cap, int *triangle_ct)
+{
+  if (grow_array((void**)vertices, vertex_cap, 3 * (*vertex_ct + 3), sizeof(double)) != 0
+      || grow_array((void**)indices, index_cap, 3 * (*triangle_ct + 1), sizeof(int)) != 0) return -1;
+  memcpy(&(*vertices)[3 * (*vertex_ct)], corners, 9 * sizeof(double));
+  for (int k = 0; k < 3; k++) (*indices)[3 * (*triangle_ct) + k] = (*vertex_ct)++;
+  (*triangle_ct)++;
+  return 0;
+}
+
+/**** Binary STL: 80 byte header, uint32 count, then 50 byte records (normal, three float corners, attribute).
+ * A file whose size doesn't match is read as ASCII "vertex x y z" lines ****/
+static int
+read_stl(FILE *f, double **vertices, int *vertex_ct, int **indices, int *triangle_ct)
+{
+  unsigned char header[84], record[50];
+  int vertex_cap = 0, index_cap = 0;
+  uint32_t count;
+  long size;
+  double corners[9];
+  char token[64];
+
+  if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) return 1;
+  if (size >= 84 && fread(header, 1, sizeof(header), f) == sizeof(header)) {
+    memcpy(&count, header + 80, sizeof(count));
+    if ((uint64_t)size == 84 + 50 * (uint64_t)count) {
+      for (uint32_t t = 0; t < count; t++) {
+        float xyz[9];
+        if (fread(record, 1, sizeof(record), f) != sizeof(record)) return 1;
+        memcpy(xyz, record + 12, sizeof(xyz));
+        for (int k = 0; k < 9; k++) corners[k] = xyz[k];
+        if (stl_triangle(corners, vertices, &vertex_cap, vertex_ct, indices, &index_cap, triangle_ct) != 0) return 1;
+      }
+      return 0;
+    }
+  }
+
+  if (fseek(f, 0, SEEK_SET) != 0) return 1;
+  if (fscanf(f, "%63s", token) != 1 || strcmp(token, "solid") != 0) return 2;
+  for (int corner = 0; fscanf(f, "%63s", token) == 1;) {
+    if (strcmp(token, "vertex") != 0) continue;
+    if (fscanf(f, "%lf %lf %lf", &corners[3 * corner], &corners[3 * corner + 1], &corners[3 * corner + 2]) != 3) {
+      return 2;
+    }
+    if (++corner < 3) continue;
+    corner = 0;
+    if (stl_triangle(corners, vertices, &vertex_cap, vertex_ct, indices, &index_cap, triangle_ct) != 0) return 1;
+  }
+  return 0;
+}
+
+TriangleMesh *
+load_triangleMesh(const char *path, int *status)
+{
+  const char *ext = strrchr(path, '.');
+  double *vertices = NULL;
+  int *indices = NULL, vertex_ct = 0, triangle_ct = 0;
+  TriangleMesh *mesh = NULL;
+  FILE *f = fopen(path, "rb");
+
+  if (f == NULL) {
+    (*status) = 1;
+    return NULL;
+  }
+  if (ext != NULL && strcasecmp(ext, ".stl") == 0) {
+    (*status) = read_stl(f, &vertices, &vertex_ct, &indices, &triangle_ct);
+  } else {
+    (*status) = read_obj(f, &vertices, &vertex_ct, &indices, &triangle_ct);
+  }
+  if (ferror(f)) (*status) = 1;
+  fclose(f);
+
+  if ((*status) == 0) {
+    mesh = createTriangleMesh(vertices, vertex_ct, indices, triangle_ct);
+    if (mesh == NULL) (*status) = 2;
+  }
+  tracked_free(vertices);
+  tracked_free(indices);
+  return mesh;
+}
+
+void
+transformMesh(TriangleMesh *mesh, const double scale, const Vector3 offset)
+{
+  const double shift[3] = {offset.x, offset.y, offset.z};
+
+  if (!(scale > 0)) return;
+  for (int t = 0; t < mesh->triangle_ct; t++) {
+    MeshTriangle *tri = &mesh->triangles[t];
+    tri->a = addVectors(scaleVector(tri->a, scale), offset);
+    tri->b = addVectors(scaleVector(tri->b, scale), offset);
+    tri->c = addVectors(scaleVector(tri->c, scale), offset);
+  }
+  for (int n = 0; n < mesh->node_ct; n++) {
+    for (int a = 0; a < 3; a++) {
+      mesh->nodes[n].min[a] = mesh->nodes[n].min[a] * scale + shift[a];
+      mesh->nodes[n].max[a] = mesh->nodes[n].max[a] * scale + shift[a];
+    }
+  }
+}
+
+/* Component helpers; Geometry.c's are out of line, and these run once per triangle near every particle */
+static inline Vector3
+v_sub(const Vector3 a, const Vector3 b)
+{
+  return (Vector3){a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+static inline double
+v_dot(const Vector3 a, const Vector3 b)
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline Vector3
+v_along(const Vector3 a, const Vector3 d, const double s)
+{
+  return (Vector3){a.x + s * d.x, a.y + s * d.y, a.z + s * d.z};
+}
+
+/**** Voronoi region test from Ericson, Real-Time Collision Detection 5.1.5 ****/
+static inline Vector3
+closest_point(const MeshTriangle *t, const Vector3 p)
+{
+  const Vector3 ab = v_sub(t->b, t->a), ac = v_sub(t->c, t->a);
+  const Vector3 ap = v_sub(p, t->a), bp = v_sub(p, t->b), cp = v_sub(p, t->c);
+  const double d1 = v_dot(ab, ap), d2 = v_dot(ac, ap);
+  const double d3 = v_dot(ab, bp), d4 = v_dot(ac, bp);
+  const double d5 = v_dot(ab, cp), d6 = v_dot(ac, cp);
+  const double vc = d1 * d4 - d3 * d2, vb = d5 * d2 - d1 * d6, va = d3 * d6 - d5 * d4;
+
+  if (d1 <= 0 && d2 <= 0) return t->a;
+  if (d3 >= 0 && d4 <= d3) return t->b;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0) return v_along(t->a, ab, d1 / (d1 - d3));
+  if (d6 >= 0 && d5 <= d6) return t->c;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0) return v_along(t->a, ac, d2 / (d2 - d6));
+  if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) return v_along(t->b, v_sub(t->c, t->b), (d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  return v_along(v_along(t->a, ab, vb / (va + vb + vc)), ac, vc / (va + vb + vc));
+}
+
+Vector3
+mesh_closestPoint(const MeshTriangle *t, const Vector3 p)
+{
+  return closest_point(t, p);
+}
+
+/**** Squared distance from p to a node's box, 0 inside ****/
+static double
+box_distance2(const MeshNode *node, const double p[3])
+{
+  double d2 = 0;
+  for (int a = 0; a < 3; a++) {
+    const double d = (p[a] < node->min[a]) ? node->min[a] - p[a] : (p[a] > node->max[a]) ? p[a] - node->max[a] : 0.0;
+    d2 += d * d;
+  }
+  return d2;
+}
+
+/**** Depth first with an explicit stack; boxes farther than radius prune their subtree ****/
+int
+mesh_query(const TriangleMesh *mesh, const Vector3 center, const double radius, int hits[], const int max_hits,
+           MeshStats *stats)
+{
+  const double p[3] = {center.x, center.y, center.z}, r2 = radius * radius;
+  int stack[MESH_MAX_DEPTH + 1], top = 0, hit_ct = 0;
+  MeshStats tally = {1, 0, 0, 0, 0};
+
+  if (mesh->node_ct > 0) stack[top++] = 0;
+  while (top > 0) {
+    const int index = stack[--top];
+    const MeshNode *node = &mesh->nodes[index];
+
+    tally.nodes_visited++;
+    if (box_distance2(node, p) >= r2) continue;
+    if (node->count == 0) {
+      stack[top++] = node->first;
+      stack[top++] = index + 1;                   // Left child is popped first
+      continue;
+    }
+    for (int t = node->first; t < node->first + node->count; t++) {
+      const MeshTriangle *tri = &mesh->triangles[t];
+      const double plane = v_dot(v_sub(center, tri->a), tri->normal);
+      tally.triangles_tested++;
+      if (plane * plane >= r2) continue;          // Farther from the plane than radius, so from the triangle too
+      const Vector3 d = v_sub(center, closest_point(tri, center));
+      if (v_dot(d, d) >= r2) continue;
+      if (hit_ct < max_hits) {
+        hits[hit_ct++] = t;
+      } else {
+        tally.dropped++;
+      }
+    }
+  }
+
+  if (stats != NULL) {
+    stats->queries += tally.queries;
+    stats->nodes_visited += tally.nodes_visited;
+    stats->triangles_tested += tally.triangles_tested;
+    stats->dropped += tally.dropped;
+  }
+  return hit_ct;
+}
+
+/**** Resolves one sphere against the triangles it overlapped at the start. Each is re-tested from the current
+ * position, so the second triangle of a shared edge finds the sphere already pushed clear ****/
+static void
+mesh_resolve(const TriangleMesh *mesh, Object *obj, MeshStats *tally)
+{
+  int hits[MESH_MAX_HITS];
+  const int hit_ct = mesh_query(mesh, obj->position, obj->radius, hits, MESH_MAX_HITS, tally);
+
+  for (int k = 0; k < hit_ct; k++) {
+    const MeshTriangle *tri = &mesh->triangles[hits[k]];
+    const Vector3 d = subtractVectors(obj->position, mesh_closestPoint(tri, obj->position));
+    const double dist = magnitude(d);
+    double vn;
+    Vector3 n;
+
+    if (dist >= obj->radius) continue;
+    if (dist > 0) {
+      n = scaleVector(d, 1.0 / dist);
+    } else {                                      // Centre on the face: back out the way it came
+      n = (dotProduct(obj->velocity, tri->normal) <= 0) ? tri->normal : scaleVector(tri->normal, -1.0);
+    }
+    obj->position = addVectors(obj->position, scaleVector(n, obj->radius - dist));
+    vn = dotProduct(obj->velocity, n);
+    if (vn < 0) obj->velocity = subtractVectors(obj->velocity, scaleVector(n, (1.0 + mesh->restitution) * vn));
+    tally->contacts++;
+  }
+}
+
+void
+meshCollisions(TriangleMesh *mesh, Object objects[], const int particle_ct)
+{
+  uint64_t queries = 0, visited = 0, tested = 0, contacts = 0, dropped = 0;
+
+  PROFILE_BEGIN(mesh_start);
+  perf_enter();
+  TRACE_BEGIN(mesh_trace);
+  #pragma omp parallel for schedule(static) reduction(+:queries,visited,tested,contacts,dropped)
+  for (int i = 0; i < particle_ct; i++) {
+    MeshStats tally = {0, 0, 0, 0, 0};
+    mesh_resolve(mesh, &objects[i], &tally);
+    queries += tally.queries;
+    visited += tally.nodes_visited;
+    tested += tally.triangles_tested;
+    contacts += tally.contacts;
+    dropped += tally.dropped;
+  }
+  mesh->stats = (MeshStats){queries, visited, tested, contacts, dropped};
+  TRACE_END(TRACE_MESH, mesh_trace, particle_ct, (int)contacts);
+  perf_leave(PERF_MESH);
+  PROFILE_END(PHASE_MESH, mesh_start);
+}
+
+void
+destroy_triangleMesh(TriangleMesh *mesh)
+{
+  if (mesh == NULL) return;
+  tracked_free(mesh->triangles);
+  tracked_free(mesh->nodes);
+  tracked_free(mesh);
+}
@@ -0,0 +1,507 @@
+#include <string.h>
+#include "../include/Octree.h"
+#include "../include/Profile.h"
+#include "../include/PerfCounters.h"
+#include "../include/Trace.h"
+#include "../include/Alloc.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define TASK_CUTOFF 4096        // Subtrees with fewer particles are built by the thread that split their parent
+
+#define GROW(ptr, n)                                                                   \
+  do {                                                                                 \
+    void *grown = tracked_realloc((ptr), (size_t)(n) * sizeof(*(ptr)), ALLOC_OCTREE);  \
+    if (grown == NULL) return -1;                                                      \
+    (ptr) = grown;                                                                     \
+  } while (0)
+
+Octree *
+createOctree(const double theta, const double strength, const double softening, const int leaf_size)
+{
+  Octree *tree = (Octree*)tracked_calloc(1, sizeof(Octree), ALLOC_OCTREE);
+  if (tree == NULL) return NULL;
+
+  tree->theta = theta;
+  tree->strength = strength;
+  tree->softening = softening;
+  tree->leaf_size = (leaf_size < 1) ? 1 : leaf_size;
+  return tree;
+}
+
+void
+destroy_octree(Octree *tree)
+{
+  if (tree == NULL) return;
+  tracked_free(tree->accel);
+  tracked_free(tree->keys);
+  tracked_free(tree->keys_tmp);
+  tracked_free(tree->sorted);
+  tracked_free(tree->sorted_tmp);
+  tracked_free(tree->x);
+  tracked_free(tree->y);
+  tracked_free(tree->z);
+  tracked_free(tree->m);
+  tracked_free(tree->nodes);
+  tracked_free(tree->groups);
+  for (int t = 0; t < tree->list_ct; t++) {
+    tracked_free(tree->lists[t].x);
+    tracked_free(tree->lists[t].y);
+    tracked_free(tree->lists[t].z);
+    tracked_free(tree->lists[t].m);
+  }
+  tracked_free(tree->lists);
+  tracked_free(tree);
+}
+
+/**** Per particle buffers sized for particle_ct, grown only when the count goes up ****/
+static int
+grow_particles(Octree *tree, const int particle_ct)
+{
+  if (particle_ct <= tree->particle_capacity) return 0;
+  GROW(tree->accel, particle_ct);
+  GROW(tree->keys, particle_ct);
+  GROW(tree->keys_tmp, particle_ct);
+  GROW(tree->sorted, particle_ct);
+  GROW(tree->sorted_tmp, particle_ct);
+  GROW(tree->x, particle_ct);
+  GROW(tree->y, particle_ct);
+  GROW(tree->z, particle_ct);
+  GROW(tree->m, particle_ct);
+  tree->particle_capacity = particle_ct;
+  return 0;
+}
+
+static int
+grow_nodes(Octree *tree, const int node_ct)
+{
+  if (node_ct <= tree->node_capacity) return 0;
+  GROW(tree->nodes, node_ct);
+  tree->node_capacity = node_ct;
+  return 0;
+}
+
+/**** Spreads the low 21 bits of v out to every third bit ****/
+static uint64_t
+spread_bits(uint64_t v)
+{
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8) & 0x100f00f00f00f00full;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2) & 0x1249249249249249ull;
+  return v;
+}
+
+/**** Grid coordinate of p along one axis at the finest level, clamped so the far face lands in the last cell ****/
+static uint64_t
+quantize(const double p, const double lo, const double scale)
+{
+  const double q = (p - lo) * scale;
+  const double top = (double)((1 << OCTREE_DEPTH) - 1);
+  return (uint64_t)((q < 0) ? 0 : (q > top) ? top : q);
+}
+
+/**** Stable LSD radix sort of keys carrying sorted along; bytes shared by every key are skipped ****/
+static void
+radix_sort(Octree *tree, const int n)
+{
+  size_t counts[256];
+  uint64_t *swap_keys;
+  int *swap_sorted;
+
+  for (int shift = 0; shift < 64; shift += 8) {
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < n; i++) counts[(tree->keys[i] >> shift) & 0xff]++;
+    if (counts[(tree->keys[0] >> shift) & 0xff] == (size_t)n) continue;
+
+    for (size_t b = 0, sum = 0; b < 256; b++) {
+      const size_t c = counts[b];
+      counts[b] = sum;
+      sum += c;
+    }
+    for (int i = 0; i < n; i++) {
+      const size_t slot = counts[(tree->keys[i] >> shift) & 0xff]++;
+      tree->keys_tmp[slot] = tree->keys[i];
+      tree->sorted_tmp[slot] = tree->sorted[i];
+    }
+    swap_keys = tree->keys;
+    tree->keys = tree->keys_tmp;
+    tree->keys_tmp = swap_keys;
+    swap_sorted = tree->sorted;
+    tree->sorted = tree->sorted_tmp;
+    tree->sorted_tmp = swap_sorted;
+  }
+}
+
+/**** First slot in [lo, hi) whose octant at this level is at least octant; keys there share every higher bit ****/
+static int
+octant_start(const uint64_t keys[], int lo, int hi, const int shift, const uint64_t octant)
+{
+  while (lo < hi) {
+    const int mid = lo + (hi - lo) / 2;
+    if (((keys[mid] >> shift) & 7) < octant) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+static void
+raise_depth(int *depth, const int level)
+{
+  int seen = __atomic_load_n(depth, __ATOMIC_RELAXED);
+  while (level > seen && !__atomic_compare_exchange_n(depth, &seen, level, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+/**** Mass and centre of mass of a leaf straight from the Morton ordered arrays ****/
+static void
+leaf_moments(Octree *tree, OctreeNode *node)
+{
+  const int end = node->first + node->count;
+  const double *x = tree->x, *y = tree->y, *z = tree->z, *m = tree->m;
+  double mass = 0, mx = 0, my = 0, mz = 0;
+
+  #pragma omp simd reduction(+:mass,mx,my,mz)
+  for (int j = node->first; j < end; j++) {
+    mass += m[j];
+    mx += m[j] * x[j];
+    my += m[j] * y[j];
+    mz += m[j] * z[j];
+  }
+  node->mass = mass;
+  node->com = (mass > 0) ? (Vector3){mx / mass, my / mass, mz / mass} : node->center;
+}
+
+/**** Splits node n into its non-empty octants, recursing as tasks on large subtrees, then sums their moments.
+ * Children come from a shared pool; running out sets overflow and the caller rebuilds with a larger pool ****/
+static void
+build_node(Octree *tree, const int n, const int level)
+{
+  OctreeNode *node = &tree->nodes[n];
+  int bounds[9], child, child_ct = 0, slot;
+  const int shift = 3 * (OCTREE_DEPTH - 1 - level);
+  const double quarter = 0.5 * node->half;
+
+  node->child = -1;
+  node->child_ct = 0;
+  if (node->count <= tree->leaf_size || level == OCTREE_DEPTH) {
+    leaf_moments(tree, node);
+    raise_depth(&tree->stats.depth, level);
+    return;
+  }
+
+  bounds[0] = node->first;
+  bounds[8] = node->first + node->count;
+  for (int o = 1; o < 8; o++) bounds[o] = octant_start(tree->keys, bounds[o - 1], bounds[8], shift, (uint64_t)o);
+  for (int o = 0; o < 8; o++) child_ct += (bounds[o + 1] > bounds[o]);
+
+  child = __atomic_fetch_add(&tree->node_ct, child_ct, __ATOMIC_RELAXED);
+  if (child + child_ct > tree->node_capacity) {
+    __atomic_store_n(&tree->overflow, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  slot = child;
+  for (int o = 0; o < 8; o++) {
+    if (bounds[o + 1] == bounds[o]) continue;
+    OctreeNode *kid = &tree->nodes[slot++];
+    kid->first = bounds[o];
+    kid->count = bounds[o + 1] - bounds[o];
+    kid->half = quarter;
+    kid->center = (Vector3){node->center.x + ((o & 4) ? quarter : -quarter),
+                            node->center.y + ((o & 2) ? quarter : -quarter),
+                            node->center.z + ((o & 1) ? quarter : -quarter)};
+  }
+
+  for (int k = child; k < child + child_ct; k++) {
+    if (tree->nodes[k].count > TASK_CUTOFF) {
+      #pragma omp task firstprivate(k)
+      build_node(tree, k, level + 1);
+    } else {
+      build_node(tree, k, level + 1);
+    }
+  }
+  #pragma omp taskwait
+
+  node->child = child;
+  node->child_ct = child_ct;
+  node->mass = 0;
+  node->com = (Vector3){0, 0, 0};
+  for (int k = child; k < child + child_ct; k++) {
+    const OctreeNode *kid = &tree->nodes[k];
+    node->mass += kid->mass;
+    node->com = addVectors(node->com, scaleVector(kid->com, kid->mass));
+  }
+  node->com = (node->mass > 0) ? scaleVector(node->com, 1.0 / node->mass) : node->center;
+}
+
+/**** Keys, Morton sort, gather and build. The root is the bounding cube of the particles, not sim->cube,
+ * so particles that leave the box are still placed exactly ****/
+static int
+build_tree(Octree *tree, const Object objects[], const int particle_ct)
+{
+  double min_x = objects[0].position.x, min_y = objects[0].position.y, min_z = objects[0].position.z;
+  double max_x = min_x, max_y = min_y, max_z = min_z;
+  double extent, scale;
+
+  #pragma omp parallel for schedule(static) reduction(min:min_x,min_y,min_z) reduction(max:max_x,max_y,max_z)
+  for (int i = 0; i < particle_ct; i++) {
+    const Vector3 p = objects[i].position;
+    min_x = (p.x < min_x) ? p.x : min_x;
+    min_y = (p.y < min_y) ? p.y : min_y;
+    min_z = (p.z < min_z) ? p.z : min_z;
+    max_x = (p.x > max_x) ? p.x : max_x;
+    max_y = (p.y > max_y) ? p.y : max_y;
+    max_z = (p.z > max_z) ? p.z : max_z;
+  }
+  extent = max_x - min_x;
+  if (max_y - min_y > extent) extent = max_y - min_y;
+  if (max_z - min_z > extent) extent = max_z - min_z;
+  if (extent <= 0) extent = 1.0;
+  scale = (double)(1 << OCTREE_DEPTH) / extent;
+
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < particle_ct; i++) {
+    const Vector3 p = objects[i].position;
+    tree->keys[i] = spread_bits(quantize(p.x, min_x, scale)) << 2 | spread_bits(quantize(p.y, min_y, scale)) << 1
+                  | spread_bits(quantize(p.z, min_z, scale));
+    tree->sorted[i] = i;
+  }
+  radix_sort(tree, particle_ct);
+
+  #pragma omp parallel for schedule(static)
+  for (int s = 0; s < particle_ct; s++) {
+    const Object *obj = &objects[tree->sorted[s]];
+    tree->x[s] = obj->position.x;
+    tree->y[s] = obj->position.y;
+    tree->z[s] = obj->position.z;
+    tree->m[s] = obj->mass;
+  }
+
+  // Most trees fit in 4N / leaf_size nodes; a pool that runs out is doubled and the build repeated
+  if (grow_nodes(tree, 4 * particle_ct / tree->leaf_size + 64) != 0) return -1;
+  do {
+    if (tree->overflow && grow_nodes(tree, 2 * tree->node_capacity) != 0) return -1;
+    tree->overflow = 0;
+    tree->node_ct = 1;
+    tree->stats.depth = 0;
+    tree->nodes[0].first = 0;
+    tree->nodes[0].count = particle_ct;
+    tree->nodes[0].half = 0.5 * extent;
+    tree->nodes[0].center = (Vector3){min_x + 0.5 * extent, min_y + 0.5 * extent, min_z + 0.5 * extent};
+
+    #pragma omp parallel
+    #pragma omp single
+    build_node(tree, 0, 0);
+  } while (tree->overflow);
+
+  tree->stats.nodes = tree->node_ct;
+  tree->stats.leaves = 0;
+  for (int n = 0; n < tree->node_ct; n++) tree->stats.leaves += (tree->nodes[n].child_ct == 0);
+  return 0;
+}
+
+/**** Nodes with at most OCTREE_GROUP particles (or leaves) whose parent has more; they tile the particles ****/
+static int
+collect_groups(Octree *tree)
+{
+  int stack[OCTREE_STACK], top = 0, group_ct = 0;
+
+  if (tree->group_capacity < tree->node_ct) {
+    GROW(tree->groups, tree->node_capacity);
+    tree->group_capacity = tree->node_capacity;
+  }
+  stack[top++] = 0;
+  while (top > 0) {
+    const int n = stack[--top];
+    const OctreeNode *node = &tree->nodes[n];
+    if (node->count <= OCTREE_GROUP || node->child_ct == 0) {
+      tree->groups[group_ct++] = n;
+      continue;
+    }
+    for (int k = node->child + node->child_ct - 1; k >= node->child; k--) stack[top++] = k;
+  }
+  tree->stats.groups = group_ct;
+  return group_ct;
+}
+
+/**** Appends a point mass to the calling thread's list, doubling it when full ****/
+static int
+list_push(OctreeList *list, const double x, const double y, const double z, const double m)
+{
+  if (list->count == list->capacity) {
+    const int capacity = (list->capacity > 0) ? 2 * list->capacity : 1024;
+    GROW(list->x, capacity);
+    GROW(list->y, capacity);
+    GROW(list->z, capacity);
+    GROW(list->m, capacity);
+    list->capacity = capacity;
+  }
+  list->x[list->count] = x;
+  list->y[list->count] = y;
+  list->z[list->count] = z;
+  list->m[list->count] = m;
+  list->count++;
+  return 0;
+}
+
+/**** Walks the tree once for every particle of group g. A node is taken whole when its edge is under theta times
+ * the distance from its centre of mass to the nearest point of g's cell, so the test holds for each particle
+ * in g. Nodes containing g are always opened and opened leaves add their particles. Children are visited in
+ * octant order so the list doesn't depend on how the pool was filled. Sets *cells to the monopole count ****/
+static int
+walk_group(const Octree *tree, const OctreeNode *g, OctreeList *list, int *cells)
+{
+  int stack[OCTREE_STACK], top = 0;
+  const double theta2 = tree->theta * tree->theta;
+
+  list->count = 0;
+  *cells = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const OctreeNode *node = &tree->nodes[stack[--top]];
+    const int contains = fabs(g->center.x - node->center.x) < node->half && fabs(g->center.y - node->center.y) < node->half
+                         && fabs(g->center.z - node->center.z) < node->half;
+
+    if (!contains) {
+      const double dx = fmax(0.0, fabs(node->com.x - g->center.x) - g->half);
+      const double dy = fmax(0.0, fabs(node->com.y - g->center.y) - g->half);
+      const double dz = fmax(0.0, fabs(node->com.z - g->center.z) - g->half);
+      const double edge = 2.0 * node->half;
+      if (edge * edge < theta2 * (dx * dx + dy * dy + dz * dz)) {
+        if (list_push(list, node->com.x, node->com.y, node->com.z, node->mass) != 0) return -1;
+        (*cells)++;
+        continue;
+      }
+    }
+    if (node->child_ct == 0) {
+      for (int j = node->first; j < node->first + node->count; j++) {
+        if (list_push(list, tree->x[j], tree->y[j], tree->z[j], tree->m[j]) != 0) return -1;
+      }
+      continue;
+    }
+    for (int k = node->child + node->child_ct - 1; k >= node->child; k--) stack[top++] = k;
+  }
+  return 0;
+}
+
+/**** Sums a list for one particle; the self term has zero separation and adds nothing ****/
+static Vector3
+list_accel(const OctreeList *list, const double px, const double py, const double pz, const double eps2)
+{
+  const double *x = list->x, *y = list->y, *z = list->z, *m = list->m;
+  double ax = 0, ay = 0, az = 0;
+
+  #pragma omp simd reduction(+:ax,ay,az)
+  for (int j = 0; j < list->count; j++) {
+    const double dx = x[j] - px, dy = y[j] - py, dz = z[j] - pz;
+    const double r2 = dx * dx + dy * dy + dz * dz + eps2;
+    const double inv = 1.0 / sqrt(r2 + (r2 == 0));          // Unsoftened self term: finite, times dx = 0
+    const double f = m[j] * inv * inv * inv;
+    ax += f * dx;
+    ay += f * dy;
+    az += f * dz;
+  }
+  return (Vector3){ax, ay, az};
+}
+
+/**** One interaction list per thread, kept across calls ****/
+static int
+grow_lists(Octree *tree)
+{
+#ifdef _OPENMP
+  const int thread_ct = omp_get_max_threads();
+#else
+  const int thread_ct = 1;
+#endif
+  if (thread_ct <= tree->list_ct) return 0;
+  GROW(tree->lists, thread_ct);
+  memset(&tree->lists[tree->list_ct], 0, (thread_ct - tree->list_ct) * sizeof(OctreeList));
+  tree->list_ct = thread_ct;
+  return 0;
+}
+
+/**** Rebuilds the tree, then walks it once per group. Each group's particles are contiguous in Morton order,
+ * so the list it builds is summed by a vector loop per particle ****/
+int
+octreeForces(Octree *tree, const Object objects[], const int particle_ct)
+{
+  uint64_t cells = 0, pairs = 0;
+  int status, group_ct, failed = 0;
+  const double eps2 = tree->softening * tree->softening;
+
+  tree->stats.cell_interactions = 0;
+  tree->stats.pair_interactions = 0;
+  if (grow_particles(tree, particle_ct) != 0 || grow_lists(tree) != 0) return -1;
+  if (particle_ct == 0) return 0;
+
+  PROFILE_BEGIN(build_start);
+  perf_enter();
+  TRACE_BEGIN(build_trace);
+  status = build_tree(tree, objects, particle_ct);
+  group_ct = (status == 0) ? collect_groups(tree) : -1;
+  TRACE_END(TRACE_TREE_BUILD, build_trace, particle_ct, tree->node_ct);
+  PROFILE_END(PHASE_TREE_BUILD, build_start);
+  if (group_ct < 0) {
+    perf_leave(PERF_TREE);
+    return -1;
+  }
+
+  PROFILE_BEGIN(force_start);
+  #pragma omp parallel reduction(+:cells,pairs)
+  {
+#ifdef _OPENMP
+    OctreeList *list = &tree->lists[omp_get_thread_num()];
+#else
+    OctreeList *list = &tree->lists[0];
+#endif
+    int walked = 0, monopoles;
+    TRACE_BEGIN(force_trace);
+
+    #pragma omp for schedule(dynamic, 1) nowait
+    for (int k = 0; k < group_ct; k++) {
+      const OctreeNode *g = &tree->nodes[tree->groups[k]];
+      if (walk_group(tree, g, list, &monopoles) != 0) {
+        __atomic_store_n(&failed, 1, __ATOMIC_RELAXED);
+        continue;
+      }
+      for (int s = g->first; s < g->first + g->count; s++) {
+        const Vector3 a = list_accel(list, tree->x[s], tree->y[s], tree->z[s], eps2);
+        tree->accel[tree->sorted[s]] = scaleVector(a, tree->strength);
+      }
+      cells += (uint64_t)monopoles * g->count;
+      pairs += (uint64_t)(list->count - monopoles) * g->count;
+      walked += g->count;
+    }
+    TRACE_END(TRACE_TREE_FORCE, force_trace, walked, 0);
+  }
+  perf_leave(PERF_TREE);
+  PROFILE_END(PHASE_TREE_FORCE, force_start);
+
+  tree->stats.cell_interactions = cells;
+  tree->stats.pair_interactions = pairs;
+  return failed ? -1 : 0;
+}
+
+void
+directForces(const Octree *tree, const Object objects[], const int particle_ct,
+             const int which[], const int count, Vector3 out[])
+{
+  const double eps2 = tree->softening * tree->softening;
+
+  #pragma omp parallel for schedule(dynamic, 1)
+  for (int k = 0; k < count; k++) {
+    const Vector3 p = objects[which[k]].position;
+    Vector3 a = {0, 0, 0};
+    for (int j = 0; j < particle_ct; j++) {
+      const Vector3 d = subtractVectors(objects[j].position, p);
+      const double r2 = dotProduct(d, d) + eps2;
+      const double inv = (r2 > 0) ? 1.0 / sqrt(r2) : 0.0;
+      a = addVectors(a, scaleVector(d, objects[j].mass * inv * inv * inv));
+    }
+    out[k] = scaleVector(a, tree->strength);
+  }
+}
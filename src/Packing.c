@@ -0,0 +1,237 @@
+#include "../include/Packing.h"
+#include "../include/Alloc.h"
+#include <string.h>
+
+#define DRAWS_PER_PARTICLE (3 * ATTEMPT_CAP)    // Counter space reserved for each particle
+
+/**** Uniform double in [0, 1) from a particle's private counter range ****/
+static double
+draw(const uint64_t seed, const int particle, const int k)
+{
+  uint64_t bits = rng_hash(seed, (uint64_t)particle * DRAWS_PER_PARTICLE + k);
+  return (double)(bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**** Uniform placement, kept so the old initial conditions stay reproducible from a seed ****/
+static int
+pack_uniform(Object objects[], const int particle_ct, const Cube cube, const double radius, const uint64_t seed)
+{
+  const Vector3 span = addScalar(cubeExtent(&cube), -2.0 * radius);
+
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < particle_ct; i++) {
+    objects[i].position.x = cube.min.x + radius + span.x * draw(seed, i, 0);
+    objects[i].position.y = cube.min.y + radius + span.y * draw(seed, i, 1);
+    objects[i].position.z = cube.min.z + radius + span.z * draw(seed, i, 2);
+  }
+  return particle_ct;
+}
+
+/* SC or FCC: the fewest cells that hold particle_ct sites, stretched to the box. Each axis gets cells in
+   proportion to its extent, so a column is tall in cells too. Sites are numbered x-major so a partial fill
+   occupies the low x (gravity) side first */
+static int
+pack_lattice(Object objects[], const int particle_ct, const Cube cube, const double radius,
+             const int fcc, const double jitter, const uint64_t seed)
+{
+  static const Vector3 basis[4] = {{0, 0, 0}, {0.5, 0.5, 0}, {0.5, 0, 0.5}, {0, 0.5, 0.5}};
+  const int per_cell = fcc ? 4 : 1;
+  const Vector3 size = cubeExtent(&cube);
+  const double extent[3] = {size.x, size.y, size.z}, longest = fmax(size.x, fmax(size.y, size.z));
+  double span[3], spacing[3], offset[3], nearest = 0, amplitude, min_spacing = INFINITY;
+  int cells[3] = {1, 1, 1};
+
+  for (int t = 1; per_cell * cells[0] * cells[1] * cells[2] < particle_ct; t++) {
+    for (int k = 0; k < 3; k++) cells[k] = (int)ceil(t * extent[k] / longest);
+  }
+
+  // Cell edge such that the outermost site sits on the far wall; a periodic box tiles whole cells instead
+  for (int k = 0; k < 3; k++) {
+    span[k] = extent[k] - 2.0 * radius;
+    if (cube.periodic) spacing[k] = extent[k] / cells[k];
+    else if (fcc) spacing[k] = span[k] / (cells[k] - 0.5);
+    else spacing[k] = (cells[k] > 1) ? span[k] / (cells[k] - 1) : span[k];
+    min_spacing = fmin(min_spacing, spacing[k]);
+    // An SC axis of one cell has no neighbour along it
+    if (!fcc && cells[k] > 1) nearest = (nearest > 0) ? fmin(nearest, spacing[k]) : spacing[k];
+    // Periodic sites sit off the faces by more than the jitter, half a spacing (SC) or a quarter (FCC)
+    offset[k] = cube.periodic ? (fcc ? 0.25 : 0.5) * spacing[k] : radius;
+  }
+  if (fcc) nearest = min_spacing / sqrt(2.0);
+  else if (nearest == 0) nearest = min_spacing;
+  if (particle_ct > 1 && nearest < 2.0 * radius) {
+    fprintf(stderr, "Packing: %d particles of radius %.3lf do not fit a %s lattice\n",
+            particle_ct, radius, fcc ? "FCC" : "SC");
+    return -1;
+  }
+
+  // Largest per-axis offset that keeps every pair apart, whatever direction each moves
+  amplitude = jitter * (0.5 * nearest - radius) / sqrt(3.0);
+
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < particle_ct; i++) {
+    const int cell = i / per_cell;
+    const Vector3 b = basis[i % per_cell];
+    Vector3 site;
+    site.x = cube.min.x + offset[0] + (cell / (cells[1] * cells[2]) + b.x) * spacing[0];
+    site.y = cube.min.y + offset[1] + ((cell / cells[2]) % cells[1] + b.y) * spacing[1];
+    site.z = cube.min.z + offset[2] + (cell % cells[2] + b.z) * spacing[2];
+    if (amplitude > 0) {
+      site.x += amplitude * (2.0 * draw(seed, i, 0) - 1.0);
+      site.y += amplitude * (2.0 * draw(seed, i, 1) - 1.0);
+      site.z += amplitude * (2.0 * draw(seed, i, 2) - 1.0);
+      if (cube.periodic) {
+        objects[i].position = site;
+        continue;
+      }
+      // Pulling a boundary site back toward its lattice point can't create an overlap
+      site.x = fmin(fmax(site.x, cube.min.x + radius), cube.min.x + radius + span[0]);
+      site.y = fmin(fmax(site.y, cube.min.y + radius), cube.min.y + radius + span[1]);
+      site.z = fmin(fmax(site.z, cube.min.z + radius), cube.min.z + radius + span[2]);
+    }
+    objects[i].position = site;
+  }
+  return particle_ct;
+}
+
+/**** Cell of a point in the RSA grid, clamped so points on the far wall stay inside ****/
+static int
+rsa_cell(const double coord, const double origin, const double cell_len, const int cells)
+{
+  int c = (int)((coord - origin) / cell_len);
+  return (c < 0) ? 0 : (c >= cells) ? cells - 1 : c;
+}
+
+/* RSA: candidates are only tested against the 3x3x3 neighbouring cells, which is
+   enough since the cell edge is at least one diameter. Each accepted particle is
+   pushed onto its cell's list (head/next arrays), so the test is O(1) per candidate.
+   A periodic box draws over the whole box and tests wrapped cells by nearest image */
+static int
+pack_rsa(Object objects[], const int particle_ct, const Cube cube, const double radius, const uint64_t seed)
+{
+  const double margin = cube.periodic ? 0.0 : radius;
+  const Vector3 extent = cubeExtent(&cube), span = addScalar(extent, -2.0 * margin);
+  const Int3 cells = gridDims(cube, 2.0 * radius, 0);
+  const Vector3 cell_len = {extent.x / cells.x, extent.y / cells.y, extent.z / cells.z};
+  const double min_dist2 = 4.0 * radius * radius;
+  int *head = (int*)tracked_malloc((size_t)grid_partitionCount(cells) * sizeof(int), ALLOC_PACKING);
+  int *next = (int*)tracked_malloc(particle_ct * sizeof(int), ALLOC_PACKING);
+  int placed = 0;
+
+  if (head == NULL || next == NULL) {
+    tracked_free(head);
+    tracked_free(next);
+    return -1;
+  }
+  for (int c = 0; c < grid_partitionCount(cells); c++) head[c] = -1;
+
+  for (int i = 0; i < particle_ct; i++) {
+    int accepted = 0;
+    for (int attempt = 0; attempt < ATTEMPT_CAP && !accepted; attempt++) {
+      Vector3 p = {cube.min.x + margin + span.x * draw(seed, i, 3 * attempt),
+                   cube.min.y + margin + span.y * draw(seed, i, 3 * attempt + 1),
+                   cube.min.z + margin + span.z * draw(seed, i, 3 * attempt + 2)};
+      Int3 c = {rsa_cell(p.x, cube.min.x, cell_len.x, cells.x),
+                rsa_cell(p.y, cube.min.y, cell_len.y, cells.y),
+                rsa_cell(p.z, cube.min.z, cell_len.z, cells.z)};
+      int clear = 1;
+
+      for (int dx = -1; dx <= 1 && clear; dx++) {
+        for (int dy = -1; dy <= 1 && clear; dy++) {
+          for (int dz = -1; dz <= 1 && clear; dz++) {
+            Int3 n = {c.x + dx, c.y + dy, c.z + dz};
+            if (cube.periodic) n = wrap_cell(n, cells);
+            if (!grid_contains(n, cells)) continue;
+            for (int j = head[grid_indexCalc(n, cells)]; j != -1; j = next[j]) {
+              Vector3 d = minimumImage(&cube, subtractVectors(p, objects[j].position));
+              if (dotProduct(d, d) < min_dist2) {
+                clear = 0;
+                break;
+              }
+            }
+          }
+        }
+      }
+
+      if (clear) {
+        int cell = grid_indexCalc(c, cells);
+        objects[placed].position = p;
+        next[placed] = head[cell];
+        head[cell] = placed;
+        placed++;
+        accepted = 1;
+      }
+    }
+    if (!accepted) break;           // Box is saturated; later particles would fail too
+  }
+
+  tracked_free(head);
+  tracked_free(next);
+  return placed;
+}
+
+/**** Dispatches on mode and resets the dynamic state of every placed particle ****/
+int
+packObjects(Object objects[], const int particle_ct, const Cube cube, const double radius,
+            const PackingMode mode, const double jitter, const uint64_t seed)
+{
+  int placed;
+
+  switch (mode) {
+    case PACK_SC:
+      placed = pack_lattice(objects, particle_ct, cube, radius, 0, jitter, seed);
+      break;
+    case PACK_FCC:
+      placed = pack_lattice(objects, particle_ct, cube, radius, 1, jitter, seed);
+      break;
+    case PACK_RSA:
+      placed = pack_rsa(objects, particle_ct, cube, radius, seed);
+      break;
+    default:
+      placed = pack_uniform(objects, particle_ct, cube, radius, seed);
+      break;
+  }
+  if (placed < 0) return placed;
+
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < placed; i++) {
+    objects[i].radius = radius;
+    objects[i].velocity = (Vector3){0, 0, 0};
+    objects[i].acceleration = (Vector3){0, 0, 0};
+  }
+  return placed;
+}
+
+/**** Packing gets its own stream seeded by one draw of the run's rng. A trajectory or frame ring fixes the particle
+ * count, so then the pack goes to a copy that is only kept when every particle fit ****/
+int
+packSimulation(Simulation *sim, const PackingMode mode, const double jitter)
+{
+  const uint64_t seed = rng_hash(sim->rng.seed, sim->rng.counter);
+  const int requested = sim->particle_ct;
+  const int fixed_count = (sim->trajectory != NULL || sim->frames != NULL);
+  Object *target = sim->objects;
+  int placed;
+
+  if (fixed_count) {
+    target = (Object*)tracked_malloc(requested * sizeof(Object), ALLOC_PACKING);
+    if (target == NULL) return -1;
+    memcpy(target, sim->objects, requested * sizeof(Object));
+  }
+  placed = packObjects(target, requested, sim->cube, sim->objects[0].radius, mode, jitter, seed);
+  sim->rng.counter++;
+  if (fixed_count) {
+    if (placed == requested) memcpy(sim->objects, target, requested * sizeof(Object));
+    tracked_free(target);
+    if (placed >= 0 && placed < requested) return -2;
+  }
+  if (placed < 0) return -1;
+
+  if (placed < requested) {
+    sim->particle_ct = placed;
+    sim->grid_dims = mapSize(sim->objects, placed, sim->cube);
+  }
+  sim->primed = 0;
+  if (sim->contacts != NULL) contact_clearHistory(sim->contacts);   // Keyed by the old neighbours
+  return requested - placed;
+}
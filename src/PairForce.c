@@ -0,0 +1,213 @@
+#include <string.h>
+#include "../include/PairForce.h"
+#include "../include/Profile.h"
+#include "../include/PerfCounters.h"
+#include "../include/Trace.h"
+#include "../include/Alloc.h"
+
+static const char *kind_names[PAIR_KIND_CT] = {"lj", "wca", "soft"};
+
+/**** Neighbours after a cell in (x, y, z) order; with the cell itself they cover every pair exactly once ****/
+static const Int3 half_shell[13] = {
+  {1, -1, -1}, {1, -1, 0}, {1, -1, 1}, {1, 0, -1}, {1, 0, 0}, {1, 0, 1}, {1, 1, -1}, {1, 1, 0}, {1, 1, 1},
+  {0, 1, -1}, {0, 1, 0}, {0, 1, 1},
+  {0, 0, 1}
+};
+
+/**** Unshifted U(r) of a pair at squared distance r2 > 0, with |f| / r written to f_over_r ****/
+static double
+pair_kernel(const PairForce *pf, const double r2, double *f_over_r)
+{
+  if (pf->kind == PAIR_SOFT) {
+    const double r = sqrt(r2), gap = 1.0 - r / pf->sigma;
+    *f_over_r = pf->epsilon * gap / (pf->sigma * r);
+    return 0.5 * pf->epsilon * gap * gap;
+  }
+  const double sr2 = pf->sigma * pf->sigma / r2, sr6 = sr2 * sr2 * sr2;
+  *f_over_r = 24.0 * pf->epsilon * (2.0 * sr6 * sr6 - sr6) / r2;
+  return 4.0 * pf->epsilon * (sr6 * sr6 - sr6);
+}
+
+PairForce *
+createPairForce(const int kind, const double epsilon, const double sigma, const double cutoff)
+{
+  PairForce *pf;
+  double unused;
+
+  if (kind < 0 || kind >= PAIR_KIND_CT || sigma <= 0) return NULL;
+  pf = (PairForce*)tracked_calloc(1, sizeof(PairForce), ALLOC_FORCES);
+  if (pf == NULL) return NULL;
+
+  pf->kind = kind;
+  pf->epsilon = epsilon;
+  pf->sigma = sigma;
+  switch (kind) {
+    case PAIR_LJ:  pf->cutoff = (cutoff > 0) ? cutoff : 2.5 * sigma; break;
+    case PAIR_WCA: pf->cutoff = pow(2.0, 1.0 / 6.0) * sigma; break;
+    default:       pf->cutoff = sigma; break;
+  }
+  pf->shift = pair_kernel(pf, pf->cutoff * pf->cutoff, &unused);
+  pf->store = (MapStore){NULL, 0, 0};
+  return pf;
+}
+
+void
+destroy_pairForce(PairForce *pf)
+{
+  if (pf == NULL) return;
+  destroy_mapStore(&pf->store);
+  tracked_free(pf->cell_potential);
+  tracked_free(pf->cell_virial);
+  tracked_free(pf);
+}
+
+const char *
+pair_kindName(const int kind)
+{
+  if (kind < 0 || kind >= PAIR_KIND_CT) return NULL;
+  return kind_names[kind];
+}
+
+int
+pair_fitsCube(const PairForce *pf, const Cube cube)
+{
+  const Vector3 extent = cubeExtent(&cube);
+  const double span = 2.0 * pf->cutoff;
+
+  if (!cube.periodic) return 1;
+  return extent.x >= span && extent.y >= span && extent.z >= span;
+}
+
+/**** One pair: force on i along r_i - r_j (its nearest image in a periodic box), the opposite on j ****/
+static void
+pair_interact(const PairForce *pf, const Cube *cube, const Object objects[], Vector3 accel[], const int i, const int j,
+              double *potential, double *virial, uint64_t *in_range)
+{
+  double dx = objects[i].position.x - objects[j].position.x;
+  double dy = objects[i].position.y - objects[j].position.y;
+  double dz = objects[i].position.z - objects[j].position.z;
+  double r2, f_over_r, fi, fj;
+
+  if (cube->periodic) {
+    dx = min_image(dx, cube->max.x - cube->min.x);
+    dy = min_image(dy, cube->max.y - cube->min.y);
+    dz = min_image(dz, cube->max.z - cube->min.z);
+  }
+  r2 = dx * dx + dy * dy + dz * dz;
+
+  if (r2 >= pf->cutoff * pf->cutoff || r2 == 0) return;        // Coincident particles have no direction
+  *potential += pair_kernel(pf, r2, &f_over_r) - pf->shift;
+  *virial += f_over_r * r2;
+  (*in_range)++;
+  fi = f_over_r / objects[i].mass;
+  fj = f_over_r / objects[j].mass;
+  accel[i].x += fi * dx;
+  accel[i].y += fi * dy;
+  accel[i].z += fi * dz;
+  accel[j].x -= fj * dx;
+  accel[j].y -= fj * dy;
+  accel[j].z -= fj * dz;
+}
+
+/**** Pairs within cell c and between c and its half shell, wrapped in a periodic box.
+ * Writes reach only c's 3x3x3 neighbourhood ****/
+static void
+pair_cell(PairForce *pf, const Cube *cube, const Object objects[], Map *map[], const int c, Vector3 accel[],
+          uint64_t *tested, uint64_t *in_range)
+{
+  const Int3 center = decompose_1Dindex(c, pf->dims);
+  const Int3 dims = pf->dims;
+  double potential = 0, virial = 0;
+  Map *curr, *adjust;
+
+  if (map[c]->obj_index != -1) {
+    for (curr = map[c]; curr != NULL; curr = curr->next) {
+      for (adjust = curr->next; adjust != NULL; adjust = adjust->next) {
+        pair_interact(pf, cube, objects, accel, curr->obj_index, adjust->obj_index, &potential, &virial, in_range);
+        (*tested)++;
+      }
+    }
+    for (int s = 0; s < 13; s++) {
+      Int3 n = {center.x + half_shell[s].x, center.y + half_shell[s].y, center.z + half_shell[s].z};
+      if (sweep_repeats(half_shell[s], dims, cube->periodic)) continue;
+      if (cube->periodic) n = wrap_cell(n, dims);
+      if (!grid_contains(n, dims)) continue;
+      Map *neighbour = map[grid_indexCalc(n, dims)];
+      if (neighbour->obj_index == -1) continue;
+      for (curr = map[c]; curr != NULL; curr = curr->next) {
+        for (adjust = neighbour; adjust != NULL; adjust = adjust->next) {
+          pair_interact(pf, cube, objects, accel, curr->obj_index, adjust->obj_index, &potential, &virial, in_range);
+          (*tested)++;
+        }
+      }
+    }
+  }
+  pf->cell_potential[c] = potential;
+  pf->cell_virial[c] = virial;
+}
+
+/**** Same colour sweep as collisionStep: a cell and its half shell stay inside its 3x3x3 block, and blocks of
+ * one colour don't overlap, so a colour's cells run in parallel and the result doesn't depend on thread count.
+ * Cells are at least one cutoff wide, widened so there are about 2N or fewer and a dilute box doesn't get millions.
+ * A periodic box uses nearest images, so it must be at least two cutoffs wide along each axis or a pair would be
+ * counted once per image in range; narrower boxes are refused. An axis under 3 cells would wrap a half shell onto
+ * itself and is merged into one cell ****/
+int
+pairForces(PairForce *pf, const Object objects[], const Cube cube, const int particle_ct, Vector3 accel[])
+{
+  const Int3 dims = sweep_dims(gridDims(cube, pf->cutoff, 2 * particle_ct), cube.periodic);
+  const int partition_ct = grid_partitionCount(dims), colour_ct = sweep_colours(dims, cube.periodic);
+  int status;
+  uint64_t tested = 0, in_range = 0;
+  Map **map;
+
+  if (!pair_fitsCube(pf, cube)) return -1;
+  pf->dims = dims;
+  pf->potential = 0;
+  pf->virial = 0;
+  pf->pairs_tested = 0;
+  pf->pairs_in_range = 0;
+
+  if (partition_ct > pf->cell_capacity) {
+    double *potential = (double*)tracked_realloc(pf->cell_potential, partition_ct * sizeof(double), ALLOC_FORCES);
+    if (potential == NULL) return -1;
+    pf->cell_potential = potential;
+    double *virial = (double*)tracked_realloc(pf->cell_virial, partition_ct * sizeof(double), ALLOC_FORCES);
+    if (virial == NULL) return -1;
+    pf->cell_virial = virial;
+    pf->cell_capacity = partition_ct;
+  }
+
+  PROFILE_BEGIN(pair_start);
+  perf_enter();
+  TRACE_BEGIN(pair_trace);
+  status = buildMap(&pf->store, objects, cube, dims, particle_ct);
+  if (status != 0) {
+    perf_leave(PERF_PAIRS);
+    return -1;
+  }
+  map = pf->store.map;
+
+  #pragma omp parallel reduction(+:tested,in_range)
+  {
+    for (int colour = 0; colour < colour_ct; colour++) {
+      const SweepClass sweep = sweepClass(dims, cube.periodic, colour);
+
+      #pragma omp for schedule(dynamic, 4)
+      for (int k = 0; k < sweep.count.x * sweep.count.y * sweep.count.z; k++) {
+        pair_cell(pf, &cube, objects, map, grid_indexCalc(sweep_cell(&sweep, k), dims), accel, &tested, &in_range);
+      }
+    }
+  }
+
+  for (int c = 0; c < partition_ct; c++) {
+    pf->potential += pf->cell_potential[c];
+    pf->virial += pf->cell_virial[c];
+  }
+  pf->pairs_tested = tested;
+  pf->pairs_in_range = in_range;
+  TRACE_END(TRACE_PAIRS, pair_trace, particle_ct, (int)in_range);
+  perf_leave(PERF_PAIRS);
+  PROFILE_END(PHASE_PAIRS, pair_start);
+  return 0;
+}
@@ -0,0 +1,184 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "../include/PerfCounters.h"
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+PerfCounters *perf_session = NULL;
+
+static const char *event_names[PERF_EVENT_CT] = {
+  "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "task_clock_ns"
+};
+
+static const char *phase_names[PERF_PHASE_CT] = {
+  "map", "scan", "integrate", "tree", "pairs", "contacts", "mesh", "walls"
+};
+
+#ifdef __linux__
+/**** Counts the calling thread in user space only, so perf_event_paranoid <= 2 is enough ****/
+static int
+open_event(const int event)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.type = PERF_TYPE_HARDWARE;
+  switch (event) {
+    case PERF_CYCLES: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+    case PERF_INSTRUCTIONS: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+    case PERF_L1D_MISSES:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    case PERF_LLC_MISSES: attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+    case PERF_BRANCH_MISSES: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+    default:
+      attr.type = PERF_TYPE_SOFTWARE;
+      attr.config = PERF_COUNT_SW_TASK_CLOCK;
+      break;
+  }
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**** Value scaled up by enabled / running time when the kernel had to multiplex ****/
+static double
+read_event(const int fd)
+{
+  uint64_t buf[3];
+
+  if (fd < 0 || read(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf) || buf[2] == 0) return 0.0;
+  return (double)buf[0] * ((double)buf[1] / buf[2]);
+}
+#else
+static int
+open_event(const int event)
+{
+  (void)event;
+  errno = ENOSYS;
+  return -1;
+}
+
+static double
+read_event(const int fd)
+{
+  (void)fd;
+  return 0.0;
+}
+#endif
+
+PerfCounters *
+openPerfCounters(void)
+{
+  PerfCounters *pc = (PerfCounters*)calloc(1, sizeof(PerfCounters));
+  if (pc == NULL) return NULL;
+
+#ifdef _OPENMP
+  pc->thread_ct = omp_get_max_threads();
+#else
+  pc->thread_ct = 1;
+#endif
+  if (pc->thread_ct > PERF_MAX_THREADS) pc->thread_ct = PERF_MAX_THREADS;
+  for (int t = 0; t < PERF_MAX_THREADS; t++) {
+    for (int e = 0; e < PERF_EVENT_CT; e++) pc->fds[t][e] = -1;
+  }
+
+  // Each worker opens its own counters; static schedule pins iteration t to thread t
+  #pragma omp parallel for schedule(static, 1) num_threads(pc->thread_ct)
+  for (int t = 0; t < pc->thread_ct; t++) {
+    for (int e = 0; e < PERF_EVENT_CT; e++) {
+      pc->fds[t][e] = open_event(e);
+      if (pc->fds[t][e] < 0 && t == 0 && pc->error == 0) pc->error = errno;
+    }
+  }
+
+  // An event counts only if every thread has it, otherwise the sums would be partial
+  for (int e = 0; e < PERF_EVENT_CT; e++) {
+    pc->event_ok[e] = 1;
+    for (int t = 0; t < pc->thread_ct; t++) {
+      if (pc->fds[t][e] < 0) pc->event_ok[e] = 0;
+    }
+    if (pc->event_ok[e]) pc->available = 1;
+  }
+  return pc;
+}
+
+void
+startPerfCounters(PerfCounters *pc)
+{
+  if (pc != NULL) {
+    memset(pc->calls, 0, sizeof(pc->calls));
+    memset(pc->value, 0, sizeof(pc->value));
+  }
+  perf_session = (pc != NULL && pc->available) ? pc : NULL;
+}
+
+/**** Totals of every usable event over all threads ****/
+static void
+read_totals(const PerfCounters *pc, double totals[])
+{
+  for (int e = 0; e < PERF_EVENT_CT; e++) {
+    totals[e] = 0.0;
+    if (!pc->event_ok[e]) continue;
+    for (int t = 0; t < pc->thread_ct; t++) totals[e] += read_event(pc->fds[t][e]);
+  }
+}
+
+void
+perf_enter(void)
+{
+  if (perf_session == NULL) return;
+  read_totals(perf_session, perf_session->snapshot);
+}
+
+void
+perf_leave(const int phase)
+{
+  double totals[PERF_EVENT_CT];
+
+  if (perf_session == NULL) return;
+  read_totals(perf_session, totals);
+  for (int e = 0; e < PERF_EVENT_CT; e++) {
+    perf_session->value[phase][e] += totals[e] - perf_session->snapshot[e];
+  }
+  perf_session->calls[phase]++;
+}
+
+const char *
+perf_eventName(const int event)
+{
+  if (event < 0 || event >= PERF_EVENT_CT) return NULL;
+  return event_names[event];
+}
+
+const char *
+perf_phaseName(const int phase)
+{
+  if (phase < 0 || phase >= PERF_PHASE_CT) return NULL;
+  return phase_names[phase];
+}
+
+void
+closePerfCounters(PerfCounters *pc)
+{
+  if (pc == NULL) return;
+  if (perf_session == pc) perf_session = NULL;
+  for (int t = 0; t < pc->thread_ct; t++) {
+    for (int e = 0; e < PERF_EVENT_CT; e++) {
+      if (pc->fds[t][e] >= 0) close(pc->fds[t][e]);
+    }
+  }
+  free(pc);
+}
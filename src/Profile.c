@@ -0,0 +1,72 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include "../include/Profile.h"
+
+static const char *phase_names[PHASE_CT] = {
+  "map_alloc", "binning", "neighbor_scan", "narrow", "collision", "wall", "integrate", "tree_build", "tree_force", "pairs", "contacts", "mesh"
+};
+
+#ifdef PSIM_PROFILE
+PhaseCounter profile_counters[PHASE_CT];
+
+static double
+monotonic_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**** Tick rate measured once against the monotonic clock over a short spin ****/
+static double
+calibrate_ticks(void)
+{
+  static double ticks_per_second = 0.0;
+
+  if (ticks_per_second > 0.0) return ticks_per_second;
+#if !defined(__x86_64__) && !defined(__i386__)
+  ticks_per_second = 1e9;
+#else
+  double start_s, end_s;
+  uint64_t start_t, end_t;
+
+  start_s = monotonic_seconds();
+  start_t = profile_ticks();
+  do {
+    end_s = monotonic_seconds();
+  } while (end_s - start_s < 0.01);
+  end_t = profile_ticks();
+  ticks_per_second = (end_t - start_t) / (end_s - start_s);
+#endif
+  return ticks_per_second;
+}
+#endif
+
+Profile
+get_profile(void)
+{
+  Profile profile;
+
+  memset(&profile, 0, sizeof(Profile));
+#ifdef PSIM_PROFILE
+  profile.enabled = 1;
+  profile.ticks_per_second = calibrate_ticks();
+  memcpy(profile.phase, profile_counters, sizeof(profile_counters));
+#endif
+  return profile;
+}
+
+void
+reset_profile(void)
+{
+#ifdef PSIM_PROFILE
+  memset(profile_counters, 0, sizeof(profile_counters));
+#endif
+}
+
+const char *
+profile_phaseName(const int phase)
+{
+  if (phase < 0 || phase >= PHASE_CT) return NULL;
+  return phase_names[phase];
+}
@@ -0,0 +1,213 @@
+#define _DEFAULT_SOURCE
+#include <math.h>
+#include <string.h>
+#include "../include/Render.h"
+#include "../include/Alloc.h"
+
+/**** Rings of latitude from pole to pole; the seam column is duplicated so indices stay simple ****/
+SphereMesh *
+createSphereMesh(const int slices, const int stacks)
+{
+  SphereMesh *mesh = (SphereMesh*)tracked_malloc(sizeof(SphereMesh), ALLOC_RENDER);
+  double theta, phi;
+  int v = 0, k = 0, row, next;
+
+  if (mesh == NULL || slices < 3 || stacks < 2) {
+    tracked_free(mesh);
+    return NULL;
+  }
+
+  mesh->vertex_ct = (stacks + 1) * (slices + 1);
+  mesh->index_ct = stacks * slices * 6;
+  mesh->vertices = (float*)tracked_malloc(mesh->vertex_ct * 3 * sizeof(float), ALLOC_RENDER);
+  mesh->indices = (uint32_t*)tracked_malloc(mesh->index_ct * sizeof(uint32_t), ALLOC_RENDER);
+  if (mesh->vertices == NULL || mesh->indices == NULL) {
+    destroy_sphereMesh(mesh);
+    return NULL;
+  }
+
+  for (int i = 0; i <= stacks; i++) {
+    phi = M_PI * i / stacks;
+    for (int j = 0; j <= slices; j++) {
+      theta = 2.0 * M_PI * j / slices;
+      mesh->vertices[v++] = (float)(sin(phi) * cos(theta));
+      mesh->vertices[v++] = (float)cos(phi);
+      mesh->vertices[v++] = (float)(sin(phi) * sin(theta));
+    }
+  }
+
+  for (int i = 0; i < stacks; i++) {
+    row = i * (slices + 1);
+    next = row + slices + 1;
+    for (int j = 0; j < slices; j++) {
+      mesh->indices[k++] = row + j;
+      mesh->indices[k++] = next + j;
+      mesh->indices[k++] = row + j + 1;
+      mesh->indices[k++] = row + j + 1;
+      mesh->indices[k++] = next + j;
+      mesh->indices[k++] = next + j + 1;
+    }
+  }
+
+  return mesh;
+}
+
+void
+destroy_sphereMesh(SphereMesh *mesh)
+{
+  if (mesh == NULL) return;
+  tracked_free(mesh->vertices);
+  tracked_free(mesh->indices);
+  tracked_free(mesh);
+}
+
+/**** One linear pass straight from particle state into the upload buffer ****/
+int
+fillInstances(const Object objects[], const int particle_ct, float out[])
+{
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < particle_ct; i++) {
+    float *dst = out + (size_t)i * INSTANCE_FLOATS;
+    dst[0] = (float)objects[i].position.x;
+    dst[1] = (float)objects[i].position.y;
+    dst[2] = (float)objects[i].position.z;
+    dst[3] = (float)objects[i].radius;
+    dst[4] = (float)magnitude(objects[i].velocity);
+  }
+  return particle_ct;
+}
+
+/**** Gribb/Hartmann planes (a, b, c, d) with inside meaning a x + b y + c z + d >= 0, normalized ****/
+static void
+frustum_planes(const float m[16], double planes[6][4])
+{
+  double length;
+
+  for (int k = 0; k < 3; k++) {
+    for (int c = 0; c < 4; c++) {
+      planes[2 * k][c] = m[c * 4 + 3] + m[c * 4 + k];
+      planes[2 * k + 1][c] = m[c * 4 + 3] - m[c * 4 + k];
+    }
+  }
+  for (int p = 0; p < 6; p++) {
+    length = sqrt(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+    for (int c = 0; c < 4; c++) planes[p][c] /= length;
+  }
+}
+
+/**** -1 fully outside, 1 fully inside, 0 straddling, for a box grown by pad ****/
+static int
+classify_box(double planes[6][4], const Vector3 min, const Vector3 max, const double pad)
+{
+  int inside = 1;
+  double near, far;
+
+  for (int p = 0; p < 6; p++) {
+    const double *n = planes[p];
+    // Signed distance of the corners farthest along and against the normal
+    far = n[3] + n[0] * (n[0] > 0 ? max.x : min.x) + n[1] * (n[1] > 0 ? max.y : min.y)
+          + n[2] * (n[2] > 0 ? max.z : min.z);
+    near = n[3] + n[0] * (n[0] > 0 ? min.x : max.x) + n[1] * (n[1] > 0 ? min.y : max.y)
+           + n[2] * (n[2] > 0 ? min.z : max.z);
+    if (far < -pad) return -1;
+    if (near < pad) inside = 0;
+  }
+  return inside;
+}
+
+static int
+sphere_visible(double planes[6][4], const Vector3 c, const double radius)
+{
+  for (int p = 0; p < 6; p++) {
+    if (planes[p][0] * c.x + planes[p][1] * c.y + planes[p][2] * c.z + planes[p][3] < -radius) return 0;
+  }
+  return 1;
+}
+
+/**** Tier from projected diameter; w is the clip space w of the centre ****/
+static int
+lod_tier(const float m[16], const Vector3 c, const double radius, const double focal_px,
+         const double lod_px[LOD_TIERS - 1])
+{
+  const double w = m[3] * c.x + m[7] * c.y + m[11] * c.z + m[15];
+  const double diameter_px = (w > tol) ? 2.0 * radius * focal_px / w : 1e30;
+  int k = 0;
+
+  while (k < LOD_TIERS - 1 && diameter_px < lod_px[k]) k++;
+  return k;
+}
+
+/* Pass 1 walks the buckets: cells outside the frustum are dropped whole, cells
+   inside skip the sphere test, straddling cells test each sphere. Boundary cells
+   also hold particles pushed past a wall, so they are never rejected whole.
+   Pass 2 prefix sums the tier counts and scatters instances into their tier */
+int
+cullInstances(const Object objects[], const int particle_ct, const Cube cube, const Int3 dims,
+              const float view_proj[16], const double focal_px, const double lod_px[LOD_TIERS - 1],
+              int tier[], float out[], CullResult *result)
+{
+  const int partition_ct = grid_partitionCount(dims);
+  const Vector3 extent = cubeExtent(&cube);
+  const Vector3 cell_len = {extent.x / dims.x, extent.y / dims.y, extent.z / dims.z};
+  double planes[6][4], max_radius = 0;
+  int status = 0, verdict, cursor[LOD_TIERS];
+  Map **map = createMap(objects, cube, dims, particle_ct, &status);
+  Map *curr;
+  Int3 cell;
+  Vector3 min, max;
+
+  if (map == NULL) return -1;
+  frustum_planes(view_proj, planes);
+  memset(result, 0, sizeof(CullResult));
+
+  for (int i = 0; i < particle_ct; i++) {
+    tier[i] = -1;
+    if (objects[i].radius > max_radius) max_radius = objects[i].radius;
+  }
+
+  for (int i = 0; i < partition_ct; i++) {
+    if (map[i]->obj_index == -1) continue;
+    cell = decompose_1Dindex(i, dims);
+    min = (Vector3){cube.min.x + cell.x * cell_len.x, cube.min.y + cell.y * cell_len.y, cube.min.z + cell.z * cell_len.z};
+    max = addVectors(min, cell_len);
+
+    verdict = classify_box(planes, min, max, max_radius);
+    if (verdict == -1 && (cell.x == 0 || cell.y == 0 || cell.z == 0 || cell.x == dims.x - 1
+                          || cell.y == dims.y - 1 || cell.z == dims.z - 1)) {
+      verdict = 0;
+    }
+    if (verdict == -1) {
+      result->cells_rejected++;
+      continue;
+    }
+    if (verdict == 1) result->cells_accepted++;
+
+    for (curr = map[i]; curr != NULL && curr->obj_index != -1; curr = curr->next) {
+      const Object *o = &objects[curr->obj_index];
+      if (verdict == 0 && !sphere_visible(planes, o->position, o->radius)) continue;
+      tier[curr->obj_index] = lod_tier(view_proj, o->position, o->radius, focal_px, lod_px);
+      result->tier_ct[tier[curr->obj_index]]++;
+    }
+  }
+  destroy_map(map, partition_ct);
+
+  for (int k = 0; k < LOD_TIERS; k++) {
+    result->tier_start[k] = result->visible;
+    cursor[k] = result->visible;
+    result->visible += result->tier_ct[k];
+  }
+
+  // Index order scatter keeps the output stable frame to frame
+  for (int i = 0; i < particle_ct; i++) {
+    float *dst;
+    if (tier[i] < 0) continue;
+    dst = out + (size_t)(cursor[tier[i]]++) * INSTANCE_FLOATS;
+    dst[0] = (float)objects[i].position.x;
+    dst[1] = (float)objects[i].position.y;
+    dst[2] = (float)objects[i].position.z;
+    dst[3] = (float)objects[i].radius;
+    dst[4] = (float)magnitude(objects[i].velocity);
+  }
+
+  return result->visible;
+}
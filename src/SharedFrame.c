@@ -0,0 +1,192 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/SharedFrame.h"
+#include "../include/Alloc.h"
+
+#define READ_RETRIES 16
+
+/**** Slot size for a particle count, padded to a cache line ****/
+static uint64_t
+slot_size(const uint64_t particle_ct)
+{
+  uint64_t bytes = sizeof(SharedSlotHeader) + 4 * particle_ct * sizeof(float);
+  return (bytes + SHARED_FRAME_ALIGN - 1) / SHARED_FRAME_ALIGN * SHARED_FRAME_ALIGN;
+}
+
+static SharedSlotHeader *
+slot_at(const SharedRingHeader *ring, const uint64_t index)
+{
+  return (SharedSlotHeader*)((char*)ring + ring->slot_offset + index * ring->slot_bytes);
+}
+
+/**** Creates the segment and writes the ring header; slots start with seq 0 ****/
+SharedFrames *
+openSharedFrames(const char *name, const int particle_ct, const int slot_ct)
+{
+  SharedFrames *shm;
+  SharedRingHeader *ring;
+  size_t length;
+  void *mapping;
+  int fd;
+
+  if (particle_ct <= 0 || slot_ct <= 0) return NULL;    // publishFrame picks the slot as step % slot_ct
+  shm = (SharedFrames*)tracked_malloc(sizeof(SharedFrames), ALLOC_IO);
+  if (shm == NULL) return NULL;
+  length = sizeof(SharedRingHeader) + (size_t)slot_ct * slot_size(particle_ct);
+
+  shm_unlink(name);                                 // Drop a segment left by a crashed run
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0 || ftruncate(fd, length) != 0) {
+    fprintf(stderr, "SharedFrame: cannot create %s\n", name);
+    if (fd >= 0) {
+      close(fd);
+      shm_unlink(name);
+    }
+    tracked_free(shm);
+    return NULL;
+  }
+  mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    shm_unlink(name);
+    tracked_free(shm);
+    return NULL;
+  }
+
+  // ftruncate zero fills, so only the header needs writing
+  ring = (SharedRingHeader*)mapping;
+  ring->version = SHARED_FRAME_VERSION;
+  ring->slot_ct = slot_ct;
+  ring->particle_ct = particle_ct;
+  ring->slot_bytes = slot_size(particle_ct);
+  ring->slot_offset = sizeof(SharedRingHeader);
+  ring->latest = UINT64_MAX;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(ring->magic, SHARED_FRAME_MAGIC, 8);       // Last, so attachers never see a half built header
+
+  shm->ring = ring;
+  shm->length = length;
+  shm->writable = 1;
+  shm->name = (char*)tracked_malloc(strlen(name) + 1, ALLOC_IO);
+  if (shm->name == NULL) {                          // close couldn't unlink it, so don't leave it behind
+    munmap(mapping, length);
+    shm_unlink(name);
+    tracked_free(shm);
+    return NULL;
+  }
+  strcpy(shm->name, name);
+  return shm;
+}
+
+SharedFrames *
+attachSharedFrames(const char *name)
+{
+  SharedFrames *shm = (SharedFrames*)tracked_malloc(sizeof(SharedFrames), ALLOC_IO);
+  SharedRingHeader *ring;
+  struct stat st;
+  void *mapping;
+  int fd;
+
+  if (shm == NULL) return NULL;
+  fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SharedRingHeader)) {
+    if (fd >= 0) close(fd);
+    tracked_free(shm);
+    return NULL;
+  }
+  mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    tracked_free(shm);
+    return NULL;
+  }
+
+  ring = (SharedRingHeader*)mapping;
+  if (memcmp(ring->magic, SHARED_FRAME_MAGIC, 8) != 0 || ring->version != SHARED_FRAME_VERSION || ring->slot_ct == 0
+      || ring->slot_offset + ring->slot_ct * ring->slot_bytes > (uint64_t)st.st_size) {
+    fprintf(stderr, "SharedFrame: %s is not a v%d frame ring\n", name, SHARED_FRAME_VERSION);
+    munmap(mapping, st.st_size);
+    tracked_free(shm);
+    return NULL;
+  }
+
+  shm->ring = ring;
+  shm->length = st.st_size;
+  shm->writable = 0;
+  shm->name = NULL;
+  return shm;
+}
+
+/**** Seqlock write: odd seq, fill, even seq, then advertise the slot as latest ****/
+int
+publishFrame(SharedFrames *shm, const Object objects[], const int particle_ct, const uint64_t step,
+             const double time)
+{
+  SharedRingHeader *ring = shm->ring;
+  const uint64_t index = step % ring->slot_ct;
+  SharedSlotHeader *slot = slot_at(ring, index);
+  float *positions = (float*)(slot + 1);
+  float *radii = positions + 3 * ring->particle_ct;
+  const uint64_t seq = slot->seq;
+
+  if (!shm->writable || (uint64_t)particle_ct != ring->particle_ct) return -1;
+
+  __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  slot->frame = step;
+  slot->time = time;
+  for (int i = 0; i < particle_ct; i++) {
+    positions[3 * i] = (float)objects[i].position.x;
+    positions[3 * i + 1] = (float)objects[i].position.y;
+    positions[3 * i + 2] = (float)objects[i].position.z;
+    radii[i] = (float)objects[i].radius;
+  }
+
+  __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&ring->latest, index, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/**** Seqlock read of the latest slot, retried if the writer lapped us mid copy ****/
+int
+readLatestFrame(const SharedFrames *shm, float positions[], float radii[], uint64_t *frame)
+{
+  const SharedRingHeader *ring = shm->ring;
+  const SharedSlotHeader *slot;
+  const float *src;
+  uint64_t index, before, after;
+
+  for (int attempt = 0; attempt < READ_RETRIES; attempt++) {
+    index = __atomic_load_n(&ring->latest, __ATOMIC_ACQUIRE);
+    if (index == UINT64_MAX) return -1;
+    slot = slot_at(ring, index);
+    src = (const float*)(slot + 1);
+
+    before = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (before & 1) continue;
+
+    memcpy(positions, src, 3 * ring->particle_ct * sizeof(float));
+    if (radii != NULL) memcpy(radii, src + 3 * ring->particle_ct, ring->particle_ct * sizeof(float));
+    if (frame != NULL) (*frame) = slot->frame;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    if (before == after) return 0;
+  }
+  return -1;
+}
+
+void
+closeSharedFrames(SharedFrames *shm)
+{
+  if (shm == NULL) return;
+  munmap(shm->ring, shm->length);
+  if (shm->writable && shm->name != NULL) shm_unlink(shm->name);
+  tracked_free(shm->name);
+  tracked_free(shm);
+}
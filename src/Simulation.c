@@ -0,0 +1,204 @@
+#include <sys/mman.h>
+#include <string.h>
+#include "../include/Simulation.h"
+#include "../include/Alloc.h"
+#include "../include/Trace.h"
+
+/**** Random position in [2, 8] drawn from the run's rng, same range as randomPosition() ****/
+static double
+rng_position(Rng *rng)
+{
+  return 6.0 * rng_uniform(rng) + 2.0;
+}
+
+/**** Allocates a run and places its particles reproducibly from seed ****/
+Simulation *
+createSimulation(const Cube cube, const int particle_ct, const double radius,
+                 const double dt, const int sub_steps, const uint64_t seed)
+{
+  Simulation *sim = (Simulation*)tracked_malloc(sizeof(Simulation), ALLOC_SIMULATION);
+  if (sim == NULL) return NULL;
+
+  sim->objects = (Object*)tracked_malloc(particle_ct * sizeof(Object), ALLOC_SIMULATION);
+  if (sim->objects == NULL) {
+    tracked_free(sim);
+    return NULL;
+  }
+
+  sim->cube = cube;
+  sim->container = boxContainer(cube);
+  sim->particle_ct = particle_ct;
+  sim->sub_steps = sub_steps;
+  sim->dt = dt;
+  sim->time = 0.0;
+  sim->step = 0;
+  sim->rng = (Rng){seed, 0};
+  sim->forces = createForceField(FIELD_SPIN);
+  sim->integrator = INTEGRATOR_MIDSTEP;
+  sim->primed = 0;
+  sim->analysis = NULL;
+  sim->gravity = NULL;
+  sim->pairs = NULL;
+  sim->contacts = NULL;
+  sim->obstacles = NULL;
+  sim->trajectory = NULL;
+  sim->frames = NULL;
+  sim->field = NULL;
+  memset(&sim->collision, 0, sizeof(CollisionStats));
+  sim->store = (MapStore){NULL, 0, 0};
+  sim->frame_allocs = 0;
+  sim->mapping = NULL;
+  sim->mapping_len = 0;
+
+  for (int i = 0; i < particle_ct; i++) {
+    sim->objects[i].radius = radius;
+    sim->objects[i].mass = 0.5;
+    sim->objects[i].position.x = rng_position(&sim->rng);
+    sim->objects[i].position.y = rng_position(&sim->rng);
+    sim->objects[i].position.z = rng_position(&sim->rng);
+    sim->objects[i].velocity = (Vector3){0, 0, 0};
+    sim->objects[i].acceleration = (Vector3){0, 0, 0};
+  }
+
+  sim->grid_dims = mapSize(sim->objects, particle_ct, cube);
+  return sim;
+}
+
+/**** Sums the attached forces into sim->field; NULL when nothing is attached, -1 in status on failure.
+ * dt is the substep, which advances the contact springs ****/
+static const Vector3 *
+compute_field(Simulation *sim, const double dt, int *status)
+{
+  (*status) = 0;
+  if (sim->gravity == NULL && sim->pairs == NULL && sim->contacts == NULL) return NULL;
+  if (sim->field == NULL) {
+    sim->field = (Vector3*)tracked_malloc(sim->particle_ct * sizeof(Vector3), ALLOC_FORCES);
+    if (sim->field == NULL) {
+      (*status) = -1;
+      return NULL;
+    }
+  }
+
+  if (sim->gravity != NULL) {
+    if (octreeForces(sim->gravity, sim->objects, sim->particle_ct) != 0) {
+      (*status) = -1;
+      return NULL;
+    }
+    memcpy(sim->field, sim->gravity->accel, sim->particle_ct * sizeof(Vector3));
+  } else {
+    memset(sim->field, 0, sim->particle_ct * sizeof(Vector3));
+  }
+  if (sim->pairs != NULL && pairForces(sim->pairs, sim->objects, sim->cube, sim->particle_ct, sim->field) != 0) {
+    (*status) = -1;
+    return NULL;
+  }
+  if (sim->contacts != NULL &&
+      contactForces(sim->contacts, sim->objects, sim->cube, &sim->container, sim->obstacles, sim->particle_ct, dt,
+                    sim->field) != 0) {
+    (*status) = -1;
+    return NULL;
+  }
+  return sim->field;
+}
+
+/**** Collisions and obstacles, unless contacts replace them, then the attached forces, one update of the run's
+ * integrator and the container pass.
+ * Verlet drifts first so the forces are taken at the new positions and cached for the next substep.
+ * A periodic box wraps positions after every move so the cell lists bin them in range ****/
+static int
+substep(Simulation *sim, const double dt)
+{
+  CollisionStats sub_stats;
+  const Vector3 *field;
+  int status;
+
+  if (sim->integrator == INTEGRATOR_VERLET) {
+    if (!sim->primed) {
+      field = compute_field(sim, 0.0, &status);
+      if (status != 0) return -1;
+      kickObjects(sim->objects, &sim->forces, field, sim->particle_ct, 0.0);
+      sim->primed = 1;
+    }
+    driftObjects(sim->objects, sim->particle_ct, dt);
+    if (sim->cube.periodic) wrapObjects(sim->objects, sim->cube, sim->particle_ct);
+  }
+  if (sim->contacts == NULL) {
+    collisionStep(&sim->store, sim->cube, sim->objects, sim->particle_ct, sim->grid_dims);
+    sub_stats = get_collisionStats();
+    mergeCollisionStats(&sim->collision, &sub_stats);
+    if (sim->obstacles != NULL) meshCollisions(sim->obstacles, sim->objects, sim->particle_ct);
+  }
+  field = compute_field(sim, dt, &status);
+  if (status != 0) return -1;
+
+  switch (sim->integrator) {
+    case INTEGRATOR_VERLET: kickObjects(sim->objects, &sim->forces, field, sim->particle_ct, dt); break;
+    case INTEGRATOR_EULER:  eulerObjects(sim->objects, &sim->forces, field, sim->particle_ct, dt); break;
+    default:                updateObjects(sim->objects, &sim->forces, field, sim->particle_ct, dt); break;
+  }
+  if (sim->contacts == NULL) {
+    sim->collision.wall_hits += containObjects(&sim->container, sim->objects, sim->particle_ct);
+  }
+  if (sim->cube.periodic) wrapObjects(sim->objects, sim->cube, sim->particle_ct);
+  return 0;
+}
+
+/**** Same substepped frame as updateCall, but also advances the clock ****/
+int
+stepSimulation(Simulation *sim, const int frames)
+{
+  const double sub_dt = (double)(sim->dt / sim->sub_steps);
+
+  for (int f = 0; f < frames; f++) {
+    const uint64_t allocs = alloc_count();
+    TRACE_BEGIN(frame_trace);
+    memset(&sim->collision, 0, sizeof(CollisionStats));
+    for (int i = 0; i < sim->sub_steps; i++) {
+      if (substep(sim, sub_dt) != 0) return 0;
+    }
+    sim->step++;
+    TRACE_END(TRACE_FRAME, frame_trace, (int)sim->step, 0);
+    sim->time = sim->step * sim->dt;     // Recomputed rather than summed so a restart can't drift
+
+    if (sim->analysis != NULL && sim->step % sim->analysis->interval == 0) {
+      if (analyzeObjects(sim->analysis, &sim->store, sim->objects, sim->cube, sim->particle_ct,
+                         sim->grid_dims) != 0) {
+        return 0;
+      }
+      sim->analysis->last_step = sim->step;
+    }
+    if (sim->trajectory != NULL && sim->step % sim->trajectory->interval == 0
+        && submitFrame(sim->trajectory, sim->objects, sim->particle_ct, sim->step, sim->time) != 0) {
+      return 0;
+    }
+    if (sim->frames != NULL
+        && publishFrame(sim->frames, sim->objects, sim->particle_ct, sim->step, sim->time) != 0) {
+      return 0;
+    }
+    sim->frame_allocs = alloc_count() - allocs;    // Counts the sampling and hand-off above too
+  }
+
+  return 1;
+}
+
+/**** Frees the handle; objects are either heap owned or part of a checkpoint mapping ****/
+void
+destroy_simulation(Simulation *sim)
+{
+  if (sim == NULL) return;
+  destroy_analysis(sim->analysis);
+  destroy_octree(sim->gravity);
+  destroy_pairForce(sim->pairs);
+  destroy_contactModel(sim->contacts);
+  destroy_triangleMesh(sim->obstacles);
+  if (sim->trajectory != NULL) closeTrajectory(sim->trajectory);
+  closeSharedFrames(sim->frames);
+  tracked_free(sim->field);
+  destroy_mapStore(&sim->store);
+  if (sim->mapping != NULL) {
+    munmap(sim->mapping, sim->mapping_len);
+  } else {
+    tracked_free(sim->objects);
+  }
+  tracked_free(sim);
+}
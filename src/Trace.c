@@ -0,0 +1,142 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "../include/Trace.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+TraceState *trace_active = NULL;
+
+static const char *trace_names[TRACE_NAME_CT] = {
+  "frame", "createMap", "collision scan", "bucket", "destroy_map", "integrate", "tree build", "tree force", "pair forces", "contacts", "obstacles", "walls"
+};
+
+static const char *trace_args[TRACE_NAME_CT][2] = {
+  {"frame", NULL}, {NULL, NULL}, {NULL, NULL}, {"cell", "particles"}, {NULL, NULL}, {"particles", NULL},
+  {"particles", "nodes"}, {"particles", NULL}, {"particles", "pairs"}, {"particles", "contacts"}, {"particles", "contacts"}, {"particles", "contacts"}
+};
+
+static char *exit_path = NULL;
+
+static void
+dump_at_exit(void)
+{
+  if (trace_active != NULL && exit_path != NULL) (void)dumpTrace(exit_path);
+}
+
+int
+startTrace(const size_t events_per_thread, const char *path)
+{
+  static int registered = 0;
+  TraceState *state;
+
+  stopTrace();
+  state = (TraceState*)calloc(1, sizeof(TraceState));
+  if (state == NULL) return -1;
+#ifdef _OPENMP
+  state->thread_ct = omp_get_max_threads();
+#else
+  state->thread_ct = 1;
+#endif
+  state->buffers = (TraceBuffer*)calloc(state->thread_ct, sizeof(TraceBuffer));
+  if (state->buffers == NULL) {
+    free(state);
+    return -1;
+  }
+  for (int t = 0; t < state->thread_ct; t++) {
+    state->buffers[t].events = (TraceEvent*)malloc(events_per_thread * sizeof(TraceEvent));
+    state->buffers[t].capacity = (state->buffers[t].events != NULL) ? events_per_thread : 0;
+  }
+
+  if (path != NULL) {
+    exit_path = (char*)malloc(strlen(path) + 1);
+    if (exit_path != NULL) strcpy(exit_path, path);
+    if (!registered) registered = (atexit(dump_at_exit) == 0);
+  }
+  state->epoch = trace_now();
+  trace_active = state;
+  return 0;
+}
+
+void
+trace_record(const int name, const uint64_t start, const int arg0, const int arg1)
+{
+  const uint64_t end = trace_now();
+  TraceState *state = trace_active;
+  TraceBuffer *buffer;
+  int thread = 0;
+
+#ifdef _OPENMP
+  thread = omp_get_thread_num();
+#endif
+  if (state == NULL || thread >= state->thread_ct) return;
+  buffer = &state->buffers[thread];
+  if (buffer->count == buffer->capacity) {
+    buffer->dropped++;
+    return;
+  }
+  buffer->events[buffer->count++] = (TraceEvent){start - state->epoch, end - start, name, arg0, arg1};
+}
+
+/**** One "X" event; Chrome wants microseconds ****/
+static void
+write_event(FILE *f, const TraceEvent *event, const int thread, const int first)
+{
+  const char *const *args = trace_args[event->name];
+
+  fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+          first ? "" : ",", trace_names[event->name], thread, event->start * 1e-3, event->duration * 1e-3);
+  if (args[0] != NULL) {
+    fprintf(f, ",\"args\":{\"%s\":%d", args[0], event->arg0);
+    if (args[1] != NULL) fprintf(f, ",\"%s\":%d", args[1], event->arg1);
+    fprintf(f, "}");
+  }
+  fprintf(f, "}");
+}
+
+int
+dumpTrace(const char *path)
+{
+  const TraceState *state = trace_active;
+  size_t dropped = 0;
+  int first = 1;
+  FILE *f;
+
+  if (state == NULL) return -1;
+  f = fopen(path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Trace: cannot open %s\n", path);
+    return -1;
+  }
+
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  for (int t = 0; t < state->thread_ct; t++) {
+    fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+            first ? "" : ",", t, (t == 0) ? "main" : "worker", t);
+    first = 0;
+  }
+  for (int t = 0; t < state->thread_ct; t++) {
+    for (size_t i = 0; i < state->buffers[t].count; i++) write_event(f, &state->buffers[t].events[i], t, 0);
+    dropped += state->buffers[t].dropped;
+  }
+  fprintf(f, "\n],\"otherData\":{\"dropped_events\":%zu}}\n", dropped);
+
+  if (fclose(f) != 0) return -1;
+  if (dropped > 0) fprintf(stderr, "Trace: %zu events dropped, buffers were full\n", dropped);
+  return 0;
+}
+
+void
+stopTrace(void)
+{
+  TraceState *state = trace_active;
+
+  trace_active = NULL;
+  free(exit_path);
+  exit_path = NULL;
+  if (state == NULL) return;
+  for (int t = 0; t < state->thread_ct; t++) free(state->buffers[t].events);
+  free(state->buffers);
+  free(state);
+}
@@ -0,0 +1,379 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include <math.h>
+#include "../include/Trajectory.h"
+#include "../include/Alloc.h"
+
+#define VARINT_MAX 5              // Bytes in the longest zigzag LEB128 int32
+
+/**** Fixed point position relative to the header origin. A particle far outside the cube (or NaN) is clamped
+ * to the limit so neither the int32 nor a delta against the keyframe can overflow ****/
+static int32_t
+quantize(const double value, const double origin, const double resolution, uint64_t *clipped)
+{
+  const double steps = (value - origin) / resolution;
+
+  if (steps >= -TRAJECTORY_QUANT_LIMIT && steps <= TRAJECTORY_QUANT_LIMIT) return (int32_t)lround(steps);
+  (*clipped)++;
+  return (steps > 0) ? TRAJECTORY_QUANT_LIMIT : -TRAJECTORY_QUANT_LIMIT;
+}
+
+/**** Zigzag + LEB128: small deltas of either sign take one or two bytes ****/
+static size_t
+put_varint(unsigned char *out, const int32_t value)
+{
+  uint32_t zz = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+  size_t n = 0;
+  while (zz >= 0x80) {
+    out[n++] = (unsigned char)(zz | 0x80);
+    zz >>= 7;
+  }
+  out[n++] = (unsigned char)zz;
+  return n;
+}
+
+/**** Payload buffer size: every coordinate at the worst case varint length ****/
+static size_t
+payload_capacity(const uint64_t particle_ct)
+{
+  return 3 * particle_ct * VARINT_MAX;
+}
+
+static size_t
+get_varint(const unsigned char *in, int32_t *value)
+{
+  uint32_t zz = 0;
+  size_t n = 0;
+  int shift = 0;
+  do {
+    zz |= (uint32_t)(in[n] & 0x7F) << shift;
+    shift += 7;
+  } while ((in[n++] & 0x80) && n < VARINT_MAX);   // A corrupt run of continuation bytes stops at 5
+  (*value) = (int32_t)(zz >> 1) ^ -(int32_t)(zz & 1);
+  return n;
+}
+
+/**** Encodes one slot. Keyframes are raw int32s, others are deltas against the last keyframe ****/
+static int
+write_slot(TrajectoryWriter *w, const TrajectorySlot *slot)
+{
+  const TrajectoryHeader *h = &w->header;
+  const int count = (int)h->particle_ct * 3;
+  TrajectoryFrame frame;
+  TrajectoryIndex *grown;
+  size_t bytes = 0;
+
+  for (int i = 0; i < (int)h->particle_ct; i++) {
+    w->quantized[3 * i] = quantize(slot->positions[i].x, h->origin.x, h->resolution, &w->clipped);
+    w->quantized[3 * i + 1] = quantize(slot->positions[i].y, h->origin.y, h->resolution, &w->clipped);
+    w->quantized[3 * i + 2] = quantize(slot->positions[i].z, h->origin.z, h->resolution, &w->clipped);
+  }
+
+  frame.keyframe = (w->frame_ct % h->keyframe_interval == 0);
+  if (frame.keyframe) {
+    memcpy(w->keyframe, w->quantized, count * sizeof(int32_t));
+    memcpy(w->payload, w->quantized, count * sizeof(int32_t));
+    bytes = count * sizeof(int32_t);
+  } else {
+    for (int i = 0; i < count; i++) {
+      bytes += put_varint(w->payload + bytes, w->quantized[i] - w->keyframe[i]);
+    }
+  }
+
+  if (w->frame_ct == w->index_cap) {
+    grown = (TrajectoryIndex*)tracked_realloc(w->index, 2 * w->index_cap * sizeof(TrajectoryIndex), ALLOC_IO);
+    if (grown == NULL) return -1;
+    w->index = grown;
+    w->index_cap *= 2;
+  }
+  w->index[w->frame_ct] = (TrajectoryIndex){slot->step, (uint64_t)ftell(w->file)};
+
+  frame.step = slot->step;
+  frame.time = slot->time;
+  frame.payload_bytes = (uint32_t)bytes;
+  if (fwrite(&frame, sizeof(frame), 1, w->file) != 1) return -1;
+  if (fwrite(w->payload, 1, bytes, w->file) != bytes) return -1;
+
+  w->frame_ct++;
+  return 0;
+}
+
+/**** io thread: pops filled slots until closed and drained ****/
+static void *
+writer_loop(void *arg)
+{
+  TrajectoryWriter *w = (TrajectoryWriter*)arg;
+  TrajectorySlot *slot;
+  int status;
+
+  pthread_mutex_lock(&w->lock);
+  while (1) {
+    while (w->queued == 0 && !w->closing) {
+      pthread_cond_wait(&w->not_empty, &w->lock);
+    }
+    if (w->queued == 0 && w->closing) break;
+
+    slot = &w->slots[w->tail];
+    pthread_mutex_unlock(&w->lock);
+
+    // Encoding and the fwrite happen outside the lock so submit never waits on disk
+    status = w->failed ? -1 : write_slot(w, slot);
+
+    pthread_mutex_lock(&w->lock);
+    if (status != 0) w->failed = 1;
+    w->tail = (w->tail + 1) % w->queue_depth;
+    w->queued--;
+    pthread_cond_signal(&w->not_full);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+/**** Frees everything owned by the writer (file closed separately) ****/
+static void
+free_writer(TrajectoryWriter *w)
+{
+  if (w->slots != NULL) {
+    for (int i = 0; i < w->queue_depth; i++) tracked_free(w->slots[i].positions);
+  }
+  tracked_free(w->slots);
+  tracked_free(w->keyframe);
+  tracked_free(w->quantized);
+  tracked_free(w->payload);
+  tracked_free(w->index);
+  tracked_free(w);
+}
+
+/**** Opens the trajectory and preallocates every buffer so the io thread never allocates per frame ****/
+TrajectoryWriter *
+openTrajectory(const char *path, const Cube cube, const int particle_ct, const int interval,
+               const int keyframe_interval, const int queue_depth, const double resolution)
+{
+  TrajectoryWriter *w;
+  int alloc_failed = 0;
+
+  if (particle_ct <= 0 || !(resolution > 0)) return NULL;
+  w = (TrajectoryWriter*)tracked_malloc(sizeof(TrajectoryWriter), ALLOC_IO);
+  if (w == NULL) return NULL;
+  memset(w, 0, sizeof(TrajectoryWriter));
+
+  memcpy(w->header.magic, TRAJECTORY_MAGIC, 8);
+  w->header.version = TRAJECTORY_VERSION;
+  w->header.keyframe_interval = (keyframe_interval > 0) ? keyframe_interval : 1;
+  w->header.particle_ct = particle_ct;
+  w->header.resolution = resolution;
+  w->header.origin = cube.min;
+
+  w->queue_depth = (queue_depth > 0) ? queue_depth : 1;
+  w->interval = (interval > 0) ? interval : 1;
+  w->index_cap = 64;
+  w->slots = (TrajectorySlot*)tracked_calloc(w->queue_depth, sizeof(TrajectorySlot), ALLOC_IO);
+  w->keyframe = (int32_t*)tracked_malloc(3 * particle_ct * sizeof(int32_t), ALLOC_IO);
+  w->quantized = (int32_t*)tracked_malloc(3 * particle_ct * sizeof(int32_t), ALLOC_IO);
+  w->payload = (unsigned char*)tracked_malloc(payload_capacity(particle_ct), ALLOC_IO);
+  w->index = (TrajectoryIndex*)tracked_malloc(w->index_cap * sizeof(TrajectoryIndex), ALLOC_IO);
+  alloc_failed = (w->slots == NULL || w->keyframe == NULL || w->quantized == NULL
+                  || w->payload == NULL || w->index == NULL);
+  for (int i = 0; !alloc_failed && i < w->queue_depth; i++) {
+    w->slots[i].positions = (Vector3*)tracked_malloc(particle_ct * sizeof(Vector3), ALLOC_IO);
+    alloc_failed = (w->slots[i].positions == NULL);
+  }
+  if (alloc_failed) {
+    free_writer(w);
+    return NULL;
+  }
+
+  w->file = fopen(path, "wb");
+  if (w->file == NULL) {
+    fprintf(stderr, "Trajectory: cannot open %s\n", path);
+    free_writer(w);
+    return NULL;
+  }
+  if (fwrite(&w->header, sizeof(TrajectoryHeader), 1, w->file) != 1) {
+    fclose(w->file);
+    free_writer(w);
+    return NULL;
+  }
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->not_empty, NULL);
+  pthread_cond_init(&w->not_full, NULL);
+  if (pthread_create(&w->thread, NULL, writer_loop, w) != 0) {
+    fclose(w->file);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->not_empty);
+    pthread_cond_destroy(&w->not_full);
+    free_writer(w);
+    return NULL;
+  }
+
+  return w;
+}
+
+/**** Step thread side: one strided copy of positions, then hand off ****/
+int
+submitFrame(TrajectoryWriter *writer, const Object objects[], const int particle_ct, const uint64_t step,
+            const double time)
+{
+  TrajectorySlot *slot;
+  int failed;
+
+  if ((uint64_t)particle_ct != writer->header.particle_ct) return -1;
+  pthread_mutex_lock(&writer->lock);
+  if (writer->queued == writer->queue_depth) {
+    writer->stalls++;
+    while (writer->queued == writer->queue_depth) {
+      pthread_cond_wait(&writer->not_full, &writer->lock);
+    }
+  }
+  slot = &writer->slots[writer->head];
+  pthread_mutex_unlock(&writer->lock);
+
+  // Slot at head is not visible to the io thread until queued is bumped
+  for (int i = 0; i < particle_ct; i++) {
+    slot->positions[i] = objects[i].position;
+  }
+  slot->step = step;
+  slot->time = time;
+
+  pthread_mutex_lock(&writer->lock);
+  writer->head = (writer->head + 1) % writer->queue_depth;
+  writer->queued++;
+  pthread_cond_signal(&writer->not_empty);
+  failed = writer->failed;
+  pthread_mutex_unlock(&writer->lock);
+
+  return failed ? -1 : 0;
+}
+
+/**** Joins the io thread then appends the seek table and footer ****/
+int
+closeTrajectory(TrajectoryWriter *writer)
+{
+  uint64_t index_offset;
+  int status;
+
+  pthread_mutex_lock(&writer->lock);
+  writer->closing = 1;
+  pthread_cond_signal(&writer->not_empty);
+  pthread_mutex_unlock(&writer->lock);
+  pthread_join(writer->thread, NULL);
+
+  index_offset = (uint64_t)ftell(writer->file);
+  status = writer->failed ? -1 : 0;
+  if (fwrite(writer->index, sizeof(TrajectoryIndex), writer->frame_ct, writer->file) != writer->frame_ct
+      || fwrite(&index_offset, sizeof(uint64_t), 1, writer->file) != 1
+      || fwrite(&writer->frame_ct, sizeof(uint64_t), 1, writer->file) != 1
+      || fwrite(TRAJECTORY_INDEX_MAGIC, 1, 8, writer->file) != 8) {
+    status = -1;
+  }
+  if (fclose(writer->file) != 0) status = -1;
+
+  pthread_mutex_destroy(&writer->lock);
+  pthread_cond_destroy(&writer->not_empty);
+  pthread_cond_destroy(&writer->not_full);
+  free_writer(writer);
+  return status;
+}
+
+/**** Loads header and seek table; frames are decoded lazily ****/
+TrajectoryReader *
+openTrajectoryReader(const char *path)
+{
+  TrajectoryReader *r = (TrajectoryReader*)tracked_malloc(sizeof(TrajectoryReader), ALLOC_IO);
+  uint64_t index_offset;
+  char magic[8];
+
+  if (r == NULL) return NULL;
+  memset(r, 0, sizeof(TrajectoryReader));
+  r->keyframe_no = UINT64_MAX;
+
+  r->file = fopen(path, "rb");
+  if (r->file == NULL) {
+    tracked_free(r);
+    return NULL;
+  }
+
+  if (fread(&r->header, sizeof(TrajectoryHeader), 1, r->file) != 1
+      || memcmp(r->header.magic, TRAJECTORY_MAGIC, 8) != 0
+      || r->header.version != TRAJECTORY_VERSION
+      || fseek(r->file, -24, SEEK_END) != 0
+      || fread(&index_offset, sizeof(uint64_t), 1, r->file) != 1
+      || fread(&r->frame_ct, sizeof(uint64_t), 1, r->file) != 1
+      || fread(magic, 1, 8, r->file) != 8
+      || memcmp(magic, TRAJECTORY_INDEX_MAGIC, 8) != 0) {
+    fprintf(stderr, "Trajectory: %s is not a complete v%d trajectory\n", path, TRAJECTORY_VERSION);
+    closeTrajectoryReader(r);
+    return NULL;
+  }
+
+  r->index = (TrajectoryIndex*)tracked_malloc((r->frame_ct + 1) * sizeof(TrajectoryIndex), ALLOC_IO);
+  r->keyframe = (int32_t*)tracked_malloc(3 * r->header.particle_ct * sizeof(int32_t), ALLOC_IO);
+  r->payload = (unsigned char*)tracked_malloc(payload_capacity(r->header.particle_ct), ALLOC_IO);
+  if (r->index == NULL || r->keyframe == NULL || r->payload == NULL
+      || fseek(r->file, (long)index_offset, SEEK_SET) != 0
+      || fread(r->index, sizeof(TrajectoryIndex), r->frame_ct, r->file) != r->frame_ct) {
+    closeTrajectoryReader(r);
+    return NULL;
+  }
+
+  return r;
+}
+
+/**** Reads a frame header + payload at the index entry for frame_no. A payload longer than the buffer, or a
+ * keyframe that isn't exactly one int32 triple per particle, marks a corrupt file ****/
+static int
+load_payload(TrajectoryReader *r, const uint64_t frame_no, TrajectoryFrame *frame)
+{
+  if (fseek(r->file, (long)r->index[frame_no].offset, SEEK_SET) != 0) return -1;
+  if (fread(frame, sizeof(TrajectoryFrame), 1, r->file) != 1) return -1;
+  if (frame->payload_bytes > payload_capacity(r->header.particle_ct)) return -1;
+  if (frame->keyframe && frame->payload_bytes != 3 * r->header.particle_ct * sizeof(int32_t)) return -1;
+  if (fread(r->payload, 1, frame->payload_bytes, r->file) != frame->payload_bytes) return -1;
+  return 0;
+}
+
+/**** Seeks to the governing keyframe (cached between calls) then applies the frame's deltas ****/
+int
+readFrame(TrajectoryReader *reader, const uint64_t frame_no, Vector3 positions[], uint64_t *step)
+{
+  const TrajectoryHeader *h = &reader->header;
+  const uint64_t key_no = frame_no - frame_no % h->keyframe_interval;
+  const double res = h->resolution;
+  TrajectoryFrame frame;
+  int32_t delta[3];
+  size_t at = 0;
+
+  if (frame_no >= reader->frame_ct) return -1;
+
+  if (key_no != reader->keyframe_no) {
+    if (load_payload(reader, key_no, &frame) != 0) return -1;
+    memcpy(reader->keyframe, reader->payload, 3 * h->particle_ct * sizeof(int32_t));
+    reader->keyframe_no = key_no;
+  }
+  if (load_payload(reader, frame_no, &frame) != 0) return -1;
+
+  for (uint64_t i = 0; i < h->particle_ct; i++) {
+    delta[0] = delta[1] = delta[2] = 0;
+    if (!frame.keyframe) {
+      for (int k = 0; k < 3; k++) at += get_varint(reader->payload + at, &delta[k]);
+    }
+    positions[i].x = h->origin.x + (reader->keyframe[3 * i] + delta[0]) * res;
+    positions[i].y = h->origin.y + (reader->keyframe[3 * i + 1] + delta[1]) * res;
+    positions[i].z = h->origin.z + (reader->keyframe[3 * i + 2] + delta[2]) * res;
+  }
+
+  if (step != NULL) (*step) = frame.step;
+  return 0;
+}
+
+void
+closeTrajectoryReader(TrajectoryReader *reader)
+{
+  if (reader == NULL) return;
+  if (reader->file != NULL) fclose(reader->file);
+  tracked_free(reader->index);
+  tracked_free(reader->keyframe);
+  tracked_free(reader->payload);
+  tracked_free(reader);
+}
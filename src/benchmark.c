@@ -0,0 +1,819 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "../include/Geometry.h"
+#include "../include/ImprovedCollision.h"
+#include "../include/Simulation.h"
+#include "../include/Packing.h"
+#include "../include/Profile.h"
+#include "../include/PerfCounters.h"
+#include "../include/Trace.h"
+#include "../include/Alloc.h"
+#include "../include/Octree.h"
+#include "../include/PairForce.h"
+
+/**** Portable replacement for python_integration/benchmark_funcs.c: monotonic clock, no windows.h ****/
+
+#define MAX_COUNTS 32
+#define MAX_THREAD_STEPS 32
+#define STEADY_FRAMES 5         // Frames checked for allocations after the frame case has warmed the run
+#define ERROR_SAMPLES 256       // Particles checked against the direct sum in the tree case
+
+enum BenchMode {BENCH_PHASES, BENCH_STRONG, BENCH_WEAK};
+
+typedef struct {
+  int counts[MAX_COUNTS], count_ct;
+  int warmup, trials;
+  double density, radius, dt;
+  int sub_steps;
+  uint64_t seed;
+  const char *json_path;
+  enum BenchMode mode;
+  int max_threads;
+  const char *csv_path;
+  int perf;               // Sample hardware counters around engine phases in the frame case
+  const char *trace_path; // Chrome trace of the phases run
+  double theta;           // Barnes-Hut opening angle; 0 runs without the long-range force
+  int pair_kind;          // PairKind with sigma = 2 * radius, or -1 for none
+  double contact_kn;      // DEM normal stiffness, restitution and friction 0.5; 0 keeps impulse collisions
+  int field_kind;         // FieldKind with the default parameters
+  int integrator;         // IntegratorKind of every frame
+  int periodic;           // Periodic box instead of walls
+  Vector3 aspect;         // Box edge ratios x:y:z at the same volume, 1:1:1 for a cube
+  const char *mesh_path;  // Obstacle mesh fitted into every box, NULL for none
+} BenchConfig;
+
+/**** Sorted samples reduced to the numbers we report ****/
+typedef struct {
+  const char *name;
+  int particle_ct, trials;
+  double min, mean, median, p90, p99, max;    // Milliseconds
+  double allocs_per_frame;                    // Frame case only
+  int64_t peak_bytes;                         // Tracked high-water mark while the case ran
+  OctreeStats tree;                           // Tree case only
+  double force_rms, force_max;                // Tree case relative error against the direct sum
+  double potential, virial;                   // Pairs case, per particle
+  double pairs_per_particle;                  // Pairs case, pairs inside the cutoff
+  ContactStats contacts;                      // Contacts case
+  MeshStats mesh;                             // Mesh case
+} BenchStats;
+
+static double
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+/**** Nearest rank percentile of sorted samples ****/
+static double
+percentile(const double sorted[], const int n, const double p)
+{
+  int rank = (int)ceil(p / 100.0 * n) - 1;
+  return sorted[(rank < 0) ? 0 : (rank >= n) ? n - 1 : rank];
+}
+
+static BenchStats
+reduce(const char *name, const int particle_ct, double samples[], const int n)
+{
+  BenchStats stats;
+  double sum = 0;
+
+  memset(&stats, 0, sizeof(BenchStats));
+  stats.name = name;
+  stats.particle_ct = particle_ct;
+  stats.trials = n;
+  qsort(samples, n, sizeof(double), compare_double);
+  for (int i = 0; i < n; i++) sum += samples[i];
+  stats.min = samples[0];
+  stats.max = samples[n - 1];
+  stats.mean = sum / n;
+  stats.median = percentile(samples, n, 50);
+  stats.p90 = percentile(samples, n, 90);
+  stats.p99 = percentile(samples, n, 99);
+  return stats;
+}
+
+/**** Loads path and scales it uniformly to fill the box, centred, since the box grows with the count ****/
+static int
+attach_mesh(Simulation *sim, const char *path)
+{
+  int status;
+  double scale = INFINITY;
+  const Vector3 extent = cubeExtent(&sim->cube);
+  const double size[3] = {extent.x, extent.y, extent.z};
+  Vector3 offset;
+  MeshNode root;
+
+  sim->obstacles = load_triangleMesh(path, &status);
+  if (sim->obstacles == NULL) {
+    fprintf(stderr, "Cannot load mesh %s (%s)\n", path, (status == 1) ? "io error" : "bad file");
+    return -1;
+  }
+  root = sim->obstacles->nodes[0];
+  for (int a = 0; a < 3; a++) {
+    if (root.max[a] > root.min[a]) scale = fmin(scale, size[a] / (root.max[a] - root.min[a]));
+  }
+  offset = (Vector3){sim->cube.min.x + 0.5 * (extent.x - scale * (root.min[0] + root.max[0])),
+                     sim->cube.min.y + 0.5 * (extent.y - scale * (root.min[1] + root.max[1])),
+                     sim->cube.min.z + 0.5 * (extent.z - scale * (root.min[2] + root.max[2]))};
+  transformMesh(sim->obstacles, scale, offset);
+  return 0;
+}
+
+/**** Run with the requested count at fixed number density, packed without overlaps ****/
+static Simulation *
+bench_simulation(const BenchConfig *cfg, const int particle_ct)
+{
+  const double unit = cbrt(particle_ct / cfg->density / (cfg->aspect.x * cfg->aspect.y * cfg->aspect.z));
+  Cube cube = createBox((Vector3){0, 0, 0}, scaleVector(cfg->aspect, unit));
+  Simulation *sim;
+
+  cube.periodic = cfg->periodic;
+  sim = createSimulation(cube, particle_ct, cfg->radius, cfg->dt, cfg->sub_steps, cfg->seed);
+
+  if (sim == NULL) return NULL;
+  if (packSimulation(sim, PACK_FCC, 0.5) < 0) {
+    destroy_simulation(sim);
+    return NULL;
+  }
+  sim->forces = createForceField(cfg->field_kind);
+  sim->integrator = cfg->integrator;
+  if (cfg->theta > 0) {
+    sim->gravity = createOctree(cfg->theta, 1.0, cfg->radius, 8);
+    if (sim->gravity == NULL) {
+      destroy_simulation(sim);
+      return NULL;
+    }
+  }
+  if (cfg->pair_kind >= 0) {
+    sim->pairs = createPairForce(cfg->pair_kind, 1.0, 2.0 * cfg->radius, 0.0);
+    if (sim->pairs == NULL || !pair_fitsCube(sim->pairs, sim->cube)) {
+      destroy_simulation(sim);
+      return NULL;
+    }
+  }
+  if (cfg->contact_kn > 0) {
+    sim->contacts = createContactModel(cfg->contact_kn, 0.0, 0.5, 0.5);
+    if (sim->contacts == NULL) {
+      destroy_simulation(sim);
+      return NULL;
+    }
+  }
+  if (cfg->mesh_path != NULL && attach_mesh(sim, cfg->mesh_path) != 0) {
+    destroy_simulation(sim);
+    return NULL;
+  }
+  if (sim->pairs != NULL || sim->contacts != NULL) {
+    // The field is allocated here rather than on the first frame so the force cases can add into it
+    sim->field = (Vector3*)tracked_malloc(particle_ct * sizeof(Vector3), ALLOC_FORCES);
+    if (sim->field == NULL) {
+      destroy_simulation(sim);
+      return NULL;
+    }
+  }
+  return sim;
+}
+
+/**** Map build alone: createMap + destroy_map at the run's grid_dims ****/
+static void
+bench_map(Simulation *sim)
+{
+  int status = 0;
+  Map **map = createMap(sim->objects, sim->cube, sim->grid_dims, sim->particle_ct, &status);
+  if (map != NULL) destroy_map(map, grid_partitionCount(sim->grid_dims));
+}
+
+/**** One collision pass followed by one substep and the walls so the state keeps evolving ****/
+static void
+bench_collision(Simulation *sim)
+{
+  collisionCall(sim->cube, sim->objects, grid_partitionCount(sim->grid_dims), sim->particle_ct, sim->grid_dims);
+  updateObjects(sim->objects, &sim->forces, NULL, sim->particle_ct, sim->dt / sim->sub_steps);
+  (void)containObjects(&sim->container, sim->objects, sim->particle_ct);
+}
+
+/**** Container pass alone ****/
+static void
+bench_walls(Simulation *sim)
+{
+  (void)containObjects(&sim->container, sim->objects, sim->particle_ct);
+}
+
+/**** Octree build and force walk alone ****/
+static void
+bench_tree(Simulation *sim)
+{
+  (void)octreeForces(sim->gravity, sim->objects, sim->particle_ct);
+}
+
+/**** RMS and max of |a_tree - a_direct| / |a_direct| over evenly spaced particles, from the last bench_tree ****/
+static void
+force_error(const Simulation *sim, BenchStats *stats)
+{
+  int which[ERROR_SAMPLES] = {0};
+  Vector3 direct[ERROR_SAMPLES];
+  const int count = (sim->particle_ct < ERROR_SAMPLES) ? sim->particle_ct : ERROR_SAMPLES;
+  double sum = 0, err;
+
+  for (int k = 0; k < count; k++) which[k] = (int)((long)k * sim->particle_ct / count);
+  directForces(sim->gravity, sim->objects, sim->particle_ct, which, count, direct);
+  stats->force_max = 0;
+  for (int k = 0; k < count; k++) {
+    const Vector3 diff = subtractVectors(sim->gravity->accel[which[k]], direct[k]);
+    const double norm = magnitude(direct[k]);
+    err = (norm > 0) ? magnitude(diff) / norm : 0.0;
+    sum += err * err;
+    if (err > stats->force_max) stats->force_max = err;
+  }
+  stats->force_rms = sqrt(sum / count);
+}
+
+/**** Pair force pass alone, into a cleared field ****/
+static void
+bench_pairs(Simulation *sim)
+{
+  memset(sim->field, 0, sim->particle_ct * sizeof(Vector3));
+  (void)pairForces(sim->pairs, sim->objects, sim->cube, sim->particle_ct, sim->field);
+}
+
+/**** Contact pass alone at the substep, into a cleared field ****/
+static void
+bench_contacts(Simulation *sim)
+{
+  memset(sim->field, 0, sim->particle_ct * sizeof(Vector3));
+  (void)contactForces(sim->contacts, sim->objects, sim->cube, &sim->container, sim->obstacles, sim->particle_ct,
+                      sim->dt / sim->sub_steps, sim->field);
+}
+
+/**** Obstacle pass alone ****/
+static void
+bench_mesh(Simulation *sim)
+{
+  meshCollisions(sim->obstacles, sim->objects, sim->particle_ct);
+}
+
+/**** A full frame, the same work as updateCall ****/
+static void
+bench_frame(Simulation *sim)
+{
+  stepSimulation(sim, 1);
+}
+
+typedef void (*benchFunc)(Simulation *sim);
+
+/**** Warmup, then trials timed individually ****/
+static BenchStats
+run_case(const BenchConfig *cfg, const char *name, benchFunc func, Simulation *sim, double samples[])
+{
+  double start;
+  BenchStats stats;
+
+  reset_allocPeak();
+  for (int i = 0; i < cfg->warmup; i++) func(sim);
+  for (int i = 0; i < cfg->trials; i++) {
+    start = now_ms();
+    func(sim);
+    samples[i] = now_ms() - start;
+  }
+  stats = reduce(name, sim->particle_ct, samples, cfg->trials);
+  stats.peak_bytes = get_allocStats().total.peak_bytes;
+  return stats;
+}
+
+static void
+print_stats(const BenchStats *s)
+{
+  printf("%-10s %10d %10.4f %10.4f %10.4f %10.4f %10.4f\n",
+         s->name, s->particle_ct, s->median, s->mean, s->p90, s->p99, s->min);
+}
+
+/**** Per phase split of the frame case, only filled when built with PSIM_PROFILE ****/
+static void
+print_profile(const Profile *profile, const int frames)
+{
+  for (int p = 0; p < PHASE_CT; p++) {
+    printf("  %-14s %10.4f ms/frame %12.1f calls/frame\n", profile_phaseName(p),
+           1e3 * profile->phase[p].ticks / profile->ticks_per_second / frames,
+           (double)profile->phase[p].calls / frames);
+  }
+}
+
+static void
+write_profile(FILE *f, const Profile *profile)
+{
+  fprintf(f, ", \"profile\": {");
+  for (int p = 0; p < PHASE_CT; p++) {
+    fprintf(f, "\"%s\": {\"seconds\": %.6f, \"calls\": %llu}%s", profile_phaseName(p),
+            profile->phase[p].ticks / profile->ticks_per_second,
+            (unsigned long long)profile->phase[p].calls, (p + 1 < PHASE_CT) ? ", " : "");
+  }
+  fprintf(f, "}");
+}
+
+/**** Hardware counters per frame for each engine phase, with IPC when both cycles and instructions exist ****/
+static void
+print_perf(const PerfCounters *pc, const int frames)
+{
+  for (int p = 0; p < PERF_PHASE_CT; p++) {
+    printf("  perf %-9s", perf_phaseName(p));
+    for (int e = 0; e < PERF_EVENT_CT; e++) {
+      if (pc->event_ok[e]) printf(" %s=%.0f", perf_eventName(e), pc->value[p][e] / frames);
+    }
+    if (pc->event_ok[PERF_CYCLES] && pc->event_ok[PERF_INSTRUCTIONS] && pc->value[p][PERF_CYCLES] > 0) {
+      printf(" ipc=%.2f", pc->value[p][PERF_INSTRUCTIONS] / pc->value[p][PERF_CYCLES]);
+    }
+    printf("\n");
+  }
+}
+
+static void
+write_perf(FILE *f, const PerfCounters *pc)
+{
+  fprintf(f, ", \"perf\": {");
+  for (int p = 0; p < PERF_PHASE_CT; p++) {
+    fprintf(f, "\"%s\": {\"calls\": %llu", perf_phaseName(p), (unsigned long long)pc->calls[p]);
+    for (int e = 0; e < PERF_EVENT_CT; e++) {
+      if (pc->event_ok[e]) fprintf(f, ", \"%s\": %.0f", perf_eventName(e), pc->value[p][e]);
+    }
+    fprintf(f, "}%s", (p + 1 < PERF_PHASE_CT) ? ", " : "");
+  }
+  fprintf(f, "}");
+}
+
+static int
+write_json(const BenchConfig *cfg, const BenchStats stats[], const Profile profiles[],
+           const PerfCounters perfs[], const int n)
+{
+  FILE *f = (strcmp(cfg->json_path, "-") == 0) ? stdout : fopen(cfg->json_path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot open %s\n", cfg->json_path);
+    return -1;
+  }
+
+  fprintf(f, "{\n  \"config\": {\"warmup\": %d, \"trials\": %d, \"density\": %g, \"radius\": %g, "
+             "\"dt\": %g, \"sub_steps\": %d, \"seed\": %llu, \"field\": \"%s\", \"integrator\": \"%s\", \"periodic\": %d, "
+             "\"aspect\": [%g, %g, %g]},\n  \"results\": [\n",
+          cfg->warmup, cfg->trials, cfg->density, cfg->radius, cfg->dt, cfg->sub_steps,
+          (unsigned long long)cfg->seed, field_kindName(cfg->field_kind),
+          integrator_kindName(cfg->integrator), cfg->periodic, cfg->aspect.x, cfg->aspect.y, cfg->aspect.z);
+  for (int i = 0; i < n; i++) {
+    fprintf(f, "    {\"name\": \"%s\", \"particle_ct\": %d, \"trials\": %d, \"unit\": \"ms\", "
+               "\"min\": %.6f, \"mean\": %.6f, \"median\": %.6f, \"p90\": %.6f, \"p99\": %.6f, \"max\": %.6f, "
+               "\"allocs_per_frame\": %g, \"peak_bytes\": %lld",
+            stats[i].name, stats[i].particle_ct, stats[i].trials, stats[i].min, stats[i].mean,
+            stats[i].median, stats[i].p90, stats[i].p99, stats[i].max, stats[i].allocs_per_frame,
+            (long long)stats[i].peak_bytes);
+    if (strcmp(stats[i].name, "tree") == 0) {
+      fprintf(f, ", \"tree\": {\"theta\": %g, \"nodes\": %d, \"leaves\": %d, \"depth\": %d, "
+                 "\"cell_interactions\": %llu, \"pair_interactions\": %llu, \"force_rms\": %.6g, \"force_max\": %.6g}",
+              cfg->theta, stats[i].tree.nodes, stats[i].tree.leaves, stats[i].tree.depth,
+              (unsigned long long)stats[i].tree.cell_interactions, (unsigned long long)stats[i].tree.pair_interactions,
+              stats[i].force_rms, stats[i].force_max);
+    }
+    if (strcmp(stats[i].name, "pairs") == 0) {
+      fprintf(f, ", \"pairs\": {\"kind\": \"%s\", \"in_range_per_particle\": %.4f, \"potential_per_particle\": %.6g, "
+                 "\"virial_per_particle\": %.6g}", pair_kindName(cfg->pair_kind), stats[i].pairs_per_particle,
+              stats[i].potential, stats[i].virial);
+    }
+    if (strcmp(stats[i].name, "contacts") == 0) {
+      fprintf(f, ", \"contacts\": {\"kn\": %g, \"contacts\": %llu, \"wall_contacts\": %llu, \"sliding\": %llu, "
+                 "\"mesh_contacts\": %llu, \"continued\": %llu, \"dropped\": %llu, \"max_overlap\": %.6g}", cfg->contact_kn,
+              (unsigned long long)stats[i].contacts.contacts, (unsigned long long)stats[i].contacts.wall_contacts,
+              (unsigned long long)stats[i].contacts.mesh_contacts,
+              (unsigned long long)stats[i].contacts.sliding, (unsigned long long)stats[i].contacts.continued,
+              (unsigned long long)stats[i].contacts.dropped, stats[i].contacts.max_overlap);
+    }
+    if (strcmp(stats[i].name, "mesh") == 0) {
+      fprintf(f, ", \"mesh\": {\"path\": \"%s\", \"queries\": %llu, \"nodes_visited\": %llu, "
+                 "\"triangles_tested\": %llu, \"contacts\": %llu, \"dropped\": %llu}", cfg->mesh_path,
+              (unsigned long long)stats[i].mesh.queries, (unsigned long long)stats[i].mesh.nodes_visited,
+              (unsigned long long)stats[i].mesh.triangles_tested, (unsigned long long)stats[i].mesh.contacts,
+              (unsigned long long)stats[i].mesh.dropped);
+    }
+    if (profiles[i].enabled) write_profile(f, &profiles[i]);
+    if (perfs[i].available) write_perf(f, &perfs[i]);
+    fprintf(f, "}%s\n", (i + 1 < n) ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+
+  if (f != stdout) fclose(f);
+  return 0;
+}
+
+/**** One (particle count, thread count) cell of a scaling sweep ****/
+typedef struct {
+  int particle_ct, threads;
+  double median_ms, steps_per_sec, updates_per_sec, efficiency, bytes_per_particle;
+} ScalingPoint;
+
+static int
+available_threads(void)
+{
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+static void
+set_threads(const int threads)
+{
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#else
+  (void)threads;
+#endif
+}
+
+/**** 1, 2, 4, ... up to max_threads, always ending on max_threads ****/
+static int
+thread_steps(const int max_threads, int steps[])
+{
+  int n = 0;
+  for (int t = 1; t < max_threads && n < MAX_THREAD_STEPS - 1; t *= 2) steps[n++] = t;
+  steps[n++] = max_threads;
+  return n;
+}
+
+static int
+write_scaling(const BenchConfig *cfg, const ScalingPoint points[], const int n)
+{
+  const char *mode = (cfg->mode == BENCH_WEAK) ? "weak" : "strong";
+  FILE *f;
+
+  if (cfg->csv_path != NULL) {
+    f = (strcmp(cfg->csv_path, "-") == 0) ? stdout : fopen(cfg->csv_path, "w");
+    if (f == NULL) {
+      fprintf(stderr, "Cannot open %s\n", cfg->csv_path);
+      return -1;
+    }
+    fprintf(f, "mode,particle_ct,threads,median_ms,steps_per_sec,particle_updates_per_sec,efficiency,bytes_per_particle\n");
+    for (int i = 0; i < n; i++) {
+      fprintf(f, "%s,%d,%d,%.6f,%.6f,%.1f,%.4f,%.1f\n", mode, points[i].particle_ct, points[i].threads,
+              points[i].median_ms, points[i].steps_per_sec, points[i].updates_per_sec,
+              points[i].efficiency, points[i].bytes_per_particle);
+    }
+    if (f != stdout) fclose(f);
+  }
+
+  if (cfg->json_path != NULL) {
+    f = (strcmp(cfg->json_path, "-") == 0) ? stdout : fopen(cfg->json_path, "w");
+    if (f == NULL) {
+      fprintf(stderr, "Cannot open %s\n", cfg->json_path);
+      return -1;
+    }
+    fprintf(f, "{\n  \"config\": {\"mode\": \"%s\", \"warmup\": %d, \"trials\": %d, \"density\": %g, "
+               "\"radius\": %g, \"dt\": %g, \"sub_steps\": %d, \"seed\": %llu},\n  \"results\": [\n",
+            mode, cfg->warmup, cfg->trials, cfg->density, cfg->radius, cfg->dt, cfg->sub_steps,
+            (unsigned long long)cfg->seed);
+    for (int i = 0; i < n; i++) {
+      fprintf(f, "    {\"particle_ct\": %d, \"threads\": %d, \"median_ms\": %.6f, \"steps_per_sec\": %.6f, "
+                 "\"particle_updates_per_sec\": %.1f, \"efficiency\": %.4f, \"bytes_per_particle\": %.1f}%s\n",
+              points[i].particle_ct, points[i].threads, points[i].median_ms, points[i].steps_per_sec,
+              points[i].updates_per_sec, points[i].efficiency, points[i].bytes_per_particle, (i + 1 < n) ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    if (f != stdout) fclose(f);
+  }
+  return 0;
+}
+
+/**** Strong: each count is run at every thread step, efficiency t1 / (p * tp).
+ * Weak: each count is particles per thread, so p threads run count * p particles, efficiency t1 / tp ****/
+static int
+run_scaling(const BenchConfig *cfg)
+{
+  const int weak = (cfg->mode == BENCH_WEAK);
+  int steps[MAX_THREAD_STEPS], step_ct = thread_steps(cfg->max_threads, steps), point_ct = 0;
+  ScalingPoint *points = (ScalingPoint*)safe_malloc(cfg->count_ct * step_ct * sizeof(ScalingPoint));
+  double *samples = (double*)safe_malloc(cfg->trials * sizeof(double));
+  double base_ms;
+  BenchStats stats;
+  Simulation *sim;
+
+  if (points == NULL || samples == NULL) return -1;
+
+  printf("%-7s %12s %8s %12s %12s %16s %10s %12s\n", weak ? "weak" : "strong", "particles", "threads",
+         "median_ms", "steps/s", "updates/s", "efficiency", "bytes/part");
+  for (int i = 0; i < cfg->count_ct; i++) {
+    base_ms = 0.0;
+    for (int t = 0; t < step_ct; t++) {
+      const int particle_ct = weak ? cfg->counts[i] * steps[t] : cfg->counts[i];
+      ScalingPoint *point = &points[point_ct++];
+
+      sim = bench_simulation(cfg, particle_ct);
+      if (sim == NULL) {
+        fprintf(stderr, "Could not set up %d particles\n", particle_ct);
+        return -1;
+      }
+      set_threads(steps[t]);
+      stats = run_case(cfg, "frame", bench_frame, sim, samples);
+      if (t == 0) base_ms = stats.median;
+
+      point->particle_ct = particle_ct;
+      point->threads = steps[t];
+      point->median_ms = stats.median;
+      point->steps_per_sec = 1e3 / stats.median;
+      point->updates_per_sec = particle_ct * point->steps_per_sec;
+      point->efficiency = weak ? base_ms / stats.median : base_ms / (steps[t] * stats.median);
+      point->bytes_per_particle = (double)stats.peak_bytes / particle_ct;    // Measured peak, run_case resets it
+      destroy_simulation(sim);
+
+      printf("%-7s %12d %8d %12.4f %12.2f %16.0f %10.3f %12.1f\n", "", point->particle_ct, point->threads,
+             point->median_ms, point->steps_per_sec, point->updates_per_sec, point->efficiency,
+             point->bytes_per_particle);
+    }
+  }
+  set_threads(cfg->max_threads);
+
+  if (write_scaling(cfg, points, point_ct) != 0) return -1;
+  free(points);
+  free(samples);
+  return 0;
+}
+
+/**** Comma separated particle counts, e.g. 1000,10000 ****/
+static int
+parse_counts(const char *arg, int counts[])
+{
+  int n = 0;
+  char *end;
+
+  while (*arg != '\0' && n < MAX_COUNTS) {
+    counts[n] = (int)strtol(arg, &end, 10);
+    if (end == arg || counts[n] <= 0) return -1;
+    n++;
+    arg = (*end == ',') ? end + 1 : end;
+  }
+  return n;
+}
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-m phases|strong|weak] [-n counts] [-w warmup] [-t trials] [-d density]\n"
+                  "          [-r radius] [-s sub_steps] [-S seed] [-T max_threads]\n"
+                  "          [-o results.json | -o -] [-c scaling.csv | -c -] [-p] [-x trace.json] [-g theta]\n"
+                  "          [-f lj|wca|soft] [-k kn] [-F field] [-I integrator] [-P] [-A x,y,z]\n"
+                  "          [-M mesh.obj|mesh.stl]\n"
+                  "  phases: map, collision and frame timings per count\n"
+                  "  strong: frames at each thread count 1, 2, 4 .. max_threads for every count\n"
+                  "  weak:   as strong, with count particles per thread\n"
+                  "  -p:     perf_event_open counters per engine phase in the phases frame case\n"
+                  "  -x:     Chrome trace of the phases run, per thread and per bucket\n"
+                  "  -g:     Barnes-Hut gravity at this opening angle in every frame, plus a tree case\n"
+                  "  -f:     pair potential with sigma = 2 * radius in every frame, plus a pairs case\n"
+                  "  -k:     DEM contacts of this stiffness instead of impulse collisions, plus a contacts case\n"
+                  "  -F:     external field spin (default), none, uniform, drag or harmonic\n"
+                  "  -I:     integrator midstep (default), verlet or euler\n"
+                  "  -P:     periodic box, no walls\n"
+                  "  -A:     box edge ratios at the same volume, e.g. 10,1,1 for a column along gravity\n"
+                  "  -M:     obstacle mesh scaled to fit the box in every frame, plus a mesh case\n", prog);
+}
+
+/**** Live and peak tracked bytes per subsystem ****/
+static void
+print_allocs(void)
+{
+  const AllocStats a = get_allocStats();
+
+  printf("%-12s %10s %10s %14s %14s\n", "alloc tag", "allocs", "frees", "live_bytes", "peak_bytes");
+  for (int t = 0; t < ALLOC_TAG_CT; t++) {
+    printf("%-12s %10llu %10llu %14lld %14lld\n", alloc_tagName(t), (unsigned long long)a.tag[t].allocs,
+           (unsigned long long)a.tag[t].frees, (long long)a.tag[t].live_bytes, (long long)a.tag[t].peak_bytes);
+  }
+}
+
+/**** Allocations per frame of a warmed run, first bare and then sampling analysis every frame; stops at the
+ * first pass that allocates ****/
+static int
+steady_allocs(Simulation *sim, double *allocs_per_frame)
+{
+  uint64_t allocs = alloc_count();
+
+  stepSimulation(sim, STEADY_FRAMES);
+  *allocs_per_frame = (double)(alloc_count() - allocs) / STEADY_FRAMES;
+  if (*allocs_per_frame != 0) return -1;
+
+  sim->analysis = createAnalysis(1, 50, 1.0, 20);
+  if (sim->analysis == NULL) return -1;
+  stepSimulation(sim, 1);                      // Sizes the map store when contacts skipped collisionStep
+  allocs = alloc_count();
+  stepSimulation(sim, STEADY_FRAMES);
+  *allocs_per_frame = (double)(alloc_count() - allocs) / STEADY_FRAMES;
+  return (*allocs_per_frame != 0) ? -1 : 0;
+}
+
+/**** Map, collision and frame timings at each count.
+ * Fails if a frame of the warmed run allocates, with or without analysis: the step loop must reuse its buffers ****/
+static int
+run_phases(const BenchConfig *cfg)
+{
+  BenchStats *stats;
+  Profile *profiles;
+  PerfCounters *perfs, *pc = NULL;
+  double *samples;
+  int stat_ct = 0;
+
+  stats = (BenchStats*)safe_malloc(8 * cfg->count_ct * sizeof(BenchStats));
+  profiles = (Profile*)calloc(8 * cfg->count_ct, sizeof(Profile));
+  perfs = (PerfCounters*)calloc(8 * cfg->count_ct, sizeof(PerfCounters));
+  samples = (double*)safe_malloc(cfg->trials * sizeof(double));
+  if (stats == NULL || profiles == NULL || perfs == NULL || samples == NULL) return -1;
+
+  if (cfg->perf) {
+    pc = openPerfCounters();
+    if (pc != NULL && !pc->available) {
+      fprintf(stderr, "perf counters unavailable (%s), continuing without them\n", strerror(pc->error));
+    } else if (pc != NULL && pc->error != 0) {
+      fprintf(stderr, "perf: skipping");
+      for (int e = 0; e < PERF_EVENT_CT; e++) {
+        if (!pc->event_ok[e]) fprintf(stderr, " %s", perf_eventName(e));
+      }
+      fprintf(stderr, " (%s)\n", strerror(pc->error));
+    }
+  }
+
+  if (cfg->trace_path != NULL && startTrace(1 << 20, NULL) != 0) return -1;
+
+  printf("%-10s %10s %10s %10s %10s %10s %10s\n", "case", "particles", "median", "mean", "p90", "p99", "min");
+  for (int i = 0; i < cfg->count_ct; i++) {
+    Simulation *sim = bench_simulation(cfg, cfg->counts[i]);
+    if (sim == NULL) {
+      fprintf(stderr, "Could not set up %d particles\n", cfg->counts[i]);
+      return -1;
+    }
+
+    stats[stat_ct] = run_case(cfg, "map", bench_map, sim, samples);
+    print_stats(&stats[stat_ct++]);
+    stats[stat_ct] = run_case(cfg, "collision", bench_collision, sim, samples);
+    print_stats(&stats[stat_ct++]);
+    if (sim->container.shape_ct > 0) {
+      stats[stat_ct] = run_case(cfg, "walls", bench_walls, sim, samples);
+      print_stats(&stats[stat_ct++]);
+    }
+    if (sim->gravity != NULL) {
+      stats[stat_ct] = run_case(cfg, "tree", bench_tree, sim, samples);
+      stats[stat_ct].tree = sim->gravity->stats;
+      force_error(sim, &stats[stat_ct]);
+      print_stats(&stats[stat_ct]);
+      printf("  theta %g: %d nodes, %d leaves, depth %d, %.1f cell + %.1f pair terms/particle, "
+             "force error rms %.3g max %.3g\n", cfg->theta, stats[stat_ct].tree.nodes, stats[stat_ct].tree.leaves,
+             stats[stat_ct].tree.depth, (double)stats[stat_ct].tree.cell_interactions / sim->particle_ct,
+             (double)stats[stat_ct].tree.pair_interactions / sim->particle_ct, stats[stat_ct].force_rms,
+             stats[stat_ct].force_max);
+      stat_ct++;
+    }
+    if (sim->pairs != NULL) {
+      stats[stat_ct] = run_case(cfg, "pairs", bench_pairs, sim, samples);
+      stats[stat_ct].potential = sim->pairs->potential / sim->particle_ct;
+      stats[stat_ct].virial = sim->pairs->virial / sim->particle_ct;
+      stats[stat_ct].pairs_per_particle = (double)sim->pairs->pairs_in_range / sim->particle_ct;
+      print_stats(&stats[stat_ct]);
+      printf("  %s cutoff %g: %dx%dx%d cells, %.2f pairs in range/particle (%.2f tested), U/N %.4g, W/N %.4g\n",
+             pair_kindName(cfg->pair_kind), sim->pairs->cutoff, sim->pairs->dims.x, sim->pairs->dims.y,
+             sim->pairs->dims.z, stats[stat_ct].pairs_per_particle,
+             (double)sim->pairs->pairs_tested / sim->particle_ct, stats[stat_ct].potential, stats[stat_ct].virial);
+      stat_ct++;
+    }
+    if (sim->contacts != NULL) {
+      stats[stat_ct] = run_case(cfg, "contacts", bench_contacts, sim, samples);
+      stats[stat_ct].contacts = sim->contacts->stats;
+      print_stats(&stats[stat_ct]);
+      printf("  kn %g: %dx%dx%d cells, %.2f contacts + %.2f wall/particle, %.1f%% sliding, %llu dropped, "
+             "max overlap %.3g radii, collision time %.3g\n", cfg->contact_kn, sim->contacts->dims.x,
+             sim->contacts->dims.y, sim->contacts->dims.z,
+             (double)sim->contacts->stats.contacts / sim->particle_ct,
+             (double)sim->contacts->stats.wall_contacts / sim->particle_ct,
+             100.0 * sim->contacts->stats.sliding / fmax(1.0, (double)(sim->contacts->stats.contacts + sim->contacts->stats.wall_contacts)),
+             (unsigned long long)sim->contacts->stats.dropped, sim->contacts->stats.max_overlap,
+             contact_time(sim->contacts, sim->objects[0].mass / 2));
+      stat_ct++;
+    }
+    if (sim->obstacles != NULL && sim->contacts == NULL) {
+      stats[stat_ct] = run_case(cfg, "mesh", bench_mesh, sim, samples);
+      stats[stat_ct].mesh = sim->obstacles->stats;
+      print_stats(&stats[stat_ct]);
+      printf("  %d triangles, depth %d: %.2f nodes + %.2f triangles tested/particle, %llu contacts, %llu dropped\n",
+             sim->obstacles->triangle_ct, sim->obstacles->depth,
+             (double)sim->obstacles->stats.nodes_visited / sim->particle_ct,
+             (double)sim->obstacles->stats.triangles_tested / sim->particle_ct,
+             (unsigned long long)sim->obstacles->stats.contacts, (unsigned long long)sim->obstacles->stats.dropped);
+      stat_ct++;
+    }
+    reset_profile();
+    startPerfCounters(pc);
+    stats[stat_ct] = run_case(cfg, "frame", bench_frame, sim, samples);
+    startPerfCounters(NULL);
+    profiles[stat_ct] = get_profile();
+    if (pc != NULL && pc->available) perfs[stat_ct] = *pc;
+    print_stats(&stats[stat_ct]);
+    if (profiles[stat_ct].enabled) print_profile(&profiles[stat_ct], cfg->warmup + cfg->trials);
+    if (perfs[stat_ct].available) print_perf(&perfs[stat_ct], cfg->warmup + cfg->trials);
+
+    if (steady_allocs(sim, &stats[stat_ct].allocs_per_frame) != 0) {
+      fprintf(stderr, "FAIL: steady-state frame at %d particles made %g allocations\n",
+              cfg->counts[i], stats[stat_ct].allocs_per_frame);
+      return -1;
+    }
+    stat_ct++;
+
+    destroy_simulation(sim);
+  }
+
+  print_allocs();
+  if (cfg->json_path != NULL && write_json(cfg, stats, profiles, perfs, stat_ct) != 0) return -1;
+  if (cfg->trace_path != NULL) {
+    if (dumpTrace(cfg->trace_path) != 0) return -1;
+    stopTrace();
+  }
+
+  closePerfCounters(pc);
+  free(stats);
+  free(profiles);
+  free(perfs);
+  free(samples);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  BenchConfig cfg = {{1000, 10000}, 2, 5, 50, 0.5, 0.25, 1e-3, 8, 1, NULL, BENCH_PHASES, 0, NULL, 0, NULL, 0.0, -1, 0.0, FIELD_SPIN, INTEGRATOR_MIDSTEP, 0, {1, 1, 1}, NULL};
+  int opt;
+
+  cfg.max_threads = available_threads();
+  while ((opt = getopt(argc, argv, "m:n:w:t:d:r:s:S:T:o:c:px:g:f:k:F:I:PA:M:h")) != -1) {
+    switch (opt) {
+      case 'm':
+        if (strcmp(optarg, "phases") == 0) cfg.mode = BENCH_PHASES;
+        else if (strcmp(optarg, "strong") == 0) cfg.mode = BENCH_STRONG;
+        else if (strcmp(optarg, "weak") == 0) cfg.mode = BENCH_WEAK;
+        else cfg.count_ct = -1;
+        break;
+      case 'n': cfg.count_ct = parse_counts(optarg, cfg.counts); break;
+      case 'w': cfg.warmup = atoi(optarg); break;
+      case 't': cfg.trials = atoi(optarg); break;
+      case 'd': cfg.density = atof(optarg); break;
+      case 'r': cfg.radius = atof(optarg); break;
+      case 's': cfg.sub_steps = atoi(optarg); break;
+      case 'S': cfg.seed = strtoull(optarg, NULL, 10); break;
+      case 'T': cfg.max_threads = atoi(optarg); break;
+      case 'o': cfg.json_path = optarg; break;
+      case 'c': cfg.csv_path = optarg; break;
+      case 'p': cfg.perf = 1; break;
+      case 'x': cfg.trace_path = optarg; break;
+      case 'g': cfg.theta = atof(optarg); break;
+      case 'f':
+        cfg.pair_kind = -1;
+        for (int k = 0; k < PAIR_KIND_CT; k++) {
+          if (strcmp(optarg, pair_kindName(k)) == 0) cfg.pair_kind = k;
+        }
+        if (cfg.pair_kind < 0) cfg.count_ct = -1;
+        break;
+      case 'k': cfg.contact_kn = atof(optarg); break;
+      case 'F':
+        cfg.field_kind = field_kindOf(optarg);
+        if (cfg.field_kind < 0) cfg.count_ct = -1;
+        break;
+      case 'P': cfg.periodic = 1; break;
+      case 'A':
+        if (sscanf(optarg, "%lf,%lf,%lf", &cfg.aspect.x, &cfg.aspect.y, &cfg.aspect.z) != 3) cfg.count_ct = -1;
+        break;
+      case 'M': cfg.mesh_path = optarg; break;
+      case 'I':
+        cfg.integrator = integrator_kindOf(optarg);
+        if (cfg.integrator < 0) cfg.count_ct = -1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (cfg.count_ct <= 0 || cfg.trials <= 0 || cfg.warmup < 0 || cfg.density <= 0 || cfg.sub_steps <= 0
+      || cfg.max_threads <= 0 || cfg.theta < 0 || cfg.contact_kn < 0
+      || cfg.aspect.x <= 0 || cfg.aspect.y <= 0 || cfg.aspect.z <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (cfg.mode == BENCH_PHASES) return (run_phases(&cfg) == 0) ? 0 : 1;
+  return (run_scaling(&cfg) == 0) ? 0 : 1;
+}
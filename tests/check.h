@@ -0,0 +1,30 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/**** Shared by the tests/test_*.c programs: prints each check and exits 1 at the first one that fails ****/
+#define CHECK(cond, ...)                                                  \
+  do {                                                                    \
+    if (!(cond)) {                                                        \
+      fprintf(stderr, "%s:%d: FAIL %s: ", __FILE__, __LINE__, #cond);     \
+      fprintf(stderr, __VA_ARGS__);                                       \
+      fprintf(stderr, "\n");                                              \
+      exit(1);                                                            \
+    }                                                                     \
+    printf("ok   ");                                                      \
+    printf(__VA_ARGS__);                                                  \
+    printf("\n");                                                         \
+  } while (0)
+
+// For checks inside loops: silent unless it fails
+#define CHECK_QUIET(cond)                                                 \
+  do {                                                                    \
+    if (!(cond)) {                                                        \
+      fprintf(stderr, "%s:%d: FAIL %s\n", __FILE__, __LINE__, #cond);     \
+      exit(1);                                                            \
+    }                                                                     \
+  } while (0)
+
+#endif // CHECK_H
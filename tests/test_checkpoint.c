@@ -0,0 +1,199 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include "../include/Simulation.h"
+#include "../include/Checkpoint.h"
+#include "../include/Packing.h"
+#include "check.h"
+
+#define PARTICLES 400
+#define HOPPER_SIDE 7             // Quads along each edge of a hopper slope
+
+/**** Particles whose position, velocity and acceleration differ bitwise between two runs ****/
+static int
+differing(const Simulation *a, const Simulation *b)
+{
+  int differ = 0;
+
+  for (int i = 0; i < a->particle_ct; i++) {
+    const Object *x = &a->objects[i], *y = &b->objects[i];
+    differ += memcmp(&x->position, &y->position, sizeof(Vector3)) != 0 ||
+              memcmp(&x->velocity, &y->velocity, sizeof(Vector3)) != 0 ||
+              memcmp(&x->acceleration, &y->acceleration, sizeof(Vector3)) != 0;
+  }
+  return differ;
+}
+
+/**** Saves sim after 150 frames, runs it 50 more, and returns the checkpoint loaded and run the same 50 ****/
+static Simulation *
+restart(Simulation *sim, const char *path)
+{
+  Simulation *resumed;
+  int status;
+
+  CHECK_QUIET(stepSimulation(sim, 150) == 1);
+  CHECK(save_checkpoint(sim, path) == 0, "saved at step %llu", (unsigned long long)sim->step);
+  CHECK_QUIET(stepSimulation(sim, 50) == 1);
+  resumed = load_checkpoint(path, &status);
+  CHECK(resumed != NULL && status == 0, "loaded, status %d", status);
+  return resumed;
+}
+
+/**** A pile settling under gravity with friction: the reloaded run carries on from the same contacts ****/
+static void
+test_contacts(const char *path)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){6, 6, 6});
+  Simulation *sim = createSimulation(cube, PARTICLES, 0.3, 1e-3, 4, 7);
+  Simulation *resumed;
+
+  packSimulation(sim, PACK_FCC, 0.3);
+  sim->forces = createForceField(FIELD_UNIFORM);
+  sim->forces.gravity = (Vector3){0, 0, -9.81};
+  sim->contacts = createContactModel(1e4, 0.0, 0.5, 0.5);
+  resumed = restart(sim, path);
+  CHECK(resumed->contacts != NULL && resumed->contacts->kn == 1e4 && resumed->contacts->friction == 0.5,
+        "contact model restored");
+  CHECK(resumed->contacts->stats.continued > 0, "%llu contacts with history at the save",
+        (unsigned long long)resumed->contacts->stats.continued);
+  CHECK_QUIET(stepSimulation(resumed, 50) == 1);
+  CHECK(differing(sim, resumed) == 0, "contacts: 50 frames after the reload match the uninterrupted run");
+  CHECK(resumed->contacts->stats.continued == sim->contacts->stats.continued, "same contacts continued");
+  destroy_simulation(resumed);
+  destroy_simulation(sim);
+}
+
+/**** LJ pairs and Barnes-Hut gravity in a harmonic trap: the field and both attachments come back as saved ****/
+static void
+test_forces(const char *path)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){8, 8, 8});
+  Simulation *sim = createSimulation(cube, 343, 0.05, 2e-3, 4, 9);
+  Simulation *resumed;
+
+  packSimulation(sim, PACK_FCC, 0.2);
+  sim->forces = createForceField(FIELD_HARMONIC);
+  sim->forces.center = (Vector3){4, 4, 4};
+  sim->forces.stiffness = 0.5;
+  sim->pairs = createPairForce(PAIR_LJ, 1.0, 1.0, 2.0);
+  sim->gravity = createOctree(0.5, 0.01, 0.1, 8);
+  resumed = restart(sim, path);
+  CHECK(resumed->forces.kind == FIELD_HARMONIC && resumed->forces.stiffness == 0.5 &&
+        resumed->forces.center.x == 4, "force field restored");
+  CHECK(resumed->pairs != NULL && resumed->pairs->kind == PAIR_LJ && resumed->pairs->cutoff == 2.0,
+        "pair potential restored");
+  CHECK(resumed->gravity != NULL && resumed->gravity->theta == 0.5 && resumed->gravity->leaf_size == 8,
+        "gravity restored");
+  CHECK_QUIET(stepSimulation(resumed, 50) == 1);
+  CHECK(differing(sim, resumed) == 0, "forces: 50 frames after the reload match the uninterrupted run");
+  destroy_simulation(resumed);
+  destroy_simulation(sim);
+}
+
+/**** Velocity Verlet picks up from the cached accelerations instead of priming again ****/
+static void
+test_verlet(const char *path)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){8, 8, 8});
+  Simulation *sim = createSimulation(cube, 343, 0.05, 2e-3, 4, 9);
+  Simulation *resumed;
+
+  packSimulation(sim, PACK_FCC, 0.2);
+  sim->forces = createForceField(FIELD_DRAG);
+  sim->forces.gravity = (Vector3){0, 0, -1};
+  sim->forces.drag = 0.5;
+  sim->pairs = createPairForce(PAIR_LJ, 1.0, 1.0, 0.0);
+  sim->integrator = INTEGRATOR_VERLET;
+  resumed = restart(sim, path);
+  CHECK(resumed->integrator == INTEGRATOR_VERLET && resumed->primed, "integrator restored, primed");
+  CHECK_QUIET(stepSimulation(resumed, 50) == 1);
+  CHECK(differing(sim, resumed) == 0, "verlet: 50 frames after the reload match the uninterrupted run");
+  destroy_simulation(resumed);
+  destroy_simulation(sim);
+}
+
+/**** A V shaped hopper of two slopes, each a grid of quads split in two, at half size (transformMesh doubles it) ****/
+static TriangleMesh *
+hopper(void)
+{
+  static double vertices[2 * 3 * (HOPPER_SIDE + 1) * (HOPPER_SIDE + 1)];
+  static int indices[2 * 6 * HOPPER_SIDE * HOPPER_SIDE];
+  const int side = HOPPER_SIDE;
+  int vertex_ct = 0, triangle_ct = 0;
+
+  for (int slope = 0; slope < 2; slope++) {
+    const int base = vertex_ct;
+    for (int u = 0; u <= side; u++) {
+      for (int w = 0; w <= side; w++) {
+        const double t = (double)u / side;         // 0 at the rim, 1 at the throat
+        vertices[3 * vertex_ct] = slope ? 3.0 - 1.3 * t : 0.0 + 1.3 * t;
+        vertices[3 * vertex_ct + 1] = 3.0 * w / side;
+        vertices[3 * vertex_ct + 2] = 2.0 - 1.2 * t;
+        vertex_ct++;
+      }
+    }
+    for (int u = 0; u < side; u++) {
+      for (int w = 0; w < side; w++) {
+        const int q = base + u * (side + 1) + w;
+        const int quad[6] = {q, q + side + 1, q + 1, q + 1, q + side + 1, q + side + 2};
+        memcpy(&indices[3 * triangle_ct], quad, sizeof(quad));
+        triangle_ct += 2;
+      }
+    }
+  }
+  return createTriangleMesh(vertices, vertex_ct, indices, triangle_ct);
+}
+
+/**** Particles poured through an obstacle hopper, by impulses and then as contacts: the mesh comes back with the
+ * same triangle order and tree, so the contact history keyed by triangle still lines up ****/
+static void
+test_obstacles(const char *path)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){6, 6, 8});
+
+  for (int contacts = 0; contacts <= 1; contacts++) {
+    Simulation *sim = createSimulation(cube, PARTICLES, 0.15, 1e-3, 4, 11);
+    Simulation *resumed;
+    const char *name = contacts ? "contacts" : "impulses";
+
+    packSimulation(sim, PACK_FCC, 0.3);
+    sim->forces = createForceField(FIELD_UNIFORM);
+    sim->forces.gravity = (Vector3){0, 0, -9.81};
+    sim->obstacles = hopper();
+    transformMesh(sim->obstacles, 2.0, (Vector3){0, 0, 1});
+    sim->obstacles->restitution = 0.4;
+    if (contacts) sim->contacts = createContactModel(1e4, 0.0, 0.5, 0.5);
+    resumed = restart(sim, path);
+    CHECK(resumed->obstacles != NULL && resumed->obstacles->triangle_ct == sim->obstacles->triangle_ct
+          && resumed->obstacles->restitution == 0.4, "%s: %d obstacle triangles restored", name,
+          resumed->obstacles->triangle_ct);
+    CHECK(resumed->obstacles->node_ct == sim->obstacles->node_ct
+          && memcmp(resumed->obstacles->triangles, sim->obstacles->triangles,
+                    sim->obstacles->triangle_ct * sizeof(MeshTriangle)) == 0
+          && memcmp(resumed->obstacles->nodes, sim->obstacles->nodes,
+                    sim->obstacles->node_ct * sizeof(MeshNode)) == 0, "%s: same triangle order and tree", name);
+    CHECK_QUIET(stepSimulation(resumed, 50) == 1);
+    CHECK((contacts ? sim->contacts->stats.mesh_contacts : sim->obstacles->stats.contacts) > 0,
+          "%s: particles on the hopper", name);
+    CHECK(differing(sim, resumed) == 0, "%s: 50 frames after the reload match the uninterrupted run", name);
+    destroy_simulation(resumed);
+    destroy_simulation(sim);
+  }
+}
+
+int
+main(void)
+{
+  char path[] = "/tmp/psim_checkpointXXXXXX";
+  const int fd = mkstemp(path);
+
+  CHECK(fd >= 0, "temporary file");
+  close(fd);
+  test_contacts(path);
+  test_forces(path);
+  test_verlet(path);
+  test_obstacles(path);
+  unlink(path);
+  printf("test_checkpoint passed\n");
+  return 0;
+}
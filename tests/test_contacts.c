@@ -0,0 +1,86 @@
+#include <math.h>
+#include <string.h>
+#include <omp.h>
+#include "../include/Simulation.h"
+#include "../include/Packing.h"
+#include "check.h"
+
+#define PARTICLES 400
+
+/**** Two spheres meeting head on: the rebound speed is restitution times the approach speed and the momentum
+ * is unchanged ****/
+static void
+test_head_on(void)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){10, 10, 10});
+  Simulation *sim = createSimulation(cube, 2, 0.5, 1e-3, 4, 1);
+  double approach, rebound, momentum;
+
+  sim->forces = createForceField(FIELD_NONE);
+  sim->integrator = INTEGRATOR_VERLET;
+  sim->contacts = createContactModel(1e4, 0.0, 0.8, 0.5);
+  sim->objects[0].position = (Vector3){4.4, 5, 5};
+  sim->objects[1].position = (Vector3){5.6, 5, 5};
+  sim->objects[0].velocity = (Vector3){1, 0, 0};
+  sim->objects[1].velocity = (Vector3){-1, 0, 0};
+  approach = sim->objects[0].velocity.x - sim->objects[1].velocity.x;
+  CHECK(contact_time(sim->contacts, 0.25) > 40 * sim->dt / sim->sub_steps, "contact resolved by %.0f substeps",
+        contact_time(sim->contacts, 0.25) / (sim->dt / sim->sub_steps));
+
+  CHECK_QUIET(stepSimulation(sim, 200) == 1);
+  rebound = sim->objects[1].velocity.x - sim->objects[0].velocity.x;
+  momentum = sim->objects[0].mass * sim->objects[0].velocity.x + sim->objects[1].mass * sim->objects[1].velocity.x;
+  CHECK(fabs(rebound / approach - 0.8) < 1e-2, "restitution %.4f for 0.8", rebound / approach);
+  CHECK(fabs(momentum) < 1e-12, "momentum after the collision %.3g", momentum);
+  CHECK(fabs(sim->objects[0].velocity.y) + fabs(sim->objects[0].velocity.z) < 1e-12, "no sideways velocity");
+  destroy_simulation(sim);
+}
+
+/**** A pile settling under gravity: contacts and friction give bitwise identical runs for 1 and 4 threads ****/
+static Simulation *
+settle(const int threads)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){6, 6, 6});
+  Simulation *sim = createSimulation(cube, PARTICLES, 0.3, 1e-3, 4, 7);
+
+  omp_set_num_threads(threads);
+  packSimulation(sim, PACK_FCC, 0.3);
+  sim->forces = createForceField(FIELD_UNIFORM);
+  sim->forces.gravity = (Vector3){0, 0, -9.81};
+  sim->contacts = createContactModel(1e4, 0.0, 0.5, 0.5);
+  CHECK_QUIET(stepSimulation(sim, 300) == 1);
+  return sim;
+}
+
+static void
+test_threads(void)
+{
+  Simulation *serial = settle(1);
+  Simulation *threaded = settle(4);
+  const ContactStats *stats = &threaded->contacts->stats;
+  int differ = 0;
+
+  CHECK(stats->contacts > 0 && stats->wall_contacts > 0 && stats->continued > 0,
+        "%llu contacts, %llu wall contacts, %llu continued", (unsigned long long)stats->contacts,
+        (unsigned long long)stats->wall_contacts, (unsigned long long)stats->continued);
+  CHECK(stats->dropped == 0, "no history dropped");
+  // Field by field: Object has padding that the runs never write
+  for (int i = 0; i < PARTICLES; i++) {
+    const Object *a = &serial->objects[i], *b = &threaded->objects[i];
+    differ += memcmp(&a->position, &b->position, sizeof(Vector3)) != 0 ||
+              memcmp(&a->velocity, &b->velocity, sizeof(Vector3)) != 0 ||
+              memcmp(&a->acceleration, &b->acceleration, sizeof(Vector3)) != 0;
+  }
+  CHECK(differ == 0, "1 and 4 threads give identical particles after 300 frames, %d differ", differ);
+  destroy_simulation(serial);
+  destroy_simulation(threaded);
+}
+
+int
+main(void)
+{
+  test_head_on();
+  test_threads();
+  printf("test_contacts passed\n");
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include <math.h>
+#include <string.h>
+#include "../include/Simulation.h"
+#include "../include/Container.h"
+#include "check.h"
+
+static Object
+sphere_at(const Vector3 position, const Vector3 velocity)
+{
+  Object obj;
+
+  memset(&obj, 0, sizeof(Object));
+  obj.position = position;
+  obj.velocity = velocity;
+  obj.mass = 1.0;
+  obj.radius = 0.5;
+  return obj;
+}
+
+/**** A lone box is the container when it is a union and an obstacle to keep out of when it is subtracted ****/
+static void
+test_lone_box(void)
+{
+  const Shape box = {SHAPE_BOX, SHAPE_UNION, {2, 2, 2}, {8, 8, 8}, 0.0};
+  Shape pillar = box;
+  Container container = {.shape_ct = 0, .restitution = 0.75};
+  Object obj = sphere_at((Vector3){8.2, 5, 5}, (Vector3){1, 0, 0});
+  Vector3 gradient;
+  int feature;
+
+  CHECK(addShape(&container, box) == 0, "union box");
+  CHECK(containObjects(&container, &obj, 1) == 1 && obj.position.x == 7.5 && obj.velocity.x == -0.75,
+        "union box: sphere clamped inside at x %g, velocity %g", obj.position.x, obj.velocity.x);
+
+  pillar.op = SHAPE_SUBTRACT;
+  container.shape_ct = 0;
+  CHECK(addShape(&container, pillar) == 0, "subtracted box");
+  obj = sphere_at((Vector3){8.2, 5, 5}, (Vector3){-1, 0, 0});
+  CHECK(containObjects(&container, &obj, 1) == 1, "subtracted box: one contact");
+  CHECK(fabs(obj.position.x - 8.5) < 1e-12 && obj.velocity.x == 0.75,
+        "subtracted box: sphere pushed out to x %g, velocity %g", obj.position.x, obj.velocity.x);
+  CHECK(containerDistance(&container, obj.position, &gradient, &feature) <= -0.5 + 1e-12, "clear of the pillar");
+  obj = sphere_at((Vector3){0.5, 5, 5}, (Vector3){-1, 0, 0});
+  CHECK(containObjects(&container, &obj, 1) == 0 && obj.position.x == 0.5, "free space outside the pillar");
+}
+
+/**** The step loop reports the container pass's hits in the frame's collision counters ****/
+static void
+test_wall_hits(void)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){10, 10, 10});
+  Simulation *sim = createSimulation(cube, 1, 0.5, 1e-2, 1, 1);
+  uint64_t hits = 0;
+
+  sim->forces = createForceField(FIELD_NONE);
+  sim->objects[0].position = (Vector3){9, 5, 5};
+  sim->objects[0].velocity = (Vector3){10, 0, 0};
+  for (int f = 0; f < 10; f++) {
+    CHECK_QUIET(stepSimulation(sim, 1) == 1);
+    hits += sim->collision.wall_hits;
+  }
+  CHECK(hits == 1 && sim->objects[0].velocity.x < 0, "one wall hit counted, rebounding at %g",
+        sim->objects[0].velocity.x);
+  destroy_simulation(sim);
+}
+
+/**** createSimulation places particles in [2, 8] whatever the box, so in a 4 wide box the container pass clamps
+ * many onto the same corner. Coincident centres must part cleanly rather than turn the run into NaN ****/
+static void
+test_coincident(void)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){4, 4, 4});
+  Simulation *sim = createSimulation(cube, 100, 0.2, 1e-3, 8, 0);
+  int bad = 0;
+
+  CHECK_QUIET(stepSimulation(sim, 20) == 1);
+  for (int i = 0; i < sim->particle_ct; i++) {
+    const Vector3 p = sim->objects[i].position, v = sim->objects[i].velocity;
+    bad += !isfinite(p.x + p.y + p.z + v.x + v.y + v.z) || p.x < 0 || p.x > 4 || p.y < 0 || p.y > 4 || p.z < 0 ||
+           p.z > 4;
+  }
+  CHECK(bad == 0, "particles clamped into a small box stay finite and inside, %d not", bad);
+  destroy_simulation(sim);
+}
+
+int
+main(void)
+{
+  test_lone_box();
+  test_wall_hits();
+  test_coincident();
+  printf("test_container passed\n");
+  return 0;
+}
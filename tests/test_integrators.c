@@ -0,0 +1,122 @@
+#include <math.h>
+#include <string.h>
+#include "../include/Simulation.h"
+#include "../include/Packing.h"
+#include "check.h"
+
+#define PARTICLES 343
+
+/**** Kinetic plus pair potential energy at the current positions ****/
+static double
+total_energy(Simulation *sim)
+{
+  static Vector3 scratch[PARTICLES];
+  double kinetic = 0.0;
+
+  for (int i = 0; i < sim->particle_ct; i++) {
+    const Vector3 v = sim->objects[i].velocity;
+    kinetic += 0.5 * sim->objects[i].mass * (v.x * v.x + v.y * v.y + v.z * v.z);
+  }
+  pairForces(sim->pairs, sim->objects, sim->cube, sim->particle_ct, scratch);
+  return kinetic + sim->pairs->potential;
+}
+
+/**** LJ liquid in a periodic box with no external field: largest |E - E0| / |E0| over frames, sampled every 10 ****/
+static double
+energy_drift(const int integrator, const int frames)
+{
+  Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){8, 8, 8});
+  Simulation *sim;
+  uint64_t state = 12345;
+  Vector3 mean = {0, 0, 0};
+  double e0, worst = 0.0;
+
+  cube.periodic = 1;
+  sim = createSimulation(cube, PARTICLES, 0.05, 1e-2, 4, 9);       // Radius well inside sigma: no collisions
+  packSimulation(sim, PACK_FCC, 0.2);
+  sim->forces = createForceField(FIELD_NONE);
+  sim->integrator = integrator;
+  sim->pairs = createPairForce(PAIR_LJ, 1.0, 1.0, 0.0);
+  for (int i = 0; i < PARTICLES; i++) {
+    double v[3];
+    for (int k = 0; k < 3; k++) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      v[k] = (double)(state >> 11) / 9007199254740992.0 - 0.5;
+    }
+    sim->objects[i].velocity = (Vector3){v[0], v[1], v[2]};
+    mean = addVectors(mean, scaleVector(sim->objects[i].velocity, 1.0 / PARTICLES));
+  }
+  for (int i = 0; i < PARTICLES; i++) {
+    sim->objects[i].velocity = subtractVectors(sim->objects[i].velocity, mean);
+  }
+
+  e0 = total_energy(sim);
+  for (int f = 0; f < frames; f += 10) {
+    CHECK_QUIET(stepSimulation(sim, 10) == 1);
+    worst = fmax(worst, fabs(total_energy(sim) - e0) / fabs(e0));
+  }
+  destroy_simulation(sim);
+  return worst;
+}
+
+/**** One particle in a field with a closed form solution, t = 0.5 ****/
+static Simulation *
+lone_particle(const int kind, const int integrator, const Vector3 position, const Vector3 velocity)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){10, 10, 10});
+  Simulation *sim = createSimulation(cube, 1, 0.1, 1e-2, 4, 1);
+
+  sim->forces = createForceField(kind);
+  sim->forces.gravity = (Vector3){0, 0, -9.81};
+  sim->forces.stiffness = 4.0;
+  sim->integrator = integrator;
+  sim->objects[0].position = position;
+  sim->objects[0].velocity = velocity;
+  CHECK_QUIET(stepSimulation(sim, 50) == 1);
+  return sim;
+}
+
+static void
+test_fields(void)
+{
+  static const char *names[3] = {"midstep", "verlet", "euler"};
+  const int integrators[3] = {INTEGRATOR_MIDSTEP, INTEGRATOR_VERLET, INTEGRATOR_EULER};
+  // Midstep's opening half kick uses the acceleration cached by the previous step, which is zero on the first
+  // one: constant fields pick up an O(dt) offset that Verlet's priming kick avoids
+  const double free_fall[3] = {5e-3, 1e-9, 1e-2}, fall_speed[3] = {5e-2, 1e-9, 1e-9}, trap[3] = {1e-2, 1e-4, 1e-2};
+  const double t = 0.5, omega = 2.0;
+
+  for (int k = 0; k < 3; k++) {
+    // Free fall: z = 5 + t - g t^2 / 2, Euler is first order and lands g t dt / 2 short per substep dt
+    Simulation *sim = lone_particle(FIELD_UNIFORM, integrators[k], (Vector3){5, 5, 5}, (Vector3){0, 0, 1});
+    double error = fabs(sim->objects[0].position.z - (5 + t - 0.5 * 9.81 * t * t));
+    CHECK(error < free_fall[k], "%s uniform field error %.3g", names[k], error);
+    error = fabs(sim->objects[0].velocity.z - (1 - 9.81 * t));
+    CHECK(error < fall_speed[k], "%s uniform field velocity error %.3g", names[k], error);
+    destroy_simulation(sim);
+
+    // Harmonic trap about (5, 5, 5): x = 5 + cos(omega t)
+    sim = lone_particle(FIELD_HARMONIC, integrators[k], (Vector3){6, 5, 5}, (Vector3){0, 0, 0});
+    error = fabs(sim->objects[0].position.x - (5 + cos(omega * t)));
+    CHECK(error < trap[k], "%s harmonic field error %.3g", names[k], error);
+    destroy_simulation(sim);
+  }
+}
+
+int
+main(void)
+{
+  // Midstep holds the pair force over the step and is gone well before 1000 frames
+  const double midstep = energy_drift(INTEGRATOR_MIDSTEP, 200);
+  const double verlet = energy_drift(INTEGRATOR_VERLET, 1000);
+  const double euler = energy_drift(INTEGRATOR_EULER, 1000);
+
+  printf("LJ energy drift: midstep %.3g over 200 frames, verlet %.3g and euler %.3g over 1000\n", midstep, verlet,
+         euler);
+  CHECK(verlet < 1e-3, "verlet conserves energy, |dE|/E %.3g", verlet);
+  CHECK(euler < 1e-2 && verlet < euler, "euler bounded, |dE|/E %.3g", euler);
+  CHECK(midstep > euler, "midstep drifts most");
+  test_fields();
+  printf("test_integrators passed\n");
+  return 0;
+}
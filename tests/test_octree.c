@@ -0,0 +1,80 @@
+#include <math.h>
+#include <string.h>
+#include <omp.h>
+#include "../include/Simulation.h"
+#include "check.h"
+
+#define PARTICLES 2000
+
+/**** RMS and largest of |a - direct| / |direct| over every particle ****/
+static void
+relative_error(const Octree *tree, const Object objects[], double *rms, double *worst)
+{
+  static int which[PARTICLES];
+  static Vector3 direct[PARTICLES];
+  double sum = 0.0, err;
+
+  for (int i = 0; i < PARTICLES; i++) which[i] = i;
+  directForces(tree, objects, PARTICLES, which, PARTICLES, direct);
+  *worst = 0.0;
+  for (int i = 0; i < PARTICLES; i++) {
+    err = magnitude(subtractVectors(tree->accel[i], direct[i])) / magnitude(direct[i]);
+    sum += err * err;
+    *worst = fmax(*worst, err);
+  }
+  *rms = sqrt(sum / PARTICLES);
+}
+
+/**** theta 0 opens every node, so the walk must reproduce the direct sum to rounding ****/
+static void
+test_exact(const Object objects[])
+{
+  Octree *tree = createOctree(0.0, 1.0, 0.05, 8);
+  double rms, worst;
+
+  CHECK(octreeForces(tree, objects, PARTICLES) == 0, "theta 0 pass");
+  relative_error(tree, objects, &rms, &worst);
+  CHECK(worst < 1e-10, "theta 0 matches the direct sum, worst %.3g", worst);
+  CHECK(tree->stats.cell_interactions == 0, "theta 0 accepts no cells");
+  destroy_octree(tree);
+}
+
+/**** theta 0.5 against the direct sum, and identical for 1 and 4 threads ****/
+static void
+test_theta(const Object objects[])
+{
+  static Vector3 serial[PARTICLES];
+  Octree *tree = createOctree(0.5, 1.0, 0.05, 8);
+  OctreeStats serial_stats;
+  double rms, worst;
+
+  omp_set_num_threads(1);
+  CHECK(octreeForces(tree, objects, PARTICLES) == 0, "theta 0.5 serial pass");
+  memcpy(serial, tree->accel, sizeof(serial));
+  serial_stats = tree->stats;
+  omp_set_num_threads(4);
+  CHECK(octreeForces(tree, objects, PARTICLES) == 0, "theta 0.5 threaded pass");
+
+  relative_error(tree, objects, &rms, &worst);
+  CHECK(rms < 1e-2, "theta 0.5: rms error %.3g, max %.3g", rms, worst);
+  CHECK(tree->stats.cell_interactions > 0, "theta 0.5: %.1f cell terms/particle",
+        (double)tree->stats.cell_interactions / PARTICLES);
+  CHECK(memcmp(serial, tree->accel, sizeof(serial)) == 0
+        && serial_stats.cell_interactions == tree->stats.cell_interactions
+        && serial_stats.pair_interactions == tree->stats.pair_interactions,
+        "theta 0.5 identical for 1 and 4 threads");
+  destroy_octree(tree);
+}
+
+int
+main(void)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){10, 10, 10});
+  Simulation *sim = createSimulation(cube, PARTICLES, 0.05, 1e-3, 4, 9);
+
+  test_exact(sim->objects);
+  test_theta(sim->objects);
+  destroy_simulation(sim);
+  printf("test_octree passed\n");
+  return 0;
+}
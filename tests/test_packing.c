@@ -0,0 +1,99 @@
+#include <math.h>
+#include "../include/Simulation.h"
+#include "../include/Packing.h"
+#include "../include/SharedFrame.h"
+#include <string.h>
+#include <unistd.h>
+#include "check.h"
+
+/**** Smallest centre distance over all pairs, brute force ****/
+static double
+min_separation(const Simulation *sim)
+{
+  double closest = INFINITY;
+  for (int i = 0; i < sim->particle_ct; i++) {
+    for (int j = i + 1; j < sim->particle_ct; j++) {
+      closest = fmin(closest, magnitude(subtractVectors(sim->objects[i].position, sim->objects[j].position)));
+    }
+  }
+  return closest;
+}
+
+/**** RSA far past its jamming density keeps what it placed, with the grid and cached state following it ****/
+static void
+test_saturated_rsa(void)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){4, 4, 4});
+  Simulation *sim = createSimulation(cube, 4000, 0.25, 1e-3, 4, 5);
+  const Int3 before = sim->grid_dims, expected_before = mapSize(sim->objects, 4000, cube);
+  Int3 after;
+  int shortfall;
+
+  CHECK(before.x == expected_before.x && before.y == expected_before.y && before.z == expected_before.z,
+        "grid sized for 4000");
+  sim->integrator = INTEGRATOR_VERLET;
+  CHECK(stepSimulation(sim, 1) == 1 && sim->primed, "Verlet primed before the repack");
+
+  shortfall = packSimulation(sim, PACK_RSA, 0.0);
+  after = mapSize(sim->objects, sim->particle_ct, cube);
+  CHECK(shortfall > 0 && sim->particle_ct + shortfall == 4000, "%d placed, shortfall %d returned",
+        sim->particle_ct, shortfall);
+  CHECK(sim->grid_dims.x == after.x && sim->grid_dims.y == after.y && sim->grid_dims.z == after.z,
+        "grid resized to %d x %d x %d", sim->grid_dims.x, sim->grid_dims.y, sim->grid_dims.z);
+  CHECK(!sim->primed, "cached accelerations marked stale");
+  CHECK(min_separation(sim) >= 0.5 - 1e-12, "no overlaps, closest %.6f", min_separation(sim));
+  CHECK(stepSimulation(sim, 2) == 1, "steps after the repack");
+  destroy_simulation(sim);
+}
+
+/**** A frame ring fixes the count, so a short pack leaves the run as it was; contact history never survives ****/
+static void
+test_fixed_count(void)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){4, 4, 4});
+  Simulation *sim = createSimulation(cube, 4000, 0.25, 1e-3, 4, 5);
+  Object *before = (Object*)malloc(4000 * sizeof(Object));
+  char ring_name[64];
+
+  snprintf(ring_name, sizeof(ring_name), "/particlesim_pack_%d", (int)getpid());
+  memcpy(before, sim->objects, 4000 * sizeof(Object));
+  sim->frames = openSharedFrames(ring_name, 4000, 2);
+  CHECK(packSimulation(sim, PACK_RSA, 0.0) == -2, "short pack refused with a frame ring attached");
+  CHECK(sim->particle_ct == 4000 && memcmp(before, sim->objects, 4000 * sizeof(Object)) == 0, "run unchanged");
+  CHECK(stepSimulation(sim, 1) == 1, "still publishes after the refusal");
+  destroy_simulation(sim);
+  free(before);
+
+  sim = createSimulation(createBox((Vector3){0, 0, 0}, (Vector3){10, 10, 10}), 500, 0.2, 1e-3, 4, 5);
+  sim->contacts = createContactModel(1e4, 0.0, 0.8, 0.5);
+  CHECK(packSimulation(sim, PACK_SC, 0.0) == 0, "SC places every particle");
+  for (int i = 0; i < 500; i++) sim->objects[i].position.y = 5.0 + 0.3 * (i % 2);   // Crush them together
+  CHECK(stepSimulation(sim, 1) == 1 && contact_saveHistory(sim->contacts, NULL) > 0, "history recorded");
+  CHECK(packSimulation(sim, PACK_FCC, 0.0) == 0, "FCC places every particle");
+  CHECK(contact_saveHistory(sim->contacts, NULL) == 0, "history cleared by the pack");
+  destroy_simulation(sim);
+}
+
+static void
+test_lattice(void)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){10, 10, 10});
+  Simulation *sim = createSimulation(cube, 500, 0.2, 1e-3, 4, 5);
+
+  CHECK(packSimulation(sim, PACK_FCC, 0.5) == 0 && sim->particle_ct == 500, "FCC places every particle");
+  CHECK(min_separation(sim) >= 0.4 - 1e-12, "no overlaps, closest %.6f", min_separation(sim));
+  destroy_simulation(sim);
+  sim = createSimulation(cube, 20000, 0.2, 1e-3, 4, 5);
+  CHECK(packSimulation(sim, PACK_SC, 0.0) == -1 && sim->particle_ct == 20000, "overfull lattice rejected");
+  destroy_simulation(sim);
+}
+
+int
+main(void)
+{
+  test_saturated_rsa();
+  test_lattice();
+  test_fixed_count();
+  printf("test_packing passed\n");
+  return 0;
+}
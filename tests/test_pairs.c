@@ -0,0 +1,128 @@
+#include <math.h>
+#include <string.h>
+#include <omp.h>
+#include "../include/Simulation.h"
+#include "../include/Packing.h"
+#include "check.h"
+
+#define PARTICLES 400
+
+/**** Reference U(r) and |f| / r written out from the definitions in PairForce.h, independent of PairForce.c ****/
+static double
+reference_kernel(const int kind, const double epsilon, const double sigma, const double r, double *f_over_r)
+{
+  if (kind == PAIR_SOFT) {
+    *f_over_r = epsilon * (1.0 - r / sigma) / (sigma * r);
+    return 0.5 * epsilon * (1.0 - r / sigma) * (1.0 - r / sigma);
+  }
+  const double s6 = pow(sigma / r, 6);
+  *f_over_r = 24.0 * epsilon * (2.0 * s6 * s6 - s6) / (r * r);
+  return 4.0 * epsilon * (s6 * s6 - s6);
+}
+
+/**** O(N^2) sum over every pair (nearest images when periodic): energy, virial and accelerations ****/
+static void
+direct_sum(const PairForce *pf, const Object objects[], const Cube cube, Vector3 accel[], double *energy,
+           double *virial)
+{
+  double unused;
+  const double shift = reference_kernel(pf->kind, pf->epsilon, pf->sigma, pf->cutoff, &unused);
+
+  *energy = *virial = 0.0;
+  memset(accel, 0, PARTICLES * sizeof(Vector3));
+  for (int i = 0; i < PARTICLES; i++) {
+    for (int j = i + 1; j < PARTICLES; j++) {
+      Vector3 d = subtractVectors(objects[i].position, objects[j].position);
+      double r, f_over_r;
+
+      d = minimumImage(&cube, d);
+      r = magnitude(d);
+      if (r >= pf->cutoff) continue;
+      *energy += reference_kernel(pf->kind, pf->epsilon, pf->sigma, r, &f_over_r) - shift;
+      *virial += f_over_r * r * r;
+      accel[i] = addVectors(accel[i], scaleVector(d, f_over_r / objects[i].mass));
+      accel[j] = subtractVectors(accel[j], scaleVector(d, f_over_r / objects[j].mass));
+    }
+  }
+}
+
+/**** pairForces against the direct sum for one kind, and identical for 1 and all threads ****/
+static void
+check_kind(Simulation *sim, const int kind, const double sigma)
+{
+  static Vector3 accel[PARTICLES], reference[PARTICLES], serial[PARTICLES];
+  PairForce *pf = createPairForce(kind, 1.0, sigma, 0.0);
+  const char *name = pair_kindName(kind);
+  double energy, virial, worst = 0.0, scale = 0.0, serial_potential;
+  Vector3 momentum = {0, 0, 0};
+
+  direct_sum(pf, sim->objects, sim->cube, reference, &energy, &virial);
+  memset(serial, 0, sizeof(serial));
+  omp_set_num_threads(1);
+  CHECK(pairForces(pf, sim->objects, sim->cube, PARTICLES, serial) == 0, "%s serial pass", name);
+  serial_potential = pf->potential;
+  omp_set_num_threads(4);
+  memset(accel, 0, sizeof(accel));
+  CHECK(pairForces(pf, sim->objects, sim->cube, PARTICLES, accel) == 0, "%s threaded pass", name);
+
+  for (int i = 0; i < PARTICLES; i++) {
+    worst = fmax(worst, magnitude(subtractVectors(accel[i], reference[i])));
+    scale = fmax(scale, magnitude(reference[i]));
+    momentum = addVectors(momentum, scaleVector(accel[i], sim->objects[i].mass));
+  }
+  CHECK(pf->pairs_in_range > 0, "%s periodic %d: %llu pairs in range", name, sim->cube.periodic,
+        (unsigned long long)pf->pairs_in_range);
+  CHECK(fabs(pf->potential - energy) <= 1e-10 * fabs(energy), "%s energy %.12g vs direct %.12g", name,
+        pf->potential, energy);
+  CHECK(fabs(pf->virial - virial) <= 1e-10 * fabs(virial), "%s virial %.12g vs direct %.12g", name, pf->virial,
+        virial);
+  CHECK(worst <= 1e-10 * scale, "%s force error %.3g of %.3g", name, worst, scale);
+  CHECK(magnitude(momentum) <= 1e-10 * scale, "%s net force %.3g", name, magnitude(momentum));
+  CHECK(memcmp(accel, serial, sizeof(accel)) == 0 && pf->potential == serial_potential,
+        "%s identical for 1 and 4 threads", name);
+  destroy_pairForce(pf);
+}
+
+/**** A periodic box under two cutoffs wide along any axis is refused rather than counting images twice ****/
+static void
+test_small_box(void)
+{
+  static Object objects[2];
+  static Vector3 accel[2];
+  Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){10, 10, 4.9});
+  PairForce *pf = createPairForce(PAIR_LJ, 1.0, 1.0, 2.5);
+
+  for (int i = 0; i < 2; i++) {
+    objects[i].position = (Vector3){1 + i, 1, 1};
+    objects[i].mass = 1.0;
+    objects[i].radius = 0.1;
+  }
+  CHECK(pair_fitsCube(pf, cube) && pairForces(pf, objects, cube, 2, accel) == 0, "open 10x10x4.9 box fits");
+  cube.periodic = 1;
+  CHECK(!pair_fitsCube(pf, cube) && pairForces(pf, objects, cube, 2, accel) == -1,
+        "periodic 10x10x4.9 box refused for cutoff 2.5");
+  cube = createBox((Vector3){0, 0, 0}, (Vector3){5, 5, 5});
+  cube.periodic = 1;
+  CHECK(pair_fitsCube(pf, cube) && pairForces(pf, objects, cube, 2, accel) == 0, "periodic 5x5x5 box fits");
+  destroy_pairForce(pf);
+}
+
+int
+main(void)
+{
+  test_small_box();
+  for (int periodic = 0; periodic <= 1; periodic++) {
+    Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){10, 10, 10});
+    Simulation *sim;
+
+    cube.periodic = periodic;
+    sim = createSimulation(cube, PARTICLES, 0.5, 1e-3, 4, 3);
+    CHECK(packSimulation(sim, PACK_FCC, 0.6) == 0, "FCC pack, periodic %d", periodic);
+    check_kind(sim, PAIR_LJ, 1.0);
+    check_kind(sim, PAIR_WCA, 1.5);
+    check_kind(sim, PAIR_SOFT, 2.0);
+    destroy_simulation(sim);
+  }
+  printf("test_pairs passed\n");
+  return 0;
+}
@@ -0,0 +1,114 @@
+#define _DEFAULT_SOURCE
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "../include/Simulation.h"
+#include "../include/SharedFrame.h"
+#include "check.h"
+
+#define PARTICLES 500
+#define FRAMES 20000
+
+static const char *ring_name = "/psim_test_frames";
+static int writer_done;
+
+/**** stepSimulation publishes every frame; an attached reader sees the newest one as float32 ****/
+static void
+test_step_publishing(void)
+{
+  static float positions[3 * PARTICLES], radii[PARTICLES];
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){10, 10, 10});
+  Simulation *sim = createSimulation(cube, PARTICLES, 0.1, 1e-3, 4, 11);
+  SharedFrames *reader;
+  uint64_t frame;
+  double worst = 0.0;
+
+  sim->frames = openSharedFrames(ring_name, PARTICLES, 4);
+  CHECK(sim->frames != NULL, "create %s", ring_name);
+  reader = attachSharedFrames(ring_name);
+  CHECK(reader != NULL, "attach %s read-only", ring_name);
+  CHECK(readLatestFrame(reader, positions, radii, &frame) != 0, "nothing to read before the first frame");
+
+  for (int f = 1; f <= 6; f++) {
+    CHECK(stepSimulation(sim, 1) == 1, "step %d", f);
+    CHECK(readLatestFrame(reader, positions, radii, &frame) == 0 && frame == sim->step, "latest is frame %llu",
+          (unsigned long long)frame);
+  }
+  for (int i = 0; i < PARTICLES; i++) {
+    worst = fmax(worst, fabs(positions[3 * i] - sim->objects[i].position.x));
+    worst = fmax(worst, fabs(positions[3 * i + 1] - sim->objects[i].position.y));
+    worst = fmax(worst, fabs(positions[3 * i + 2] - sim->objects[i].position.z));
+    worst = fmax(worst, fabs(radii[i] - sim->objects[i].radius));
+  }
+  CHECK(worst < 1e-5, "float32 copy within %.3g of the run", worst);
+
+  closeSharedFrames(reader);
+  destroy_simulation(sim);
+  CHECK(attachSharedFrames(ring_name) == NULL, "ring removed with the run");
+}
+
+/**** Writer thread whose frame n sets every coordinate to n: any torn copy mixes values ****/
+static void *
+publish_loop(void *arg)
+{
+  static Object objects[PARTICLES];
+  SharedFrames *shm = (SharedFrames*)arg;
+
+  for (int f = 0; f < FRAMES; f++) {
+    for (int i = 0; i < PARTICLES; i++) {
+      objects[i].position = (Vector3){f, f, f};
+      objects[i].radius = f;
+    }
+    publishFrame(shm, objects, PARTICLES, (uint64_t)f, 0.0);
+  }
+  __atomic_store_n(&writer_done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void
+test_concurrent_reads(void)
+{
+  static float positions[3 * PARTICLES], radii[PARTICLES];
+  SharedFrames *writer = openSharedFrames(ring_name, PARTICLES, 2);
+  SharedFrames *reader = attachSharedFrames(ring_name);
+  pthread_t thread;
+  uint64_t frame;
+  int reads = 0, torn = 0;
+
+  CHECK(writer != NULL && reader != NULL, "ring of 2 slots");
+  CHECK(pthread_create(&thread, NULL, publish_loop, writer) == 0, "writer thread");
+  while (!__atomic_load_n(&writer_done, __ATOMIC_ACQUIRE)) {
+    if (readLatestFrame(reader, positions, radii, &frame) != 0) continue;
+    reads++;
+    for (int i = 0; i < 3 * PARTICLES; i++) torn += (positions[i] != (float)frame);
+    for (int i = 0; i < PARTICLES; i++) torn += (radii[i] != (float)frame);
+  }
+  pthread_join(thread, NULL);
+  CHECK(readLatestFrame(reader, positions, radii, &frame) == 0 && frame == FRAMES - 1, "last frame %llu",
+        (unsigned long long)frame);
+  CHECK(reads > 0 && torn == 0, "%d reads under a racing writer, %d torn values", reads, torn);
+  closeSharedFrames(reader);
+  closeSharedFrames(writer);
+}
+
+/**** Empty rings are refused before anything is created ****/
+static void
+test_bad_sizes(void)
+{
+  shm_unlink(ring_name);
+  CHECK(openSharedFrames(ring_name, PARTICLES, 0) == NULL, "no slots refused");
+  CHECK(openSharedFrames(ring_name, 0, 4) == NULL, "no particles refused");
+  CHECK(attachSharedFrames(ring_name) == NULL, "nothing left to attach to");
+}
+
+int
+main(void)
+{
+  test_bad_sizes();
+  test_step_publishing();
+  test_concurrent_reads();
+  printf("test_shared_frames passed\n");
+  return 0;
+}
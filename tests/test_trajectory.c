@@ -0,0 +1,145 @@
+#define _DEFAULT_SOURCE
+#include <math.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include "../include/Simulation.h"
+#include "../include/Trajectory.h"
+#include "check.h"
+
+#define PARTICLES 300
+#define RECORDS 12
+#define RESOLUTION 1e-4
+
+/**** Largest coordinate error between a decoded frame and the positions it was taken from ****/
+static double
+max_error(const Vector3 decoded[], const Vector3 expected[], const int count)
+{
+  double worst = 0.0;
+  for (int i = 0; i < count; i++) {
+    worst = fmax(worst, fabs(decoded[i].x - expected[i].x));
+    worst = fmax(worst, fabs(decoded[i].y - expected[i].y));
+    worst = fmax(worst, fabs(decoded[i].z - expected[i].z));
+  }
+  return worst;
+}
+
+/**** stepSimulation feeds the writer every interval'th frame; every record reads back within resolution ****/
+static void
+test_step_recording(const char *path)
+{
+  static Vector3 expected[RECORDS][PARTICLES], decoded[PARTICLES];
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){10, 10, 10});
+  Simulation *sim = createSimulation(cube, PARTICLES, 0.1, 1e-3, 4, 7);
+  TrajectoryReader *reader;
+  uint64_t step;
+
+  sim->trajectory = openTrajectory(path, cube, PARTICLES, 2, 5, 4, RESOLUTION);
+  CHECK(sim->trajectory != NULL, "open %s", path);
+  for (int r = 0; r < RECORDS; r++) {
+    CHECK(stepSimulation(sim, 2) == 1, "step to frame %d", 2 * (r + 1));
+    for (int i = 0; i < PARTICLES; i++) expected[r][i] = sim->objects[i].position;
+  }
+  CHECK(closeTrajectory(sim->trajectory) == 0, "close");
+  sim->trajectory = NULL;
+  destroy_simulation(sim);
+
+  reader = openTrajectoryReader(path);
+  CHECK(reader != NULL, "reopen %s", path);
+  CHECK(reader->frame_ct == RECORDS, "%llu frames recorded", (unsigned long long)reader->frame_ct);
+  // Backwards so every frame seeks to a keyframe it doesn't have cached
+  for (int r = RECORDS - 1; r >= 0; r--) {
+    CHECK(readFrame(reader, r, decoded, &step) == 0 && step == (uint64_t)(2 * (r + 1)), "frame %d is step %llu",
+          r, (unsigned long long)step);
+    CHECK(max_error(decoded, expected[r], PARTICLES) <= 0.5 * RESOLUTION + 1e-12, "frame %d error %.3g", r,
+          max_error(decoded, expected[r], PARTICLES));
+  }
+  CHECK(readFrame(reader, RECORDS, decoded, &step) != 0, "frame past the end is rejected");
+  closeTrajectoryReader(reader);
+}
+
+/**** Particles that left the cube by more than the int32 range are clamped, not wrapped, and don't disturb the
+ * deltas of the others ****/
+static void
+test_out_of_range(const char *path)
+{
+  const Cube cube = createBox((Vector3){0, 0, 0}, (Vector3){10, 10, 10});
+  const double limit = TRAJECTORY_QUANT_LIMIT * RESOLUTION;
+  Object objects[3];
+  Vector3 decoded[3];
+  TrajectoryWriter *writer;
+  TrajectoryReader *reader;
+
+  memset(objects, 0, sizeof(objects));
+  objects[0].position = (Vector3){1, 2, 3};
+  objects[1].position = (Vector3){4, 5, 6};
+  objects[2].position = (Vector3){7, 8, 9};
+  writer = openTrajectory(path, cube, 3, 1, 4, 2, RESOLUTION);
+  CHECK(writer != NULL, "open %s", path);
+  CHECK(submitFrame(writer, objects, 3, 0, 0.0) == 0, "keyframe in range");
+  objects[1].position = (Vector3){1e12, -1e12, NAN};
+  objects[2].position.x += 0.5;
+  CHECK(submitFrame(writer, objects, 3, 1, 1.0) == 0, "delta frame with a runaway particle");
+  CHECK(submitFrame(writer, objects, 2, 2, 2.0) != 0, "particle count mismatch is rejected");
+  CHECK(closeTrajectory(writer) == 0, "close");
+
+  reader = openTrajectoryReader(path);
+  CHECK(reader != NULL && readFrame(reader, 1, decoded, NULL) == 0, "read delta frame");
+  CHECK(fabs(decoded[1].x - limit) < RESOLUTION && fabs(decoded[1].y + limit) < RESOLUTION
+        && fabs(decoded[1].z + limit) < RESOLUTION, "runaway clamped to (%g, %g, %g)", decoded[1].x, decoded[1].y,
+        decoded[1].z);
+  CHECK(fabs(decoded[0].x - 1) < RESOLUTION && fabs(decoded[2].x - 7.5) < RESOLUTION, "others exact");
+  closeTrajectoryReader(reader);
+}
+
+/**** Overwrites the payload_bytes field of the frame at offset ****/
+static void
+patch_payload_bytes(const char *path, const uint64_t offset, const uint32_t payload_bytes)
+{
+  FILE *f = fopen(path, "r+b");
+
+  CHECK_QUIET(f != NULL);
+  CHECK_QUIET(fseek(f, (long)(offset + offsetof(TrajectoryFrame, payload_bytes)), SEEK_SET) == 0);
+  CHECK_QUIET(fwrite(&payload_bytes, sizeof(uint32_t), 1, f) == 1);
+  fclose(f);
+}
+
+/**** A frame header claiming more payload than the buffer holds, or a short keyframe, fails the read ****/
+static void
+test_corrupt(const char *path)
+{
+  TrajectoryReader *reader = openTrajectoryReader(path);
+  uint64_t offsets[2];
+  Vector3 decoded[3];
+
+  CHECK(reader != NULL && reader->frame_ct == 2, "reopen %s", path);
+  offsets[0] = reader->index[0].offset;
+  offsets[1] = reader->index[1].offset;
+  closeTrajectoryReader(reader);
+
+  patch_payload_bytes(path, offsets[1], 0x7fffffff);
+  reader = openTrajectoryReader(path);
+  CHECK(reader != NULL && readFrame(reader, 1, decoded, NULL) == -1, "oversized payload rejected");
+  closeTrajectoryReader(reader);
+
+  patch_payload_bytes(path, offsets[0], 5);
+  reader = openTrajectoryReader(path);
+  CHECK(reader != NULL && readFrame(reader, 0, decoded, NULL) == -1, "short keyframe rejected");
+  closeTrajectoryReader(reader);
+}
+
+int
+main(void)
+{
+  char path[] = "/tmp/psim_trajectoryXXXXXX";
+  const int fd = mkstemp(path);
+
+  CHECK(fd >= 0, "temporary file");
+  close(fd);
+  test_step_recording(path);
+  test_out_of_range(path);
+  test_corrupt(path);
+  unlink(path);
+  printf("test_trajectory passed\n");
+  return 0;
+}